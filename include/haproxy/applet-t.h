@@ -80,17 +80,33 @@ struct appctx {
 				struct {
 					struct nst_memory_object  *obj;
 					struct nst_memory_item    *item;
+					uint32_t                   offset;  /* of the next record in item */
+					uint32_t                   left;    /* of the current data record */
+					struct nst_memory_zstream *zstream; /* decoding the body, or NULL */
+					struct nst_http_range     *range;   /* requested ranges, or NULL */
+					int                        head;    /* send the headers only */
+					int                        follow;  /* obj is being filled */
+					uint64_t                   hash;    /* of the key, to follow obj */
 				} memory;
 				struct {
-					int       fd;
-					int       header_len;
-					uint64_t  payload_len;
-					uint64_t  offset;
+					int                    fd;
+					int                    header_len;
+					uint64_t               payload_len;
+					uint64_t               offset;
+					struct nst_http_range *range;
+					int                    head;
+					struct nst_disk_aio   *aio;    /* async reads, or NULL */
 				} disk;
 			} store;
+			struct {
+				struct buffer    *req;    /* the request to send, in htx */
+				struct nst_rule  *rule;
+				struct nst_key   *key;    /* of the entry to refresh */
+			} refresh;
 			struct {
 				struct nst_dict  *dict;
 				uint64_t          idx;
+				int               index;  /* NST_DICT_INDEX_* walked instead of buckets, or 0 */
 				struct buffer     buf;
 				struct ist        name;
 				struct ist        host;
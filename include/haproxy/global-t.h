@@ -187,11 +187,25 @@ struct global {
 			uint64_t data_size;              /* max memory used by data, in bytes */
 
 			int dict_cleaner;                /* the number of entries checked once */
+			int dict_rehasher;               /* the number of buckets rehashed once */
+			int dict_layout;                 /* NST_DICT_LAYOUT_* */
+			int dict_index;                  /* secondary indexes for purging or not */
+			int compaction;                  /* move objects out of sparse blocks or not */
+			int eviction;                    /* NST_EVICTION_* */
+			int admission;                   /* admission filter of memory on or off */
 			int data_cleaner;                /* the number of data checked once */
 			int disk_cleaner;                /* the number of files checked once */
 			int disk_loader;                 /* the number of files load once */
 			int disk_saver;                  /* the number of entries checked once for persist_async */
+			int disk_io;                     /* NST_DISK_IO_* */
+			int disk_io_threads;             /* the number of disk io threads */
+			int disk_layout;                 /* NST_DISK_LAYOUT_* */
+			uint64_t segment_size;           /* max size of a segment file, in bytes */
+			int disk_checkpoint;             /* seconds between two checkpoints of the dict, 0: off */
 			int clean_temp;                  /* clean temp file or not */
+			int hugepages;                   /* NST_SHMEM_PAGES_* */
+			char *hugepages_dir;             /* hugetlbfs directory */
+			int numa;                        /* NST_SHMEM_NUMA_* or node */
 
 			struct ist root;                 /* disk root directory */
 
@@ -204,11 +218,23 @@ struct global {
 			uint64_t data_size;              /* max memory used by data, in bytes */
 
 			int dict_cleaner;                /* the number of entries checked once */
+			int dict_rehasher;               /* the number of buckets rehashed once */
+			int dict_layout;                 /* NST_DICT_LAYOUT_* */
+			int dict_index;                  /* secondary indexes for purging or not */
+			int compaction;                  /* move objects out of sparse blocks or not */
 			int data_cleaner;                /* the number of data checked once */
 			int disk_cleaner;                /* the number of files checked once */
 			int disk_loader;                 /* the number of files load once */
 			int disk_saver;                  /* the number of entries checked once for persist_async */
+			int disk_io;                     /* NST_DISK_IO_* */
+			int disk_io_threads;             /* the number of disk io threads */
+			int disk_layout;                 /* NST_DISK_LAYOUT_* */
+			uint64_t segment_size;           /* max size of a segment file, in bytes */
+			int disk_checkpoint;             /* seconds between two checkpoints of the dict, 0: off */
 			int clean_temp;                  /* clean temp file or not */
+			int hugepages;                   /* NST_SHMEM_PAGES_* */
+			char *hugepages_dir;             /* hugetlbfs directory */
+			int numa;                        /* NST_SHMEM_NUMA_* or node */
 
 			struct ist root;                 /* disk root directory */
 
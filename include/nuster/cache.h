@@ -25,6 +25,19 @@
 #include <nuster/common.h>
 
 
+/* ms, a parked stream in wait mode checks the entry again at least this often */
+#define NST_CACHE_WAIT_RECHECK          1000
+
+/* ms, a failed refresh-ahead of an entry is not retried before this delay */
+#define NST_CACHE_REFRESH_RETRY         1000
+
+/* appctx->st0 of the refresh-ahead applet */
+enum {
+    NST_CACHE_REFRESH_SEND = 0,
+    NST_CACHE_REFRESH_RECV,
+    NST_CACHE_REFRESH_DONE,
+};
+
 extern hpx_flt_ops_t  nst_cache_filter_ops;
 extern const char    *nst_cache_flt_id;
 
@@ -36,7 +49,13 @@ void nst_cache_create(hpx_http_msg_t *msg, nst_ctx_t *ctx);
 int nst_cache_append(hpx_http_msg_t *msg, nst_ctx_t *ctx, unsigned int offset, unsigned int len);
 int nst_cache_finish(nst_ctx_t *ctx);
 void nst_cache_abort(nst_ctx_t *ctx);
-int nst_cache_exists(nst_ctx_t *ctx);
+void nst_cache_revalidate(nst_ctx_t *ctx);
+int nst_cache_revalidated(hpx_stream_t *s, nst_ctx_t *ctx);
+int nst_cache_exists(hpx_stream_t *s, nst_ctx_t *ctx);
+int nst_cache_wait(hpx_stream_t *s, nst_ctx_t *ctx);
+void nst_cache_unwait(nst_ctx_t *ctx);
+void nst_cache_refresh(hpx_stream_t *s, nst_ctx_t *ctx);
+int nst_cache_refreshing(hpx_stream_t *s, nst_ctx_t *ctx);
 int nst_cache_delete(nst_key_t *key);
 void nst_cache_hit(hpx_stream_t *s, hpx_stream_interface_t *si, hpx_channel_t *req,
         hpx_channel_t *res, nst_ctx_t *ctx);
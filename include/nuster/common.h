@@ -46,6 +46,7 @@ typedef struct applet                   hpx_applet_t;
 typedef struct htx_sl                   hpx_htx_sl_t;
 typedef struct filter                   hpx_filter_t;
 typedef struct sample                   hpx_sample_t;
+typedef struct task                     hpx_task_t;
 typedef struct proxy                    hpx_proxy_t;
 typedef struct list                     hpx_list_t;
 typedef struct ist                      hpx_ist_t;
@@ -87,10 +88,13 @@ typedef struct nst_core                 nst_core_t;
 #define NST_DEFAULT_DICT_SIZE           NST_DEFAULT_SIZE
 #define NST_DEFAULT_DATA_SIZE           NST_DEFAULT_SIZE
 #define NST_DEFAULT_DICT_CLEANER        1000
+#define NST_DEFAULT_DICT_REHASHER       1000
 #define NST_DEFAULT_DATA_CLEANER        1000
 #define NST_DEFAULT_DISK_CLEANER        100
 #define NST_DEFAULT_DISK_LOADER         100
 #define NST_DEFAULT_DISK_SAVER          100
+#define NST_DEFAULT_DISK_IO_THREADS     4
+#define NST_DEFAULT_SEGMENT_SIZE        64 * 1024 * 1024
 #define NST_DEFAULT_KEY                "method.scheme.host.uri"
 #define NST_DEFAULT_CODE               "200"
 
@@ -100,6 +104,42 @@ enum {
     NST_STATUS_ON               =  1,
 };
 
+enum {
+    NST_DICT_LAYOUT_CHAIN       = 0,
+    NST_DICT_LAYOUT_TAG         = 1,
+};
+
+enum {
+    NST_EVICTION_OFF            = 0,
+    NST_EVICTION_LRU            = 1,
+    NST_EVICTION_CLOCK          = 2,
+    NST_EVICTION_S3FIFO         = 3,
+};
+
+enum {
+    NST_SHMEM_PAGES_NORMAL      = 0,
+    NST_SHMEM_PAGES_THP         = 1,
+    NST_SHMEM_PAGES_2M          = 2,
+    NST_SHMEM_PAGES_1G          = 3,
+    NST_SHMEM_PAGES_FILE        = 4,
+};
+
+enum {
+    NST_SHMEM_NUMA_OFF          = -1,
+    NST_SHMEM_NUMA_INTERLEAVE   = -2,
+};
+
+enum {
+    NST_DISK_IO_SYNC            = 0,
+    NST_DISK_IO_THREADS         = 1,
+    NST_DISK_IO_URING           = 2,
+};
+
+enum {
+    NST_DISK_LAYOUT_FILE        = 0,
+    NST_DISK_LAYOUT_SEGMENT     = 1,
+};
+
 enum {
     NST_MODE_CACHE              = 1,
     NST_MODE_NOSQL              = 2,
@@ -169,6 +209,7 @@ typedef struct nst_rule_key {
 
     char                      *name;
     nst_key_element_t        **data;           /* parsed key */
+    int                        head;           /* HEAD is looked up with the key of GET */
     int                        idx;
 } nst_rule_key_t;
 
@@ -191,6 +232,10 @@ typedef struct nst_rule_config {
     int                        last_modified; /* last_modified on|off */
     int                        wait;          /* -1: not wait, 0: wait forever, > 0, wait seconds */
     int                        inactive;      /* 0: disabled, > 0: inactive seconds */
+    char                      *tag_header;    /* response header holding tags, or NULL */
+    int                        compress;      /* NST_MEMORY_ENCODING_* of the memory store */
+    int                        precompress;   /* NST_MEMORY_ENCODING_* of the copy on demand */
+    int                        refresh_ahead; /* 0: off, > 0: refresh at this percent of ttl */
 
     /*
      *  -1: do not use stale
@@ -233,6 +278,9 @@ typedef struct nst_rule_prop {
     int                        inactive;
     int                        stale;
     int                        status_code;
+    int                        compress;
+    int                        precompress;
+    int                        refresh_ahead;
 } nst_rule_prop_t;
 
 typedef struct nst_rule {
@@ -248,6 +296,8 @@ typedef struct nst_rule {
 
     nst_rule_prop_t            prop;
 
+    hpx_ist_t                  tag_header;    /* response header holding tags */
+
     hpx_acl_cond_t            *cond;          /* acl condition to meet */
 } nst_rule_t;
 
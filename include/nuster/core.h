@@ -43,6 +43,7 @@ enum {
     NST_CTX_STATE_DONE,              /* done */
     NST_CTX_STATE_INVALID,           /* invalid */
     NST_CTX_STATE_CHECK_DISK,        /* check disk */
+    NST_CTX_STATE_WAIT_DISK,         /* wait for the disk io threads */
 };
 
 typedef struct nst_proxy {
@@ -64,13 +65,27 @@ typedef struct nst_ctx {
 
     uint64_t                    ctime;
 
+    int                         refresh;    /* internal request of refresh-ahead */
+    int                         refresh_due;    /* see nst_cache_refresh */
+    int                         conditional;    /* the update carries the validators */
+
+    struct {
+        hpx_list_t              list;       /* in the waiters of its dict stripe */
+        hpx_task_t             *task;       /* the parked stream, or NULL */
+        uint64_t                hash;
+    } wait;
+
     struct {
         struct {
-            nst_memory_obj_t   *obj;
-            nst_memory_item_t  *item;
+            nst_memory_obj_t      *obj;
+            nst_memory_item_t     *item;
+            nst_memory_zstream_t  *zstream;     /* encoding the body, or NULL */
+            nst_memory_obj_t      *filling;     /* obj while it can be followed */
+            int                    follow;      /* obj is followed while filled */
         } memory;
         struct {
             nst_disk_obj_t      obj;
+            nst_disk_aio_t     *aio;        /* async reads, or NULL */
         } disk;
     } store;
 
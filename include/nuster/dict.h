@@ -23,6 +23,7 @@
 #define _NUSTER_DICT_H
 
 #include <nuster/common.h>
+#include <nuster/shctx.h>
 #include <nuster/http.h>
 #include <nuster/key.h>
 
@@ -37,7 +38,44 @@ enum {
 };
 
 /*
- * A nst_dict_entry is an entry in nst_dict hash table
+ * Secondary indexes, see nst_dict_index_get
+ */
+enum {
+    NST_DICT_INDEX_PROXY           = 1,
+    NST_DICT_INDEX_RULE,
+    NST_DICT_INDEX_HOST,
+    NST_DICT_INDEX_PATH,
+    NST_DICT_INDEX_TAG,
+};
+
+/*
+ * A nst_dict_link puts an entry in a group of a secondary index
+ */
+typedef struct nst_dict_link {
+    struct nst_dict_link       *prev;           /* in group */
+    struct nst_dict_link       *next;
+    struct nst_dict_link       *sibling;        /* next link of the same entry */
+    struct nst_dict_entry      *entry;
+    struct nst_dict_group      *group;
+} nst_dict_link_t;
+
+/*
+ * A nst_dict_group holds the entries of a stripe which have the same proxy,
+ * rule, host, path or tag, groups of a stripe are chained in its index.
+ */
+typedef struct nst_dict_group {
+    struct nst_dict_group      *next;
+    nst_dict_link_t            *link;
+    uint64_t                    hash;
+    int                         type;           /* NST_DICT_INDEX_* */
+    int                         len;
+    char                        name[0];
+} nst_dict_group_t;
+
+/*
+ * A nst_dict_entry is an entry in nst_dict hash table.
+ * Fields used while walking a bucket come first, so that a lookup mostly
+ * touches the first cache lines of an entry.
  */
 typedef struct nst_dict_entry {
     struct nst_dict_entry      *next;
@@ -46,19 +84,34 @@ typedef struct nst_dict_entry {
 
     nst_key_t                   key;
 
-    hpx_buffer_t                buf;
+    uint64_t                    expire;
+    uint64_t                    atime;
 
-    hpx_ist_t                   host;
-    hpx_ist_t                   path;
-    hpx_ist_t                   etag;
-    hpx_ist_t                   last_modified;
+    struct {
+        struct {
+            nst_memory_obj_t   *obj;
+            nst_memory_item_t  *item;
+            nst_memory_obj_t   *filling;        /* in INIT state, see nst_cache_create */
+        } memory;
+        struct {
+            char               *file;
+            uint64_t            base;           /* of the record in a segment */
+        } disk;
+    } store;
 
     int                         header_len;
     uint64_t                    payload_len;
 
-    uint64_t                    expire;
     uint64_t                    ctime;
-    uint64_t                    atime;
+
+    hpx_buffer_t                buf;
+
+    hpx_ist_t                   host;
+    hpx_ist_t                   path;
+    hpx_ist_t                   etag;
+    hpx_ist_t                   last_modified;
+    hpx_ist_t                   tags;
+    hpx_ist_t                   vary;           /* set on a primary entry, see nst_cache_exists */
 
     nst_rule_prop_t             prop;
 
@@ -68,37 +121,129 @@ typedef struct nst_dict_entry {
     /* extended count  */
     int                         extended;
 
+    /* time of the last refresh-ahead, see _nst_cache_refresh_due */
+    uint64_t                    refresh;
+
+    /* see nst_dict_evict */
     struct {
-        struct {
-            nst_memory_obj_t   *obj;
-            nst_memory_item_t  *item;
-        } memory;
-        struct {
-            char               *file;
-        } disk;
-    } store;
+        uint64_t                time;           /* atime seen by the last sweep */
+        uint64_t                hits;           /* accesses seen by the last sweep */
+        uint8_t                 main;           /* in the main queue of s3fifo */
+        uint8_t                 freq;
+    } evict;
+
+    /* groups of the entry, NULL without index */
+    nst_dict_link_t            *link;
 } nst_dict_entry_t;
 
+/*
+ * Entries are protected by NST_DICT_STRIPES locks, an entry belongs to the
+ * stripe of key.hash & (NST_DICT_STRIPES - 1). Since the number of buckets is
+ * a multiple of NST_DICT_STRIPES, all entries of a bucket, in both tables,
+ * belong to the same stripe.
+ *
+ * With secondary indexes, each stripe also has a hash table of the groups
+ * of its entries, protected by the stripe lock too.
+ */
+#define NST_DICT_STRIPES                64
+
+typedef struct nst_dict_stripe {
+#if defined NUSTER_USE_PTHREAD || defined USE_PTHREAD_PSHARED
+    pthread_mutex_t             mutex;
+#else
+    unsigned int                waiters;
+#endif
+
+    nst_dict_group_t          **index;
+} __attribute__((aligned(64))) nst_dict_stripe_t;
+
+/*
+ * Buckets are split into pages of one shmem block each, since shmem cannot
+ * allocate more than one block at a time. A page can be NULL in a table that
+ * is being filled by rehashing, it is allocated on first use.
+ *
+ * With the tag layout, each bucket also has a tag word holding one byte of
+ * the hash of up to NST_DICT_TAGS entries of the bucket, so that a lookup
+ * of a missing key does not dereference the entries. Tag pages are laid out
+ * like bucket pages.
+ */
+#define NST_DICT_TAGS                   8
+#define NST_DICT_TAGS_OVERFLOW          (~0ULL)     /* more entries than tags */
+
+typedef struct nst_dict_table {
+    nst_dict_entry_t         ***page;
+    uint64_t                  **tag;            /* NULL with the chain layout */
+    uint64_t                    size;           /* number of buckets, power of 2 */
+} nst_dict_table_t;
+
+/*
+ * Things which can still be seen by lock free readers, see nst_dict_reclaim
+ */
+typedef struct nst_dict_retired {
+    nst_dict_entry_t           *entry;
+    nst_memory_obj_t           *obj;
+    nst_dict_table_t            table;
+} nst_dict_retired_t;
+
 typedef struct nst_dict {
     nst_shmem_t                *shmem;
 
-    nst_dict_entry_t          **entry;
-    uint64_t                    size;           /* number of entries */
+    int                         layout;         /* NST_DICT_LAYOUT_* */
+    uint64_t                    index_size;     /* groups buckets per stripe, 0 without index */
+
+    /*
+     * table[1] is only used during rehashing, buckets of table[0] are moved
+     * to table[1] one by one by nst_dict_rehash, then table[1] replaces
+     * table[0].
+     */
+    nst_dict_table_t            table[2];
+    int64_t                     rehash_idx;     /* -1 if not rehashing */
+    unsigned int                rehash_pause;   /* number of running iterators */
+    unsigned int                table_seq;      /* odd while tables are changing */
+
+    uint64_t                    min_size;       /* initial number of buckets */
+    uint64_t                    max_size;
+    uint64_t                    page_size;      /* number of buckets per page */
+    int                         page_shift;
+
     uint64_t                    used;           /* number of used entries */
 
     uint64_t                    cleanup_idx;
 
+    uint64_t                    evict_idx;
+
+    uint64_t                    compact_idx;
+
     uint64_t                    sync_idx;
 
     nst_store_t                *store;
 
-#if defined NUSTER_USE_PTHREAD || defined USE_PTHREAD_PSHARED
-    pthread_mutex_t             mutex;
-#else
-    unsigned int                waiters;
-#endif
+    /*
+     * Lock free readers register in readers[epoch & 1]. Retired things are
+     * moved to reclaim when the master flips the epoch, and freed once no
+     * reader of the previous epoch is left.
+     */
+    unsigned int                epoch;
+    unsigned int                readers[2];
+    nst_dict_retired_t          retired;
+    nst_dict_retired_t          reclaim;
+
+    nst_dict_stripe_t           stripe[NST_DICT_STRIPES];
 } nst_dict_t;
 
+/*
+ * hash is either key.hash or a bucket index, see nst_dict_bucket
+ */
+static inline void
+nst_dict_lock(nst_dict_t *dict, uint64_t hash) {
+    nst_shctx_lock(&dict->stripe[hash & (NST_DICT_STRIPES - 1)]);
+}
+
+static inline void
+nst_dict_unlock(nst_dict_t *dict, uint64_t hash) {
+    nst_shctx_unlock(&dict->stripe[hash & (NST_DICT_STRIPES - 1)]);
+}
+
 
 static inline int
 nst_dict_entry_expired(nst_dict_entry_t *entry) {
@@ -162,15 +307,99 @@ nst_dict_entry_valid(nst_dict_entry_t *entry) {
     return 0;
 }
 
-int nst_dict_init(nst_dict_t *dict, nst_store_t *store, nst_shmem_t *shmem, uint64_t dict_size);
+static inline int
+nst_dict_rehashing(nst_dict_t *dict) {
+    return dict->rehash_idx != -1;
+}
+
+/*
+ * Number of buckets to iterate over, buckets of table[1] follow the ones
+ * of table[0] while rehashing.
+ */
+static inline uint64_t
+nst_dict_buckets(nst_dict_t *dict) {
+
+    if(nst_dict_rehashing(dict)) {
+        return dict->table[0].size + dict->table[1].size;
+    }
+
+    return dict->table[0].size;
+}
+
+/*
+ * return the address of bucket idx, see nst_dict_buckets
+ * return NULL if the page of the bucket is not allocated yet
+ */
+static inline nst_dict_entry_t **
+nst_dict_bucket(nst_dict_t *dict, uint64_t idx) {
+    nst_dict_table_t   *table = &dict->table[0];
+    nst_dict_entry_t  **page;
+
+    if(idx >= table->size) {
+        idx  -= table->size;
+        table = &dict->table[1];
+    }
+
+    page = table->page[idx >> dict->page_shift];
+
+    if(!page) {
+        return NULL;
+    }
+
+    return &page[idx & (dict->page_size - 1)];
+}
+
+/*
+ * Entries returned by nst_dict_get_lockless must not be used after
+ * nst_dict_read_end.
+ */
+static inline unsigned int
+nst_dict_read_begin(nst_dict_t *dict) {
+    unsigned int  epoch;
+
+    while(1) {
+        epoch = *(volatile unsigned int *)&dict->epoch;
+
+        __sync_add_and_fetch(&dict->readers[epoch & 1], 1);
+
+        /* the master may have flipped the epoch in between */
+        if(epoch == *(volatile unsigned int *)&dict->epoch) {
+            return epoch;
+        }
+
+        __sync_sub_and_fetch(&dict->readers[epoch & 1], 1);
+    }
+}
+
+static inline void
+nst_dict_read_end(nst_dict_t *dict, unsigned int epoch) {
+    __sync_sub_and_fetch(&dict->readers[epoch & 1], 1);
+}
+
+int nst_dict_init(nst_dict_t *dict, nst_store_t *store, nst_shmem_t *shmem, uint64_t dict_size,
+        int layout, int index);
 void nst_dict_cleanup(nst_dict_t *dict);
+uint64_t nst_dict_evict(nst_dict_t *dict, int policy, uint64_t target);
+int nst_dict_compact(nst_dict_t *dict);
+int nst_dict_rehash(nst_dict_t *dict);
+void nst_dict_rehash_pause(nst_dict_t *dict);
+void nst_dict_rehash_resume(nst_dict_t *dict);
+void nst_dict_reclaim(nst_dict_t *dict);
+
+nst_dict_group_t *nst_dict_index_get(nst_dict_t *dict, int stripe, int type, hpx_ist_t name);
+void nst_dict_index_remove(nst_dict_t *dict, nst_dict_entry_t *entry);
+
+nst_dict_entry_t *nst_dict_get_lockless(nst_dict_t *dict, nst_key_t *key, nst_memory_obj_t **obj);
 
 nst_dict_entry_t *nst_dict_get(nst_dict_t *dict, nst_key_t *key);
 nst_dict_entry_t *nst_dict_set(nst_dict_t *dict, nst_key_t *key, nst_http_txn_t *txn,
         nst_rule_prop_t *prop);
 
 int nst_dict_set_from_disk(nst_dict_t *dict, hpx_buffer_t *buf, nst_key_t *key, nst_http_txn_t *txn,
-        nst_rule_prop_t *prop, char *file, uint64_t expire);
+        nst_rule_prop_t *prop, char *file, uint64_t base, uint64_t expire);
+int nst_dict_unset_from_disk(nst_dict_t *dict, nst_key_t *key, char *file, uint64_t base);
+int nst_dict_move_disk(nst_dict_t *dict, nst_key_t *key, char *file, uint64_t base, char *to,
+        uint64_t to_base);
 
 void nst_dict_record_access(nst_dict_entry_t *entry);
 
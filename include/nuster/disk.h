@@ -24,14 +24,15 @@
 
 #include <nuster/common.h>
 #include <nuster/key.h>
+#include <nuster/shctx.h>
 
 
-#define NST_DISK_VERSION  6
+#define NST_DISK_VERSION  7
 
 /*
    Offset              Length(bytes)           Content
    0                   6                       NUSTER
-   6                   1                       mode: not used
+   6                   1                       flags: deleted
    7                   1                       version
    8 * 1               8                       hash
    8 * 2               20                      uuid
@@ -45,7 +46,8 @@
    8 * 11              8                       last-modified: on|off: 4, length: 4
    8 * 12              8                       ttl: 4, extend: 4
    8 * 13              8                       stale: 4, inactive: 4
-   8 * 14              20                      reserved
+   8 * 14              8                       tags len: 4, reserved: 4
+   8 * 15              8                       record length
    NST_DISK_META_SIZE  key_len                 key
    + key_len           proxy_len               proxy
    + proxy_len         rule_len                rule
@@ -53,11 +55,13 @@
    + host_len          path_len                path
    + path_len          etag_len                etag
    + etag_len          last_modified_len       last_modified
-   + last_modified_len header_len              header
+   + last_modified_len tags_len                tags
+   + tags_len          header_len              header
    + header_len        payload_len             payload
    + payload_len       TLR/EOT                 [optional]
    */
 
+#define NST_DISK_META_POS_FLAGS                 6
 #define NST_DISK_META_POS_HASH                  8 * 1
 #define NST_DISK_META_POS_UUID                  8 * 2
 #define NST_DISK_META_POS_KEY_LEN               8 * 2  + 20
@@ -75,12 +79,49 @@
 #define NST_DISK_META_POS_TTL_EXTEND            8 * 12
 #define NST_DISK_META_POS_STALE                 8 * 13
 #define NST_DISK_META_POS_INACTIVE              8 * 13 + 4
+#define NST_DISK_META_POS_TAGS_LEN              8 * 14
+#define NST_DISK_META_POS_LENGTH                8 * 15
 
 #define NST_DISK_META_SIZE                      8 * 16
 #define NST_DISK_POS_KEY                        NST_DISK_META_SIZE
 
 #define NST_DISK_FILE_LEN                       NST_KEY_UUID_LEN * 2
 
+/* a deleted record of a segment, left to the compaction */
+#define NST_DISK_META_DELETED                   0x01
+
+/*
+ * With the segment layout, objects up to NST_DISK_STAGE_MAX are staged in
+ * memory, then appended to the active segment at once. Larger ones are spilled
+ * to a temp file and get a file of their own.
+ */
+#define NST_DISK_STAGE_MAX                      64 * 1024
+#define NST_DISK_SEGMENT_NAME_LEN               8
+
+/*
+   The index is a checkpoint of the entries of the dict which are on disk:
+
+   Offset              Length(bytes)           Content
+   0                   8                       NUSTERIX
+   8                   4                       version
+   12                  4                       generation
+   16                  8                       number of records
+   24                  ...                     records
+
+   A record is the meta, key, proxy, rule, host, path, etag, last-modified and
+   tags of the object as they are on disk, followed by
+
+   + tags_len          8                       base
+   + 8                 file_len + 1            file
+
+   and padded to 8 bytes, the record length of the meta is the whole length.
+   Changes since the checkpoint of a generation are appended to the journal of
+   the generation, a deleted record drops the entry of its key.
+ */
+#define NST_DISK_INDEX_MAGIC                    "NUSTERIX"
+#define NST_DISK_INDEX_HEADER_SIZE              24
+#define NST_DISK_INDEX_BUF_SIZE                 1024 * 1024
+
 enum {
     NST_DISK_APPLET_ERROR    = -1,
     NST_DISK_APPLET_DONE     =  0,
@@ -91,21 +132,106 @@ enum {
 };
 
 typedef struct nst_disk_object {
-    char               *file;               /* disk file */
+    char               *file;               /* disk file, or segment */
     int                 fd;
     uint64_t            offset;
+    uint64_t            base;               /* of the record in the segment, 0 in a file */
+    uint64_t            length;             /* of the record written so far */
+    char               *stage;              /* the record staged in memory, or NULL */
+    int                 stage_size;
     char                meta[NST_DISK_META_SIZE];
 } nst_disk_obj_t;
 
+/* returned by the async disk io while the request is served */
+#define NST_DISK_AIO_AGAIN  -2
+
+/* size of the submission queue of the io_uring of each thread */
+#define NST_DISK_URING_ENTRIES  256
+
+enum {
+    NST_DISK_AIO_IDLE       = 0,
+    NST_DISK_AIO_BUSY,                      /* queued, or in flight in the ring */
+    NST_DISK_AIO_DONE,                      /* served, the result is not consumed */
+};
+
+enum {
+    NST_DISK_AIO_OP_READ    = 0,            /* pread len bytes at offset of fd */
+    NST_DISK_AIO_OP_OPEN,                   /* open buf, read the meta and the key */
+};
+
+/*
+ * An async disk io request, owned by the thread which created it. The result
+ * is read into buf and the owner task is woken up when it is ready.
+ */
+typedef struct nst_disk_aio {
+    hpx_list_t          list;               /* in the queue or the done list of tid */
+    hpx_task_t         *task;               /* woken up on completion */
+    int                 tid;
+    int                 state;              /* NST_DISK_AIO_* */
+    int                 orphan;             /* released by its owner while busy */
+    int                 io;                 /* NST_DISK_IO_THREADS or NST_DISK_IO_URING */
+    int                 op;                 /* NST_DISK_AIO_OP_* */
+    int                 step;               /* of OP_OPEN in the ring, open then read */
+    int                 fd;
+    int                 len;
+    uint64_t            offset;
+    int                 ret;
+    char                meta[NST_DISK_META_SIZE];
+    char               *buf;                /* global.tune.bufsize bytes */
+} nst_disk_aio_t;
+
 
 typedef struct nst_disk {
     nst_shmem_t        *shmem;
     hpx_ist_t           root;               /* disk root directory */
+    int                 io;                 /* NST_DISK_IO_* */
+    int                 layout;             /* NST_DISK_LAYOUT_* */
     int                 loaded;
     int                 idx;
     DIR                *dir;
     nst_dirent_t       *de;
     char               *file;
+
+    /*
+     * segments are <root>/seg/<id>, from first to active. Records are appended
+     * to the active one, sealed ones are loaded and compacted by the master.
+     */
+    struct {
+        uint32_t        first;
+        uint32_t        active;
+        uint64_t        size;               /* of the active segment */
+        uint64_t        max;
+        char           *file;
+        int             fd;                 /* of the master, on segment id */
+        uint32_t        id;
+        uint64_t        pos;
+        int             compact;            /* copying the live records of id */
+        uint64_t        live;
+        uint64_t        dead;
+    } seg;
+
+    /*
+     * the dict is checkpointed to <root>/index by the master, changes are
+     * appended to <root>/journal/<gen> by everyone meanwhile
+     */
+    struct {
+        int             interval;           /* seconds, 0: off */
+        uint32_t        gen;                /* of the journal */
+        uint32_t        first;              /* oldest journal left */
+        uint64_t        next;               /* time of the next checkpoint */
+        uint64_t        idx;                /* next bucket of the checkpoint */
+        uint64_t        count;
+        int             fd;                 /* of index.tmp while checkpointing */
+        char           *buf;                /* of the master, records not written yet */
+        uint64_t        used;
+        char           *file;
+    } index;
+
+#if defined NUSTER_USE_PTHREAD || defined USE_PTHREAD_PSHARED
+    pthread_mutex_t     mutex;
+#else
+    unsigned int        waiters;
+#endif
 } nst_disk_t;
 
 
@@ -124,6 +250,17 @@ nst_disk_path_file_len(hpx_ist_t root) {
     return root.len + 47;
 }
 
+/* /seg/xxxxxxxx: 13 */
+static inline int
+nst_disk_path_segment_len(hpx_ist_t root) {
+    return root.len + 5 + NST_DISK_SEGMENT_NAME_LEN;
+}
+
+static inline int
+nst_disk_file_segment(nst_disk_t *disk, const char *file) {
+    return memcmp(file + disk->root.len, "/seg/", 5) == 0;
+}
+
 static inline int
 nst_disk_file_remove(const char *file) {
     return remove(file);
@@ -139,6 +276,16 @@ nst_disk_file_open(const char *pathname) {
     return open(pathname, O_RDONLY);
 }
 
+static inline void
+nst_disk_meta_set_flags(char *p, uint8_t v) {
+    *(uint8_t *)(p + NST_DISK_META_POS_FLAGS) = v;
+}
+
+static inline uint8_t
+nst_disk_meta_get_flags(char *p) {
+    return *(uint8_t *)(p + NST_DISK_META_POS_FLAGS);
+}
+
 static inline void
 nst_disk_meta_set_hash(char *p, uint64_t v) {
     *(uint64_t *)(p + NST_DISK_META_POS_HASH) = v;
@@ -309,6 +456,26 @@ nst_disk_meta_get_inactive(char *p) {
     return *(int32_t *)(p + NST_DISK_META_POS_INACTIVE);
 }
 
+static inline void
+nst_disk_meta_set_tags_len(char *p, uint32_t v) {
+    *(uint32_t *)(p + NST_DISK_META_POS_TAGS_LEN) = v;
+}
+
+static inline uint32_t
+nst_disk_meta_get_tags_len(char *p) {
+    return *(uint32_t *)(p + NST_DISK_META_POS_TAGS_LEN);
+}
+
+static inline void
+nst_disk_meta_set_length(char *p, uint64_t v) {
+    *(uint64_t *)(p + NST_DISK_META_POS_LENGTH) = v;
+}
+
+static inline uint64_t
+nst_disk_meta_get_length(char *p) {
+    return *(uint64_t *)(p + NST_DISK_META_POS_LENGTH);
+}
+
 static inline int
 nst_disk_meta_check_expire(char *p) {
     uint64_t  expire = nst_disk_meta_get_expire(p);
@@ -342,38 +509,38 @@ nst_disk_meta_check_stale(char *p) {
     return NST_ERR;
 }
 
-static inline int
+static inline uint64_t
 nst_disk_pos_proxy(nst_disk_obj_t *obj) {
-    return NST_DISK_POS_KEY + nst_disk_meta_get_key_len(obj->meta);
+    return obj->base + NST_DISK_POS_KEY + nst_disk_meta_get_key_len(obj->meta);
 }
 
-static inline int
+static inline uint64_t
 nst_disk_pos_rule(nst_disk_obj_t *obj) {
-    return NST_DISK_POS_KEY
+    return obj->base + NST_DISK_POS_KEY
         + nst_disk_meta_get_key_len(obj->meta)
         + nst_disk_meta_get_proxy_len(obj->meta);
 }
 
-static inline int
+static inline uint64_t
 nst_disk_pos_host(nst_disk_obj_t *obj) {
-    return NST_DISK_POS_KEY
+    return obj->base + NST_DISK_POS_KEY
         + nst_disk_meta_get_key_len(obj->meta)
         + nst_disk_meta_get_proxy_len(obj->meta)
         + nst_disk_meta_get_rule_len(obj->meta);
 }
 
-static inline int
+static inline uint64_t
 nst_disk_pos_path(nst_disk_obj_t *obj) {
-    return NST_DISK_POS_KEY
+    return obj->base + NST_DISK_POS_KEY
         + nst_disk_meta_get_key_len(obj->meta)
         + nst_disk_meta_get_proxy_len(obj->meta)
         + nst_disk_meta_get_rule_len(obj->meta)
         + nst_disk_meta_get_host_len(obj->meta);
 }
 
-static inline int
+static inline uint64_t
 nst_disk_pos_etag(nst_disk_obj_t *obj) {
-    return NST_DISK_POS_KEY
+    return obj->base + NST_DISK_POS_KEY
         + nst_disk_meta_get_key_len(obj->meta)
         + nst_disk_meta_get_proxy_len(obj->meta)
         + nst_disk_meta_get_rule_len(obj->meta)
@@ -381,9 +548,9 @@ nst_disk_pos_etag(nst_disk_obj_t *obj) {
         + nst_disk_meta_get_path_len(obj->meta);
 }
 
-static inline int
+static inline uint64_t
 nst_disk_pos_last_modified(nst_disk_obj_t *obj) {
-    return NST_DISK_POS_KEY
+    return obj->base + NST_DISK_POS_KEY
         + nst_disk_meta_get_key_len(obj->meta)
         + nst_disk_meta_get_proxy_len(obj->meta)
         + nst_disk_meta_get_rule_len(obj->meta)
@@ -392,9 +559,9 @@ nst_disk_pos_last_modified(nst_disk_obj_t *obj) {
         + nst_disk_meta_get_etag_len(obj->meta);
 }
 
-static inline int
-nst_disk_pos_header(nst_disk_obj_t *obj) {
-    return NST_DISK_META_SIZE
+static inline uint64_t
+nst_disk_pos_tags(nst_disk_obj_t *obj) {
+    return obj->base + NST_DISK_POS_KEY
         + nst_disk_meta_get_key_len(obj->meta)
         + nst_disk_meta_get_proxy_len(obj->meta)
         + nst_disk_meta_get_rule_len(obj->meta)
@@ -404,9 +571,30 @@ nst_disk_pos_header(nst_disk_obj_t *obj) {
         + nst_disk_meta_get_last_modified_len(obj->meta);
 }
 
+static inline uint64_t
+nst_disk_pos_header(nst_disk_obj_t *obj) {
+    return obj->base + NST_DISK_META_SIZE
+        + nst_disk_meta_get_key_len(obj->meta)
+        + nst_disk_meta_get_proxy_len(obj->meta)
+        + nst_disk_meta_get_rule_len(obj->meta)
+        + nst_disk_meta_get_host_len(obj->meta)
+        + nst_disk_meta_get_path_len(obj->meta)
+        + nst_disk_meta_get_etag_len(obj->meta)
+        + nst_disk_meta_get_last_modified_len(obj->meta)
+        + nst_disk_meta_get_tags_len(obj->meta);
+}
+
+int nst_disk_stage(nst_disk_obj_t *obj, char *buf, int len);
+
 static inline int
 nst_disk_write(nst_disk_obj_t *obj, char *buf, int len) {
-    ssize_t ret = pwrite(obj->fd, buf, len, obj->offset);
+    ssize_t ret;
+
+    if(obj->stage) {
+        return nst_disk_stage(obj, buf, len);
+    }
+
+    ret = pwrite(obj->fd, buf, len, obj->offset);
 
     if(ret != len) {
         return NST_ERR;
@@ -414,6 +602,10 @@ nst_disk_write(nst_disk_obj_t *obj, char *buf, int len) {
 
     obj->offset += len;
 
+    if(obj->offset > obj->length) {
+        obj->length = obj->offset;
+    }
+
     return NST_OK;
 }
 
@@ -473,6 +665,13 @@ nst_disk_write_last_modified(nst_disk_obj_t *obj, hpx_ist_t lm) {
     return nst_disk_write(obj, lm.ptr, lm.len);
 }
 
+static inline int
+nst_disk_write_tags(nst_disk_obj_t *obj, hpx_ist_t tags) {
+    obj->offset = nst_disk_pos_tags(obj);
+
+    return nst_disk_write(obj, tags.ptr, tags.len);
+}
+
 int nst_disk_read_key(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key);
 int nst_disk_read_proxy(nst_disk_obj_t *obj, hpx_ist_t proxy);
 int nst_disk_read_rule(nst_disk_obj_t *obj, hpx_ist_t rule);
@@ -480,13 +679,21 @@ int nst_disk_read_host(nst_disk_obj_t *obj, hpx_ist_t host);
 int nst_disk_read_path(nst_disk_obj_t *obj, hpx_ist_t path);
 int nst_disk_read_etag(nst_disk_obj_t *obj, hpx_ist_t etag);
 int nst_disk_read_last_modified(nst_disk_obj_t *obj, hpx_ist_t last_modified);
+int nst_disk_read_tags(nst_disk_obj_t *obj, hpx_ist_t tags);
 
 int nst_disk_init(nst_disk_t *disk, hpx_ist_t root, nst_shmem_t *shmem, int clean_temp);
+int nst_disk_segment_init(nst_disk_t *disk, uint64_t size);
 void nst_disk_load(nst_core_t *core);
 void nst_disk_cleanup(nst_core_t *core);
 int nst_disk_purge_by_key(nst_disk_obj_t *disk, nst_key_t *key, hpx_ist_t root);
-int nst_disk_purge_by_path(char *path);
-void nst_disk_update_expire(char *file, uint64_t expire);
+int nst_disk_purge_by_path(nst_disk_t *disk, char *path, uint64_t base);
+void nst_disk_update_expire(char *file, uint64_t base, uint64_t expire);
+
+struct nst_dict_entry;
+
+int nst_disk_index_init(nst_core_t *core, int interval);
+void nst_disk_checkpoint(nst_core_t *core);
+void nst_disk_journal(nst_disk_t *disk, struct nst_dict_entry *entry, int deleted);
 
 int nst_disk_obj_create(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key,
         nst_http_txn_t *txn, nst_rule_prop_t *prop);
@@ -495,6 +702,9 @@ static inline int
 nst_disk_obj_append(nst_disk_t *disk, nst_disk_obj_t *obj, char *buf, int len) {
 
     if(nst_disk_write(obj, buf, len) != NST_OK) {
+        free(obj->stage);
+        obj->stage = NULL;
+
         if(obj->fd != -1) {
             close(obj->fd);
             obj->fd = -1;
@@ -515,9 +725,13 @@ nst_disk_obj_append(nst_disk_t *disk, nst_disk_obj_t *obj, char *buf, int len) {
 int
 nst_disk_obj_finish(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key, nst_http_txn_t *txn,
         uint64_t expire);
+void nst_disk_obj_replace(nst_disk_t *disk, nst_disk_obj_t *obj, char *file, uint64_t base);
 
 static inline void
 nst_disk_obj_abort(nst_disk_t *disk, nst_disk_obj_t *obj) {
+    free(obj->stage);
+    obj->stage = NULL;
+
     if(obj->fd != -1) {
         close(obj->fd);
         obj->fd = -1;
@@ -533,4 +747,13 @@ nst_disk_obj_abort(nst_disk_t *disk, nst_disk_obj_t *obj) {
 int nst_disk_obj_valid(nst_disk_obj_t *disk, nst_key_t *key);
 int nst_disk_obj_exists(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key);
 
+int nst_disk_aio_init(nst_disk_t *disk, int io, int threads);
+nst_disk_aio_t *nst_disk_aio_new(nst_disk_t *disk, hpx_task_t *task);
+void nst_disk_aio_free(nst_disk_aio_t *aio);
+int nst_disk_aio_read(nst_disk_aio_t *aio, int fd, char **p, int len, uint64_t offset);
+int nst_disk_aio_obj_valid(nst_disk_aio_t *aio, nst_disk_obj_t *obj, nst_key_t *key);
+int nst_disk_aio_obj_exists(nst_disk_t *disk, nst_disk_aio_t *aio, nst_disk_obj_t *obj,
+        nst_key_t *key);
+int nst_disk_pread(nst_disk_aio_t *aio, int fd, char **p, int len, uint64_t offset);
+
 #endif /* _NUSTER_DISK_H */
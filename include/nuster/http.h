@@ -63,8 +63,29 @@ typedef struct nst_http_res {
     int                 ttl;
     hpx_ist_t           etag;
     hpx_ist_t           last_modified;
+    hpx_ist_t           tags;               /* separated by a space */
+    hpx_ist_t           vary;               /* lower case names, separated by a space */
 } nst_http_res_t;
 
+#define NST_HTTP_RANGE_MAX      16
+
+/*
+ * Byte ranges of a cached payload requested with a Range header, sent as a
+ * 206 response by the cache applet, or a 416 one if count is 0.
+ */
+typedef struct nst_http_range {
+    int                 count;
+    int                 idx;                /* of the next range to send */
+    uint64_t            total;              /* payload length */
+    uint64_t            pos;                /* payload offset of the data to send */
+    uint64_t            left;               /* bytes left in the current range */
+    uint64_t            boundary;           /* of a multipart/byteranges body */
+    int                 type_len;
+    char                type[128];          /* content-type of the parts */
+    uint64_t            first[NST_HTTP_RANGE_MAX];
+    uint64_t            last[NST_HTTP_RANGE_MAX];
+} nst_http_range_t;
+
 typedef struct nst_http_txn {
     nst_http_req_t      req;
     nst_http_res_t      res;
@@ -73,7 +94,21 @@ typedef struct nst_http_txn {
 int nst_http_parse_htx(hpx_stream_t *s, hpx_buffer_t *buf, nst_http_txn_t *txn);
 
 int nst_http_find_param(char *query_beg, char *query_end, char *name, char **val, int *val_len);
-int nst_http_memory_item_to_htx(nst_memory_item_t *item, hpx_htx_t *htx);
+int nst_http_memory_item_to_htx(nst_memory_item_t *item, uint32_t *offset, uint32_t *left,
+        hpx_htx_t *htx);
+int nst_http_memory_item_encoded_to_htx(nst_memory_obj_t *obj, nst_memory_item_t *item,
+        uint32_t *offset, uint32_t *left, nst_memory_zstream_t *z, hpx_htx_t *htx);
+int nst_http_inflate_to_htx(nst_memory_zstream_t *z, const char *data, uint32_t *offset,
+        uint32_t *left, hpx_htx_t *htx);
+int nst_http_accept_encoding(hpx_htx_t *htx, int encoding);
+int nst_http_memory_headers_to_htx(nst_memory_item_t **item, uint32_t *offset, hpx_htx_t *htx);
+int nst_http_memory_range_to_htx(nst_memory_obj_t *obj, uint64_t *pos, uint64_t *left,
+        hpx_htx_t *htx);
+
+int nst_http_parse_range(hpx_htx_t *htx, nst_http_txn_t *txn, uint64_t total,
+        nst_http_range_t *range);
+int nst_http_range_headers(hpx_htx_t *htx, nst_http_range_t *range);
+int nst_http_range_next(nst_http_range_t *range, hpx_htx_t *htx);
 
 void nst_http_reply(hpx_stream_t *s, int idx);
 int nst_http_reply_100(hpx_stream_t *s);
@@ -89,5 +124,32 @@ void nst_http_build_last_modified(hpx_stream_t *s, hpx_buffer_t *buf, nst_http_t
 
 int nst_http_parse_ttl(hpx_htx_t *htx, hpx_buffer_t *buf, nst_http_txn_t *txn);
 
+int nst_http_build_tags(hpx_stream_t *s, hpx_buffer_t *buf, nst_http_txn_t *txn, hpx_ist_t name);
+int nst_http_build_vary(hpx_stream_t *s, hpx_buffer_t *buf, nst_http_txn_t *txn);
+
+/*
+ * Iterate over tags built by nst_http_build_tags, or header names built by
+ * nst_http_build_vary, tag->ptr must be NULL on the first call.
+ * return 0 if there is no more tag.
+ */
+static inline int
+nst_http_tags_next(hpx_ist_t tags, hpx_ist_t *tag) {
+    char  *p   = tag->ptr ? tag->ptr + tag->len + 1 : tags.ptr;
+    char  *end = tags.ptr + tags.len;
+
+    if(p >= end) {
+        return 0;
+    }
+
+    tag->ptr = p;
+    tag->len = 0;
+
+    while(p + tag->len < end && p[tag->len] != ' ') {
+        tag->len++;
+    }
+
+    return 1;
+}
+
 
 #endif /* _NUSTER_HTTP_H */
@@ -32,6 +32,7 @@
 enum {
     NST_KEY_MEMORY_CHECKED = 0x0001,
     NST_KEY_DISK_CHECKED   = 0x0002,
+    NST_KEY_VARY           = 0x0004,        /* key of a variant, see nst_key_build_vary */
 };
 
 typedef struct nst_key {
@@ -63,9 +64,14 @@ nst_key_disk_set_checked(nst_key_t *key) {
     key->flags |=  NST_KEY_DISK_CHECKED;
 }
 
+static inline int
+nst_key_vary(nst_key_t *key) {
+    return key->flags & NST_KEY_VARY;
+}
+
 static inline void
 nst_key_reset_flag(nst_key_t *key) {
-    key->flags = 0;
+    key->flags &= NST_KEY_VARY;
 }
 
 static inline hpx_buffer_t *
@@ -130,6 +136,7 @@ nst_key_uuid_stringify(nst_key_t *key, char *str){
 void nst_key_hash(nst_key_t *key);
 
 void nst_key_debug(hpx_stream_t *s, nst_key_t *key);
+int nst_key_build_vary(hpx_stream_t *s, nst_key_t *key, hpx_ist_t vary);
 
 int nst_key_build(hpx_stream_t *s, hpx_http_msg_t *msg, nst_rule_t *rule, nst_http_txn_t *txn,
         nst_key_t *key, hpx_http_meth_t method);
@@ -37,6 +37,7 @@ enum {
     NST_MANAGER_HOST,
     NST_MANAGER_PATH_HOST,
     NST_MANAGER_REGEX_HOST,
+    NST_MANAGER_TAG,
 };
 
 enum {
@@ -22,17 +22,61 @@
 #ifndef _NUSTER_MEMORY_H
 #define _NUSTER_MEMORY_H
 
+#include <haproxy/htx-t.h>
+
+#if defined(USE_ZLIB)
+#include <zlib.h>
+#endif
+
 #include <nuster/common.h>
 
+/* watermarks of the used shmem in percent, see nst_memory_evict_target */
+#define NST_MEMORY_EVICT_HIGH           95
+#define NST_MEMORY_EVICT_LOW            90
+
+/*
+ * Admission sketch, a count-min sketch of NST_MEMORY_SKETCH_DEPTH rows of
+ * one shmem block each, a counter is one byte saturated at
+ * NST_MEMORY_SKETCH_MAX. Counters are halved every
+ * NST_MEMORY_SKETCH_SAMPLE * width additions, see nst_memory_sketch_age.
+ */
+#define NST_MEMORY_SKETCH_DEPTH         4
+#define NST_MEMORY_SKETCH_MAX           15
+#define NST_MEMORY_SKETCH_SAMPLE        10
+#define NST_MEMORY_ADMIT_FREQ           2
+
+/*
+ * Extents double in size from NST_MEMORY_EXTENT_MIN bytes up to one shmem
+ * block, see nst_memory_obj_append.
+ */
+#define NST_MEMORY_EXTENT_MIN           1024
+
+/* bodies with a smaller content-length are not encoded */
+#define NST_MEMORY_ENCODE_MIN           256
+
+/* encodings of the data records of a nst_memory_object, see rule compress */
+enum {
+    NST_MEMORY_ENCODING_IDENTITY = 0,
+    NST_MEMORY_ENCODING_GZIP,
+};
 
 /*
  * A nst_memory_object contains a complete http response data
  * All nst_memory_object are stored in a circular singly linked list
+ *
+ * The data are stored in a list of extents, nst_memory_item, as records of
+ * one htx block: 4 bytes of info followed by the block. Data blocks may be
+ * split into several records between extents, other records are never split.
+ *
+ * Records are published by item->used once complete and are never modified
+ * afterwards, so an object can be read while it is being filled.
  */
 typedef struct nst_memory_item {
     struct nst_memory_item      *next;
 
-    uint32_t                     info;
+    uint32_t                     size;          /* capacity of data */
+    uint32_t                     used;
+    uint32_t                     payload;       /* data bytes, to seek a range */
     char                         data[0];
 } nst_memory_item_t;
 
@@ -42,18 +86,86 @@ typedef struct nst_memory_object {
     int                          clients;
     int                          invalid;
 
+    /* bytes accounted in nst_memory.evicting, 0 if not evicted */
+    uint64_t                     evicted;
+
+    /* NST_MEMORY_ENCODING_*, and the length of the encoded body */
+    int                          encoding;
+    uint64_t                     length;
+
+    /*
+     * encoding of the precompressed copy built by nst_memory_precompress
+     * once a client wants it, the copy is owned by this object
+     */
+    int                          precompress;
+    int                          wanted;
+    struct nst_memory_object    *wanted_next;
+    struct nst_memory_object    *encoded;
+
+    /*
+     * 1 while the object is created and can be followed by clients, 0 once
+     * complete, -1 if the creation failed, and set if it was followed
+     */
+    int                          filling;
+    int                          followed;
+
     nst_memory_item_t           *item;
 } nst_memory_obj_t;
 
+/*
+ * A zlib stream encoding the body of a nst_memory_object being created, or
+ * decoding it for a client which does not accept the encoding
+ */
+typedef struct nst_memory_zstream {
+#if defined(USE_ZLIB)
+    z_stream                     zs;
+#endif
+    int                          inflate;
+    int                          end;           /* Z_STREAM_END reached */
+} nst_memory_zstream_t;
+
 typedef struct nst_memory {
     nst_shmem_t                 *shmem;
 
     nst_memory_obj_t            *head;
     nst_memory_obj_t            *tail;
 
+    /* invalid objects removed from the list, freed by nst_dict_reclaim */
+    nst_memory_obj_t            *retired;
+
     uint64_t                     count;
     uint64_t                     invalid;
 
+    /*
+     * set when an allocation fails, bytes of evicted objects not freed yet,
+     * and total number of evicted objects, see nst_dict_evict
+     */
+    int                          pressure;
+    uint64_t                     evicting;
+    uint64_t                     evicted;
+
+    /* number of objects moved by nst_dict_compact */
+    uint64_t                     compacted;
+
+    /* number of encoded objects, and their body length before and after */
+    struct {
+        uint64_t                 objs;
+        uint64_t                 raw;
+        uint64_t                 encoded;
+    } encoding;
+
+    /* attached objects waiting for a precompressed copy */
+    nst_memory_obj_t            *wanted;
+    uint64_t                     precompressed;
+
+    /* row[0] is NULL without admission */
+    struct {
+        uint8_t                 *row[NST_MEMORY_SKETCH_DEPTH];
+        uint64_t                 width;
+        uint64_t                 additions;
+        uint64_t                 rejected;
+    } sketch;
+
 #if defined NUSTER_USE_PTHREAD || defined USE_PTHREAD_PSHARED
     pthread_mutex_t              mutex;
 #else
@@ -63,7 +175,12 @@ typedef struct nst_memory {
 
 
 int nst_memory_init(nst_memory_t *mem, nst_shmem_t *shmem);
+int nst_memory_sketch_init(nst_memory_t *mem);
+int nst_memory_admit(nst_memory_t *mem, uint64_t hash);
+void nst_memory_sketch_age(nst_memory_t *mem);
 void nst_memory_cleanup(nst_memory_t *mem);
+nst_memory_obj_t *nst_memory_retired(nst_memory_t *mem);
+void nst_memory_obj_free(nst_memory_t *mem, nst_memory_obj_t *obj);
 static inline void
 nst_memory_incr_invalid(nst_memory_t *mem) {
     nst_shctx_lock(mem);
@@ -71,10 +188,65 @@ nst_memory_incr_invalid(nst_memory_t *mem) {
     nst_shctx_unlock(mem);
 }
 
+static inline void
+nst_memory_incr_encoded(nst_memory_t *mem, uint64_t raw, uint64_t encoded) {
+    nst_shctx_lock(mem);
+    mem->encoding.objs++;
+    mem->encoding.raw     += raw;
+    mem->encoding.encoded += encoded;
+    nst_shctx_unlock(mem);
+}
+
+static inline void
+nst_memory_obj_evict(nst_memory_t *mem, nst_memory_obj_t *obj, uint64_t size) {
+    obj->evicted = size ? size : 1;
+    obj->invalid = 1;
+
+    nst_shctx_lock(mem);
+    mem->invalid++;
+    mem->evicting += obj->evicted;
+    mem->evicted++;
+    nst_shctx_unlock(mem);
+}
+
+/*
+ * bytes to evict to get back under the low watermark, 0 if the used memory
+ * is under the high watermark and no allocation failed
+ */
+static inline uint64_t
+nst_memory_evict_target(nst_memory_t *mem) {
+    uint64_t  size = mem->shmem->size;
+    uint64_t  used = mem->shmem->used;
+    uint64_t  high = size / 100 * NST_MEMORY_EVICT_HIGH;
+    uint64_t  low  = size / 100 * NST_MEMORY_EVICT_LOW;
+    uint64_t  target;
 
-static inline nst_memory_item_t *
-nst_memory_alloc_item(nst_memory_t *mem, uint32_t size) {
-    return nst_shmem_alloc(mem->shmem, sizeof(nst_memory_item_t) + size);
+    if(used < high && !mem->pressure) {
+        return 0;
+    }
+
+    target = used > low ? used - low : 0;
+
+    /* fragmented, free as much as between the watermarks */
+    if(mem->pressure && target < high - low) {
+        target = high - low;
+    }
+
+    target = target > mem->evicting ? target - mem->evicting : 0;
+
+    return target;
+}
+
+/*
+ * size of the htx block of a record
+ */
+static inline uint32_t
+nst_memory_blksz(uint32_t info) {
+    uint32_t  type = info >> 28;
+
+    return (type == HTX_BLK_HDR || type == HTX_BLK_TLR)
+        ? (info & 0xff) + ((info >> 8) & 0xfffff)
+        : info & 0xfffffff;
 }
 
 nst_memory_obj_t *nst_memory_obj_create(nst_memory_t *mem);
@@ -82,13 +254,23 @@ nst_memory_obj_t *nst_memory_obj_create(nst_memory_t *mem);
 int nst_memory_obj_append(nst_memory_t *mem, nst_memory_obj_t *obj, nst_memory_item_t **tail,
         const char *buf, uint32_t len, uint32_t info);
 
-static inline int
-nst_memory_obj_finish(nst_memory_t *mem, nst_memory_obj_t *obj) {
-    obj->invalid = 0;
+void nst_memory_obj_finish(nst_memory_t *mem, nst_memory_obj_t *obj, nst_memory_item_t **tail);
+
+nst_memory_obj_t *nst_memory_obj_copy(nst_memory_t *mem, nst_memory_obj_t *obj);
 
-    return NST_OK;
+static inline const char *
+nst_memory_encoding_str(int encoding) {
+    return encoding == NST_MEMORY_ENCODING_GZIP ? "gzip" : "identity";
 }
 
+nst_memory_zstream_t *nst_memory_zstream_create(int encoding, int inflate);
+void nst_memory_zstream_free(nst_memory_zstream_t *z);
+int nst_memory_obj_deflate(nst_memory_t *mem, nst_memory_obj_t *obj, nst_memory_item_t **tail,
+        nst_memory_zstream_t *z, const char *buf, uint32_t len, int finish);
+int nst_memory_obj_append_vary(nst_memory_t *mem, nst_memory_obj_t *obj,
+        nst_memory_item_t **tail);
+int nst_memory_precompress(nst_memory_t *mem);
+
 static inline void
 nst_memory_obj_abort(nst_memory_t *mem, nst_memory_obj_t *obj) {
 
@@ -114,15 +296,29 @@ nst_memory_obj_invalid(nst_memory_obj_t *obj) {
 
 static inline void
 nst_memory_obj_attach(nst_memory_t *mem, nst_memory_obj_t *obj) {
-    nst_shctx_lock(mem);
-    obj->clients++;
-    nst_shctx_unlock(mem);
+    __sync_add_and_fetch(&obj->clients, 1);
 }
 
 static inline void
 nst_memory_obj_detach(nst_memory_t *mem, nst_memory_obj_t *obj) {
+    __sync_sub_and_fetch(&obj->clients, 1);
+}
+
+/*
+ * queue obj for nst_memory_precompress, it stays attached until then
+ */
+static inline void
+nst_memory_obj_want(nst_memory_t *mem, nst_memory_obj_t *obj) {
+
+    if(obj->wanted || !__sync_bool_compare_and_swap(&obj->wanted, 0, 1)) {
+        return;
+    }
+
+    nst_memory_obj_attach(mem, obj);
+
     nst_shctx_lock(mem);
-    obj->clients--;
+    obj->wanted_next = mem->wanted;
+    mem->wanted      = obj;
     nst_shctx_unlock(mem);
 }
 
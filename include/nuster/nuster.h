@@ -45,6 +45,7 @@ typedef struct nuster {
 
     struct {
         hpx_applet_t            cache;
+        hpx_applet_t            refresh;
         hpx_applet_t            nosql;
         hpx_applet_t            purger;
         hpx_applet_t            stats;
@@ -22,6 +22,8 @@
 #ifndef _NUSTER_SHMEM_H
 #define _NUSTER_SHMEM_H
 
+#include <haproxy/defaults.h>
+
 #include <nuster/common.h>
 
 
@@ -32,6 +34,25 @@
 #define NST_SHMEM_BLOCK_MAX_SIZE      1024 * 1024 * 2
 #define NST_SHMEM_BLOCK_MAX_SHIFT     21
 #define NST_SHMEM_INFO_BITMAP_BITS    32
+#define NST_SHMEM_CLASSES             (NST_SHMEM_BLOCK_MAX_SHIFT - NST_SHMEM_CHUNK_MIN_SHIFT + 1)
+
+/*
+ * Compaction drains blocks at most NST_SHMEM_COMPACT_SPARSE percent used,
+ * up to NST_SHMEM_COMPACT_BLOCKS blocks among the first
+ * NST_SHMEM_COMPACT_SCAN blocks of each class.
+ */
+#define NST_SHMEM_COMPACT_SPARSE      25
+#define NST_SHMEM_COMPACT_BLOCKS      64
+#define NST_SHMEM_COMPACT_SCAN        1024
+
+/*
+ * Per thread caches of free chunks, one magazine per size class up to
+ * NST_SHMEM_CACHE_MAX_SIZE. Chunks held in a magazine are counted in used.
+ */
+#define NST_SHMEM_CACHE_MAX           4          /* shmem instances cached */
+#define NST_SHMEM_CACHE_SIZE          16         /* chunks per magazine */
+#define NST_SHMEM_CACHE_BATCH         8          /* chunks per refill/flush */
+#define NST_SHMEM_CACHE_MAX_SIZE      2048
 
 
 /* start                                 alignment                   stop
@@ -45,7 +66,7 @@
 
 /*
  * info:
- * | bitmap: 32 | reserved: 16 | 5 | full: 1 | bitmap: 1 | inited: 1 | type: 8 |
+ * | bitmap: 32 | reserved: 16 | 3 | draining: 1 | full: 1 | bitmap: 1 | inited: 1 | type: 8 |
  * bitmap: points to bitmap area, doesn't change once set
  * chunk size[n]: 1<<(NST_SHMEM_CHUNK_MIN_SHIFT + n)
  */
@@ -72,6 +93,9 @@ typedef struct nst_shmem {
     uint64_t                     size;
     uint64_t                     used;
 
+    int                          pages;       /* NST_SHMEM_PAGES_* in effect */
+    int                          numa;        /* NST_SHMEM_NUMA_* or node in effect */
+
     uint32_t                     block_size;  /* max shmem can be allocated */
     uint32_t                     chunk_size;  /* min shmem can be allocated */
     int                          chunk_shift;
@@ -90,8 +114,32 @@ typedef struct nst_shmem {
         uint8_t                 *free;
         uint8_t                 *end;
     } data;
+
+    int                          id;          /* magazine slot, -1 if none */
+
+    struct {
+        uint64_t                 blocks;      /* blocks of this chunk size */
+        uint64_t                 chunks;      /* used chunks */
+    } classes[NST_SHMEM_CLASSES];
+
+    struct {
+        nst_shmem_ctrl_t        *draining;    /* blocks not allocated from */
+        uint64_t                 drained;     /* blocks emptied */
+    } compact;
+
+    struct {
+        uint64_t                 hit;         /* served by the magazine */
+        uint64_t                 miss;        /* went through the lock */
+        uint64_t                 refill;
+        uint64_t                 flush;
+    } stats[MAX_THREADS];
 } nst_shmem_t;
 
+typedef struct nst_shmem_cache {
+    void                        *chunk[NST_SHMEM_CLASSES][NST_SHMEM_CACHE_SIZE];
+    int                          count[NST_SHMEM_CLASSES];
+} nst_shmem_cache_t;
+
 
 #define bit_set(bit, i)         (bit |= 1 << i)
 #define bit_clear(bit, i)       (bit &= ~(1 << i))
@@ -133,10 +181,47 @@ _nst_shmem_block_clear_full(nst_shmem_ctrl_t *block) {
     bit_clear(block->info, 11);
 }
 
+static inline void
+_nst_shmem_block_set_draining(nst_shmem_ctrl_t *block) {
+    bit_set(block->info, 12);
+}
+
+static inline int
+_nst_shmem_block_is_draining(nst_shmem_ctrl_t *block) {
+    return bit_used(block->info, 12);
+}
+
+static inline void
+_nst_shmem_block_clear_draining(nst_shmem_ctrl_t *block) {
+    bit_clear(block->info, 12);
+}
+
 nst_shmem_t *
-nst_shmem_create(char *name, uint64_t size, uint32_t block_size, uint32_t chunk_size);
+nst_shmem_create(char *name, uint64_t size, uint32_t block_size, uint32_t chunk_size,
+        int pages, char *dir, int numa);
+
+const char *nst_shmem_pages_str(int pages);
 
 void *nst_shmem_alloc(nst_shmem_t *shmem, int size);
 void nst_shmem_free(nst_shmem_t *shmem, void *p);
 
+int nst_shmem_compact_begin(nst_shmem_t *shmem);
+void nst_shmem_compact_end(nst_shmem_t *shmem);
+
+/*
+ * whether p is in a block being drained, can be called without the lock
+ */
+static inline int
+nst_shmem_draining(nst_shmem_t *shmem, void *p) {
+    int  block_idx;
+
+    if((uint8_t *)p < shmem->data.begin || (uint8_t *)p >= shmem->data.free) {
+        return 0;
+    }
+
+    block_idx = ((uint8_t *)p - shmem->data.begin) / shmem->block_size;
+
+    return _nst_shmem_block_is_draining(&shmem->block[block_idx]);
+}
+
 #endif /* _NUSTER_SHMEM_H */
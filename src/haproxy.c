@@ -185,31 +185,55 @@ struct global global = {
 #endif
 	.nuster = {
 		.cache = {
-			.status       = NST_STATUS_UNDEFINED,
-			.data_size    = NST_DEFAULT_DATA_SIZE,
-			.dict_size    = NST_DEFAULT_DICT_SIZE,
-			.dict_cleaner = NST_DEFAULT_DICT_CLEANER,
-			.data_cleaner = NST_DEFAULT_DATA_CLEANER,
-			.disk_cleaner = NST_DEFAULT_DISK_CLEANER,
-			.disk_loader  = NST_DEFAULT_DISK_LOADER,
-			.disk_saver   = NST_DEFAULT_DISK_SAVER,
-			.clean_temp   = NST_STATUS_OFF,
-			.root         = {
+			.status        = NST_STATUS_UNDEFINED,
+			.data_size     = NST_DEFAULT_DATA_SIZE,
+			.dict_size     = NST_DEFAULT_DICT_SIZE,
+			.dict_cleaner  = NST_DEFAULT_DICT_CLEANER,
+			.dict_rehasher = NST_DEFAULT_DICT_REHASHER,
+			.dict_layout   = NST_DICT_LAYOUT_CHAIN,
+			.dict_index    = NST_STATUS_OFF,
+			.compaction    = NST_STATUS_OFF,
+			.eviction      = NST_EVICTION_OFF,
+			.admission     = NST_STATUS_OFF,
+			.data_cleaner  = NST_DEFAULT_DATA_CLEANER,
+			.disk_cleaner  = NST_DEFAULT_DISK_CLEANER,
+			.disk_loader   = NST_DEFAULT_DISK_LOADER,
+			.disk_saver    = NST_DEFAULT_DISK_SAVER,
+			.disk_io       = NST_DISK_IO_SYNC,
+			.disk_io_threads = NST_DEFAULT_DISK_IO_THREADS,
+			.disk_layout   = NST_DISK_LAYOUT_FILE,
+			.segment_size  = NST_DEFAULT_SEGMENT_SIZE,
+			.clean_temp    = NST_STATUS_OFF,
+			.hugepages     = NST_SHMEM_PAGES_NORMAL,
+			.hugepages_dir = NULL,
+			.numa          = NST_SHMEM_NUMA_OFF,
+			.root          = {
 				.ptr  = NULL,
 				.len  = 0,
 			},
 		},
 		.nosql = {
-			.status       = NST_STATUS_UNDEFINED,
-			.data_size    = NST_DEFAULT_DATA_SIZE,
-			.dict_size    = NST_DEFAULT_DICT_SIZE,
-			.dict_cleaner = NST_DEFAULT_DICT_CLEANER,
-			.data_cleaner = NST_DEFAULT_DATA_CLEANER,
-			.disk_cleaner = NST_DEFAULT_DISK_CLEANER,
-			.disk_loader  = NST_DEFAULT_DISK_LOADER,
-			.disk_saver   = NST_DEFAULT_DISK_SAVER,
-			.clean_temp   = NST_STATUS_OFF,
-			.root         = {
+			.status        = NST_STATUS_UNDEFINED,
+			.data_size     = NST_DEFAULT_DATA_SIZE,
+			.dict_size     = NST_DEFAULT_DICT_SIZE,
+			.dict_cleaner  = NST_DEFAULT_DICT_CLEANER,
+			.dict_rehasher = NST_DEFAULT_DICT_REHASHER,
+			.dict_layout   = NST_DICT_LAYOUT_CHAIN,
+			.dict_index    = NST_STATUS_OFF,
+			.compaction    = NST_STATUS_OFF,
+			.data_cleaner  = NST_DEFAULT_DATA_CLEANER,
+			.disk_cleaner  = NST_DEFAULT_DISK_CLEANER,
+			.disk_loader   = NST_DEFAULT_DISK_LOADER,
+			.disk_saver    = NST_DEFAULT_DISK_SAVER,
+			.disk_io       = NST_DISK_IO_SYNC,
+			.disk_io_threads = NST_DEFAULT_DISK_IO_THREADS,
+			.disk_layout   = NST_DISK_LAYOUT_FILE,
+			.segment_size  = NST_DEFAULT_SEGMENT_SIZE,
+			.clean_temp    = NST_STATUS_OFF,
+			.hugepages     = NST_SHMEM_PAGES_NORMAL,
+			.hugepages_dir = NULL,
+			.numa          = NST_SHMEM_NUMA_OFF,
+			.root          = {
 				.ptr  = NULL,
 				.len  = 0,
 			},
@@ -11,17 +11,58 @@
  */
 
 #include <haproxy/stream_interface.h>
+#include <haproxy/http_htx.h>
+#include <haproxy/http_ana.h>
+#include <haproxy/intops.h>
+#include <haproxy/frontend.h>
+#include <haproxy/session.h>
+#include <haproxy/stream.h>
+#include <haproxy/proxy.h>
 
 #include <nuster/nuster.h>
 
+/*
+ * Streams parked on an entry in INIT state, see nst_cache_wait, and applets
+ * following a memory object being filled, see _nst_cache_follow_wait. The
+ * lists are local to the process, each one is protected by the lock of its
+ * dict stripe.
+ */
+static hpx_list_t  _nst_cache_waiters[NST_DICT_STRIPES];
+static hpx_list_t  _nst_cache_followers[NST_DICT_STRIPES];
+
+/*
+ * The internal requests of refresh-ahead are accepted by a listener of their
+ * own frontend, see _nst_cache_refresh
+ */
+static hpx_proxy_t       _nst_cache_refresh_fe;
+static struct bind_conf  _nst_cache_refresh_bind;
+static struct listener   _nst_cache_refresh_li;
+
+/* request headers not copied to the internal request of refresh-ahead */
+static const hpx_ist_t   _nst_cache_refresh_skip[] = {
+    IST("content-length"),
+    IST("transfer-encoding"),
+    IST("expect"),
+    IST("range"),
+    IST("if-range"),
+    IST("if-match"),
+    IST("if-none-match"),
+    IST("if-modified-since"),
+    IST("if-unmodified-since"),
+};
+
 static void
 _nst_cache_memory_handler(hpx_appctx_t *appctx) {
     hpx_htx_t               *req_htx, *res_htx;
     hpx_stream_interface_t  *si    = appctx->owner;
     hpx_channel_t           *req   = si_oc(si);
     hpx_channel_t           *res   = si_ic(si);
+    nst_memory_obj_t        *obj   = appctx->ctx.nuster.store.memory.obj;
+    nst_memory_zstream_t    *z     = appctx->ctx.nuster.store.memory.zstream;
     nst_memory_item_t       *item  = NULL;
+    uint32_t                 zero  = 0;
     int                      total = 0;
+    int                      ret;
 
     res_htx = htxbuf(&res->buf);
     total   = res_htx->data;
@@ -39,6 +80,10 @@ _nst_cache_memory_handler(hpx_appctx_t *appctx) {
 
     if(res->flags & (CF_SHUTW|CF_SHUTR|CF_SHUTW_NOW)) {
         appctx->ctx.nuster.store.memory.item = NULL;
+
+        if(z) {
+            z->end = 1;
+        }
     }
 
     if(appctx->ctx.nuster.store.memory.item) {
@@ -46,7 +91,16 @@ _nst_cache_memory_handler(hpx_appctx_t *appctx) {
 
         while(item) {
 
-            if(nst_http_memory_item_to_htx(item, res_htx) != NST_OK) {
+            if(obj->encoding != NST_MEMORY_ENCODING_IDENTITY) {
+                ret = nst_http_memory_item_encoded_to_htx(obj, item,
+                        &appctx->ctx.nuster.store.memory.offset,
+                        &appctx->ctx.nuster.store.memory.left, z, res_htx);
+            } else {
+                ret = nst_http_memory_item_to_htx(item, &appctx->ctx.nuster.store.memory.offset,
+                        &appctx->ctx.nuster.store.memory.left, res_htx);
+            }
+
+            if(ret != NST_OK) {
                 si_rx_room_blk(si);
 
                 goto out;
@@ -54,27 +108,36 @@ _nst_cache_memory_handler(hpx_appctx_t *appctx) {
 
             item = item->next;
 
+            appctx->ctx.nuster.store.memory.offset = 0;
         }
+    }
 
-    } else {
+    /*
+     * all items are sent, end in the same call as the request may be gone
+     * already to wake it up, output of the decoded body may still be pending
+     */
+    if(z && nst_http_inflate_to_htx(z, NULL, &zero, &zero, res_htx) != NST_OK) {
+        si_rx_room_blk(si);
 
-        if(!htx_add_endof(res_htx, HTX_BLK_EOM)) {
-            si_rx_room_blk(si);
+        goto out;
+    }
 
-            goto out;
-        }
+    if(!htx_add_endof(res_htx, HTX_BLK_EOM)) {
+        si_rx_room_blk(si);
 
-        if(!(res->flags & CF_SHUTR) ) {
-            res->flags |= CF_READ_NULL;
-            si_shutr(si);
-        }
+        goto out;
+    }
 
-        /* eat the whole request */
-        if(co_data(req)) {
-            req_htx = htx_from_buf(&req->buf);
-            co_htx_skip(req, req_htx, co_data(req));
-            htx_to_buf(req_htx, &req->buf);
-        }
+    if(!(res->flags & CF_SHUTR) ) {
+        res->flags |= CF_READ_NULL;
+        si_shutr(si);
+    }
+
+    /* eat the whole request */
+    if(co_data(req)) {
+        req_htx = htx_from_buf(&req->buf);
+        co_htx_skip(req, req_htx, co_data(req));
+        htx_to_buf(req_htx, &req->buf);
     }
 
 out:
@@ -89,187 +152,145 @@ out:
 }
 
 /*
- * The cache disk applet acts like the backend to send cached http data
+ * Park appctx in the followers of its memory object once it sent all the
+ * records appended so far, or leave them if the object grew meanwhile.
+ * return 1 if parked, 0 otherwise
+ */
+static int
+_nst_cache_follow_wait(hpx_appctx_t *appctx) {
+    nst_dict_t         *dict = &nuster.cache->dict;
+    nst_memory_obj_t   *obj  = appctx->ctx.nuster.store.memory.obj;
+    nst_memory_item_t  *item = appctx->ctx.nuster.store.memory.item;
+    uint64_t            hash = appctx->ctx.nuster.store.memory.hash;
+    int                 ret  = 0;
+
+    nst_dict_lock(dict, hash);
+
+    if(obj->filling == 1 && !item->next && appctx->ctx.nuster.store.memory.offset == item->used) {
+
+        if(!LIST_ADDED(&appctx->wait_entry)) {
+            LIST_ADDQ(&_nst_cache_followers[hash & (NST_DICT_STRIPES - 1)], &appctx->wait_entry);
+        }
+
+        ret = 1;
+    } else {
+        LIST_DEL_INIT(&appctx->wait_entry);
+    }
+
+    nst_dict_unlock(dict, hash);
+
+    return ret;
+}
+
+/*
+ * Wake up the applets following obj, it grew or is not filled anymore
  */
 static void
-_nst_cache_disk_handler(hpx_appctx_t *appctx) {
-    hpx_stream_interface_t  *si  = appctx->owner;
-    hpx_channel_t           *req = si_oc(si);
-    hpx_channel_t           *res = si_ic(si);
-    hpx_buffer_t            *buf;
+_nst_cache_follow_wake(uint64_t hash, nst_memory_obj_t *obj) {
+    nst_dict_t    *dict = &nuster.cache->dict;
+    hpx_appctx_t  *appctx, *back;
+
+    nst_dict_lock(dict, hash);
+
+    list_for_each_entry_safe(appctx, back, &_nst_cache_followers[hash & (NST_DICT_STRIPES - 1)],
+            wait_entry) {
+
+        if(appctx->ctx.nuster.store.memory.obj == obj) {
+            LIST_DEL_INIT(&appctx->wait_entry);
+            appctx_wakeup(appctx);
+        }
+    }
+
+    nst_dict_unlock(dict, hash);
+}
+
+/*
+ * Send a memory object while its creator fills it, see nst_cache_create.
+ * The applet parks once it caught up and is woken up by each append.
+ */
+static void
+_nst_cache_memory_follow_handler(hpx_appctx_t *appctx) {
     hpx_htx_t               *req_htx, *res_htx;
-    hpx_htx_blk_type_t       type;
-    hpx_htx_blk_t           *blk;
-    char                    *p, *ptr;
-    uint64_t                 offset, payload_len;
-    uint32_t                 blksz, sz, info;
-    int                      total, ret, max, fd, header_len;
+    hpx_stream_interface_t  *si    = appctx->owner;
+    hpx_channel_t           *req   = si_oc(si);
+    hpx_channel_t           *res   = si_ic(si);
+    nst_memory_obj_t        *obj   = appctx->ctx.nuster.store.memory.obj;
+    nst_memory_item_t       *item  = appctx->ctx.nuster.store.memory.item;
+    nst_memory_item_t       *next;
+    int                      filling;
+    int                      total;
 
-    header_len  = appctx->ctx.nuster.store.disk.header_len;
-    payload_len = appctx->ctx.nuster.store.disk.payload_len;
-    offset      = appctx->ctx.nuster.store.disk.offset;
-    fd          = appctx->ctx.nuster.store.disk.fd;
-    res_htx     = htxbuf(&res->buf);
-    total       = res_htx->data;
+    res_htx = htxbuf(&res->buf);
+    total   = res_htx->data;
 
     if(unlikely(si->state == SI_ST_DIS || si->state == SI_ST_CLO)) {
         goto out;
     }
 
     /* Check if the input buffer is avalaible. */
-    if(res->buf.size == 0) {
+    if(!b_size(&res->buf)) {
         si_rx_room_blk(si);
 
         goto out;
     }
 
-    /* check that the output is not closed */
     if(res->flags & (CF_SHUTW|CF_SHUTR|CF_SHUTW_NOW)) {
         appctx->st1 = NST_DISK_APPLET_DONE;
     }
 
     switch(appctx->st1) {
         case NST_DISK_APPLET_HEADER:
-            buf = get_trash_chunk();
-            p   = buf->area;
-
-            ret = pread(fd, p, header_len, offset);
-
-            if(ret != header_len) {
-                appctx->st1 = NST_DISK_APPLET_ERROR;
+        case NST_DISK_APPLET_PAYLOAD:
+            appctx->st1 = NST_DISK_APPLET_PAYLOAD;
 
-                break;
-            }
+            while(1) {
+                /* all records are published once it is not filled anymore */
+                filling = *(volatile int *)&obj->filling;
 
-            while(header_len != 0) {
-                info  = *(uint32_t *)p;
-                type  = (info >> 28);
-                blksz = (info & 0xff) + ((info >> 8) & 0xfffff);
-                blk   = htx_add_blk(res_htx, type, blksz);
+                __sync_synchronize();
 
-                if(!blk) {
+                if(filling < 0) {
                     appctx->st1 = NST_DISK_APPLET_ERROR;
 
-                    break;
+                    goto error;
                 }
 
-                blk->info = info;
-
-                ptr = htx_get_blk_ptr(res_htx, blk);
-                sz  = htx_get_blksz(blk);
-                p  += 4;
-                memcpy(ptr, p, sz);
-                p  += sz;
-
-                header_len -= 4 + sz;
-            }
-
-            appctx->st1 = NST_DISK_APPLET_PAYLOAD;
-            offset += ret;
-
-            appctx->ctx.nuster.store.disk.offset = offset;
-
-        case NST_DISK_APPLET_PAYLOAD:
-            buf = get_trash_chunk();
-            p   = buf->area;
-            max = htx_get_max_blksz(res_htx, channel_htx_recv_max(res, res_htx));
-
-            if(max <= 0) {
-                goto out;
-            }
-
-            if(max < payload_len) {
-                ret = pread(fd, p, max, offset);
-            } else {
-                ret = pread(fd, p, payload_len, offset);
-            }
-
-            if(ret <= 0) {
-                appctx->st1 = NST_DISK_APPLET_ERROR;
-
-                break;
-            }
-
-            appctx->ctx.nuster.store.disk.payload_len -= ret;
-
-            type  = HTX_BLK_DATA;
-            info  = (type << 28) + ret;
-            blksz = info & 0xfffffff;
-            blk   = htx_add_blk(res_htx, type, blksz);
-
-            if(!blk) {
-                appctx->st1 = NST_DISK_APPLET_ERROR;
-
-                break;
-            }
-
-            blk->info = info;
-
-            ptr = htx_get_blk_ptr(res_htx, blk);
-            sz  = htx_get_blksz(blk);
-            memcpy(ptr, p, sz);
-
-            offset += ret;
-            appctx->ctx.nuster.store.disk.offset = offset;
-
-            if(appctx->ctx.nuster.store.disk.payload_len == 0) {
-                appctx->st1 = NST_DISK_APPLET_EOP;
-            } else {
-                si_rx_room_blk(si);
-
-                break;
-            }
-
-        case NST_DISK_APPLET_EOP:
-            buf = get_trash_chunk();
-            p   = buf->area;
-            max = htx_get_max_blksz(res_htx, channel_htx_recv_max(res, res_htx));
+                if(nst_http_memory_item_to_htx(item, &appctx->ctx.nuster.store.memory.offset,
+                            &appctx->ctx.nuster.store.memory.left, res_htx) != NST_OK) {
 
-            ret = pread(fd, p, max, offset);
+                    si_rx_room_blk(si);
 
-            if(ret < 0) {
-                appctx->st1 = NST_DISK_APPLET_ERROR;
+                    goto out;
+                }
 
-                break;
-            }
+                next = *(nst_memory_item_t * volatile *)&item->next;
 
-            if(ret > 0) {
-                max = ret;
+                __sync_synchronize();
 
-                while(max != 0) {
-                    info  = *(uint32_t *)p;
-                    type  = (info >> 28);
-                    blksz = (info & 0xff) + ((info >> 8) & 0xfffff);
-                    blk   = htx_add_blk(res_htx, type, blksz);
+                if(next) {
 
-                    if(!blk) {
-                        appctx->st1 = NST_DISK_APPLET_ERROR;
+                    /* the last records of item are appended before next */
+                    if(appctx->ctx.nuster.store.memory.offset == item->used) {
+                        item = next;
 
-                        break;
+                        appctx->ctx.nuster.store.memory.offset = 0;
                     }
 
-                    blk->info = info;
-
-                    ptr = htx_get_blk_ptr(res_htx, blk);
-                    sz  = htx_get_blksz(blk);
-                    p  += 4;
-                    memcpy(ptr, p, sz);
-                    p  += sz;
-
-                    max -= 4 + sz;
+                    continue;
                 }
 
-                offset += ret;
+                if(!filling) {
+                    break;
+                }
 
-                appctx->ctx.nuster.store.disk.offset = offset;
+                appctx->ctx.nuster.store.memory.item = item;
 
-                break;
+                if(_nst_cache_follow_wait(appctx)) {
+                    goto out;
+                }
             }
 
             appctx->st1 = NST_DISK_APPLET_END;
-
-            close(fd);
-
         case NST_DISK_APPLET_END:
 
             if(!htx_add_endof(res_htx, HTX_BLK_EOM)) {
@@ -286,6 +307,7 @@ _nst_cache_disk_handler(hpx_appctx_t *appctx) {
                 si_shutr(si);
             }
 
+            /* eat the whole request */
             if(co_data(req)) {
                 req_htx = htx_from_buf(&req->buf);
                 co_htx_skip(req, req_htx, co_data(req));
@@ -294,14 +316,16 @@ _nst_cache_disk_handler(hpx_appctx_t *appctx) {
 
             break;
         case NST_DISK_APPLET_ERROR:
+error:
+            /* the creation failed, close without the end of the message */
             si_shutr(si);
             res->flags |= CF_READ_NULL;
-            close(fd);
 
-            return;
+            break;
     }
 
 out:
+    appctx->ctx.nuster.store.memory.item = item;
     total = res_htx->data - total;
 
     if(total) {
@@ -312,94 +336,737 @@ out:
 }
 
 /*
- * The cache applet acts like the backend to send cached http data
+ * Add the data of the requested ranges to htx, from the memory object or the
+ * payload on disk which starts at store.disk.offset
+ * return NST_OK once all data are added, NST_ERR if htx is full or on error,
+ * NST_DISK_AIO_AGAIN while the disk is read
  */
-static void
-nst_cache_handler(hpx_appctx_t *appctx) {
-
-    if(appctx->st0 == NST_CTX_STATE_HIT_MEMORY) {
-        _nst_cache_memory_handler(appctx);
-    } else {
-        _nst_cache_disk_handler(appctx);
-    }
-}
-
-void
-nst_cache_housekeeping() {
-    nst_dict_t   *dict  = &nuster.cache->dict;
-    nst_store_t  *store = &nuster.cache->store;
-    uint64_t      begin = nst_time_now_ms();
-    uint64_t      start;
+static int
+_nst_cache_range_to_htx(hpx_appctx_t *appctx, nst_http_range_t *range, hpx_htx_t *htx) {
+    hpx_buffer_t  *buf;
+    size_t         sz;
+    char          *p;
+    int            ret;
 
-    if(global.nuster.cache.status == NST_STATUS_ON && master == 1) {
-        int  dict_cleaner = global.nuster.cache.dict_cleaner;
-        int  data_cleaner = global.nuster.cache.data_cleaner;
-        int  disk_cleaner = global.nuster.cache.disk_cleaner;
-        int  disk_loader  = global.nuster.cache.disk_loader;
-        int  disk_saver   = global.nuster.cache.disk_saver;
-        int  ms           = 10;
-        int  ratio        = 1;
-
-        start = nst_time_now_ms();
+    while(1) {
 
-        while(dict_cleaner--) {
-            nst_dict_cleanup(dict);
+        if(!range->left) {
+            ret = nst_http_range_next(range, htx);
 
-            if(nst_time_now_ms() - start >= ms) {
-                break;
+            if(ret <= 0) {
+                return ret == 0 ? NST_OK : NST_ERR;
             }
         }
 
-        start = nst_time_now_ms();
+        if(appctx->st0 == NST_CTX_STATE_HIT_MEMORY) {
+            ret = nst_http_memory_range_to_htx(appctx->ctx.nuster.store.memory.obj,
+                    &range->pos, &range->left, htx);
 
-        if(data_cleaner > store->memory.count) {
-            data_cleaner = store->memory.count;
-        }
+            if(ret != NST_OK) {
+                return NST_ERR;
+            }
 
-        if(store->memory.count) {
-            ratio = store->memory.invalid * 10 / store->memory.count;
+            continue;
         }
 
-        if(ratio >= 2) {
-            data_cleaner = store->memory.count;
+        buf = get_trash_chunk();
+        sz  = htx_free_data_space(htx);
+        sz  = sz < buf->size ? sz : buf->size;
+        sz  = sz < range->left ? sz : range->left;
 
-            ms = ms * ratio ;
-            ms = ms >= 100 ? 100 : ms;
+        if(!sz) {
+            return NST_ERR;
         }
 
-        while(data_cleaner--) {
-            nst_memory_cleanup(&store->memory);
+        ret = nst_disk_pread(appctx->ctx.nuster.store.disk.aio, appctx->ctx.nuster.store.disk.fd,
+                &p, sz, appctx->ctx.nuster.store.disk.offset + range->pos);
 
-            if(nst_time_now_ms() - start >= ms) {
-                break;
-            }
+        if(ret == NST_DISK_AIO_AGAIN) {
+            return ret;
         }
 
-        start = nst_time_now_ms();
-        ms    = 10;
-
-        while(store->disk.loaded && disk_saver--) {
-            nst_store_memory_sync_disk(nuster.cache);
+        if(ret <= 0) {
+            appctx->st1 = NST_DISK_APPLET_ERROR;
 
-            if(nst_time_now_ms() - start >= ms) {
-                break;
-            }
+            return NST_ERR;
         }
 
-        start = nst_time_now_ms();
+        sz = htx_add_data(htx, ist2(p, ret));
 
-        while(store->disk.loaded && disk_cleaner--) {
-            nst_disk_cleanup(nuster.cache);
+        range->pos  += sz;
+        range->left -= sz;
 
-            if(nst_time_now_ms() - start >= ms) {
-                break;
-            }
+        if(sz < ret) {
+            return NST_ERR;
         }
+    }
+}
 
-        while(!store->disk.loaded && disk_loader--) {
-            nst_disk_load(nuster.cache);
-
-            if(nst_time_now_ms() - begin >= 500) {
+/*
+ * The cache memory applet for a HEAD or Range request, sends the headers then
+ * only the requested ranges of the payload if any
+ */
+static void
+_nst_cache_memory_partial_handler(hpx_appctx_t *appctx) {
+    hpx_htx_t               *req_htx, *res_htx;
+    hpx_stream_interface_t  *si    = appctx->owner;
+    hpx_channel_t           *req   = si_oc(si);
+    hpx_channel_t           *res   = si_ic(si);
+    nst_http_range_t        *range = appctx->ctx.nuster.store.memory.range;
+    int                      total;
+
+    res_htx = htxbuf(&res->buf);
+    total   = res_htx->data;
+
+    if(unlikely(si->state == SI_ST_DIS || si->state == SI_ST_CLO)) {
+        goto out;
+    }
+
+    /* Check if the input buffer is avalaible. */
+    if(!b_size(&res->buf)) {
+        si_rx_room_blk(si);
+
+        goto out;
+    }
+
+    if(res->flags & (CF_SHUTW|CF_SHUTR|CF_SHUTW_NOW)) {
+        appctx->st1 = NST_DISK_APPLET_DONE;
+    }
+
+    switch(appctx->st1) {
+        case NST_DISK_APPLET_HEADER:
+
+            if(nst_http_memory_headers_to_htx(&appctx->ctx.nuster.store.memory.item,
+                        &appctx->ctx.nuster.store.memory.offset, res_htx) != NST_OK) {
+
+                si_rx_room_blk(si);
+
+                goto out;
+            }
+
+            if(range && nst_http_range_headers(res_htx, range) != NST_OK) {
+                appctx->st1 = NST_DISK_APPLET_ERROR;
+
+                break;
+            }
+
+            appctx->st1 = NST_DISK_APPLET_PAYLOAD;
+        case NST_DISK_APPLET_PAYLOAD:
+
+            if(range && _nst_cache_range_to_htx(appctx, range, res_htx) != NST_OK) {
+                si_rx_room_blk(si);
+
+                goto out;
+            }
+
+            appctx->st1 = NST_DISK_APPLET_END;
+        case NST_DISK_APPLET_END:
+
+            if(!htx_add_endof(res_htx, HTX_BLK_EOM)) {
+                si_rx_room_blk(si);
+
+                goto out;
+            }
+
+            appctx->st1 = NST_DISK_APPLET_DONE;
+        case NST_DISK_APPLET_DONE:
+
+            if(!(res->flags & CF_SHUTR) ) {
+                res->flags |= CF_READ_NULL;
+                si_shutr(si);
+            }
+
+            /* eat the whole request */
+            if(co_data(req)) {
+                req_htx = htx_from_buf(&req->buf);
+                co_htx_skip(req, req_htx, co_data(req));
+                htx_to_buf(req_htx, &req->buf);
+            }
+
+            break;
+        case NST_DISK_APPLET_ERROR:
+            si_shutr(si);
+            res->flags |= CF_READ_NULL;
+
+            return;
+    }
+
+out:
+    total = res_htx->data - total;
+
+    if(total) {
+        channel_add_input(res, total);
+    }
+
+    htx_to_buf(res_htx, &res->buf);
+}
+
+/*
+ * The cache disk applet acts like the backend to send cached http data
+ */
+static void
+_nst_cache_disk_handler(hpx_appctx_t *appctx) {
+    hpx_stream_interface_t  *si  = appctx->owner;
+    hpx_channel_t           *req = si_oc(si);
+    hpx_channel_t           *res = si_ic(si);
+    hpx_htx_t               *req_htx, *res_htx;
+    hpx_htx_blk_type_t       type;
+    hpx_htx_blk_t           *blk;
+    char                    *p, *ptr;
+    uint64_t                 offset, payload_len;
+    uint32_t                 blksz, sz, info;
+    int                      total, ret, max, fd, header_len;
+    nst_http_range_t        *range;
+    nst_disk_aio_t          *aio;
+
+    range       = appctx->ctx.nuster.store.disk.range;
+    aio         = appctx->ctx.nuster.store.disk.aio;
+    header_len  = appctx->ctx.nuster.store.disk.header_len;
+    payload_len = appctx->ctx.nuster.store.disk.payload_len;
+    offset      = appctx->ctx.nuster.store.disk.offset;
+    fd          = appctx->ctx.nuster.store.disk.fd;
+    res_htx     = htxbuf(&res->buf);
+    total       = res_htx->data;
+
+    if(unlikely(si->state == SI_ST_DIS || si->state == SI_ST_CLO)) {
+        goto out;
+    }
+
+    /* Check if the input buffer is avalaible. */
+    if(res->buf.size == 0) {
+        si_rx_room_blk(si);
+
+        goto out;
+    }
+
+    /* check that the output is not closed */
+    if(res->flags & (CF_SHUTW|CF_SHUTR|CF_SHUTW_NOW)) {
+        appctx->st1 = NST_DISK_APPLET_DONE;
+    }
+
+    switch(appctx->st1) {
+        case NST_DISK_APPLET_HEADER:
+            ret = nst_disk_pread(aio, fd, &p, header_len, offset);
+
+            if(ret == NST_DISK_AIO_AGAIN) {
+                goto out;
+            }
+
+            if(ret != header_len) {
+                appctx->st1 = NST_DISK_APPLET_ERROR;
+
+                break;
+            }
+
+            while(header_len != 0) {
+                info  = *(uint32_t *)p;
+                type  = (info >> 28);
+                blksz = (info & 0xff) + ((info >> 8) & 0xfffff);
+                blk   = htx_add_blk(res_htx, type, blksz);
+
+                if(!blk) {
+                    appctx->st1 = NST_DISK_APPLET_ERROR;
+
+                    break;
+                }
+
+                blk->info = info;
+
+                ptr = htx_get_blk_ptr(res_htx, blk);
+                sz  = htx_get_blksz(blk);
+                p  += 4;
+                memcpy(ptr, p, sz);
+                p  += sz;
+
+                header_len -= 4 + sz;
+            }
+
+            appctx->st1 = NST_DISK_APPLET_PAYLOAD;
+            offset += ret;
+
+            appctx->ctx.nuster.store.disk.offset = offset;
+
+            if(range && nst_http_range_headers(res_htx, range) != NST_OK) {
+                appctx->st1 = NST_DISK_APPLET_ERROR;
+
+                break;
+            }
+
+            if(appctx->ctx.nuster.store.disk.head) {
+                appctx->st1 = NST_DISK_APPLET_END;
+
+                close(fd);
+
+                goto end;
+            }
+
+        case NST_DISK_APPLET_PAYLOAD:
+
+            /* trailers are not sent with ranges */
+            if(range) {
+                ret = _nst_cache_range_to_htx(appctx, range, res_htx);
+
+                if(ret == NST_DISK_AIO_AGAIN) {
+                    goto out;
+                }
+
+                if(ret != NST_OK) {
+
+                    if(appctx->st1 != NST_DISK_APPLET_ERROR) {
+                        si_rx_room_blk(si);
+                    }
+
+                    break;
+                }
+
+                appctx->st1 = NST_DISK_APPLET_END;
+
+                close(fd);
+
+                goto end;
+            }
+
+            max = htx_get_max_blksz(res_htx, channel_htx_recv_max(res, res_htx));
+
+            if(max <= 0) {
+                goto out;
+            }
+
+            if(max < payload_len) {
+                ret = nst_disk_pread(aio, fd, &p, max, offset);
+            } else {
+                ret = nst_disk_pread(aio, fd, &p, payload_len, offset);
+            }
+
+            if(ret == NST_DISK_AIO_AGAIN) {
+                goto out;
+            }
+
+            if(ret <= 0) {
+                appctx->st1 = NST_DISK_APPLET_ERROR;
+
+                break;
+            }
+
+            appctx->ctx.nuster.store.disk.payload_len -= ret;
+
+            type  = HTX_BLK_DATA;
+            info  = (type << 28) + ret;
+            blksz = info & 0xfffffff;
+            blk   = htx_add_blk(res_htx, type, blksz);
+
+            if(!blk) {
+                appctx->st1 = NST_DISK_APPLET_ERROR;
+
+                break;
+            }
+
+            blk->info = info;
+
+            ptr = htx_get_blk_ptr(res_htx, blk);
+            sz  = htx_get_blksz(blk);
+            memcpy(ptr, p, sz);
+
+            offset += ret;
+            appctx->ctx.nuster.store.disk.offset = offset;
+
+            if(appctx->ctx.nuster.store.disk.payload_len == 0) {
+                appctx->st1 = NST_DISK_APPLET_EOP;
+            } else {
+                si_rx_room_blk(si);
+
+                break;
+            }
+
+        case NST_DISK_APPLET_EOP:
+            max = htx_get_max_blksz(res_htx, channel_htx_recv_max(res, res_htx));
+
+            ret = nst_disk_pread(aio, fd, &p, max, offset);
+
+            if(ret == NST_DISK_AIO_AGAIN) {
+                goto out;
+            }
+
+            if(ret < 0) {
+                appctx->st1 = NST_DISK_APPLET_ERROR;
+
+                break;
+            }
+
+            if(ret > 0) {
+                max = ret;
+
+                while(max != 0) {
+                    info  = *(uint32_t *)p;
+                    type  = (info >> 28);
+                    blksz = (info & 0xff) + ((info >> 8) & 0xfffff);
+                    blk   = htx_add_blk(res_htx, type, blksz);
+
+                    if(!blk) {
+                        appctx->st1 = NST_DISK_APPLET_ERROR;
+
+                        break;
+                    }
+
+                    blk->info = info;
+
+                    ptr = htx_get_blk_ptr(res_htx, blk);
+                    sz  = htx_get_blksz(blk);
+                    p  += 4;
+                    memcpy(ptr, p, sz);
+                    p  += sz;
+
+                    max -= 4 + sz;
+                }
+
+                offset += ret;
+
+                appctx->ctx.nuster.store.disk.offset = offset;
+
+                break;
+            }
+
+            appctx->st1 = NST_DISK_APPLET_END;
+
+            close(fd);
+
+        case NST_DISK_APPLET_END:
+end:
+
+            if(!htx_add_endof(res_htx, HTX_BLK_EOM)) {
+                si_rx_room_blk(si);
+
+                goto out;
+            }
+
+            appctx->st1 = NST_DISK_APPLET_DONE;
+        case NST_DISK_APPLET_DONE:
+
+            if(!(res->flags & CF_SHUTR) ) {
+                res->flags |= CF_READ_NULL;
+                si_shutr(si);
+            }
+
+            if(co_data(req)) {
+                req_htx = htx_from_buf(&req->buf);
+                co_htx_skip(req, req_htx, co_data(req));
+                htx_to_buf(req_htx, &req->buf);
+            }
+
+            break;
+        case NST_DISK_APPLET_ERROR:
+            si_shutr(si);
+            res->flags |= CF_READ_NULL;
+            close(fd);
+
+            return;
+    }
+
+out:
+    total = res_htx->data - total;
+
+    if(total) {
+        channel_add_input(res, total);
+    }
+
+    htx_to_buf(res_htx, &res->buf);
+}
+
+/*
+ * The cache applet acts like the backend to send cached http data
+ */
+static void
+nst_cache_handler(hpx_appctx_t *appctx) {
+
+    if(appctx->st0 == NST_CTX_STATE_HIT_MEMORY) {
+
+        if(appctx->ctx.nuster.store.memory.range || appctx->ctx.nuster.store.memory.head) {
+            _nst_cache_memory_partial_handler(appctx);
+        } else if(appctx->ctx.nuster.store.memory.follow) {
+            _nst_cache_memory_follow_handler(appctx);
+        } else {
+            _nst_cache_memory_handler(appctx);
+        }
+    } else {
+        _nst_cache_disk_handler(appctx);
+    }
+}
+
+static void
+_nst_cache_release_handler(hpx_appctx_t *appctx) {
+
+    if(appctx->st0 == NST_CTX_STATE_HIT_MEMORY) {
+
+        if(appctx->ctx.nuster.store.memory.follow) {
+            nst_dict_t  *dict = &nuster.cache->dict;
+            uint64_t     hash = appctx->ctx.nuster.store.memory.hash;
+
+            nst_dict_lock(dict, hash);
+            LIST_DEL_INIT(&appctx->wait_entry);
+            nst_dict_unlock(dict, hash);
+        }
+
+        nst_memory_zstream_free(appctx->ctx.nuster.store.memory.zstream);
+        free(appctx->ctx.nuster.store.memory.range);
+
+        appctx->ctx.nuster.store.memory.zstream = NULL;
+        appctx->ctx.nuster.store.memory.range   = NULL;
+    } else {
+        free(appctx->ctx.nuster.store.disk.range);
+        nst_disk_aio_free(appctx->ctx.nuster.store.disk.aio);
+
+        appctx->ctx.nuster.store.disk.range = NULL;
+        appctx->ctx.nuster.store.disk.aio   = NULL;
+    }
+}
+
+/*
+ * The refresh-ahead applet acts like the client of an internal request, the
+ * response is stored by the cache filter of the stream and discarded here
+ */
+static void
+_nst_cache_refresh_handler(hpx_appctx_t *appctx) {
+    hpx_htx_t               *req_htx, *res_htx, *htx;
+    hpx_stream_interface_t  *si  = appctx->owner;
+    hpx_channel_t           *req = si_ic(si);
+    hpx_channel_t           *res = si_oc(si);
+    hpx_buffer_t            *buf = appctx->ctx.nuster.refresh.req;
+    hpx_htx_blk_t           *blk;
+    size_t                   left;
+    int                      total, pos;
+
+    if(unlikely(si->state == SI_ST_DIS || si->state == SI_ST_CLO)) {
+        return;
+    }
+
+    if(appctx->st0 == NST_CACHE_REFRESH_SEND) {
+
+        /* Check if the input buffer is avalaible. */
+        if(!b_size(&req->buf)) {
+            si_rx_room_blk(si);
+
+            return;
+        }
+
+        req_htx = htx_from_buf(&req->buf);
+        htx     = htxbuf(buf);
+        total   = req_htx->data;
+
+        htx_xfer_blks(req_htx, htx, channel_htx_recv_max(req, req_htx), HTX_BLK_UNUSED);
+
+        channel_add_input(req, req_htx->data - total);
+        htx_to_buf(req_htx, &req->buf);
+
+        if(!htx_is_empty(htx)) {
+            si_rx_room_blk(si);
+
+            return;
+        }
+
+        free_trash_chunk(buf);
+
+        appctx->ctx.nuster.refresh.req = NULL;
+        appctx->st0 = NST_CACHE_REFRESH_RECV;
+    }
+
+    if(appctx->st0 == NST_CACHE_REFRESH_RECV && co_data(res)) {
+        res_htx = htx_from_buf(&res->buf);
+        left    = co_data(res);
+
+        for(pos = htx_get_first(res_htx); pos != -1 && left; pos = htx_get_next(res_htx, pos)) {
+            blk = htx_get_blk(res_htx, pos);
+
+            if(htx_get_blk_type(blk) == HTX_BLK_EOM) {
+                appctx->st0 = NST_CACHE_REFRESH_DONE;
+            }
+
+            left -= MIN(left, htx_get_blksz(blk));
+        }
+
+        co_htx_skip(res, res_htx, co_data(res));
+        htx_to_buf(res_htx, &res->buf);
+    }
+
+    if(appctx->st0 == NST_CACHE_REFRESH_DONE || channel_input_closed(res)) {
+        si_shutw(si);
+        si_shutr(si);
+        req->flags |= CF_READ_NULL;
+    }
+}
+
+static void
+_nst_cache_refresh_release_handler(hpx_appctx_t *appctx) {
+    nst_key_t  *key = appctx->ctx.nuster.refresh.key;
+
+    if(appctx->ctx.nuster.refresh.req) {
+        free_trash_chunk(appctx->ctx.nuster.refresh.req);
+    }
+
+    if(key) {
+        free(key->data);
+        free(key);
+    }
+
+    appctx->ctx.nuster.refresh.req = NULL;
+    appctx->ctx.nuster.refresh.key = NULL;
+}
+
+static void
+_nst_cache_refresh_init() {
+    hpx_proxy_t      *fe = &_nst_cache_refresh_fe;
+    struct listener  *li = &_nst_cache_refresh_li;
+
+    init_new_proxy(fe);
+
+    fe->id             = "<NUSTER.CACHE.REFRESH>";
+    fe->cap            = PR_CAP_FE;
+    fe->mode           = PR_MODE_HTTP;
+    fe->options2      |= PR_O2_INDEPSTR;
+    fe->conn_retries   = CONN_RETRIES;
+    fe->accept         = frontend_accept;
+    fe->http_needed    = 1;
+    fe->timeout.client = TICK_ETERNITY;
+
+    _nst_cache_refresh_bind.frontend = fe;
+
+    li->bind_conf = &_nst_cache_refresh_bind;
+    li->options   = LI_O_UNLIMITED;
+}
+
+void
+nst_cache_housekeeping() {
+    nst_dict_t   *dict  = &nuster.cache->dict;
+    nst_store_t  *store = &nuster.cache->store;
+    uint64_t      begin = nst_time_now_ms();
+    uint64_t      start;
+
+    if(global.nuster.cache.status == NST_STATUS_ON && master == 1) {
+        int  dict_cleaner  = global.nuster.cache.dict_cleaner;
+        int  dict_rehasher = global.nuster.cache.dict_rehasher;
+        int  data_cleaner  = global.nuster.cache.data_cleaner;
+        int  disk_cleaner  = global.nuster.cache.disk_cleaner;
+        int  disk_loader   = global.nuster.cache.disk_loader;
+        int  disk_saver    = global.nuster.cache.disk_saver;
+        int  eviction      = global.nuster.cache.eviction;
+        int  compaction    = global.nuster.cache.compaction;
+        int  ms            = 10;
+        int  ratio         = 1;
+
+        nst_dict_reclaim(dict);
+
+        nst_memory_sketch_age(&store->memory);
+
+        start = nst_time_now_ms();
+
+        while(dict_rehasher-- && nst_dict_rehash(dict)) {
+
+            if(nst_time_now_ms() - start >= ms) {
+                break;
+            }
+        }
+
+        start = nst_time_now_ms();
+
+        while(dict_cleaner--) {
+            nst_dict_cleanup(dict);
+
+            if(nst_time_now_ms() - start >= ms) {
+                break;
+            }
+        }
+
+        if(eviction != NST_EVICTION_OFF) {
+            uint64_t  target  = nst_memory_evict_target(&store->memory);
+            uint64_t  evicted;
+
+            start = nst_time_now_ms();
+
+            while(target) {
+                evicted = nst_dict_evict(dict, eviction, target);
+                target  = evicted >= target ? 0 : target - evicted;
+
+                if(nst_time_now_ms() - start >= ms) {
+                    break;
+                }
+            }
+
+            store->memory.pressure = 0;
+        }
+
+        if(compaction == NST_STATUS_ON) {
+            start = nst_time_now_ms();
+
+            while(nst_dict_compact(dict)) {
+
+                if(nst_time_now_ms() - start >= ms) {
+                    break;
+                }
+            }
+        }
+
+        start = nst_time_now_ms();
+
+        while(nst_memory_precompress(&store->memory)) {
+
+            if(nst_time_now_ms() - start >= ms) {
+                break;
+            }
+        }
+
+        start = nst_time_now_ms();
+
+        if(data_cleaner > store->memory.count) {
+            data_cleaner = store->memory.count;
+        }
+
+        if(store->memory.count) {
+            ratio = store->memory.invalid * 10 / store->memory.count;
+        }
+
+        if(ratio >= 2) {
+            data_cleaner = store->memory.count;
+
+            ms = ms * ratio ;
+            ms = ms >= 100 ? 100 : ms;
+        }
+
+        while(data_cleaner--) {
+            nst_memory_cleanup(&store->memory);
+
+            if(nst_time_now_ms() - start >= ms) {
+                break;
+            }
+        }
+
+        start = nst_time_now_ms();
+        ms    = 10;
+
+        while(store->disk.loaded && disk_saver--) {
+            nst_store_memory_sync_disk(nuster.cache);
+
+            if(nst_time_now_ms() - start >= ms) {
+                break;
+            }
+        }
+
+        start = nst_time_now_ms();
+
+        while(store->disk.loaded && disk_cleaner--) {
+            nst_disk_cleanup(nuster.cache);
+
+            if(nst_time_now_ms() - start >= ms) {
+                break;
+            }
+        }
+
+        if(store->disk.loaded) {
+            nst_disk_checkpoint(nuster.cache);
+        }
+
+        while(!store->disk.loaded && disk_loader--) {
+            nst_disk_load(nuster.cache);
+
+            if(nst_time_now_ms() - begin >= 500) {
                 break;
             }
         }
@@ -413,6 +1080,7 @@ nst_cache_init() {
     nst_shmem_t  *shmem;
     uint64_t      dict_size, data_size, size;
     int           clean_temp;
+    int           i;
 
     root       = global.nuster.cache.root;
     dict_size  = global.nuster.cache.dict_size;
@@ -420,11 +1088,24 @@ nst_cache_init() {
     size       = dict_size + data_size;
     clean_temp = global.nuster.cache.clean_temp;
 
-    nuster.applet.cache.fct = nst_cache_handler;
+    nuster.applet.cache.fct     = nst_cache_handler;
+    nuster.applet.cache.release = _nst_cache_release_handler;
+
+    nuster.applet.refresh.fct     = _nst_cache_refresh_handler;
+    nuster.applet.refresh.release = _nst_cache_refresh_release_handler;
+
+    _nst_cache_refresh_init();
+
+    for(i = 0; i < NST_DICT_STRIPES; i++) {
+        LIST_INIT(&_nst_cache_waiters[i]);
+        LIST_INIT(&_nst_cache_followers[i]);
+    }
 
     if(global.nuster.cache.status == NST_STATUS_ON) {
 
-        shmem = nst_shmem_create("cache.shm", size, global.tune.bufsize, NST_DEFAULT_CHUNK_SIZE);
+        shmem = nst_shmem_create("cache.shm", size, global.tune.bufsize, NST_DEFAULT_CHUNK_SIZE,
+                global.nuster.cache.hugepages, global.nuster.cache.hugepages_dir,
+                global.nuster.cache.numa);
 
         if(!shmem) {
             ha_alert("Failed to create nuster cache memory zone.\n");
@@ -445,22 +1126,208 @@ nst_cache_init() {
             exit(1);
         }
 
-        memset(nuster.cache, 0, sizeof(*nuster.cache));
+        memset(nuster.cache, 0, sizeof(*nuster.cache));
+
+        nuster.cache->shmem = shmem;
+        nuster.cache->root  = root;
+
+        if(nst_store_init(&nuster.cache->store, root, shmem, clean_temp) != NST_OK) {
+            ha_alert("Failed to init nuster cache store.\n");
+            exit(1);
+        }
+
+        if(global.nuster.cache.disk_io != NST_DISK_IO_SYNC
+                && nst_disk_aio_init(&nuster.cache->store.disk, global.nuster.cache.disk_io,
+                    global.nuster.cache.disk_io_threads) != NST_OK) {
+
+            ha_alert("Failed to init nuster cache disk io.\n");
+            exit(1);
+        }
+
+        if(global.nuster.cache.disk_layout == NST_DISK_LAYOUT_SEGMENT
+                && nst_disk_segment_init(&nuster.cache->store.disk,
+                    global.nuster.cache.segment_size) != NST_OK) {
+
+            ha_alert("Failed to init nuster cache disk segments.\n");
+            exit(1);
+        }
+
+        if(nst_dict_init(&nuster.cache->dict, &nuster.cache->store, shmem, dict_size,
+                    global.nuster.cache.dict_layout, global.nuster.cache.dict_index) != NST_OK) {
+            ha_alert("Failed to init nuster cache dict.\n");
+            exit(1);
+        }
+
+        if(global.nuster.cache.admission == NST_STATUS_ON
+                && nst_memory_sketch_init(&nuster.cache->store.memory) != NST_OK) {
+
+            ha_alert("Failed to init nuster cache admission.\n");
+            exit(1);
+        }
+
+        if(nst_disk_index_init(nuster.cache, global.nuster.cache.disk_checkpoint) != NST_OK) {
+            ha_alert("Failed to init nuster cache disk index.\n");
+            exit(1);
+        }
+
+    }
+}
+
+/*
+ * Check if the response body can be encoded in memory: it is not encoded
+ * already, not too small and not in a format which is usually compressed
+ */
+static int
+_nst_cache_encodable(hpx_htx_t *htx) {
+    hpx_http_hdr_ctx_t  hdr = { .blk = NULL };
+    hpx_htx_sl_t       *sl  = http_get_stline(htx);
+    long long           len;
+
+    if(!sl || (sl->flags & HTX_SL_F_BODYLESS)) {
+        return 0;
+    }
+
+    if(http_find_header(htx, ist("Content-Encoding"), &hdr, 0)) {
+        return 0;
+    }
+
+    hdr.blk = NULL;
+    if(http_find_header(htx, ist("Content-Length"), &hdr, 0)) {
+
+        if(strl2llrc(hdr.value.ptr, hdr.value.len, &len) == 0 && len < NST_MEMORY_ENCODE_MIN) {
+            return 0;
+        }
+    }
+
+    hdr.blk = NULL;
+    while(http_find_header(htx, ist("Cache-Control"), &hdr, 0)) {
+
+        if(isteqi(hdr.value, ist("no-transform"))) {
+            return 0;
+        }
+    }
+
+    hdr.blk = NULL;
+    if(http_find_header(htx, ist("Content-Type"), &hdr, 1)) {
+
+        if(hdr.value.len >= 6 && (!strncasecmp(hdr.value.ptr, "image/", 6)
+                    || !strncasecmp(hdr.value.ptr, "audio/", 6)
+                    || !strncasecmp(hdr.value.ptr, "video/", 6))) {
+
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Flush the end of the encoded body to the memory object
+ */
+static void
+_nst_cache_encode_end(nst_ctx_t *ctx) {
+    nst_memory_t  *mem = &nuster.cache->store.memory;
+
+    if(!ctx->store.memory.zstream) {
+        return;
+    }
+
+    if(ctx->store.memory.obj) {
+
+        if(nst_memory_obj_deflate(mem, ctx->store.memory.obj, &ctx->store.memory.item,
+                    ctx->store.memory.zstream, NULL, 0, 1) != NST_OK) {
+
+            ctx->store.memory.obj = NULL;
+        }
+    }
+
+    nst_memory_zstream_free(ctx->store.memory.zstream);
+
+    ctx->store.memory.zstream = NULL;
+}
+
+/*
+ * Let the clients waiting for the entry follow the memory object from now on,
+ * the creator keeps a reference until the object is complete or invalid
+ */
+static void
+_nst_cache_fill_begin(nst_ctx_t *ctx) {
+    nst_dict_t        *dict = &nuster.cache->dict;
+    nst_memory_obj_t  *obj  = ctx->store.memory.obj;
+
+    obj->filling = 1;
+
+    nst_memory_obj_attach(&nuster.cache->store.memory, obj);
+
+    ctx->store.memory.filling = obj;
+
+    nst_dict_lock(dict, ctx->key->hash);
+
+    ctx->entry->store.memory.filling = obj;
+    ctx->entry->header_len           = ctx->txn.res.header_len;
+
+    nst_dict_unlock(dict, ctx->key->hash);
+}
+
+/*
+ * The memory object is complete or invalid, wake up its followers and drop
+ * the reference of the creator
+ */
+static void
+_nst_cache_fill_end(nst_ctx_t *ctx, int complete) {
+    nst_dict_t        *dict = &nuster.cache->dict;
+    nst_memory_obj_t  *obj  = ctx->store.memory.filling;
+
+    if(!obj) {
+        return;
+    }
+
+    nst_dict_lock(dict, ctx->key->hash);
+
+    if(ctx->entry->store.memory.filling == obj) {
+        ctx->entry->store.memory.filling = NULL;
+    }
+
+    obj->filling = complete ? 0 : -1;
+
+    nst_dict_unlock(dict, ctx->key->hash);
+
+    _nst_cache_follow_wake(ctx->key->hash, obj);
+
+    nst_memory_obj_detach(&nuster.cache->store.memory, obj);
+
+    ctx->store.memory.filling = NULL;
+}
+
+/*
+ * The response varies on request headers which are gone by now, so it is not
+ * cached. Instead record the vary list on a primary entry without data, later
+ * requests are served from variants, see nst_cache_exists.
+ */
+static void
+_nst_cache_create_primary(nst_ctx_t *ctx) {
+    nst_dict_t        *dict = &nuster.cache->dict;
+    nst_dict_entry_t  *entry;
+
+    nst_dict_lock(dict, ctx->key->hash);
 
-        nuster.cache->shmem = shmem;
-        nuster.cache->root  = root;
+    if(ctx->state == NST_CTX_STATE_UPDATE) {
+        /* the cached response did not vary */
+        ctx->entry->state = NST_DICT_ENTRY_STATE_INVALID;
+    } else if(!isteq(ctx->txn.res.vary, ist("*")) && !nst_dict_get(dict, ctx->key)) {
+        entry = nst_dict_set(dict, ctx->key, &ctx->txn, &ctx->rule->prop);
 
-        if(nst_store_init(&nuster.cache->store, root, shmem, clean_temp) != NST_OK) {
-            ha_alert("Failed to init nuster cache store.\n");
-            exit(1);
+        if(entry) {
+            entry->prop.stale = -1;
+            entry->ctime      = nst_time_now_ms();
+            entry->expire     = entry->prop.ttl ? entry->ctime / 1000 + entry->prop.ttl : 0;
+            entry->state      = NST_DICT_ENTRY_STATE_VALID;
         }
+    }
 
-        if(nst_dict_init(&nuster.cache->dict, &nuster.cache->store, shmem, dict_size) != NST_OK) {
-            ha_alert("Failed to init nuster cache dict.\n");
-            exit(1);
-        }
+    nst_dict_unlock(dict, ctx->key->hash);
 
-    }
+    ctx->state = NST_CTX_STATE_BYPASS;
 }
 
 void
@@ -474,14 +1341,31 @@ nst_cache_create(hpx_http_msg_t *msg, nst_ctx_t *ctx) {
     nst_disk_t         *disk;
     uint32_t            sz;
     int                 idx;
+    int                 admit = 1;
+    int                 vary  = 0;
 
     dict = &nuster.cache->dict;
     mem  = &nuster.cache->store.memory;
     disk = &nuster.cache->store.disk;
     htx  = htxbuf(&msg->chn->buf);
 
+    if((ctx->state == NST_CTX_STATE_CREATE || ctx->state == NST_CTX_STATE_UPDATE)
+            && ctx->txn.res.vary.len && !nst_key_vary(ctx->key)) {
+
+        _nst_cache_create_primary(ctx);
+    }
+
+    /* without admission to memory, only store on disk if any */
+    if(ctx->state == NST_CTX_STATE_CREATE && nst_store_memory_on(ctx->rule->prop.store)) {
+        admit = nst_memory_admit(mem, ctx->key->hash);
+
+        if(!admit && !nst_store_disk_on(ctx->rule->prop.store)) {
+            ctx->state = NST_CTX_STATE_BYPASS;
+        }
+    }
+
     if(ctx->state == NST_CTX_STATE_CREATE) {
-        nst_shctx_lock(dict);
+        nst_dict_lock(dict, ctx->key->hash);
 
         entry = nst_dict_get(dict, ctx->key);
 
@@ -500,15 +1384,31 @@ nst_cache_create(hpx_http_msg_t *msg, nst_ctx_t *ctx) {
             }
         }
 
-        nst_shctx_unlock(dict);
+        nst_dict_unlock(dict, ctx->key->hash);
     }
 
     /* init store data */
 
     if(ctx->state == NST_CTX_STATE_CREATE || ctx->state == NST_CTX_STATE_UPDATE) {
 
-        if(nst_store_memory_on(ctx->rule->prop.store)) {
+        if(nst_store_memory_on(ctx->rule->prop.store) && admit) {
             ctx->store.memory.obj = nst_memory_obj_create(mem);
+
+            if(ctx->store.memory.obj && ctx->rule->prop.compress != NST_MEMORY_ENCODING_IDENTITY
+                    && _nst_cache_encodable(htx)) {
+
+                ctx->store.memory.zstream = nst_memory_zstream_create(ctx->rule->prop.compress, 0);
+
+                if(ctx->store.memory.zstream) {
+                    ctx->store.memory.obj->encoding = ctx->rule->prop.compress;
+                }
+            }
+
+            if(ctx->store.memory.obj && ctx->rule->prop.precompress != NST_MEMORY_ENCODING_IDENTITY
+                    && _nst_cache_encodable(htx)) {
+
+                ctx->store.memory.obj->precompress = ctx->rule->prop.precompress;
+            }
         }
 
         if(nst_store_disk_on(ctx->rule->prop.store)) {
@@ -534,13 +1434,24 @@ nst_cache_create(hpx_http_msg_t *msg, nst_ctx_t *ctx) {
 
             ctx->txn.res.header_len += 4 + sz;
 
+            if(type == HTX_BLK_HDR && isteqi(htx_get_blk_name(htx, blk), ist("vary"))) {
+                vary = 1;
+            }
+
             if(nst_store_memory_on(ctx->rule->prop.store) && ctx->store.memory.obj) {
                 nst_memory_obj_t    *obj  = ctx->store.memory.obj;
                 nst_memory_item_t  **item = &ctx->store.memory.item;
                 char                *ptr  = htx_get_blk_ptr(htx, blk);
-                int                  ret;
+                int                  ret  = NST_OK;
 
-                ret = nst_memory_obj_append(mem, obj, item, ptr, sz, blk->info);
+                /* the encoded body varies with accept-encoding, memory only */
+                if(type == HTX_BLK_EOH && ctx->store.memory.zstream && !vary) {
+                    ret = nst_memory_obj_append_vary(mem, obj, item);
+                }
+
+                if(ret == NST_OK) {
+                    ret = nst_memory_obj_append(mem, obj, item, ptr, sz, blk->info);
+                }
 
                 if(ret == NST_ERR) {
                     ctx->store.memory.obj = NULL;
@@ -558,6 +1469,14 @@ nst_cache_create(hpx_http_msg_t *msg, nst_ctx_t *ctx) {
         }
     }
 
+    /* the headers are complete, the body can be followed within the process */
+    if(ctx->state == NST_CTX_STATE_CREATE && ctx->store.memory.obj
+            && ctx->store.memory.obj->encoding == NST_MEMORY_ENCODING_IDENTITY
+            && ctx->rule->prop.wait >= 0 && global.nbproc == 1) {
+
+        _nst_cache_fill_begin(ctx);
+    }
+
 err:
     return;
 }
@@ -604,12 +1523,43 @@ nst_cache_append(hpx_http_msg_t *msg, nst_ctx_t *ctx, unsigned int offset, unsig
             forward += data.len;
             len     -= data.len;
 
+            if(nst_store_memory_on(ctx->rule->prop.store) && ctx->store.memory.obj) {
+                nst_memory_obj_t      *obj  = ctx->store.memory.obj;
+                nst_memory_item_t    **item = &ctx->store.memory.item;
+                nst_memory_zstream_t  *z    = ctx->store.memory.zstream;
+                int                    ret;
+
+                if(z) {
+                    ret = nst_memory_obj_deflate(mem, obj, item, z, data.ptr, data.len, 0);
+                } else {
+                    ret = nst_memory_obj_append(mem, obj, item, data.ptr, data.len, info);
+                }
+
+                if(ret == NST_ERR) {
+                    ctx->store.memory.obj = NULL;
+                }
+            }
+
+            if(nst_store_disk_on(ctx->rule->prop.store) && ctx->store.disk.obj.file) {
+                nst_disk_obj_append(disk, &ctx->store.disk.obj, data.ptr, data.len);
+            }
+        }
+
+        if(type == HTX_BLK_TLR || type == HTX_BLK_EOT) {
+            uint32_t  sz = htx_get_blksz(blk);
+
+            forward += sz;
+            len     -= sz;
+
+            _nst_cache_encode_end(ctx);
+
             if(nst_store_memory_on(ctx->rule->prop.store) && ctx->store.memory.obj) {
                 nst_memory_obj_t    *obj  = ctx->store.memory.obj;
                 nst_memory_item_t  **item = &ctx->store.memory.item;
+                char                *ptr  = htx_get_blk_ptr(htx, blk);
                 int                  ret;
 
-                ret = nst_memory_obj_append(mem, obj, item, data.ptr, data.len, info);
+                ret = nst_memory_obj_append(mem, obj, item, ptr, sz, blk->info);
 
                 if(ret == NST_ERR) {
                     ctx->store.memory.obj = NULL;
@@ -617,112 +1567,472 @@ nst_cache_append(hpx_http_msg_t *msg, nst_ctx_t *ctx, unsigned int offset, unsig
             }
 
             if(nst_store_disk_on(ctx->rule->prop.store) && ctx->store.disk.obj.file) {
-                nst_disk_obj_append(disk, &ctx->store.disk.obj, data.ptr, data.len);
+                nst_disk_obj_append(disk, &ctx->store.disk.obj, (char *)&blk->info, 4);
+                nst_disk_obj_append(disk, &ctx->store.disk.obj, htx_get_blk_ptr(htx, blk), sz);
+            }
+        }
+
+        if(type == HTX_BLK_EOM) {
+            uint32_t  sz = htx_get_blksz(blk);
+
+            forward += sz;
+            len     -= sz;
+        }
+
+        offset = 0;
+
+    }
+
+    if(ctx->store.memory.filling) {
+
+        if(!ctx->store.memory.obj) {
+            _nst_cache_fill_end(ctx, 0);
+        } else {
+            /* pairs with the barrier of nst_cache_exists setting followed */
+            __sync_synchronize();
+
+            if(ctx->store.memory.filling->followed) {
+                _nst_cache_follow_wake(ctx->key->hash, ctx->store.memory.filling);
+            }
+        }
+    }
+
+    return forward;
+}
+
+/*
+ * Wake up the streams parked on key hash, the entry has left INIT state
+ */
+static void
+_nst_cache_wake(uint64_t hash) {
+    nst_dict_t  *dict = &nuster.cache->dict;
+    nst_ctx_t   *ctx, *back;
+
+    nst_dict_lock(dict, hash);
+
+    list_for_each_entry_safe(ctx, back, &_nst_cache_waiters[hash & (NST_DICT_STRIPES - 1)],
+            wait.list) {
+
+        if(ctx->wait.hash == hash) {
+            LIST_DEL_INIT(&ctx->wait.list);
+            task_wakeup(ctx->wait.task, TASK_WOKEN_MSG);
+        }
+    }
+
+    nst_dict_unlock(dict, hash);
+}
+
+/*
+ * cache done
+ */
+int
+nst_cache_finish(nst_ctx_t *ctx) {
+    nst_dict_t        *dict  = &nuster.cache->dict;
+    nst_disk_t        *disk  = &nuster.cache->store.disk;
+    nst_dict_entry_t  *entry = ctx->entry;
+
+    ctx->state = NST_CTX_STATE_DONE;
+
+    entry->ctime = nst_time_now_ms();
+
+    if(entry->prop.ttl == 0) {
+        entry->expire = 0;
+    } else {
+        entry->expire = entry->ctime / 1000 + entry->prop.ttl;
+    }
+
+    entry->header_len  = ctx->txn.res.header_len;
+    entry->payload_len = ctx->txn.res.payload_len;
+
+    _nst_cache_encode_end(ctx);
+
+    if(nst_store_memory_on(ctx->rule->prop.store) && ctx->store.memory.obj) {
+
+        if(ctx->store.memory.obj->encoding != NST_MEMORY_ENCODING_IDENTITY) {
+            nst_memory_incr_encoded(&nuster.cache->store.memory, ctx->txn.res.payload_len,
+                    ctx->store.memory.obj->length);
+        }
+
+        nst_dict_lock(dict, ctx->key->hash);
+
+        /* followers may be reading the last extent, nobody can follow anymore */
+        if(!ctx->store.memory.obj->followed) {
+            nst_memory_obj_finish(&nuster.cache->store.memory, ctx->store.memory.obj,
+                    &ctx->store.memory.item);
+        }
+
+        entry->store.memory.filling = NULL;
+
+        if(entry && entry->state != NST_DICT_ENTRY_STATE_INVALID && entry->store.memory.obj) {
+            entry->store.memory.obj->invalid = 1;
+
+            nst_memory_incr_invalid(&nuster.cache->store.memory);
+        }
+
+        entry->state = NST_DICT_ENTRY_STATE_VALID;
+        entry->store.memory.obj = ctx->store.memory.obj;
+
+        nst_dict_unlock(dict, ctx->key->hash);
+    }
+
+    if(nst_store_disk_on(ctx->rule->prop.store) && ctx->store.disk.obj.file) {
+        nst_disk_obj_t  *obj  = &ctx->store.disk.obj;
+
+        if(nst_disk_obj_finish(disk, obj, ctx->key, &ctx->txn, entry->expire) == NST_OK) {
+            nst_dict_lock(dict, ctx->key->hash);
+
+            nst_disk_obj_replace(disk, obj, entry->store.disk.file, entry->store.disk.base);
+
+            entry->state = NST_DICT_ENTRY_STATE_VALID;
+            entry->store.disk.file = obj->file;
+            entry->store.disk.base = obj->base;
+
+            nst_disk_journal(disk, entry, 0);
+
+            nst_dict_unlock(dict, ctx->key->hash);
+        }
+    }
+
+    if(entry->state != NST_DICT_ENTRY_STATE_VALID) {
+        entry->state = NST_DICT_ENTRY_STATE_INVALID;
+    }
+
+    _nst_cache_fill_end(ctx, entry->state == NST_DICT_ENTRY_STATE_VALID);
+
+    _nst_cache_wake(ctx->key->hash);
+
+    return entry->state == NST_DICT_ENTRY_STATE_VALID ? NST_OK : NST_ERR;
+}
+
+/*
+ * Copy the request headers of htx into buf as a bodyless GET, leaving out the
+ * conditional and range headers so that the full response is fetched
+ */
+static int
+_nst_cache_refresh_request(hpx_htx_t *htx, hpx_buffer_t *buf) {
+    hpx_htx_sl_t   *sl, *refresh_sl;
+    hpx_htx_blk_t  *blk;
+    hpx_htx_t      *refresh_htx;
+    hpx_ist_t       n, v;
+    unsigned int    flags;
+    int             pos, i, skip;
+
+    sl          = http_get_stline(htx);
+    refresh_htx = htx_from_buf(buf);
+
+    if(!sl) {
+        return NST_ERR;
+    }
+
+    flags  = sl->flags & ~(HTX_SL_F_XFER_ENC | HTX_SL_F_CLEN | HTX_SL_F_CHNK);
+    flags |= HTX_SL_F_XFER_LEN | HTX_SL_F_BODYLESS;
+
+    refresh_sl = htx_add_stline(refresh_htx, HTX_BLK_REQ_SL, flags, ist("GET"),
+            htx_sl_req_uri(sl), htx_sl_req_vsn(sl));
+
+    if(!refresh_sl) {
+        return NST_ERR;
+    }
+
+    refresh_sl->info.req.meth = HTTP_METH_GET;
+
+    for(pos = htx_get_first(htx); pos != -1; pos = htx_get_next(htx, pos)) {
+        blk = htx_get_blk(htx, pos);
+
+        if(htx_get_blk_type(blk) == HTX_BLK_EOH) {
+            break;
+        }
+
+        if(htx_get_blk_type(blk) != HTX_BLK_HDR) {
+            continue;
+        }
+
+        n    = htx_get_blk_name(htx, blk);
+        v    = htx_get_blk_value(htx, blk);
+        skip = 0;
+
+        for(i = 0; i < sizeof(_nst_cache_refresh_skip) / sizeof(hpx_ist_t); i++) {
+
+            if(isteqi(n, _nst_cache_refresh_skip[i])) {
+                skip = 1;
+
+                break;
             }
         }
 
-        if(type == HTX_BLK_TLR || type == HTX_BLK_EOT) {
-            uint32_t  sz = htx_get_blksz(blk);
+        if(!skip && !htx_add_header(refresh_htx, n, v)) {
+            return NST_ERR;
+        }
+    }
+
+    if(!htx_add_endof(refresh_htx, HTX_BLK_EOH) || !htx_add_endof(refresh_htx, HTX_BLK_EOM)) {
+        return NST_ERR;
+    }
+
+    htx_to_buf(refresh_htx, buf);
+
+    return NST_OK;
+}
+
+/*
+ * Make the GET of s which updates entry conditional on the stored ETag and
+ * Last-Modified, unless the client sent validators of its own, so that an
+ * unchanged object only costs a 304, see nst_cache_revalidate.
+ * return 1 if the request is conditional, 0 otherwise
+ */
+static int
+_nst_cache_conditional(hpx_stream_t *s, nst_dict_entry_t *entry) {
+    hpx_htx_t           *htx = htxbuf(&s->req.buf);
+    hpx_http_hdr_ctx_t   hdr = { .blk = NULL };
+
+    if(s->txn->meth != HTTP_METH_GET) {
+        return 0;
+    }
+
+    if(!entry->store.memory.obj && !entry->store.disk.file) {
+        return 0;
+    }
+
+    if(!entry->etag.len && !entry->last_modified.len) {
+        return 0;
+    }
+
+    if(http_find_header(htx, ist("If-None-Match"), &hdr, 0)) {
+        return 0;
+    }
+
+    hdr.blk = NULL;
+
+    if(http_find_header(htx, ist("If-Modified-Since"), &hdr, 0)) {
+        return 0;
+    }
+
+    if(entry->etag.len && !http_add_header(htx, ist("If-None-Match"), entry->etag)) {
+        return 0;
+    }
+
+    if(entry->last_modified.len
+            && !http_add_header(htx, ist("If-Modified-Since"), entry->last_modified)) {
+
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * An entry is refreshed in the background by the first GET which hits it
+ * once it passed refresh-ahead percent of its ttl, or once it expired with
+ * use-stale on. A failed refresh is retried after NST_CACHE_REFRESH_RETRY,
+ * in the meantime the entry stays valid.
+ * return 1 if the caller has to refresh the entry, 0 otherwise
+ */
+static int
+_nst_cache_refresh_due(hpx_stream_t *s, nst_ctx_t *ctx, nst_dict_entry_t *entry) {
+    uint64_t  now, due, last;
+
+    if(s->txn->meth != HTTP_METH_GET) {
+        return 0;
+    }
+
+    now = nst_time_now_ms();
+
+    if(entry->state == NST_DICT_ENTRY_STATE_VALID) {
+
+        /* the age of an entry loaded from disk is unknown */
+        if(!ctx->rule->prop.refresh_ahead || !entry->ctime
+                || entry->expire * 1000 <= entry->ctime) {
+
+            return 0;
+        }
+
+        due = entry->ctime
+            + (entry->expire * 1000 - entry->ctime) * ctx->rule->prop.refresh_ahead / 100;
+
+        if(now < due) {
+            return 0;
+        }
+
+    } else if(entry->state != NST_DICT_ENTRY_STATE_REFRESH || entry->prop.stale != 0) {
+        return 0;
+    }
+
+    last = entry->refresh;
+
+    if(now < last + NST_CACHE_REFRESH_RETRY) {
+        return 0;
+    }
+
+    return __sync_bool_compare_and_swap(&entry->refresh, last, now);
+}
+
+/*
+ * Refresh the entry of ctx in the background: an applet sends a copy of the
+ * request of s through the backend of s, the cache filter of this internal
+ * stream updates the entry, see nst_cache_refreshing, while the clients are
+ * still served from the entry.
+ */
+static void
+_nst_cache_refresh(hpx_stream_t *s, nst_ctx_t *ctx) {
+    hpx_proxy_t      *fe = &_nst_cache_refresh_fe;
+    struct listener  *li = &_nst_cache_refresh_li;
+    hpx_appctx_t     *appctx;
+    hpx_session_t    *sess;
+    hpx_stream_t     *strm;
+    hpx_buffer_t     *req;
+    nst_key_t        *key;
+
+    req = alloc_trash_chunk();
+    key = malloc(sizeof(nst_key_t));
+
+    if(!req || !key) {
+        goto err;
+    }
+
+    *key = *ctx->key;
+
+    nst_key_reset_flag(key);
+
+    key->data = malloc(key->size);
+
+    if(!key->data) {
+        goto err;
+    }
+
+    memcpy(key->data, ctx->key->data, key->size);
+
+    if(_nst_cache_refresh_request(htxbuf(&s->req.buf), req) != NST_OK) {
+        goto err_key;
+    }
+
+    appctx = appctx_new(&nuster.applet.refresh, tid_bit);
+
+    if(!appctx) {
+        goto err_key;
+    }
+
+    appctx->st0 = NST_CACHE_REFRESH_SEND;
+
+    appctx->ctx.nuster.refresh.req  = req;
+    appctx->ctx.nuster.refresh.rule = ctx->rule;
+    appctx->ctx.nuster.refresh.key  = key;
+
+    sess = session_new(fe, li, &appctx->obj_type);
+
+    if(!sess) {
+        goto err_appctx;
+    }
+
+    /* released by session_free */
+    _HA_ATOMIC_ADD(&fe->feconn, 1);
+    _HA_ATOMIC_ADD(&li->nbconn, 1);
+    _HA_ATOMIC_ADD(&li->thr_conn[tid], 1);
 
-            forward += sz;
-            len     -= sz;
+    strm = stream_new(sess, &appctx->obj_type);
 
-            if(nst_store_memory_on(ctx->rule->prop.store) && ctx->store.memory.obj) {
-                nst_memory_obj_t    *obj  = ctx->store.memory.obj;
-                nst_memory_item_t  **item = &ctx->store.memory.item;
-                char                *ptr  = htx_get_blk_ptr(htx, blk);
-                int                  ret;
+    if(!strm) {
+        goto err_sess;
+    }
 
-                ret = nst_memory_obj_append(mem, obj, item, ptr, sz, blk->info);
+    stream_set_backend(strm, s->be);
 
-                if(ret == NST_ERR) {
-                    ctx->store.memory.obj = NULL;
-                }
-            }
+    strm->do_log     = NULL;
+    strm->res.flags |= CF_READ_DONTWAIT;
 
-            if(nst_store_disk_on(ctx->rule->prop.store) && ctx->store.disk.obj.file) {
-                nst_disk_obj_append(disk, &ctx->store.disk.obj, (char *)&blk->info, 4);
-                nst_disk_obj_append(disk, &ctx->store.disk.obj, htx_get_blk_ptr(htx, blk), sz);
-            }
-        }
+    appctx_wakeup(appctx);
+    task_wakeup(strm->task, TASK_WOKEN_INIT);
 
-        if(type == HTX_BLK_EOM) {
-            uint32_t  sz = htx_get_blksz(blk);
+    nst_debug(s, "[cache] Refresh ahead");
 
-            forward += sz;
-            len     -= sz;
-        }
+    return;
 
-        offset = 0;
+err_sess:
+    session_free(sess);
+err_appctx:
+    appctx_free(appctx);
+err_key:
+    free(key->data);
+err:
+    free(key);
 
+    if(req) {
+        free_trash_chunk(req);
     }
-
-    return forward;
 }
 
 /*
- * cache done
+ * Memory hit without taking the dict lock, the memory object is attached.
+ * return 1 if hit, 0 otherwise
  */
-int
-nst_cache_finish(nst_ctx_t *ctx) {
-    nst_dict_t        *dict  = &nuster.cache->dict;
-    nst_disk_t        *disk  = &nuster.cache->store.disk;
-    nst_dict_entry_t  *entry = ctx->entry;
-
-    ctx->state = NST_CTX_STATE_DONE;
-
-    entry->ctime = nst_time_now_ms();
+static int
+_nst_cache_exists_lockless(hpx_stream_t *s, nst_ctx_t *ctx) {
+    nst_dict_entry_t  *entry;
+    nst_dict_t        *dict    = &nuster.cache->dict;
+    int                refresh = 0;
+    unsigned int       epoch;
 
-    if(entry->prop.ttl == 0) {
-        entry->expire = 0;
-    } else {
-        entry->expire = entry->ctime / 1000 + entry->prop.ttl;
-    }
+    epoch = nst_dict_read_begin(dict);
 
-    entry->header_len  = ctx->txn.res.header_len;
-    entry->payload_len = ctx->txn.res.payload_len;
+    entry = nst_dict_get_lockless(dict, ctx->key, &ctx->store.memory.obj);
 
-    if(nst_store_memory_on(ctx->rule->prop.store) && ctx->store.memory.obj) {
-        nst_shctx_lock(dict);
+    if(entry) {
+        ctx->txn.res.header_len    = entry->header_len;
+        ctx->txn.res.payload_len   = entry->payload_len;
+        ctx->txn.res.etag          = entry->etag;
+        ctx->txn.res.last_modified = entry->last_modified;
+        ctx->prop                  = &entry->prop;
 
-        if(entry && entry->state != NST_DICT_ENTRY_STATE_INVALID && entry->store.memory.obj) {
-            entry->store.memory.obj->invalid = 1;
+        nst_dict_record_access(entry);
 
-            nst_memory_incr_invalid(&nuster.cache->store.memory);
-        }
+        refresh = _nst_cache_refresh_due(s, ctx, entry);
+    }
 
-        entry->state = NST_DICT_ENTRY_STATE_VALID;
-        entry->store.memory.obj = ctx->store.memory.obj;
+    nst_dict_read_end(dict, epoch);
 
-        nst_shctx_unlock(dict);
+    if(refresh) {
+        ctx->refresh_due = 1;
     }
 
-    if(nst_store_disk_on(ctx->rule->prop.store) && ctx->store.disk.obj.file) {
-        nst_disk_obj_t  *obj  = &ctx->store.disk.obj;
+    return entry != NULL;
+}
 
-        if(nst_disk_obj_finish(disk, obj, ctx->key, &ctx->txn, entry->expire) == NST_OK) {
-            entry->state = NST_DICT_ENTRY_STATE_VALID;
-            entry->store.disk.file = ctx->store.disk.obj.file;
-        }
+/*
+ * Open and check the disk file of ctx, or find it by key if exists is set.
+ * With disk-io threads or uring it is done async and s is woken up once done.
+ * return NST_OK, NST_ERR, or NST_DISK_AIO_AGAIN
+ */
+static int
+_nst_cache_disk_valid(hpx_stream_t *s, nst_ctx_t *ctx, int exists) {
+    nst_disk_t      *disk = &nuster.cache->store.disk;
+    nst_disk_obj_t  *obj  = &ctx->store.disk.obj;
+
+    if(!ctx->store.disk.aio) {
+        ctx->store.disk.aio = nst_disk_aio_new(disk, s->task);
     }
 
-    if(entry->state != NST_DICT_ENTRY_STATE_VALID) {
-        entry->state = NST_DICT_ENTRY_STATE_INVALID;
+    if(!ctx->store.disk.aio) {
+        return exists ? nst_disk_obj_exists(disk, obj, ctx->key) : nst_disk_obj_valid(obj, ctx->key);
+    }
 
-        return NST_ERR;
+    if(exists) {
+        return nst_disk_aio_obj_exists(disk, ctx->store.disk.aio, obj, ctx->key);
     }
 
-    return NST_OK;
+    return nst_disk_aio_obj_valid(ctx->store.disk.aio, obj, ctx->key);
 }
 
 /*
- * Check if valid cache exists
+ * Check if valid cache exists, a primary entry redirects to the variant
+ * matching the request headers listed in its vary.
  */
 int
-nst_cache_exists(nst_ctx_t *ctx) {
-    nst_dict_entry_t  *entry = NULL;
-    nst_dict_t        *dict  = &nuster.cache->dict;
-    nst_disk_t        *disk  = &nuster.cache->store.disk;
+nst_cache_exists(hpx_stream_t *s, nst_ctx_t *ctx) {
+    nst_dict_entry_t  *entry   = NULL;
+    nst_dict_t        *dict    = &nuster.cache->dict;
+    nst_disk_t        *disk    = &nuster.cache->store.disk;
+    hpx_ist_t          vary    = IST_NULL;
+    int                refresh = 0;
+    int                stale   = 0;
     int                ret;
 
     ret = NST_CTX_STATE_INIT;
@@ -734,24 +2044,49 @@ nst_cache_exists(nst_ctx_t *ctx) {
     if(!nst_key_memory_checked(ctx->key)) {
         nst_key_memory_set_checked(ctx->key);
 
-        nst_shctx_lock(dict);
+        if(_nst_cache_exists_lockless(s, ctx)) {
+            return NST_CTX_STATE_HIT_MEMORY;
+        }
+
+        nst_dict_lock(dict, ctx->key->hash);
 
         entry = nst_dict_get(dict, ctx->key);
 
+        if(entry && entry->vary.len && entry->state == NST_DICT_ENTRY_STATE_VALID) {
+            vary = ist2(ctx->buf->area + ctx->buf->data, entry->vary.len);
+
+            if(!chunk_istcat(ctx->buf, entry->vary)) {
+                vary = IST_NULL;
+            }
+
+            nst_dict_record_access(entry);
+
+            entry = NULL;
+        }
+
         if(entry) {
 
+            /* with use-stale on, an expired GET is served stale and updated in the background */
+            stale = entry->state == NST_DICT_ENTRY_STATE_REFRESH
+                && entry->prop.stale == 0
+                && s->txn->meth == HTTP_METH_GET
+                && (entry->store.memory.obj || entry->store.disk.file);
+
             if(entry->state == NST_DICT_ENTRY_STATE_VALID
                     || entry->state == NST_DICT_ENTRY_STATE_UPDATE
-                    || entry->state == NST_DICT_ENTRY_STATE_STALE) {
+                    || entry->state == NST_DICT_ENTRY_STATE_STALE
+                    || stale) {
 
                 if(entry->store.memory.obj) {
                     ret = NST_CTX_STATE_HIT_MEMORY;
 
                     ctx->store.memory.obj = entry->store.memory.obj;
+                    nst_memory_obj_attach(&nuster.cache->store.memory, ctx->store.memory.obj);
                 } else if(entry->store.disk.file) {
                     ret = NST_CTX_STATE_HIT_DISK;
 
                     ctx->store.disk.obj.file = entry->store.disk.file;
+                    ctx->store.disk.obj.base = entry->store.disk.base;
                 }
 
                 ctx->txn.res.header_len    = entry->header_len;
@@ -761,6 +2096,8 @@ nst_cache_exists(nst_ctx_t *ctx) {
                 ctx->prop                  = &entry->prop;
 
                 nst_dict_record_access(entry);
+
+                refresh = _nst_cache_refresh_due(s, ctx, entry);
             }
 
             if(entry->state == NST_DICT_ENTRY_STATE_INIT) {
@@ -769,17 +2106,50 @@ nst_cache_exists(nst_ctx_t *ctx) {
                 ctx->prop = &entry->prop;
             }
 
-            if(entry->state == NST_DICT_ENTRY_STATE_REFRESH) {
+            /* instead of waiting, follow the memory object being created */
+            if(entry->state == NST_DICT_ENTRY_STATE_INIT && entry->store.memory.filling) {
+                ret = NST_CTX_STATE_HIT_MEMORY;
+
+                ctx->store.memory.obj      = entry->store.memory.filling;
+                ctx->store.memory.follow   = 1;
+                ctx->txn.res.header_len    = entry->header_len;
+                ctx->txn.res.etag          = entry->etag;
+                ctx->txn.res.last_modified = entry->last_modified;
+
+                nst_memory_obj_attach(&nuster.cache->store.memory, ctx->store.memory.obj);
+
+                ctx->store.memory.obj->followed = 1;
+
+                __sync_synchronize();
+            }
+
+            /* a HEAD request looked up with the key of GET leaves it to GET */
+            if(entry->state == NST_DICT_ENTRY_STATE_REFRESH && !stale
+                    && !(s->txn->meth == HTTP_METH_HEAD && ctx->rule->key->head == NST_STATUS_ON)) {
+
                 ret = NST_CTX_STATE_UPDATE;
 
                 entry->state = NST_DICT_ENTRY_STATE_UPDATE;
                 ctx->entry   = entry;
                 ctx->prop    = &entry->prop;
+
+                ctx->conditional = _nst_cache_conditional(s, entry);
             }
 
         }
 
-        nst_shctx_unlock(dict);
+        nst_dict_unlock(dict, ctx->key->hash);
+
+        if(refresh) {
+            ctx->refresh_due = 1;
+        }
+
+        if(vary.len && !nst_key_vary(ctx->key)) {
+
+            if(nst_key_build_vary(s, ctx->key, vary) == NST_OK) {
+                return nst_cache_exists(s, ctx);
+            }
+        }
     }
 
     if(ret == NST_CTX_STATE_INIT) {
@@ -803,8 +2173,13 @@ nst_cache_exists(nst_ctx_t *ctx) {
             nst_key_disk_set_checked(ctx->key);
 
             if(ctx->store.disk.obj.file) {
+                int  valid = _nst_cache_disk_valid(s, ctx, 0);
+
+                if(valid == NST_DISK_AIO_AGAIN) {
+                    return NST_CTX_STATE_WAIT_DISK;
+                }
 
-                if(nst_disk_obj_valid(&ctx->store.disk.obj, ctx->key) != NST_OK) {
+                if(valid != NST_OK) {
 
                     ret = NST_CTX_STATE_INIT;
 
@@ -839,11 +2214,16 @@ nst_cache_exists(nst_ctx_t *ctx) {
     if(ret == NST_CTX_STATE_CHECK_DISK) {
 
         if(!nst_key_disk_checked(ctx->key)) {
-            nst_disk_obj_t  *obj = &ctx->store.disk.obj;
+            nst_disk_obj_t  *obj    = &ctx->store.disk.obj;
+            int              exists = _nst_cache_disk_valid(s, ctx, 1);
 
             nst_key_disk_set_checked(ctx->key);
 
-            if(nst_disk_obj_exists(disk, obj, ctx->key) == NST_OK) {
+            if(exists == NST_DISK_AIO_AGAIN) {
+                return NST_CTX_STATE_WAIT_DISK;
+            }
+
+            if(exists == NST_OK) {
                 char *meta      = ctx->store.disk.obj.meta;
                 int  stale_prop = nst_disk_meta_get_stale(meta);
                 int  stale      = nst_disk_meta_check_stale(meta) != NST_OK;
@@ -909,9 +2289,276 @@ nst_cache_abort(nst_ctx_t *ctx) {
         entry->state = NST_DICT_ENTRY_STATE_INVALID;
     }
 
+    /* the entry refreshed ahead is still valid */
     if(entry->state == NST_DICT_ENTRY_STATE_UPDATE) {
+
+        if(ctx->refresh && !nst_dict_entry_expired(entry)) {
+            entry->state = NST_DICT_ENTRY_STATE_VALID;
+        } else {
+            entry->state = NST_DICT_ENTRY_STATE_STALE;
+        }
+    }
+
+    _nst_cache_fill_end(ctx, 0);
+
+    _nst_cache_wake(ctx->key->hash);
+}
+
+/*
+ * The backend answered 304 to the conditional update, the stored object is
+ * kept as is and only its expire is renewed.
+ */
+void
+nst_cache_revalidate(nst_ctx_t *ctx) {
+    nst_dict_t        *dict  = &nuster.cache->dict;
+    nst_dict_entry_t  *entry = ctx->entry;
+
+    ctx->state = NST_CTX_STATE_DONE;
+
+    nst_dict_lock(dict, ctx->key->hash);
+
+    if(entry->state == NST_DICT_ENTRY_STATE_UPDATE
+            && (entry->store.memory.obj || entry->store.disk.file)) {
+
+        entry->ctime  = nst_time_now_ms();
+        entry->expire = entry->prop.ttl ? entry->ctime / 1000 + entry->prop.ttl : 0;
+        entry->state  = NST_DICT_ENTRY_STATE_VALID;
+
+        if(entry->store.disk.file) {
+            nst_disk_update_expire(entry->store.disk.file, entry->store.disk.base, entry->expire);
+            nst_disk_journal(&nuster.cache->store.disk, entry, 0);
+        }
+    } else if(entry->state == NST_DICT_ENTRY_STATE_UPDATE) {
         entry->state = NST_DICT_ENTRY_STATE_STALE;
     }
+
+    nst_dict_unlock(dict, ctx->key->hash);
+
+    _nst_cache_wake(ctx->key->hash);
+}
+
+/*
+ * The client did not ask for the 304 the backend answered to its revalidated
+ * update, so it is served from the stored object instead, as a hit. Like a L7
+ * retry, the response is dropped and the server released, then the stream is
+ * connected to the cache applet, whose response is analysed again. Range and
+ * Accept-Encoding are not honoured as the request is already sent. If the
+ * object is gone in the meantime, a 503 is sent.
+ * return 0 while the object is read or served, 1 if the 503 is sent
+ */
+int
+nst_cache_revalidated(hpx_stream_t *s, nst_ctx_t *ctx) {
+    hpx_stream_interface_t  *si  = &s->si[1];
+    hpx_channel_t           *req = &s->req;
+    hpx_channel_t           *res = &s->res;
+    struct server           *srv = objt_server(s->target);
+
+    nst_key_reset_flag(ctx->key);
+
+    ctx->state = nst_cache_exists(s, ctx);
+
+    ctx->refresh_due = 0;
+
+    if(ctx->state == NST_CTX_STATE_WAIT_DISK) {
+        return 0;
+    }
+
+    if(ctx->state != NST_CTX_STATE_HIT_MEMORY && ctx->state != NST_CTX_STATE_HIT_DISK) {
+        goto err;
+    }
+
+    req->flags &= ~(CF_WRITE_ERROR | CF_WRITE_TIMEOUT | CF_SHUTW | CF_SHUTW_NOW);
+    res->flags &= ~(CF_READ_ERROR | CF_READ_TIMEOUT | CF_SHUTR | CF_EOI | CF_READ_NULL
+            | CF_SHUTR_NOW);
+
+    res->analysers  &= AN_RES_FLT_END;
+    res->rex         = TICK_ETERNITY;
+    res->to_forward  = 0;
+    res->analyse_exp = TICK_ETERNITY;
+    res->total       = 0;
+
+    si->flags &= ~(SI_FL_ERR | SI_FL_EXP | SI_FL_RXBLK_SHUT);
+    si->exp    = TICK_ETERNITY;
+
+    if(srv) {
+
+        if(s->flags & SF_CURR_SESS) {
+            s->flags &= ~SF_CURR_SESS;
+            _HA_ATOMIC_SUB(&srv->cur_sess, 1);
+        }
+
+        sess_change_server(s, NULL);
+
+        if(may_dequeue_tasks(srv, s->be)) {
+            process_srv_queue(srv);
+        }
+    }
+
+    s->flags &= ~(SF_DIRECT | SF_ASSIGNED | SF_ADDR_SET | SF_ERR_SRVTO | SF_ERR_SRVCL);
+
+    si_release_endpoint(si);
+
+    b_reset(&res->buf);
+    co_set_data(res, 0);
+
+    s->txn->rsp.flags     = 0;
+    s->txn->rsp.msg_state = HTTP_MSG_RPBEFORE;
+    s->txn->status        = -1;
+
+    nst_cache_hit(s, si, req, res, ctx);
+
+    if(!s->target) {
+        goto err;
+    }
+
+    /* established with the applet by process_stream */
+    si->state = SI_ST_REQ;
+
+    return 0;
+
+err:
+    if(ctx->state == NST_CTX_STATE_HIT_MEMORY) {
+        nst_memory_obj_detach(&nuster.cache->store.memory, ctx->store.memory.obj);
+    }
+
+    if(ctx->state == NST_CTX_STATE_HIT_DISK) {
+        close(ctx->store.disk.obj.fd);
+    }
+
+    ctx->state = NST_CTX_STATE_BYPASS;
+
+    s->txn->status = 503;
+
+    http_reply_and_close(s, s->txn->status, http_error_message(s));
+
+    req->analysers &= AN_REQ_FLT_END;
+    res->analysers &= AN_RES_FLT_END;
+
+    return 1;
+}
+
+/*
+ * Park the stream until the entry of key, in INIT state, is finished or
+ * aborted. The state is checked again under the lock, so the wake up of
+ * nst_cache_finish or nst_cache_abort can not be missed.
+ * return 1 if parked, 0 if the entry is not in INIT state anymore
+ */
+int
+nst_cache_wait(hpx_stream_t *s, nst_ctx_t *ctx) {
+    nst_dict_t        *dict = &nuster.cache->dict;
+    nst_dict_entry_t  *entry;
+    int                ret  = 0;
+
+    nst_dict_lock(dict, ctx->key->hash);
+
+    entry = nst_dict_get(dict, ctx->key);
+
+    if(entry && entry->state == NST_DICT_ENTRY_STATE_INIT) {
+        ctx->wait.hash = ctx->key->hash;
+        ctx->wait.task = s->task;
+
+        LIST_ADDQ(&_nst_cache_waiters[ctx->wait.hash & (NST_DICT_STRIPES - 1)], &ctx->wait.list);
+
+        ret = 1;
+    }
+
+    nst_dict_unlock(dict, ctx->key->hash);
+
+    return ret;
+}
+
+/*
+ * Leave the waiters if still parked, either woken up or the wait expired
+ */
+void
+nst_cache_unwait(nst_ctx_t *ctx) {
+    nst_dict_t  *dict = &nuster.cache->dict;
+
+    if(!ctx->wait.task) {
+        return;
+    }
+
+    nst_dict_lock(dict, ctx->wait.hash);
+
+    LIST_DEL_INIT(&ctx->wait.list);
+
+    nst_dict_unlock(dict, ctx->wait.hash);
+
+    ctx->wait.task = NULL;
+}
+
+/*
+ * Start the refresh-ahead found due by nst_cache_exists, it is left to the
+ * caller as the internal stream it creates logs too.
+ */
+void
+nst_cache_refresh(hpx_stream_t *s, nst_ctx_t *ctx) {
+
+    if(ctx->refresh_due) {
+        ctx->refresh_due = 0;
+
+        _nst_cache_refresh(s, ctx);
+    }
+}
+
+/*
+ * Set up ctx for the internal refresh request sent by the applet at the
+ * origin of s, the entry is updated if it is still there, otherwise the
+ * response is just discarded. The request is made conditional on the stored
+ * validators, so an unchanged object only costs a 304.
+ * return 1 if s is such a request, 0 otherwise
+ */
+int
+nst_cache_refreshing(hpx_stream_t *s, nst_ctx_t *ctx) {
+    hpx_appctx_t      *appctx = objt_appctx(strm_sess(s)->origin);
+    nst_dict_t        *dict   = &nuster.cache->dict;
+    nst_dict_entry_t  *entry;
+    nst_key_t         *key;
+
+    if(!appctx || appctx->applet != &nuster.applet.refresh) {
+        return 0;
+    }
+
+    key = appctx->ctx.nuster.refresh.key;
+
+    ctx->state   = NST_CTX_STATE_BYPASS;
+    ctx->refresh = 1;
+    ctx->rule    = appctx->ctx.nuster.refresh.rule;
+    ctx->key     = &ctx->keys[ctx->rule->key->idx];
+
+    *ctx->key = *key;
+
+    ctx->key->data = malloc(key->size);
+
+    if(!ctx->key->data) {
+        return 1;
+    }
+
+    memcpy(ctx->key->data, key->data, key->size);
+
+    if(nst_http_parse_htx(s, ctx->buf, &ctx->txn) != NST_OK) {
+        return 1;
+    }
+
+    nst_dict_lock(dict, ctx->key->hash);
+
+    entry = nst_dict_get(dict, ctx->key);
+
+    if(entry && (entry->state == NST_DICT_ENTRY_STATE_VALID
+                || entry->state == NST_DICT_ENTRY_STATE_REFRESH)) {
+
+        entry->state = NST_DICT_ENTRY_STATE_UPDATE;
+
+        ctx->state = NST_CTX_STATE_UPDATE;
+        ctx->entry = entry;
+        ctx->prop  = &entry->prop;
+
+        ctx->conditional = _nst_cache_conditional(s, entry);
+    }
+
+    nst_dict_unlock(dict, ctx->key->hash);
+
+    return 1;
 }
 
 /*
@@ -925,7 +2572,7 @@ nst_cache_delete(nst_key_t *key) {
     nst_dict_entry_t  *entry = NULL;
     int                ret   = 1;
 
-    nst_shctx_lock(dict);
+    nst_dict_lock(dict, key->hash);
 
     entry = nst_dict_get(dict, key);
 
@@ -946,7 +2593,11 @@ nst_cache_delete(nst_key_t *key) {
             }
 
             if(entry->store.disk.file) {
-                nst_disk_file_remove(entry->store.disk.file);
+                nst_disk_purge_by_path(&nuster.cache->store.disk, entry->store.disk.file,
+                        entry->store.disk.base);
+
+                nst_disk_journal(&nuster.cache->store.disk, entry, 1);
+
                 nst_shmem_free(nuster.cache->shmem, entry->store.disk.file);
                 entry->store.disk.file = NULL;
             }
@@ -958,7 +2609,7 @@ nst_cache_delete(nst_key_t *key) {
         ret = 0;
     }
 
-    nst_shctx_unlock(dict);
+    nst_dict_unlock(dict, key->hash);
 
     if(!nuster.cache->store.disk.loaded && global.nuster.cache.root.len){
         nst_disk_obj_t  disk;
@@ -980,7 +2631,67 @@ void
 nst_cache_hit(hpx_stream_t *s, hpx_stream_interface_t *si, hpx_channel_t *req, hpx_channel_t *res,
         nst_ctx_t *ctx) {
 
-    hpx_appctx_t  *appctx = NULL;
+    hpx_appctx_t          *appctx  = NULL;
+    nst_memory_zstream_t  *z       = NULL;
+    nst_memory_obj_t      *obj     = NULL;
+    nst_http_range_t      *range   = NULL;
+    hpx_http_hdr_ctx_t     hdr     = { .blk = NULL };
+    nst_memory_obj_t      *encoded;
+    uint64_t               total;
+
+    if(ctx->state == NST_CTX_STATE_HIT_MEMORY) {
+        obj = ctx->store.memory.obj;
+    }
+
+    /*
+     * ranges are served from the identity payload, the whole payload is
+     * sent if it is only stored encoded or still being filled
+     */
+    if(s->txn->meth == HTTP_METH_GET) {
+
+        if(ctx->state == NST_CTX_STATE_HIT_MEMORY) {
+            total = obj->encoding == NST_MEMORY_ENCODING_IDENTITY && !ctx->store.memory.follow
+                ? ctx->txn.res.payload_len : 0;
+        } else {
+            total = nst_disk_meta_get_payload_len(ctx->store.disk.obj.meta);
+        }
+
+        if(total && http_find_header(htxbuf(&req->buf), ist("Range"), &hdr, 1)) {
+            range = malloc(sizeof(*range));
+
+            if(range && !nst_http_parse_range(htxbuf(&req->buf), &ctx->txn, total, range)) {
+                free(range);
+                range = NULL;
+            }
+        }
+    }
+
+    /*
+     * serve the precompressed copy if the client accepts it, or ask for it,
+     * decode the body if the client does not accept its encoding, HEAD only
+     * gets the stored headers, a followed object is complete only later
+     */
+    if(ctx->state == NST_CTX_STATE_HIT_MEMORY && !range && s->txn->meth != HTTP_METH_HEAD
+            && !ctx->store.memory.follow) {
+
+        encoded = *(nst_memory_obj_t * volatile *)&obj->encoded;
+
+        if(encoded && nst_http_accept_encoding(htxbuf(&req->buf), encoded->encoding)) {
+            obj = encoded;
+        } else if(obj->encoding != NST_MEMORY_ENCODING_IDENTITY
+                && !nst_http_accept_encoding(htxbuf(&req->buf), obj->encoding)) {
+
+            z = nst_memory_zstream_create(obj->encoding, 1);
+
+            if(!z) {
+                return;
+            }
+        } else if(obj->precompress != NST_MEMORY_ENCODING_IDENTITY && !encoded
+                && nst_http_accept_encoding(htxbuf(&req->buf), obj->precompress)) {
+
+            nst_memory_obj_want(&nuster.cache->store.memory, obj);
+        }
+    }
 
     /*
      * set backend to nuster.applet.cache
@@ -990,6 +2701,9 @@ nst_cache_hit(hpx_stream_t *s, hpx_stream_interface_t *si, hpx_channel_t *req, h
     if(unlikely(!si_register_handler(si, objt_applet(s->target)))) {
         /* return to regular process on error */
         s->target = NULL;
+
+        nst_memory_zstream_free(z);
+        free(range);
     } else {
         appctx = si_appctx(si);
         memset(&appctx->ctx.nuster.store, 0, sizeof(appctx->ctx.nuster.store));
@@ -997,9 +2711,17 @@ nst_cache_hit(hpx_stream_t *s, hpx_stream_interface_t *si, hpx_channel_t *req, h
         appctx->st0 = ctx->state;
 
         if(ctx->state == NST_CTX_STATE_HIT_MEMORY) {
-            nst_memory_obj_attach(&nuster.cache->store.memory, ctx->store.memory.obj);
-            appctx->ctx.nuster.store.memory.obj  = ctx->store.memory.obj;
-            appctx->ctx.nuster.store.memory.item = ctx->store.memory.obj->item;
+            /*
+             * attached by nst_cache_exists, detached by filter detach, which
+             * also keeps the precompressed copy it owns
+             */
+            appctx->ctx.nuster.store.memory.obj     = obj;
+            appctx->ctx.nuster.store.memory.item    = obj->item;
+            appctx->ctx.nuster.store.memory.zstream = z;
+            appctx->ctx.nuster.store.memory.range   = range;
+            appctx->ctx.nuster.store.memory.head    = s->txn->meth == HTTP_METH_HEAD;
+            appctx->ctx.nuster.store.memory.follow  = ctx->store.memory.follow;
+            appctx->ctx.nuster.store.memory.hash    = ctx->key->hash;
         } else {
             char  *meta = ctx->store.disk.obj.meta;
 
@@ -1007,6 +2729,18 @@ nst_cache_hit(hpx_stream_t *s, hpx_stream_interface_t *si, hpx_channel_t *req, h
             appctx->ctx.nuster.store.disk.offset      = nst_disk_pos_header(&ctx->store.disk.obj);
             appctx->ctx.nuster.store.disk.header_len  = nst_disk_meta_get_header_len(meta);
             appctx->ctx.nuster.store.disk.payload_len = nst_disk_meta_get_payload_len(meta);
+            appctx->ctx.nuster.store.disk.range       = range;
+            appctx->ctx.nuster.store.disk.head        = s->txn->meth == HTTP_METH_HEAD;
+            appctx->ctx.nuster.store.disk.aio         = ctx->store.disk.aio;
+
+            /* the reads of nst_cache_exists are done, serve the applet now */
+            if(ctx->store.disk.aio) {
+                ctx->store.disk.aio->task = appctx->t;
+                ctx->store.disk.aio       = NULL;
+            } else {
+                appctx->ctx.nuster.store.disk.aio = nst_disk_aio_new(&nuster.cache->store.disk,
+                        appctx->t);
+            }
         }
 
         appctx->st1 = NST_DISK_APPLET_HEADER;
@@ -77,6 +77,8 @@ _nst_cache_filter_attach(hpx_stream_t *s, hpx_filter_t *filter) {
         ctx->key_cnt  = key_cnt;
         ctx->buf      = alloc_trash_chunk();
 
+        LIST_INIT(&ctx->wait.list);
+
         if(!ctx->buf) {
             free(ctx);
 
@@ -99,6 +101,8 @@ _nst_cache_filter_detach(hpx_stream_t *s, hpx_filter_t *filter) {
         nst_ctx_t  *ctx = filter->ctx;
         int         i;
 
+        nst_cache_unwait(ctx);
+
         nst_stats_update_cache(ctx->state, ctx->txn.res.payload_len + ctx->txn.res.header_len);
 
         if(ctx->state == NST_CTX_STATE_HIT_MEMORY) {
@@ -117,6 +121,9 @@ _nst_cache_filter_detach(hpx_stream_t *s, hpx_filter_t *filter) {
             }
         }
 
+        nst_memory_zstream_free(ctx->store.memory.zstream);
+        nst_disk_aio_free(ctx->store.disk.aio);
+
         free_trash_chunk(ctx->buf);
 
         free(ctx);
@@ -125,6 +132,29 @@ _nst_cache_filter_detach(hpx_stream_t *s, hpx_filter_t *filter) {
     nst_debug(s, "[cache] ===== detach =====");
 }
 
+/*
+ * return 1 if the status code of the response is cached by rule, 0 otherwise
+ */
+static int
+_nst_cache_filter_code_valid(hpx_stream_t *s, nst_rule_t *rule) {
+    nst_rule_code_t  *cc = rule->code;
+
+    if(!cc) {
+        return 1;
+    }
+
+    while(cc) {
+
+        if(cc->code == s->txn->status) {
+            return 1;
+        }
+
+        cc = cc->next;
+    }
+
+    return 0;
+}
+
 static int
 _nst_cache_filter_http_headers(hpx_stream_t *s, hpx_filter_t *filter, hpx_http_msg_t *msg) {
     hpx_channel_t           *req  = msg->chn;
@@ -138,11 +168,23 @@ _nst_cache_filter_http_headers(hpx_stream_t *s, hpx_filter_t *filter, hpx_http_m
     if(!(msg->chn->flags & CF_ISRESP)) {
         /* request */
 
+        /* parked in wait mode, woken up or the wait expired */
+        if(ctx->wait.task) {
+            nst_cache_unwait(ctx);
+
+            req->analyse_exp = TICK_ETERNITY;
+        }
+
         /* check http method */
         if(meth == HTTP_METH_OTHER) {
             ctx->state = NST_CTX_STATE_BYPASS;
         }
 
+        /* the internal request of refresh-ahead updates its entry */
+        if(ctx->state == NST_CTX_STATE_INIT && nst_cache_refreshing(s, ctx)) {
+            return 1;
+        }
+
         if(ctx->state == NST_CTX_STATE_INIT) {
             int  i = 0;
 
@@ -193,7 +235,7 @@ _nst_cache_filter_http_headers(hpx_stream_t *s, hpx_filter_t *filter, hpx_http_m
                 /* check if cache exists  */
                 nst_debug_beg(s, "[cache] Check key existence: ");
 
-                ctx->state = nst_cache_exists(ctx);
+                ctx->state = nst_cache_exists(s, ctx);
 
                 if(ctx->state == NST_CTX_STATE_HIT_MEMORY || ctx->state == NST_CTX_STATE_HIT_DISK) {
                     /* OK, cache exists */
@@ -204,6 +246,18 @@ _nst_cache_filter_http_headers(hpx_stream_t *s, hpx_filter_t *filter, hpx_http_m
                         nst_debug_end("HIT disk");
                     }
 
+                    nst_cache_refresh(s, ctx);
+
+                    break;
+                }
+
+                /* looked up again once the disk io threads are done */
+                if(ctx->state == NST_CTX_STATE_WAIT_DISK) {
+                    nst_key_reset_flag(ctx->key);
+                    nst_debug_end("WAIT disk");
+
+                    nst_cache_refresh(s, ctx);
+
                     break;
                 }
 
@@ -223,6 +277,15 @@ _nst_cache_filter_http_headers(hpx_stream_t *s, hpx_filter_t *filter, hpx_http_m
 
                 nst_debug_end("MISS");
 
+                nst_cache_refresh(s, ctx);
+
+                /* the response to HEAD is not cached with the key of GET */
+                if(meth == HTTP_METH_HEAD && ctx->rule->key->head == NST_STATUS_ON) {
+                    ctx->state = NST_CTX_STATE_BYPASS;
+
+                    break;
+                }
+
                 /* no, there's no cache yet */
 
                 /* test acls to see if we should cache it */
@@ -241,6 +304,12 @@ _nst_cache_filter_http_headers(hpx_stream_t *s, hpx_filter_t *filter, hpx_http_m
             }
         }
 
+        if(ctx->state == NST_CTX_STATE_WAIT_DISK) {
+            ctx->state = NST_CTX_STATE_INIT;
+
+            return 0;
+        }
+
         if(ctx->state == NST_CTX_STATE_HIT_MEMORY || ctx->state == NST_CTX_STATE_HIT_DISK) {
             htx = htxbuf(&req->buf);
 
@@ -252,13 +321,27 @@ _nst_cache_filter_http_headers(hpx_stream_t *s, hpx_filter_t *filter, hpx_http_m
         }
 
         if(ctx->state == NST_CTX_STATE_WAIT) {
-            int  t = nst_time_now_ms() - ctx->ctime;
+            uint64_t  t    = nst_time_now_ms() - ctx->ctime;
+            uint64_t  wait = ctx->prop->wait * 1000ULL;
 
-            if(ctx->prop->wait == 0 || (ctx->prop->wait > 0 && t < ctx->prop->wait * 1000)) {
-                usleep(1);
+            if(ctx->prop->wait == 0 || (ctx->prop->wait > 0 && t < wait)) {
                 ctx->state = NST_CTX_STATE_INIT;
 
-                task_wakeup(s->task, TASK_WOKEN_MSG);
+                /*
+                 * park until the entry is finished or aborted, also recheck
+                 * once in a while as the creator may be in another process
+                 */
+                if(nst_cache_wait(s, ctx)) {
+                    uint64_t  exp = NST_CACHE_WAIT_RECHECK;
+
+                    if(ctx->prop->wait > 0 && wait - t < exp) {
+                        exp = wait - t;
+                    }
+
+                    req->analyse_exp = tick_add(now_ms, MS_TO_TICKS(exp));
+                } else {
+                    task_wakeup(s->task, TASK_WOKEN_MSG);
+                }
 
                 return 0;
             }
@@ -295,37 +378,51 @@ _nst_cache_filter_http_headers(hpx_stream_t *s, hpx_filter_t *filter, hpx_http_m
         }
 
         if(ctx->state == NST_CTX_STATE_PASS) {
-            nst_rule_code_t  *cc    = ctx->rule->code;
-            int               valid = 0;
 
             /* check if code is valid */
             nst_debug_beg(s, "[cache] Check status code: ");
 
-            if(!cc) {
-                valid = 1;
+            if(!_nst_cache_filter_code_valid(s, ctx->rule)) {
+                nst_debug_end("FAIL");
+
+                return 1;
             }
 
-            while(cc) {
+            nst_debug_end("PASS");
 
-                if(cc->code == s->txn->status) {
-                    valid = 1;
+            ctx->state = NST_CTX_STATE_CREATE;
+            ctx->prop  = &ctx->rule->prop;
+        }
 
-                    break;
-                }
+        /* the stored object is still fresh, a client gets it instead of the 304 */
+        if(ctx->state == NST_CTX_STATE_UPDATE && ctx->conditional && s->txn->status == 304) {
+            nst_debug(s, "[cache] Not modified");
 
-                cc = cc->next;
-            }
+            nst_cache_revalidate(ctx);
 
-            if(!valid) {
+            return ctx->refresh ? 1 : nst_cache_revalidated(s, ctx);
+        }
+
+        /* the stored object of nst_cache_revalidated is being read */
+        if(ctx->state == NST_CTX_STATE_WAIT_DISK) {
+            return nst_cache_revalidated(s, ctx);
+        }
+
+        /* an error does not replace the stored entry, it is served stale if allowed */
+        if(ctx->state == NST_CTX_STATE_UPDATE) {
+            nst_debug_beg(s, "[cache] Check status code: ");
+
+            if(!_nst_cache_filter_code_valid(s, ctx->rule)) {
                 nst_debug_end("FAIL");
 
+                nst_cache_abort(ctx);
+
+                ctx->state = NST_CTX_STATE_BYPASS;
+
                 return 1;
             }
 
             nst_debug_end("PASS");
-
-            ctx->state = NST_CTX_STATE_CREATE;
-            ctx->prop  = &ctx->rule->prop;
         }
 
         if(ctx->state == NST_CTX_STATE_CREATE || ctx->state == NST_CTX_STATE_UPDATE) {
@@ -351,6 +448,30 @@ _nst_cache_filter_http_headers(hpx_stream_t *s, hpx_filter_t *filter, hpx_http_m
 
             nst_http_build_last_modified(s, ctx->buf, &ctx->txn, ctx->prop->last_modified);
 
+            if(nst_http_build_tags(s, ctx->buf, &ctx->txn, ctx->rule->tag_header) != NST_OK) {
+                nst_debug(s, "[cache] Tags too long");
+
+                if(ctx->state == NST_CTX_STATE_UPDATE) {
+                    nst_cache_abort(ctx);
+                }
+
+                ctx->state = NST_CTX_STATE_BYPASS;
+
+                return 1;
+            }
+
+            if(nst_http_build_vary(s, ctx->buf, &ctx->txn) != NST_OK) {
+                nst_debug(s, "[cache] Vary too long");
+
+                if(ctx->state == NST_CTX_STATE_UPDATE) {
+                    nst_cache_abort(ctx);
+                }
+
+                ctx->state = NST_CTX_STATE_BYPASS;
+
+                return 1;
+            }
+
             if(ctx->state == NST_CTX_STATE_CREATE) {
                 nst_debug(s, "[cache] To create");
             } else {
@@ -10,117 +10,1247 @@
  *
  */
 
+#include <import/xxhash.h>
+
 #include <nuster/nuster.h>
 
+/*
+ * A page holds page_size buckets or tag words
+ */
+static void *
+_nst_dict_page_alloc(nst_dict_t *dict) {
+    void  *page;
+
+    page = nst_shmem_alloc(dict->shmem, dict->page_size * sizeof(uint64_t));
+
+    if(page) {
+        memset(page, 0, dict->page_size * sizeof(uint64_t));
+    }
+
+    return page;
+}
+
+static inline uint8_t
+_nst_dict_tag(uint64_t hash) {
+    uint8_t  tag = hash >> 56;
+
+    /* 0 is an empty slot */
+    return tag ? tag : 1;
+}
+
+/*
+ * return non zero if one of the bytes of word equals tag
+ */
+static inline int
+_nst_dict_tags_match(uint64_t word, uint8_t tag) {
+    uint64_t  v = word ^ (0x0101010101010101ULL * tag);
+
+    return ((v - 0x0101010101010101ULL) & ~v & 0x8080808080808080ULL) != 0;
+}
+
+/*
+ * Pages of table[0] are allocated upfront, pages of a rehashing table are
+ * allocated on first use, see _nst_dict_table_bucket
+ */
+static int
+_nst_dict_table_init(nst_dict_t *dict, nst_dict_table_t *table, uint64_t size, int alloc) {
+    uint64_t  pages = (size + dict->page_size - 1) >> dict->page_shift;
+    uint64_t  i;
+
+    table->size = size;
+    table->tag  = NULL;
+    table->page = nst_shmem_alloc(dict->shmem, pages * sizeof(*table->page));
+
+    if(!table->page) {
+        return NST_ERR;
+    }
+
+    memset(table->page, 0, pages * sizeof(*table->page));
+
+    if(dict->layout == NST_DICT_LAYOUT_TAG) {
+        table->tag = nst_shmem_alloc(dict->shmem, pages * sizeof(*table->tag));
+
+        if(!table->tag) {
+            return NST_ERR;
+        }
+
+        memset(table->tag, 0, pages * sizeof(*table->tag));
+    }
+
+    for(i = 0; alloc && i < pages; i++) {
+
+        if(table->tag) {
+            table->tag[i] = _nst_dict_page_alloc(dict);
+
+            if(!table->tag[i]) {
+                return NST_ERR;
+            }
+        }
+
+        table->page[i] = _nst_dict_page_alloc(dict);
+
+        if(!table->page[i]) {
+            return NST_ERR;
+        }
+    }
+
+    return NST_OK;
+}
+
+static void
+_nst_dict_table_free(nst_dict_t *dict, nst_dict_table_t *table) {
+    uint64_t  pages = (table->size + dict->page_size - 1) >> dict->page_shift;
+    uint64_t  i;
+
+    for(i = 0; i < pages; i++) {
+
+        if(table->page && table->page[i]) {
+            nst_shmem_free(dict->shmem, table->page[i]);
+        }
+
+        if(table->tag && table->tag[i]) {
+            nst_shmem_free(dict->shmem, table->tag[i]);
+        }
+    }
+
+    nst_shmem_free(dict->shmem, table->page);
+    nst_shmem_free(dict->shmem, table->tag);
+
+    table->page = NULL;
+    table->tag  = NULL;
+    table->size = 0;
+}
+
+/*
+ * return the bucket of hash in table, allocate its page if alloc is set
+ * return NULL if the page is not allocated
+ */
+static nst_dict_entry_t **
+_nst_dict_table_bucket(nst_dict_t *dict, nst_dict_table_t *table, uint64_t hash, int alloc) {
+    uint64_t  idx = hash & (table->size - 1);
+    uint64_t  pid = idx >> dict->page_shift;
+
+    /*
+     * a page holds buckets of all stripes, so it can be allocated
+     * concurrently by several stripe lock holders. The tag page goes
+     * first, a bucket page always has its tag page.
+     */
+    if(table->tag && !table->tag[pid] && alloc) {
+        uint64_t  *tag = _nst_dict_page_alloc(dict);
+
+        if(!tag) {
+            return NULL;
+        }
+
+        if(!__sync_bool_compare_and_swap(&table->tag[pid], NULL, tag)) {
+            nst_shmem_free(dict->shmem, tag);
+        }
+    }
+
+    if(!table->page[pid] && alloc) {
+        nst_dict_entry_t  **page = _nst_dict_page_alloc(dict);
+
+        if(page && !__sync_bool_compare_and_swap(&table->page[pid], NULL, page)) {
+            nst_shmem_free(dict->shmem, page);
+        }
+    }
+
+    if(!table->page[pid]) {
+        return NULL;
+    }
+
+    return &table->page[pid][idx & (dict->page_size - 1)];
+}
+
+/*
+ * return the tag word of the bucket of hash in table, or NULL
+ */
+static inline uint64_t *
+_nst_dict_table_tags(nst_dict_t *dict, nst_dict_table_t *table, uint64_t hash) {
+    uint64_t  idx = hash & (table->size - 1);
+    uint64_t  pid = idx >> dict->page_shift;
+
+    if(!table->tag || !table->tag[pid]) {
+        return NULL;
+    }
+
+    return &table->tag[pid][idx & (dict->page_size - 1)];
+}
+
+/*
+ * Rebuild the tag word of the bucket of hash in table after its entries
+ * changed, called with the stripe of the bucket locked. Lock free readers
+ * may see a stale tag word, which only makes them miss.
+ */
+static void
+_nst_dict_table_tags_update(nst_dict_t *dict, nst_dict_table_t *table, uint64_t hash) {
+    nst_dict_entry_t  **bucket;
+    nst_dict_entry_t   *entry;
+    uint64_t           *tags;
+    uint64_t            word = 0;
+    int                 n    = 0;
+
+    tags   = _nst_dict_table_tags(dict, table, hash);
+    bucket = _nst_dict_table_bucket(dict, table, hash, 0);
+
+    if(!tags || !bucket) {
+        return;
+    }
+
+    entry = *bucket;
+
+    while(entry) {
+
+        if(n == NST_DICT_TAGS) {
+            word = NST_DICT_TAGS_OVERFLOW;
+
+            break;
+        }
+
+        word |= (uint64_t)_nst_dict_tag(entry->key.hash) << (n++ * 8);
+
+        entry = entry->next;
+    }
+
+    *(volatile uint64_t *)tags = word;
+}
+
+/*
+ * return the table new entries of hash go to
+ */
+static nst_dict_table_t *
+_nst_dict_table(nst_dict_t *dict) {
+
+    if(nst_dict_rehashing(dict)) {
+        return &dict->table[1];
+    }
+
+    return &dict->table[0];
+}
+
+/*
+ * return the bucket new entries of hash go to
+ */
+static nst_dict_entry_t **
+_nst_dict_bucket(nst_dict_t *dict, uint64_t hash) {
+    return _nst_dict_table_bucket(dict, _nst_dict_table(dict), hash, nst_dict_rehashing(dict));
+}
+
+static nst_dict_entry_t *
+_nst_dict_table_lookup(nst_dict_t *dict, nst_dict_table_t *table, nst_key_t *key) {
+    nst_dict_entry_t  **bucket;
+    nst_dict_entry_t   *entry;
+    uint64_t           *tags;
+    uint64_t            word;
+
+    /* no tag page yet means no bucket page either */
+    if(table->tag) {
+        tags = _nst_dict_table_tags(dict, table, key->hash);
+
+        if(!tags) {
+            return NULL;
+        }
+
+        word = *(volatile uint64_t *)tags;
+
+        if(word != NST_DICT_TAGS_OVERFLOW
+                && !_nst_dict_tags_match(word, _nst_dict_tag(key->hash))) {
+
+            return NULL;
+        }
+    }
+
+    bucket = _nst_dict_table_bucket(dict, table, key->hash, 0);
+    entry  = bucket ? *bucket : NULL;
+
+    while(entry) {
+
+        if(entry->key.hash == key->hash && entry->key.size == key->size
+                && !memcmp(entry->key.uuid, key->uuid, NST_KEY_UUID_LEN)
+                && !memcmp(entry->key.data, key->data, key->size)) {
+
+            return entry;
+        }
+
+        entry = entry->next;
+    }
+
+    return NULL;
+}
+
+/*
+ * Entries in table[1] are newer than the ones in table[0], so look there first
+ */
+static nst_dict_entry_t *
+_nst_dict_lookup(nst_dict_t *dict, nst_key_t *key) {
+    nst_dict_entry_t  *entry = NULL;
+
+    if(nst_dict_rehashing(dict)) {
+        entry = _nst_dict_table_lookup(dict, &dict->table[1], key);
+    }
+
+    if(!entry) {
+        entry = _nst_dict_table_lookup(dict, &dict->table[0], key);
+    }
+
+    return entry;
+}
+
+/*
+ * table[] and rehash_idx are changed with all stripes locked, lock free
+ * readers check table_seq to get a consistent copy of them
+ */
+static inline void
+_nst_dict_table_seq_begin(nst_dict_t *dict) {
+    __sync_add_and_fetch(&dict->table_seq, 1);
+}
+
+static inline void
+_nst_dict_table_seq_end(nst_dict_t *dict) {
+    __sync_add_and_fetch(&dict->table_seq, 1);
+}
+
+static void
+_nst_dict_lock_all(nst_dict_t *dict) {
+    int  i;
+
+    for(i = 0; i < NST_DICT_STRIPES; i++) {
+        nst_dict_lock(dict, i);
+    }
+}
+
+static void
+_nst_dict_unlock_all(nst_dict_t *dict) {
+    int  i;
+
+    for(i = NST_DICT_STRIPES - 1; i >= 0; i--) {
+        nst_dict_unlock(dict, i);
+    }
+}
+
+static inline nst_dict_group_t **
+_nst_dict_index_bucket(nst_dict_t *dict, int stripe, uint64_t hash) {
+    return &dict->stripe[stripe].index[hash & (dict->index_size - 1)];
+}
+
+static nst_dict_group_t *
+_nst_dict_index_lookup(nst_dict_t *dict, int stripe, int type, hpx_ist_t name, uint64_t hash) {
+    nst_dict_group_t  *group = *_nst_dict_index_bucket(dict, stripe, hash);
+
+    while(group) {
+
+        if(group->hash == hash && group->type == type && group->len == name.len
+                && !memcmp(group->name, name.ptr, name.len)) {
+
+            return group;
+        }
+
+        group = group->next;
+    }
+
+    return NULL;
+}
+
+/*
+ * return the group of name in the index of stripe, or NULL.
+ * Must be called with the stripe locked.
+ */
+nst_dict_group_t *
+nst_dict_index_get(nst_dict_t *dict, int stripe, int type, hpx_ist_t name) {
+
+    if(!dict->index_size) {
+        return NULL;
+    }
+
+    return _nst_dict_index_lookup(dict, stripe, type, name, XXH64(name.ptr, name.len, type));
+}
+
+static int
+_nst_dict_index_add(nst_dict_t *dict, nst_dict_entry_t *entry, int type, hpx_ist_t name) {
+    nst_dict_group_t  **bucket, *group;
+    nst_dict_link_t    *link;
+    uint64_t            hash   = XXH64(name.ptr, name.len, type);
+    int                 stripe = entry->key.hash & (NST_DICT_STRIPES - 1);
+
+    link = nst_shmem_alloc(dict->shmem, sizeof(*link));
+
+    if(!link) {
+        return NST_ERR;
+    }
+
+    group = _nst_dict_index_lookup(dict, stripe, type, name, hash);
+
+    /* links of an entry are added in a row, so a repeated tag is at the head */
+    if(group && group->link->entry == entry) {
+        nst_shmem_free(dict->shmem, link);
+
+        return NST_OK;
+    }
+
+    if(!group) {
+        group = nst_shmem_alloc(dict->shmem, sizeof(*group) + name.len);
+
+        if(!group) {
+            nst_shmem_free(dict->shmem, link);
+
+            return NST_ERR;
+        }
+
+        group->link = NULL;
+        group->hash = hash;
+        group->type = type;
+        group->len  = name.len;
+
+        memcpy(group->name, name.ptr, name.len);
+
+        bucket      = _nst_dict_index_bucket(dict, stripe, hash);
+        group->next = *bucket;
+        *bucket     = group;
+    }
+
+    link->prev    = NULL;
+    link->next    = group->link;
+    link->entry   = entry;
+    link->group   = group;
+    link->sibling = entry->link;
+
+    if(group->link) {
+        group->link->prev = link;
+    }
+
+    group->link = link;
+    entry->link = link;
+
+    return NST_OK;
+}
+
+/*
+ * Remove entry from all its groups, groups left empty are freed.
+ * Must be called with the stripe of the entry locked.
+ */
+void
+nst_dict_index_remove(nst_dict_t *dict, nst_dict_entry_t *entry) {
+    nst_dict_group_t  **bucket, *group;
+    nst_dict_link_t    *link;
+    int                 stripe = entry->key.hash & (NST_DICT_STRIPES - 1);
+
+    while(entry->link) {
+        link        = entry->link;
+        group       = link->group;
+        entry->link = link->sibling;
+
+        if(link->prev) {
+            link->prev->next = link->next;
+        } else {
+            group->link = link->next;
+        }
+
+        if(link->next) {
+            link->next->prev = link->prev;
+        }
+
+        nst_shmem_free(dict->shmem, link);
+
+        if(group->link) {
+            continue;
+        }
+
+        bucket = _nst_dict_index_bucket(dict, stripe, group->hash);
+
+        while(*bucket != group) {
+            bucket = &(*bucket)->next;
+        }
+
+        *bucket = group->next;
+
+        nst_shmem_free(dict->shmem, group);
+    }
+}
+
+/*
+ * Add a new entry to the groups of its proxy, rule, host, path and tags.
+ * Must be called with the stripe of the entry locked.
+ */
+static int
+_nst_dict_index_entry(nst_dict_t *dict, nst_dict_entry_t *entry) {
+    hpx_ist_t  tag = { .ptr = NULL };
+
+    if(!dict->index_size) {
+        return NST_OK;
+    }
+
+    if(_nst_dict_index_add(dict, entry, NST_DICT_INDEX_PROXY, entry->prop.pid) != NST_OK
+            || _nst_dict_index_add(dict, entry, NST_DICT_INDEX_RULE, entry->prop.rid) != NST_OK
+            || _nst_dict_index_add(dict, entry, NST_DICT_INDEX_HOST, entry->host) != NST_OK
+            || _nst_dict_index_add(dict, entry, NST_DICT_INDEX_PATH, entry->path) != NST_OK) {
+
+        goto err;
+    }
+
+    while(nst_http_tags_next(entry->tags, &tag)) {
+
+        if(_nst_dict_index_add(dict, entry, NST_DICT_INDEX_TAG, tag) != NST_OK) {
+            goto err;
+        }
+    }
+
+    return NST_OK;
+
+err:
+    nst_dict_index_remove(dict, entry);
+
+    return NST_ERR;
+}
+
+int
+nst_dict_init(nst_dict_t *dict, nst_store_t *store, nst_shmem_t *shmem, uint64_t dict_size,
+        int layout, int index) {
+
+    int       entry_size = sizeof(nst_dict_entry_t *);
+    uint64_t  size       = shmem->block_size / sizeof(uint64_t);
+    int       i;
+
+    /* a bucket also has a tag word */
+    if(layout == NST_DICT_LAYOUT_TAG) {
+        entry_size += sizeof(uint64_t);
+    }
+
+    dict->shmem        = shmem;
+    dict->layout       = layout;
+    dict->index_size   = 0;
+    dict->used         = 0;
+    dict->store        = store;
+    dict->rehash_idx   = -1;
+    dict->rehash_pause = 0;
+    dict->page_size    = size;
+    dict->page_shift   = 0;
+
+    while((1ULL << dict->page_shift) < dict->page_size) {
+        dict->page_shift++;
+    }
+
+    /* the page directory of a table is one block too */
+    dict->max_size = dict->page_size * dict->page_size;
+
+    while(size * 2 <= dict_size / entry_size && size * 2 <= dict->max_size) {
+        size *= 2;
+    }
+
+    dict->min_size = size;
+
+    if(_nst_dict_table_init(dict, &dict->table[0], size, 1) != NST_OK) {
+        return NST_ERR;
+    }
+
+    dict->table[1].page = NULL;
+    dict->table[1].tag  = NULL;
+    dict->table[1].size = 0;
+
+    /* the index of a stripe is one block */
+    if(index == NST_STATUS_ON) {
+        dict->index_size = 1;
+
+        while(dict->index_size * 2 <= shmem->block_size / sizeof(nst_dict_group_t *)) {
+            dict->index_size *= 2;
+        }
+    }
+
+    for(i = 0; i < NST_DICT_STRIPES; i++) {
+
+        if(nst_shctx_init(&dict->stripe[i]) != NST_OK) {
+            return NST_ERR;
+        }
+
+        dict->stripe[i].index = NULL;
+
+        if(dict->index_size) {
+            dict->stripe[i].index = nst_shmem_alloc(shmem,
+                    dict->index_size * sizeof(nst_dict_group_t *));
+
+            if(!dict->stripe[i].index) {
+                return NST_ERR;
+            }
+
+            memset(dict->stripe[i].index, 0, dict->index_size * sizeof(nst_dict_group_t *));
+        }
+    }
+
+    return NST_OK;
+}
+
+/*
+ * Check entry validity, retire the entry if its invalid,
+ */
+void
+nst_dict_cleanup(nst_dict_t *dict) {
+    nst_dict_entry_t  **bucket;
+    nst_dict_entry_t   *entry;
+    nst_dict_entry_t   *prev;
+    uint64_t            start, idx;
+    int                 removed = 0;
+
+    if(!dict->used) {
+        return;
+    }
+
+    start = nst_time_now_ms();
+    idx   = dict->cleanup_idx;
+
+    /* the number of buckets changes when rehashing starts or finishes */
+    if(idx >= nst_dict_buckets(dict)) {
+        idx = 0;
+    }
+
+    nst_dict_lock(dict, idx);
+
+    bucket = nst_dict_bucket(dict, idx);
+    entry  = bucket ? *bucket : NULL;
+    prev  = entry;
+
+    while(entry) {
+
+        if(nst_dict_entry_invalid(entry)) {
+            nst_dict_entry_t  *tmp = entry;
+
+            if(entry->store.memory.obj) {
+                entry->store.memory.obj->invalid = 1;
+                entry->store.memory.obj          = NULL;
+
+                nst_memory_incr_invalid(&dict->store->memory);
+            }
+
+            if(prev == entry) {
+                *bucket = entry->next;
+                prev = entry->next;
+            } else {
+                prev->next = entry->next;
+            }
+
+            entry = entry->next;
+
+            nst_dict_index_remove(dict, tmp);
+
+            /* lock free readers may still see it, see nst_dict_reclaim */
+            tmp->state = NST_DICT_ENTRY_STATE_INVALID;
+            tmp->next  = dict->retired.entry;
+
+            dict->retired.entry = tmp;
+
+            removed++;
+
+            __sync_sub_and_fetch(&dict->used, 1);
+        } else {
+            prev  = entry;
+            entry = entry->next;
+        }
+
+        if(nst_time_now_ms() - start >= 10) {
+            break;
+        }
+    }
+
+    if(removed) {
+
+        if(idx < dict->table[0].size) {
+            _nst_dict_table_tags_update(dict, &dict->table[0], idx);
+        } else {
+            _nst_dict_table_tags_update(dict, &dict->table[1], idx - dict->table[0].size);
+        }
+    }
+
+    nst_dict_unlock(dict, idx);
+
+    if(entry == NULL) {
+        idx++;
+    }
+
+    /* if we have checked the whole dict */
+    if(idx >= nst_dict_buckets(dict)) {
+        idx = 0;
+    }
+
+    dict->cleanup_idx = idx;
+}
+
+/*
+ * Number of buckets swept by one nst_dict_evict, and number of entries
+ * sampled to find the least recently used one.
+ */
+#define NST_DICT_EVICT_BUCKETS          64
+#define NST_DICT_EVICT_SAMPLES          16
+#define NST_DICT_EVICT_FREQ_MAX         3
+
+static inline int
+_nst_dict_evictable(nst_dict_entry_t *entry) {
+
+    if(entry->state != NST_DICT_ENTRY_STATE_VALID && entry->state != NST_DICT_ENTRY_STATE_STALE) {
+        return 0;
+    }
+
+    return entry->store.memory.obj && !entry->store.memory.obj->invalid;
+}
+
+/*
+ * Release the memory object of entry, an entry persisted on disk stays
+ * valid and is served from disk, others are left to nst_dict_cleanup.
+ * return the number of bytes released
+ */
+static uint64_t
+_nst_dict_evict_entry(nst_dict_t *dict, nst_dict_entry_t *entry) {
+    uint64_t  size = entry->header_len + entry->payload_len;
+
+    nst_memory_obj_evict(&dict->store->memory, entry->store.memory.obj, size);
+
+    entry->store.memory.obj = NULL;
+
+    if(!entry->store.disk.file) {
+        entry->state  = NST_DICT_ENTRY_STATE_INVALID;
+        entry->expire = 0;
+    }
+
+    return size;
+}
+
+static inline uint64_t
+_nst_dict_entry_hits(nst_dict_entry_t *entry) {
+    uint64_t  hits;
+
+    hits = entry->access[0] + entry->access[1] + entry->access[2] + entry->access[3];
+
+    return hits > entry->evict.hits ? hits - entry->evict.hits : 0;
+}
+
+/*
+ * Decide whether entry should be evicted, and age it otherwise.
+ *
+ * clock:  an entry accessed since the last sweep gets a second chance.
+ * s3fifo: a new entry sits in the small queue and is evicted unless it was
+ *         hit, then it moves to the main queue with a frequency of its hits.
+ *         Entries of the main queue are evicted once their frequency drops
+ *         to 0, one per sweep. There is no ghost queue, an evicted entry
+ *         starts over in the small queue.
+ */
+static int
+_nst_dict_evict_sweep(nst_dict_entry_t *entry, int policy) {
+    uint64_t  hits;
+
+    if(policy == NST_EVICTION_CLOCK) {
+
+        if(entry->atime > entry->evict.time) {
+            entry->evict.time = entry->atime;
+
+            return 0;
+        }
+
+        return 1;
+    }
+
+    hits              = _nst_dict_entry_hits(entry);
+    entry->evict.hits += hits;
+
+    if(!entry->evict.main) {
+
+        if(!hits) {
+            return 1;
+        }
+
+        entry->evict.main = 1;
+        entry->evict.freq = hits > NST_DICT_EVICT_FREQ_MAX ? NST_DICT_EVICT_FREQ_MAX : hits;
+
+        return 0;
+    }
+
+    hits += entry->evict.freq;
+
+    entry->evict.freq = hits > NST_DICT_EVICT_FREQ_MAX ? NST_DICT_EVICT_FREQ_MAX : hits;
+
+    if(entry->evict.freq) {
+        entry->evict.freq--;
+
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Evict memory objects until target bytes are released, sweeping up to
+ * NST_DICT_EVICT_BUCKETS buckets from evict_idx. lru evicts the least
+ * recently used of the next NST_DICT_EVICT_SAMPLES evictable entries.
+ * return the number of bytes released
+ */
+uint64_t
+nst_dict_evict(nst_dict_t *dict, int policy, uint64_t target) {
+    nst_dict_entry_t  **bucket;
+    nst_dict_entry_t   *entry;
+    nst_dict_entry_t   *oldest  = NULL;
+    uint64_t            atime   = 0;
+    uint64_t            evicted = 0;
+    uint64_t            buckets, idx;
+    int                 samples = NST_DICT_EVICT_SAMPLES;
+
+    if(!dict->used || policy == NST_EVICTION_OFF) {
+        return 0;
+    }
+
+    /* lru keeps sampling up to a whole lap on a sparse dict */
+    buckets = NST_DICT_EVICT_BUCKETS;
+
+    if(policy == NST_EVICTION_LRU) {
+        buckets = nst_dict_buckets(dict);
+    }
+
+    idx = dict->evict_idx;
+
+    while(buckets-- && samples && evicted < target) {
+
+        if(idx >= nst_dict_buckets(dict)) {
+            idx = 0;
+        }
+
+        nst_dict_lock(dict, idx);
+
+        bucket = nst_dict_bucket(dict, idx);
+        entry  = bucket ? *bucket : NULL;
+
+        while(entry && samples && evicted < target) {
+
+            if(_nst_dict_evictable(entry)) {
+
+                if(policy == NST_EVICTION_LRU) {
+
+                    if(!oldest || entry->atime < atime) {
+                        oldest = entry;
+                        atime  = entry->atime;
+                    }
+
+                    samples--;
+                } else if(_nst_dict_evict_sweep(entry, policy)) {
+                    evicted += _nst_dict_evict_entry(dict, entry);
+                }
+            }
+
+            entry = entry->next;
+        }
+
+        nst_dict_unlock(dict, idx);
+
+        idx++;
+    }
+
+    dict->evict_idx = idx;
+
+    /* entries are only freed by nst_dict_reclaim, which runs in this thread too */
+    if(oldest) {
+        nst_dict_lock(dict, oldest->key.hash);
+
+        if(_nst_dict_evictable(oldest) && oldest->atime == atime) {
+            evicted += _nst_dict_evict_entry(dict, oldest);
+        }
+
+        nst_dict_unlock(dict, oldest->key.hash);
+    }
+
+    return evicted;
+}
+
+/*
+ * Maximum number of objects moved from one bucket by nst_dict_compact.
+ */
+#define NST_DICT_COMPACT_OBJS           16
+
+static int
+_nst_dict_obj_draining(nst_shmem_t *shmem, nst_memory_obj_t *obj) {
+    nst_memory_item_t  *item;
+
+    if(nst_shmem_draining(shmem, obj)) {
+        return 1;
+    }
+
+    for(item = obj->item; item; item = item->next) {
+
+        if(nst_shmem_draining(shmem, item)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Move the memory objects of one bucket out of the blocks drained by
+ * nst_shmem_compact_begin. The entry gets a copy and the old object is
+ * invalidated, so it is freed by nst_dict_reclaim once no reader uses it.
+ * A pass starts when there is no free block and ends after a whole lap.
+ * return 1 while a pass is in progress, 0 otherwise
+ */
+int
+nst_dict_compact(nst_dict_t *dict) {
+    nst_memory_t       *mem   = &dict->store->memory;
+    nst_shmem_t        *shmem = mem->shmem;
+    nst_dict_entry_t  **bucket;
+    nst_dict_entry_t   *entry;
+    nst_dict_entry_t   *entries[NST_DICT_COMPACT_OBJS];
+    nst_memory_obj_t   *objs[NST_DICT_COMPACT_OBJS];
+    nst_memory_obj_t   *copy;
+    uint64_t            idx;
+    int                 i, n = 0;
+
+    if(!shmem->compact.draining) {
+
+        if(!nst_shmem_compact_begin(shmem)) {
+            return 0;
+        }
+
+        dict->compact_idx = 0;
+    }
+
+    idx = dict->compact_idx;
+
+    if(idx >= nst_dict_buckets(dict)) {
+        nst_shmem_compact_end(shmem);
+
+        return 0;
+    }
+
+    nst_dict_lock(dict, idx);
+
+    bucket = nst_dict_bucket(dict, idx);
+    entry  = bucket ? *bucket : NULL;
+
+    while(entry && n < NST_DICT_COMPACT_OBJS) {
+
+        if(_nst_dict_evictable(entry)
+                && _nst_dict_obj_draining(shmem, entry->store.memory.obj)) {
+
+            entries[n] = entry;
+            objs[n]    = entry->store.memory.obj;
+            n++;
+        }
+
+        entry = entry->next;
+    }
+
+    nst_dict_unlock(dict, idx);
+
+    /*
+     * entries and objects are only freed by nst_dict_reclaim, which runs
+     * in this thread too, so they can be copied without the lock
+     */
+    for(i = 0; i < n; i++) {
+        copy = nst_memory_obj_copy(mem, objs[i]);
+
+        if(!copy) {
+            break;
+        }
+
+        nst_dict_lock(dict, entries[i]->key.hash);
+
+        if(entries[i]->store.memory.obj == objs[i] && !objs[i]->invalid) {
+            entries[i]->store.memory.obj = copy;
+            objs[i]->invalid             = 1;
+
+            mem->compacted++;
+        } else {
+            copy->invalid = 1;
+        }
+
+        nst_dict_unlock(dict, entries[i]->key.hash);
+
+        nst_memory_incr_invalid(mem);
+    }
+
+    dict->compact_idx = idx + 1;
+
+    return 1;
+}
+
+/*
+ * Start a rehashing if the load factor is out of range, or move one bucket
+ * of table[0] to table[1]. Only the stripe of the bucket is locked while
+ * moving it, all stripes are locked to start or finish a rehashing.
+ * return 1 if rehashing is in progress, 0 otherwise.
+ */
 int
-nst_dict_init(nst_dict_t *dict, nst_store_t *store, nst_shmem_t *shmem, uint64_t dict_size) {
+nst_dict_rehash(nst_dict_t *dict) {
+    nst_dict_entry_t  **bucket, **dst;
+    nst_dict_entry_t   *entry,   *tail;
+    uint64_t            size, idx;
 
-    int  block_size = shmem->block_size;
-    int  entry_size = sizeof(nst_dict_entry_t *);
-    int  size       = (block_size + dict_size - 1) / block_size * block_size;
-    int  i;
+    if(dict->rehash_pause) {
+        return 0;
+    }
 
-    dict->shmem = shmem;
-    dict->size  = size / entry_size;
-    dict->used  = 0;
-    dict->entry = nst_shmem_alloc(shmem, block_size);
-    dict->store = store;
+    if(!nst_dict_rehashing(dict)) {
+        size = dict->table[0].size;
 
-    if(!dict->entry) {
-        return NST_ERR;
+        if(dict->used > size && size * 2 <= dict->max_size) {
+            size *= 2;
+        } else if(dict->used < size / 8 && size / 2 >= dict->min_size) {
+            size /= 2;
+        } else {
+            return 0;
+        }
+
+        _nst_dict_lock_all(dict);
+
+        if(dict->rehash_pause) {
+            goto out;
+        }
+
+        _nst_dict_table_seq_begin(dict);
+
+        if(_nst_dict_table_init(dict, &dict->table[1], size, 0) != NST_OK) {
+
+            _nst_dict_table_free(dict, &dict->table[1]);
+        } else {
+            dict->rehash_idx = 0;
+        }
+
+        _nst_dict_table_seq_end(dict);
+
+        goto out;
     }
 
-    for(i = 1; i < size / block_size; i++) {
+    idx = dict->rehash_idx;
 
-        if(!nst_shmem_alloc(shmem, block_size)) {
-            return NST_ERR;
+    if(idx < dict->table[0].size) {
+        nst_dict_lock(dict, idx);
+
+        bucket = nst_dict_bucket(dict, idx);
+
+        while(bucket && *bucket) {
+            entry = *bucket;
+            dst   = _nst_dict_table_bucket(dict, &dict->table[1], entry->key.hash, 1);
+
+            if(!dst) {
+                /* no memory for the page, retry next time */
+                nst_dict_unlock(dict, idx);
+
+                return 1;
+            }
+
+            *bucket     = entry->next;
+            entry->next = NULL;
+
+            /*
+             * append to keep the order of entries with same key, the newer
+             * ones come first
+             */
+            if(*dst) {
+                tail = *dst;
+
+                while(tail->next) {
+                    tail = tail->next;
+                }
+
+                tail->next = entry;
+            } else {
+                *dst = entry;
+            }
+
+            _nst_dict_table_tags_update(dict, &dict->table[1], entry->key.hash);
         }
+
+        _nst_dict_table_tags_update(dict, &dict->table[0], idx);
+
+        nst_dict_unlock(dict, idx);
+
+        dict->rehash_idx = ++idx;
+    }
+
+    if(idx < dict->table[0].size) {
+        return 1;
     }
 
-    for(i = 0; i < dict->size; i++) {
-        dict->entry[i] = NULL;
+    /* the previous table[0] is not reclaimed yet */
+    if(dict->retired.table.page) {
+        return 1;
     }
 
-    return nst_shctx_init(dict);
+    _nst_dict_lock_all(dict);
+
+    if(dict->rehash_pause) {
+        goto out;
+    }
+
+    _nst_dict_table_seq_begin(dict);
+
+    dict->retired.table = dict->table[0];
+    dict->table[0]      = dict->table[1];
+    dict->table[1].page = NULL;
+    dict->table[1].tag  = NULL;
+    dict->table[1].size = 0;
+    dict->rehash_idx    = -1;
+    dict->cleanup_idx   = 0;
+    dict->evict_idx     = 0;
+    dict->compact_idx   = 0;
+    dict->sync_idx      = 0;
+
+    _nst_dict_table_seq_end(dict);
+
+out:
+    _nst_dict_unlock_all(dict);
+
+    return nst_dict_rehashing(dict);
 }
 
 /*
- * Check entry validity, free the entry if its invalid,
+ * Iterators which walk through buckets across several calls, like the
+ * purger, pause rehashing so that no bucket is skipped or visited twice.
  */
 void
-nst_dict_cleanup(nst_dict_t *dict) {
+nst_dict_rehash_pause(nst_dict_t *dict) {
+    __sync_add_and_fetch(&dict->rehash_pause, 1);
+}
+
+void
+nst_dict_rehash_resume(nst_dict_t *dict) {
+    __sync_sub_and_fetch(&dict->rehash_pause, 1);
+}
+
+/*
+ * Free what was retired before the last epoch flip once no reader of the
+ * previous epoch is left, then flip the epoch again if anything was
+ * retired since. Called by the master process only.
+ */
+void
+nst_dict_reclaim(nst_dict_t *dict) {
+    nst_memory_t      *mem = &dict->store->memory;
     nst_dict_entry_t  *entry;
-    nst_dict_entry_t  *prev;
-    uint64_t           start;
+    nst_memory_obj_t  *obj;
 
-    if(!dict->used) {
+    /*
+     * readers of the previous epoch can still see what is in reclaim, and
+     * they share their counter with readers of the next epoch
+     */
+    if(dict->readers[(dict->epoch - 1) & 1]) {
         return;
     }
 
-    start = nst_time_now_ms();
+    if(dict->reclaim.entry || dict->reclaim.obj || dict->reclaim.table.page) {
 
-    nst_shctx_lock(dict);
+        while(dict->reclaim.entry) {
+            entry = dict->reclaim.entry;
 
-    entry = dict->entry[dict->cleanup_idx];
-    prev  = entry;
+            dict->reclaim.entry = entry->next;
 
-    while(entry) {
+            nst_shmem_free(dict->shmem, entry->store.disk.file);
+            nst_shmem_free(dict->shmem, entry->buf.area);
+            nst_shmem_free(dict->shmem, entry->key.data);
+            nst_shmem_free(dict->shmem, entry);
+        }
 
-        if(nst_dict_entry_invalid(entry)) {
-            nst_dict_entry_t  *tmp = entry;
+        while(dict->reclaim.obj) {
+            obj = dict->reclaim.obj;
 
-            if(entry->store.memory.obj) {
-                entry->store.memory.obj->invalid = 1;
-                entry->store.memory.obj          = NULL;
+            dict->reclaim.obj = obj->next;
 
-                nst_memory_incr_invalid(&dict->store->memory);
-            }
+            nst_memory_obj_free(mem, obj);
+        }
 
-            if(entry->store.disk.file) {
-                nst_shmem_free(dict->shmem, entry->store.disk.file);
-                entry->store.disk.file = NULL;
-            }
+        if(dict->reclaim.table.page) {
+            _nst_dict_table_free(dict, &dict->reclaim.table);
+        }
+    }
 
-            if(prev == entry) {
-                dict->entry[dict->cleanup_idx] = entry->next;
-                prev = entry->next;
-            } else {
-                prev->next = entry->next;
-            }
+    dict->retired.obj = nst_memory_retired(mem);
 
-            entry = entry->next;
+    if(dict->retired.entry || dict->retired.obj || dict->retired.table.page) {
+        dict->reclaim = dict->retired;
 
-            nst_shmem_free(dict->shmem, tmp->buf.area);
-            nst_shmem_free(dict->shmem, tmp->key.data);
-            nst_shmem_free(dict->shmem, tmp);
+        memset(&dict->retired, 0, sizeof(dict->retired));
 
-            dict->used--;
-        } else {
-            prev  = entry;
-            entry = entry->next;
-        }
+        /* readers entering from now on cannot see what is in reclaim */
+        __sync_add_and_fetch(&dict->epoch, 1);
+    }
+}
 
-        if(nst_time_now_ms() - start >= 10) {
-            break;
-        }
+/*
+ * Lock free lookup for memory hits, must be called between
+ * nst_dict_read_begin and nst_dict_read_end.
+ * return the entry if it is valid and its memory object, which is attached
+ * to obj, is valid too. Otherwise NULL, and callers should fall back to
+ * nst_dict_get with the stripe locked.
+ */
+nst_dict_entry_t *
+nst_dict_get_lockless(nst_dict_t *dict, nst_key_t *key, nst_memory_obj_t **obj) {
+    nst_dict_table_t   table[2];
+    nst_dict_entry_t  *entry = NULL;
+    nst_memory_obj_t  *o;
+    unsigned int       seq;
+    int                rehashing;
+
+    seq = *(volatile unsigned int *)&dict->table_seq;
+
+    if(seq & 1) {
+        return NULL;
     }
 
-    if(entry == NULL) {
-        dict->cleanup_idx++;
+    __sync_synchronize();
+
+    table[0]  = dict->table[0];
+    table[1]  = dict->table[1];
+    rehashing = nst_dict_rehashing(dict);
+
+    __sync_synchronize();
+
+    if(seq != *(volatile unsigned int *)&dict->table_seq) {
+        return NULL;
     }
 
-    /* if we have checked the whole dict */
-    if(dict->cleanup_idx == dict->size) {
-        dict->cleanup_idx = 0;
+    if(rehashing) {
+        entry = _nst_dict_table_lookup(dict, &table[1], key);
+    }
+
+    if(!entry) {
+        entry = _nst_dict_table_lookup(dict, &table[0], key);
+    }
+
+    if(!entry) {
+        return NULL;
+    }
+
+    if(entry->state != NST_DICT_ENTRY_STATE_VALID && entry->state != NST_DICT_ENTRY_STATE_UPDATE) {
+        return NULL;
+    }
+
+    if(nst_dict_entry_expired(entry)) {
+        return NULL;
+    }
+
+    o = *(nst_memory_obj_t * volatile *)&entry->store.memory.obj;
+
+    if(!o) {
+        return NULL;
+    }
+
+    nst_memory_obj_attach(&dict->store->memory, o);
+
+    /* invalidated after we read it, it will not be freed before we leave */
+    if(o->invalid) {
+        nst_memory_obj_detach(&dict->store->memory, o);
+
+        return NULL;
     }
 
-    nst_shctx_unlock(dict);
+    entry->atime = nst_time_now_ms();
+
+    *obj = o;
+
+    return entry;
 }
 
 nst_dict_entry_t *
 nst_dict_set(nst_dict_t *dict, nst_key_t *key, nst_http_txn_t *txn, nst_rule_prop_t *prop) {
-    nst_dict_entry_t  *entry = NULL;
-    int                idx;
+    nst_dict_entry_t  **bucket;
+    nst_dict_entry_t   *entry = NULL;
+
+    bucket = _nst_dict_bucket(dict, key->hash);
+
+    if(!bucket) {
+        goto err;
+    }
 
     entry = nst_shmem_alloc(dict->shmem, sizeof(*entry));
 
@@ -130,13 +1260,6 @@ nst_dict_set(nst_dict_t *dict, nst_key_t *key, nst_http_txn_t *txn, nst_rule_pro
 
     memset(entry, 0, sizeof(*entry));
 
-    idx = key->hash % dict->size;
-
-    /* prepend entry to dict->entry[idx] */
-    entry->next      = dict->entry[idx];
-    dict->entry[idx] = entry;
-    dict->used++;
-
     /* init entry */
     entry->state = NST_DICT_ENTRY_STATE_INIT;
 
@@ -154,7 +1277,8 @@ nst_dict_set(nst_dict_t *dict, nst_key_t *key, nst_http_txn_t *txn, nst_rule_pro
 
     /* set buf */
     entry->buf.size = txn->req.host.len + txn->req.path.len + txn->res.etag.len
-        + txn->res.last_modified.len + prop->pid.len + prop->rid.len;
+        + txn->res.last_modified.len + txn->res.tags.len + txn->res.vary.len
+        + prop->pid.len + prop->rid.len;
 
     entry->buf.data = 0;
     entry->buf.area = nst_shmem_alloc(dict->shmem, entry->buf.size);
@@ -175,6 +1299,12 @@ nst_dict_set(nst_dict_t *dict, nst_key_t *key, nst_http_txn_t *txn, nst_rule_pro
     entry->last_modified = ist2(entry->buf.area + entry->buf.data, txn->res.last_modified.len);
     chunk_istcat(&entry->buf, txn->res.last_modified);
 
+    entry->tags = ist2(entry->buf.area + entry->buf.data, txn->res.tags.len);
+    chunk_istcat(&entry->buf, txn->res.tags);
+
+    entry->vary = ist2(entry->buf.area + entry->buf.data, txn->res.vary.len);
+    chunk_istcat(&entry->buf, txn->res.vary);
+
     entry->prop.pid = ist2(entry->buf.area + entry->buf.data, prop->pid.len);
     chunk_istcat(&entry->buf, prop->pid);
 
@@ -195,12 +1325,26 @@ nst_dict_set(nst_dict_t *dict, nst_key_t *key, nst_http_txn_t *txn, nst_rule_pro
     entry->expire             = 0;
     entry->atime              = nst_time_now_ms();
 
+    if(_nst_dict_index_entry(dict, entry) != NST_OK) {
+        goto err;
+    }
+
+    /* prepend entry to bucket once initialized, lock free readers may see it */
+    entry->next = *bucket;
+    __sync_synchronize();
+    *bucket     = entry;
+    __sync_add_and_fetch(&dict->used, 1);
+
+    _nst_dict_table_tags_update(dict, _nst_dict_table(dict), key->hash);
+
     return entry;
 
 err:
 
     if(entry) {
-        entry->state = NST_DICT_ENTRY_STATE_INVALID;
+        nst_shmem_free(dict->shmem, entry->key.data);
+        nst_shmem_free(dict->shmem, entry->buf.area);
+        nst_shmem_free(dict->shmem, entry);
     }
 
     return NULL;
@@ -214,132 +1358,110 @@ nst_dict_entry_t *
 nst_dict_get(nst_dict_t *dict, nst_key_t *key) {
     nst_dict_entry_t  *entry = NULL;
     uint64_t           max;
-    int                idx, expired;
+    int                expired;
 
     if(dict->used == 0) {
         return NULL;
     }
 
-    idx   = key->hash % dict->size;
-    entry = dict->entry[idx];
+    entry = _nst_dict_lookup(dict, key);
 
-    while(entry) {
-
-        if(entry->key.hash == key->hash && entry->key.size == key->size
-                && !memcmp(entry->key.uuid, key->uuid, NST_KEY_UUID_LEN)
-                && !memcmp(entry->key.data, key->data, key->size)) {
-
-            if(entry->state == NST_DICT_ENTRY_STATE_INVALID) {
-                return NULL;
-            }
-
-            if(entry->state == NST_DICT_ENTRY_STATE_INIT
-                    || entry->state == NST_DICT_ENTRY_STATE_UPDATE) {
+    if(!entry) {
+        return NULL;
+    }
 
-                return entry;
-            }
+    if(entry->state == NST_DICT_ENTRY_STATE_INVALID) {
+        return NULL;
+    }
 
-            if(entry->state == NST_DICT_ENTRY_STATE_STALE) {
+    if(entry->state == NST_DICT_ENTRY_STATE_INIT
+            || entry->state == NST_DICT_ENTRY_STATE_UPDATE) {
 
-                if(nst_dict_entry_stale_valid(entry)) {
-                    return entry;
-                } else {
-                    return NULL;
-                }
-            }
+        return entry;
+    }
 
-            /*
-             * check extend
-             */
-            expired = nst_dict_entry_expired(entry);
+    if(entry->state == NST_DICT_ENTRY_STATE_STALE) {
 
-            max = 1000 * entry->expire + 1000 * entry->prop.ttl * entry->prop.extend[3] / 100;
+        if(nst_dict_entry_stale_valid(entry)) {
+            return entry;
+        } else {
+            return NULL;
+        }
+    }
 
-            entry->atime = nst_time_now_ms();
+    /*
+     * check extend
+     */
+    expired = nst_dict_entry_expired(entry);
 
-            if(expired && entry->prop.extend[0] != 0xFF && entry->atime <= max
-                    && entry->access[3] > entry->access[2]
-                    && entry->access[2] > entry->access[1]) {
+    max = 1000 * entry->expire + 1000 * entry->prop.ttl * entry->prop.extend[3] / 100;
 
-                entry->expire    += entry->prop.ttl;
+    entry->atime = nst_time_now_ms();
 
-                entry->access[0] += entry->access[1];
-                entry->access[0] += entry->access[2];
-                entry->access[0] += entry->access[3];
-                entry->access[1]  = 0;
-                entry->access[2]  = 0;
-                entry->access[3]  = 0;
-                entry->extended  += 1;
+    if(expired && entry->prop.extend[0] != 0xFF && entry->atime <= max
+            && entry->access[3] > entry->access[2]
+            && entry->access[2] > entry->access[1]) {
 
-                if(entry->store.disk.file) {
-                    nst_disk_update_expire(entry->store.disk.file, entry->expire);
-                }
+        entry->expire    += entry->prop.ttl;
 
-                expired = 0;
-            }
+        entry->access[0] += entry->access[1];
+        entry->access[0] += entry->access[2];
+        entry->access[0] += entry->access[3];
+        entry->access[1]  = 0;
+        entry->access[2]  = 0;
+        entry->access[3]  = 0;
+        entry->extended  += 1;
 
-            /*
-             * check stale
-             */
-            if(expired && entry->prop.stale >= 0) {
-                entry->state = NST_DICT_ENTRY_STATE_REFRESH;
+        if(entry->store.disk.file) {
+            nst_disk_update_expire(entry->store.disk.file, entry->store.disk.base, entry->expire);
+            nst_disk_journal(&dict->store->disk, entry, 0);
+        }
 
-                expired = 0;
-            }
+        expired = 0;
+    }
 
-            /* check expire
-             * change state only, leave the free stuff to cleanup
-             * */
-            if(expired) {
-                entry->state     = NST_DICT_ENTRY_STATE_INVALID;
-                entry->expire    = 0;
-                entry->access[0] = 0;
-                entry->access[1] = 0;
-                entry->access[2] = 0;
-                entry->access[3] = 0;
-                entry->extended  = 0;
-
-                if(entry->store.memory.obj) {
-                    entry->store.memory.obj->invalid = 1;
-                    entry->store.memory.obj          = NULL;
-
-                    nst_memory_incr_invalid(&dict->store->memory);
-                }
+    /*
+     * check stale
+     */
+    if(expired && entry->prop.stale >= 0) {
+        entry->state = NST_DICT_ENTRY_STATE_REFRESH;
 
-                return NULL;
-            }
+        expired = 0;
+    }
 
-            return entry;
+    /* check expire
+     * change state only, leave the free stuff to cleanup
+     * */
+    if(expired) {
+        entry->state     = NST_DICT_ENTRY_STATE_INVALID;
+        entry->expire    = 0;
+        entry->access[0] = 0;
+        entry->access[1] = 0;
+        entry->access[2] = 0;
+        entry->access[3] = 0;
+        entry->extended  = 0;
+
+        if(entry->store.memory.obj) {
+            entry->store.memory.obj->invalid = 1;
+            entry->store.memory.obj          = NULL;
+
+            nst_memory_incr_invalid(&dict->store->memory);
         }
 
-        entry = entry->next;
+        return NULL;
     }
 
-    return NULL;
+    return entry;
 }
 
 int
 nst_dict_set_from_disk(nst_dict_t *dict, hpx_buffer_t *buf, nst_key_t *key, nst_http_txn_t *txn,
-        nst_rule_prop_t *prop, char *file, uint64_t expire) {
-
-    nst_dict_entry_t  *entry = NULL;
-    int                idx;
-
-    idx = key->hash % dict->size;
-
-    entry = dict->entry[idx];
-
-    while(entry) {
-
-        if(entry->key.hash == key->hash && entry->key.size == key->size
-                && !memcmp(entry->key.uuid, key->uuid, NST_KEY_UUID_LEN)
-                && !memcmp(entry->key.data, key->data, key->size)) {
+        nst_rule_prop_t *prop, char *file, uint64_t base, uint64_t expire) {
 
-            break;
-        }
+    nst_dict_entry_t  **bucket;
+    nst_dict_entry_t   *entry = NULL;
 
-        entry = entry->next;
-    }
+    entry = _nst_dict_lookup(dict, key);
 
     if(entry) {
         nst_shmem_free(dict->shmem, key->data);
@@ -348,6 +1470,12 @@ nst_dict_set_from_disk(nst_dict_t *dict, hpx_buffer_t *buf, nst_key_t *key, nst_
         return NST_OK;
     }
 
+    bucket = _nst_dict_bucket(dict, key->hash);
+
+    if(!bucket) {
+        return NST_ERR;
+    }
+
     entry = nst_shmem_alloc(dict->shmem, sizeof(*entry));
 
     if(!entry) {
@@ -356,11 +1484,6 @@ nst_dict_set_from_disk(nst_dict_t *dict, hpx_buffer_t *buf, nst_key_t *key, nst_
 
     memset(entry, 0, sizeof(*entry));
 
-    /* prepend entry to dict->entry[idx] */
-    entry->next      = dict->entry[idx];
-    dict->entry[idx] = entry;
-    dict->used++;
-
     /* init entry */
     if(expire == 0 || expire * 1000 > nst_time_now_ms()) {
         entry->state = NST_DICT_ENTRY_STATE_VALID;
@@ -372,7 +1495,7 @@ nst_dict_set_from_disk(nst_dict_t *dict, hpx_buffer_t *buf, nst_key_t *key, nst_
     entry->expire = expire;
     entry->atime  = nst_time_now_ms();
 
-    entry->store.disk.file = nst_shmem_alloc(dict->shmem, strlen(file));
+    entry->store.disk.file = nst_shmem_alloc(dict->shmem, strlen(file) + 1);
 
     if(!entry->store.disk.file) {
         nst_shmem_free(dict->shmem, entry);
@@ -380,7 +1503,9 @@ nst_dict_set_from_disk(nst_dict_t *dict, hpx_buffer_t *buf, nst_key_t *key, nst_
         return NST_ERR;
     }
 
-    memcpy(entry->store.disk.file, file, strlen(file));
+    memcpy(entry->store.disk.file, file, strlen(file) + 1);
+
+    entry->store.disk.base = base;
 
     entry->header_len         = txn->res.header_len;
     entry->payload_len        = txn->res.payload_len;
@@ -389,6 +1514,7 @@ nst_dict_set_from_disk(nst_dict_t *dict, hpx_buffer_t *buf, nst_key_t *key, nst_
     entry->path               = txn->req.path;
     entry->etag               = txn->res.etag;
     entry->last_modified      = txn->res.last_modified;
+    entry->tags               = txn->res.tags;
     entry->prop.pid           = prop->pid;
     entry->prop.rid           = prop->rid;
     entry->prop.ttl           = prop->ttl;
@@ -401,6 +1527,109 @@ nst_dict_set_from_disk(nst_dict_t *dict, hpx_buffer_t *buf, nst_key_t *key, nst_
     entry->prop.stale         = prop->stale;
     entry->prop.inactive      = prop->inactive;
 
+    if(_nst_dict_index_entry(dict, entry) != NST_OK) {
+        nst_shmem_free(dict->shmem, entry->store.disk.file);
+        nst_shmem_free(dict->shmem, entry);
+
+        return NST_ERR;
+    }
+
+    /* prepend entry to bucket once initialized, lock free readers may see it */
+    entry->next = *bucket;
+    __sync_synchronize();
+    *bucket     = entry;
+    __sync_add_and_fetch(&dict->used, 1);
+
+    _nst_dict_table_tags_update(dict, _nst_dict_table(dict), key->hash);
+
+    return NST_OK;
+}
+
+/*
+ * Drop the entry of key restored from disk if its object is at base of file,
+ * or whatever its object is if file is NULL. The caller holds the lock of key.
+ */
+int
+nst_dict_unset_from_disk(nst_dict_t *dict, nst_key_t *key, char *file, uint64_t base) {
+    nst_dict_entry_t  **bucket;
+    nst_dict_entry_t   *entry;
+    nst_dict_table_t   *table;
+    int                 i;
+
+    for(i = nst_dict_rehashing(dict); i >= 0; i--) {
+        table  = &dict->table[i];
+        bucket = _nst_dict_table_bucket(dict, table, key->hash, 0);
+
+        while(bucket && (entry = *bucket)) {
+
+            if(entry->key.hash != key->hash || entry->key.size != key->size
+                    || memcmp(entry->key.uuid, key->uuid, NST_KEY_UUID_LEN)
+                    || memcmp(entry->key.data, key->data, key->size)) {
+
+                bucket = &entry->next;
+
+                continue;
+            }
+
+            if(file && (!entry->store.disk.file || entry->store.disk.base != base
+                        || strcmp(entry->store.disk.file, file) != 0)) {
+
+                return NST_ERR;
+            }
+
+            if(entry->store.memory.obj) {
+                entry->store.memory.obj->invalid = 1;
+                entry->store.memory.obj          = NULL;
+
+                nst_memory_incr_invalid(&dict->store->memory);
+            }
+
+            *bucket = entry->next;
+
+            nst_dict_index_remove(dict, entry);
+
+            /* lock free readers may still see it, see nst_dict_reclaim */
+            entry->state = NST_DICT_ENTRY_STATE_INVALID;
+            entry->next  = dict->retired.entry;
+
+            dict->retired.entry = entry;
+
+            __sync_sub_and_fetch(&dict->used, 1);
+
+            _nst_dict_table_tags_update(dict, table, key->hash);
+
+            return NST_OK;
+        }
+    }
+
+    return NST_ERR;
+}
+
+/*
+ * Check that the entry of key has its object at base of file, and move it to
+ * to_base of to if set. Segment files have names of the same length, so the
+ * file of the entry is rewritten in place. The caller holds the lock of key.
+ */
+int
+nst_dict_move_disk(nst_dict_t *dict, nst_key_t *key, char *file, uint64_t base, char *to,
+        uint64_t to_base) {
+
+    nst_dict_entry_t  *entry = _nst_dict_lookup(dict, key);
+
+    if(!entry || !entry->store.disk.file || entry->store.disk.base != base
+            || strcmp(entry->store.disk.file, file) != 0) {
+
+        return NST_ERR;
+    }
+
+    if(to) {
+        memcpy(entry->store.disk.file, to, strlen(to) + 1);
+
+        entry->store.disk.base = to_base;
+
+        nst_disk_journal(&dict->store->disk, entry, 0);
+    }
+
     return NST_OK;
 }
 
@@ -106,34 +106,695 @@ nst_http_find_param(char *query_beg, char *query_end, char *name, char **val, in
     return NST_ERR;
 }
 
+/*
+ * Add the records of item from *offset to htx. A data record can be added
+ * partially, *left is the number of its bytes not added yet.
+ * return NST_OK once the whole item is added, NST_ERR if htx is full
+ */
+int
+nst_http_memory_item_to_htx(nst_memory_item_t *item, uint32_t *offset, uint32_t *left,
+        hpx_htx_t *htx) {
+
+    hpx_htx_blk_t      *blk;
+    uint32_t            blksz, info;
+    size_t              sz;
+    hpx_htx_blk_type_t  type;
+
+    while(*offset < item->used) {
+
+        if(*left == 0) {
+            memcpy(&info, item->data + *offset, 4);
+
+            type  = (info >> 28);
+            blksz = nst_memory_blksz(info);
+
+            if(type == HTX_BLK_DATA) {
+                *offset += 4;
+                *left    = blksz;
+
+                continue;
+            }
+
+            blk = htx_add_blk(htx, type, blksz);
+
+            if(!blk) {
+                return NST_ERR;
+            }
+
+            blk->info = info;
+
+            memcpy(htx_get_blk_ptr(htx, blk), item->data + *offset + 4, blksz);
+
+            *offset += 4 + blksz;
+
+            continue;
+        }
+
+        /* htx_add_data does not split data for an empty htx */
+        sz = htx_free_data_space(htx);
+        sz = sz < *left ? sz : *left;
+        sz = sz ? htx_add_data(htx, ist2(item->data + *offset, sz)) : 0;
+
+        *offset += sz;
+        *left   -= sz;
+
+        if(*left) {
+            return NST_ERR;
+        }
+    }
+
+    return NST_OK;
+}
+
+/*
+ * Decode *left bytes of data from *offset through z and add them to htx,
+ * with *left 0 only flush the pending output. Trailing bytes after the end
+ * of the encoded body or a corrupted body are dropped.
+ * return NST_OK once the input is consumed and no output is pending, NST_ERR
+ * if htx is full
+ */
+int
+nst_http_inflate_to_htx(nst_memory_zstream_t *z, const char *data, uint32_t *offset,
+        uint32_t *left, hpx_htx_t *htx) {
+
+#if defined(USE_ZLIB)
+    hpx_buffer_t  *out = get_trash_chunk();
+    size_t         room;
+    uint32_t       n;
+    int            ret;
+
+    while(!z->end) {
+        room = htx_free_data_space(htx);
+        room = room < out->size ? room : out->size;
+
+        if(!room) {
+            return NST_ERR;
+        }
+
+        z->zs.next_in   = (Bytef *)(data ? data + *offset : NULL);
+        z->zs.avail_in  = *left;
+        z->zs.next_out  = (Bytef *)out->area;
+        z->zs.avail_out = room;
+
+        ret = inflate(&z->zs, Z_NO_FLUSH);
+
+        n        = *left - z->zs.avail_in;
+        *offset += n;
+        *left   -= n;
+
+        n = room - z->zs.avail_out;
+
+        if(n) {
+            htx_add_data(htx, ist2(out->area, n));
+        }
+
+        if(ret != Z_OK && ret != Z_BUF_ERROR) {
+            z->end = 1;
+
+            break;
+        }
+
+        if(!*left && (z->zs.avail_out || ret == Z_BUF_ERROR)) {
+            return NST_OK;
+        }
+    }
+#endif
+
+    *offset += *left;
+    *left    = 0;
+
+    return NST_OK;
+}
+
+/*
+ * Same as nst_http_memory_item_to_htx for an object with an encoded body.
+ * With z the body is decoded through it, otherwise the encoded body is added
+ * as is, with a content-encoding header, the content-length of the encoded
+ * body and a weak etag.
+ */
 int
-nst_http_memory_item_to_htx(nst_memory_item_t *item, hpx_htx_t *htx) {
+nst_http_memory_item_encoded_to_htx(nst_memory_obj_t *obj, nst_memory_item_t *item,
+        uint32_t *offset, uint32_t *left, nst_memory_zstream_t *z, hpx_htx_t *htx) {
+
     hpx_htx_blk_t      *blk;
-    uint32_t            blksz, sz, info;
-    char               *ptr;
+    hpx_buffer_t       *buf;
+    hpx_ist_t           name, value;
+    uint32_t            blksz, info, zero;
+    size_t              sz;
     hpx_htx_blk_type_t  type;
 
-    info  = item->info;
-    type  = (info >> 28);
-    blksz = ((type == HTX_BLK_HDR || type == HTX_BLK_TLR)
-            ? (info & 0xff) + ((info >> 8) & 0xfffff)
-            : info & 0xfffffff);
+    while(*offset < item->used) {
+
+        if(*left == 0) {
+            memcpy(&info, item->data + *offset, 4);
+
+            type  = (info >> 28);
+            blksz = nst_memory_blksz(info);
+
+            if(type == HTX_BLK_DATA) {
+                *offset += 4;
+                *left    = blksz;
+
+                continue;
+            }
+
+            if(z && (type == HTX_BLK_TLR || type == HTX_BLK_EOT)) {
+                zero = 0;
+
+                if(nst_http_inflate_to_htx(z, NULL, &zero, &zero, htx) != NST_OK) {
+                    return NST_ERR;
+                }
+            }
+
+            if(!z && type == HTX_BLK_HDR) {
+                name  = ist2(item->data + *offset + 4, info & 0xff);
+                value = ist2(name.ptr + name.len, (info >> 8) & 0xfffff);
+
+                if(isteqi(name, ist("content-length"))) {
+                    value = ist(ultoa(obj->length));
+                } else if(isteqi(name, ist("etag")) && !istmatch(value, ist("W/"))) {
+                    buf = get_trash_chunk();
+
+                    chunk_printf(buf, "W/%.*s", (int)value.len, value.ptr);
+
+                    value = ist2(buf->area, buf->data);
+                }
+
+                if(!htx_add_header(htx, name, value)) {
+                    return NST_ERR;
+                }
+
+                *offset += 4 + blksz;
+
+                continue;
+            }
+
+            if(!z && type == HTX_BLK_EOH) {
+
+                /* content-encoding and eoh are added at once */
+                if(htx_free_space(htx) < 2 * sizeof(*blk) + 16 + 8 + blksz) {
+                    return NST_ERR;
+                }
+
+                htx_add_header(htx, ist("content-encoding"),
+                        ist(nst_memory_encoding_str(obj->encoding)));
+            }
+
+            blk = htx_add_blk(htx, type, blksz);
+
+            if(!blk) {
+                return NST_ERR;
+            }
 
-    blk = htx_add_blk(htx, type, blksz);
+            blk->info = info;
 
-    if(!blk) {
+            memcpy(htx_get_blk_ptr(htx, blk), item->data + *offset + 4, blksz);
+
+            *offset += 4 + blksz;
+
+            continue;
+        }
+
+        if(z) {
+
+            if(nst_http_inflate_to_htx(z, item->data, offset, left, htx) != NST_OK) {
+                return NST_ERR;
+            }
+
+            continue;
+        }
+
+        sz = htx_free_data_space(htx);
+        sz = sz < *left ? sz : *left;
+        sz = sz ? htx_add_data(htx, ist2(item->data + *offset, sz)) : 0;
+
+        *offset += sz;
+        *left   -= sz;
+
+        if(*left) {
+            return NST_ERR;
+        }
+    }
+
+    return NST_OK;
+}
+
+/*
+ * Check if the accept-encoding header of the request accepts encoding, an
+ * explicit q=0 refuses it
+ * return 1 if accepted, 0 otherwise
+ */
+int
+nst_http_accept_encoding(hpx_htx_t *htx, int encoding) {
+    hpx_http_hdr_ctx_t  hdr  = { .blk = NULL };
+    hpx_ist_t           name = ist(nst_memory_encoding_str(encoding));
+    hpx_ist_t           token;
+    const char         *p, *end;
+    int                 q, star = 0;
+
+    while(http_find_header(htx, ist("Accept-Encoding"), &hdr, 0)) {
+        p   = hdr.value.ptr;
+        end = hdr.value.ptr + hdr.value.len;
+
+        while(p < end && *p != ';' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+
+        token = ist2(hdr.value.ptr, p - hdr.value.ptr);
+        q     = 1000;
+
+        while(p < end) {
+
+            if((*p == 'q' || *p == 'Q') && (p[-1] == ';' || p[-1] == ' ')
+                    && p + 1 < end && p[1] == '=') {
+                q = http_parse_qvalue(p + 2, NULL);
+
+                break;
+            }
+
+            p++;
+        }
+
+        if(isteqi(token, name) || (encoding == NST_MEMORY_ENCODING_GZIP
+                    && isteqi(token, ist("x-gzip")))) {
+
+            return q > 0;
+        }
+
+        if(isteq(token, ist("*"))) {
+            star = q > 0;
+        }
+    }
+
+    return star;
+}
+
+/*
+ * Add the start line and headers of a memory object to htx, up to EOH
+ * return NST_OK once EOH is added, NST_ERR if htx is full
+ */
+int
+nst_http_memory_headers_to_htx(nst_memory_item_t **item, uint32_t *offset, hpx_htx_t *htx) {
+    hpx_htx_blk_t      *blk;
+    uint32_t            blksz, info;
+    hpx_htx_blk_type_t  type;
+
+    while(*item) {
+
+        while(*offset < (*item)->used) {
+            memcpy(&info, (*item)->data + *offset, 4);
+
+            type  = (info >> 28);
+            blksz = nst_memory_blksz(info);
+
+            if(type != HTX_BLK_DATA) {
+                blk = htx_add_blk(htx, type, blksz);
+
+                if(!blk) {
+                    return NST_ERR;
+                }
+
+                blk->info = info;
+
+                memcpy(htx_get_blk_ptr(htx, blk), (*item)->data + *offset + 4, blksz);
+            }
+
+            *offset += 4 + blksz;
+
+            if(type == HTX_BLK_EOH) {
+                return NST_OK;
+            }
+        }
+
+        *item   = (*item)->next;
+        *offset = 0;
+    }
+
+    return NST_OK;
+}
+
+/*
+ * Add *left bytes of the payload of a memory object starting at payload
+ * offset *pos to htx. Extents are skipped with their payload size, so that
+ * only the records of the extent holding *pos are walked.
+ * return NST_OK once done, NST_ERR if htx is full
+ */
+int
+nst_http_memory_range_to_htx(nst_memory_obj_t *obj, uint64_t *pos, uint64_t *left,
+        hpx_htx_t *htx) {
+
+    nst_memory_item_t  *item = obj->item;
+    uint64_t            skip = *pos;
+    uint32_t            offset, blksz, info;
+    size_t              sz;
+
+    while(item && skip >= item->payload) {
+        skip -= item->payload;
+        item  = item->next;
+    }
+
+    for(; item && *left; item = item->next) {
+        offset = 0;
+
+        while(offset < item->used && *left) {
+            memcpy(&info, item->data + offset, 4);
+
+            blksz   = nst_memory_blksz(info);
+            offset += 4;
+
+            if((info >> 28) == HTX_BLK_DATA) {
+
+                if(skip < blksz) {
+                    /* htx_add_data does not split data for an empty htx */
+                    sz = htx_free_data_space(htx);
+                    sz = sz < blksz - skip ? sz : blksz - skip;
+                    sz = sz < *left ? sz : *left;
+                    sz = sz ? htx_add_data(htx, ist2(item->data + offset + skip, sz)) : 0;
+
+                    *pos  += sz;
+                    *left -= sz;
+
+                    if(*left && sz < blksz - skip) {
+                        return NST_ERR;
+                    }
+
+                    skip = 0;
+                } else {
+                    skip -= blksz;
+                }
+            }
+
+            offset += blksz;
+        }
+    }
+
+    *left = 0;
+
+    return NST_OK;
+}
+
+static const char *
+_nst_http_range_num(const char *p, const char *end, uint64_t *v) {
+    const char  *beg = p;
+
+    *v = 0;
+
+    while(p < end && isdigit((unsigned char)*p) && p - beg < 18) {
+        *v = *v * 10 + (*p - '0');
+        p++;
+    }
+
+    return p == beg || (p < end && isdigit((unsigned char)*p)) ? NULL : p;
+}
+
+/*
+ * Parse the Range header of a request for a payload of total bytes, it is
+ * ignored if it does not match the If-Range header, is malformed, or asks
+ * for too many ranges.
+ * return the number of ranges to send, 0 to send the whole payload, -1 if
+ * none can be satisfied
+ */
+int
+nst_http_parse_range(hpx_htx_t *htx, nst_http_txn_t *txn, uint64_t total,
+        nst_http_range_t *range) {
+
+    hpx_http_hdr_ctx_t  hdr = { .blk = NULL };
+    hpx_ist_t           value;
+    const char         *p, *end;
+    uint64_t            first, last;
+    int                 specs = 0;
+
+    if(!http_find_header(htx, ist("Range"), &hdr, 1)) {
+        return 0;
+    }
+
+    value = hdr.value;
+
+    if(http_find_header(htx, ist("Range"), &hdr, 1)) {
+        return 0;
+    }
+
+    hdr.blk = NULL;
+
+    if(http_find_header(htx, ist("If-Range"), &hdr, 1)) {
+
+        if(istmatch(hdr.value, ist("W/"))) {
+            return 0;
+        }
+
+        if(!isteq(hdr.value, txn->res.etag) && !isteq(hdr.value, txn->res.last_modified)) {
+            return 0;
+        }
+    }
+
+    if(value.len < 6 || strncasecmp(value.ptr, "bytes=", 6)) {
+        return 0;
+    }
+
+    memset(range, 0, offsetof(nst_http_range_t, first));
+
+    range->total    = total;
+    range->boundary = ha_random64();
+
+    p   = value.ptr + 6;
+    end = value.ptr + value.len;
+
+    while(p < end) {
+
+        while(p < end && (HTTP_IS_LWS(*p) || *p == ',')) {
+            p++;
+        }
+
+        if(p == end) {
+            break;
+        }
+
+        specs++;
+
+        if(*p == '-') {
+            p = _nst_http_range_num(p + 1, end, &last);
+
+            if(!p) {
+                return 0;
+            }
+
+            if(!last || !total) {
+                goto next;
+            }
+
+            first = total > last ? total - last : 0;
+            last  = total - 1;
+        } else {
+            p = _nst_http_range_num(p, end, &first);
+
+            if(!p || p == end || *p != '-') {
+                return 0;
+            }
+
+            last = total - 1;
+
+            if(p + 1 < end && isdigit((unsigned char)p[1])) {
+                p = _nst_http_range_num(p + 1, end, &last);
+
+                if(!p) {
+                    return 0;
+                }
+
+                if(last < first) {
+                    return 0;
+                }
+            } else {
+                p++;
+            }
+
+            if(first >= total) {
+                goto next;
+            }
+
+            if(last >= total) {
+                last = total - 1;
+            }
+        }
+
+        if(range->count == NST_HTTP_RANGE_MAX) {
+            return 0;
+        }
+
+        range->first[range->count] = first;
+        range->last[range->count]  = last;
+        range->count++;
+
+next:
+        while(p < end && HTTP_IS_LWS(*p)) {
+            p++;
+        }
+
+        if(p < end && *p != ',') {
+            return 0;
+        }
+    }
+
+    if(!specs) {
+        return 0;
+    }
+
+    return range->count ? range->count : -1;
+}
+
+static void
+_nst_http_range_part(nst_http_range_t *range, int i, hpx_buffer_t *buf) {
+
+    chunk_printf(buf, "\r\n--%016llx\r\n", (unsigned long long)range->boundary);
+
+    if(range->type_len) {
+        chunk_appendf(buf, "Content-Type: %.*s\r\n", range->type_len, range->type);
+    }
+
+    chunk_appendf(buf, "Content-Range: bytes %llu-%llu/%llu\r\n\r\n",
+            (unsigned long long)range->first[i], (unsigned long long)range->last[i],
+            (unsigned long long)range->total);
+}
+
+/*
+ * Turn the cached response headers in htx into the ones of a 206 response,
+ * or a 416 one if no range can be satisfied
+ */
+int
+nst_http_range_headers(hpx_htx_t *htx, nst_http_range_t *range) {
+    hpx_http_hdr_ctx_t  hdr = { .blk = NULL };
+    hpx_htx_sl_t       *sl;
+    hpx_buffer_t       *buf;
+    hpx_ist_t           status, reason;
+    uint64_t            len = 0;
+    int                 i;
+
+    buf = get_trash_chunk();
+
+    if(range->count > 1 && http_find_header(htx, ist("Content-Type"), &hdr, 1)) {
+        range->type_len = hdr.value.len < sizeof(range->type) ? hdr.value.len : 0;
+
+        memcpy(range->type, hdr.value.ptr, range->type_len);
+    }
+
+    for(i = 0; i < range->count; i++) {
+        len += range->last[i] - range->first[i] + 1;
+
+        if(range->count > 1) {
+            _nst_http_range_part(range, i, buf);
+
+            len += buf->data;
+        }
+    }
+
+    if(range->count > 1) {
+        len += strlen("\r\n--") + 16 + strlen("--\r\n");
+    }
+
+    if(range->count) {
+        status = ist("206");
+        reason = ist("Partial Content");
+    } else {
+        status = ist("416");
+        reason = ist("Range Not Satisfiable");
+    }
+
+    if(!http_replace_res_status(htx, status) || !http_replace_res_reason(htx, reason)) {
+        return NST_ERR;
+    }
+
+    hdr.blk = NULL;
+    while(http_find_header(htx, ist("Content-Length"), &hdr, 1)) {
+        http_remove_header(htx, &hdr);
+    }
+
+    hdr.blk = NULL;
+    while(http_find_header(htx, ist("Transfer-Encoding"), &hdr, 1)) {
+        http_remove_header(htx, &hdr);
+    }
+
+    if(!http_add_header(htx, ist("Content-Length"), ist(ultoa(len)))) {
+        return NST_ERR;
+    }
+
+    if(range->count == 1) {
+        chunk_printf(buf, "bytes %llu-%llu/%llu", (unsigned long long)range->first[0],
+                (unsigned long long)range->last[0], (unsigned long long)range->total);
+    } else if(range->count > 1) {
+        hdr.blk = NULL;
+        while(http_find_header(htx, ist("Content-Type"), &hdr, 1)) {
+            http_remove_header(htx, &hdr);
+        }
+
+        chunk_printf(buf, "multipart/byteranges; boundary=%016llx",
+                (unsigned long long)range->boundary);
+
+        if(!http_add_header(htx, ist("Content-Type"), ist2(buf->area, buf->data))) {
+            return NST_ERR;
+        }
+    } else {
+        chunk_printf(buf, "bytes */%llu", (unsigned long long)range->total);
+    }
+
+    if(range->count <= 1 && !http_add_header(htx, ist("Content-Range"), ist2(buf->area, buf->data))) {
         return NST_ERR;
     }
 
-    blk->info = info;
-    ptr       = htx_get_blk_ptr(htx, blk);
-    sz        = htx_get_blksz(blk);
+    sl = http_get_stline(htx);
+
+    sl->info.res.status = range->count ? 206 : 416;
+    sl->flags &= ~(HTX_SL_F_XFER_ENC|HTX_SL_F_CHNK|HTX_SL_F_BODYLESS);
+    sl->flags |= HTX_SL_F_XFER_LEN|HTX_SL_F_CLEN;
 
-    memcpy(ptr, item->data, sz);
+    if(!len) {
+        sl->flags |= HTX_SL_F_BODYLESS;
+    }
 
     return NST_OK;
 }
 
+/*
+ * Move to the next range, adding its part header or the closing boundary of
+ * a multipart body to htx
+ * return 1 if a range is to be sent, 0 if all are sent, -1 if htx is full
+ */
+int
+nst_http_range_next(nst_http_range_t *range, hpx_htx_t *htx) {
+    hpx_buffer_t  *buf = get_trash_chunk();
+
+    if(range->idx >= range->count) {
+
+        if(range->count > 1 && range->idx == range->count) {
+            chunk_printf(buf, "\r\n--%016llx--\r\n", (unsigned long long)range->boundary);
+
+            if(htx_free_data_space(htx) < buf->data) {
+                return -1;
+            }
+
+            htx_add_data(htx, ist2(buf->area, buf->data));
+
+            range->idx++;
+        }
+
+        return 0;
+    }
+
+    if(range->count > 1) {
+        _nst_http_range_part(range, range->idx, buf);
+
+        if(htx_free_data_space(htx) < buf->data) {
+            return -1;
+        }
+
+        htx_add_data(htx, ist2(buf->area, buf->data));
+    }
+
+    range->pos  = range->first[range->idx];
+    range->left = range->last[range->idx] - range->pos + 1;
+    range->idx++;
+
+    return 1;
+}
+
 void
 nst_http_reply(hpx_stream_t *s, int idx) {
     hpx_stream_interface_t  *si  = &s->si[1];
@@ -540,6 +1201,119 @@ nst_http_build_last_modified(hpx_stream_t *s, hpx_buffer_t *buf, nst_http_txn_t
     }
 }
 
+/*
+ * Collect the tags in all name headers of the response, tags are separated
+ * by spaces in headers and by a single space in txn->res.tags.
+ * return NST_ERR if they do not fit in buf.
+ */
+int
+nst_http_build_tags(hpx_stream_t *s, hpx_buffer_t *buf, nst_http_txn_t *txn, hpx_ist_t name) {
+    hpx_http_hdr_ctx_t  hdr = { .blk = NULL };
+    hpx_htx_t          *htx;
+    hpx_ist_t           tag;
+    char               *p, *end;
+
+    htx = htxbuf(&s->res.buf);
+
+    txn->res.tags.ptr = buf->area + buf->data;
+    txn->res.tags.len = 0;
+
+    if(!name.len) {
+        return NST_OK;
+    }
+
+    while(http_find_header(htx, name, &hdr, 1)) {
+        p   = hdr.value.ptr;
+        end = hdr.value.ptr + hdr.value.len;
+
+        while(p < end) {
+
+            while(p < end && HTTP_IS_LWS(*p)) {
+                p++;
+            }
+
+            tag.ptr = p;
+
+            while(p < end && !HTTP_IS_LWS(*p)) {
+                p++;
+            }
+
+            tag.len = p - tag.ptr;
+
+            if(!tag.len) {
+                break;
+            }
+
+            if(txn->res.tags.len) {
+
+                if(!chunk_memcat(buf, " ", 1)) {
+                    return NST_ERR;
+                }
+
+                txn->res.tags.len++;
+            }
+
+            if(!chunk_istcat(buf, tag)) {
+                return NST_ERR;
+            }
+
+            txn->res.tags.len += tag.len;
+        }
+    }
+
+    return NST_OK;
+}
+
+/*
+ * Build the list of header names of the response Vary header, "*" if the
+ * response varies on something other than request headers.
+ */
+int
+nst_http_build_vary(hpx_stream_t *s, hpx_buffer_t *buf, nst_http_txn_t *txn) {
+    hpx_http_hdr_ctx_t  hdr = { .blk = NULL };
+    hpx_htx_t          *htx;
+    int                 i;
+
+    htx = htxbuf(&s->res.buf);
+
+    txn->res.vary.ptr = buf->area + buf->data;
+    txn->res.vary.len = 0;
+
+    while(http_find_header(htx, ist("Vary"), &hdr, 0)) {
+
+        if(!hdr.value.len) {
+            continue;
+        }
+
+        if(isteq(hdr.value, ist("*"))) {
+            txn->res.vary = ist("*");
+
+            return NST_OK;
+        }
+
+        if(txn->res.vary.len) {
+
+            if(!chunk_memcat(buf, " ", 1)) {
+                return NST_ERR;
+            }
+
+            txn->res.vary.len++;
+        }
+
+        if(buf->data + hdr.value.len > buf->size) {
+            return NST_ERR;
+        }
+
+        for(i = 0; i < hdr.value.len; i++) {
+            buf->area[buf->data++] = tolower((unsigned char)hdr.value.ptr[i]);
+        }
+
+        txn->res.vary.len += hdr.value.len;
+    }
+
+    return NST_OK;
+}
+
 hpx_ist_t
 nst_http_parse_key_value(hpx_ist_t hdr, hpx_ist_t key) {
     int  i;
@@ -31,6 +31,10 @@ nst_key_build(hpx_stream_t *s, hpx_http_msg_t *msg, nst_rule_t *rule, nst_http_t
     nst_key_element_t   *ck  = NULL;
     hpx_buffer_t        *buf = nst_key_init();
 
+    if(method == HTTP_METH_HEAD && rule->key->head == NST_STATUS_ON) {
+        method = HTTP_METH_GET;
+    }
+
     nst_debug_beg(s, "[rule ] key:  ");
 
     while((ck = *pck++)) {
@@ -212,6 +216,63 @@ nst_key_build(hpx_stream_t *s, hpx_http_msg_t *msg, nst_rule_t *rule, nst_http_t
     return NST_OK;
 }
 
+/*
+ * Turn the primary key into the key of a variant by appending the request
+ * values of the headers listed in vary.
+ */
+int
+nst_key_build_vary(hpx_stream_t *s, nst_key_t *key, hpx_ist_t vary) {
+    hpx_htx_t     *htx  = htxbuf(&s->req.buf);
+    hpx_buffer_t  *buf  = nst_key_init();
+    hpx_ist_t      name = { .ptr = NULL };
+    char          *data;
+
+    if(nst_key_cat(buf, key->data, key->size) != NST_OK) {
+        return NST_ERR;
+    }
+
+    if(nst_key_catist(buf, ist("vary")) != NST_OK) {
+        return NST_ERR;
+    }
+
+    while(nst_http_tags_next(vary, &name)) {
+        hpx_http_hdr_ctx_t  hdr = { .blk = NULL };
+
+        if(nst_key_catist(buf, name) != NST_OK) {
+            return NST_ERR;
+        }
+
+        while(http_find_header(htx, name, &hdr, 0)) {
+
+            if(nst_key_catist(buf, hdr.value) != NST_OK) {
+                return NST_ERR;
+            }
+        }
+
+        if(nst_key_catdel(buf) != NST_OK) {
+            return NST_ERR;
+        }
+    }
+
+    data = malloc(buf->data);
+
+    if(!data) {
+        return NST_ERR;
+    }
+
+    memcpy(data, buf->area, buf->data);
+
+    free(key->data);
+
+    key->data  = data;
+    key->size  = buf->data;
+    key->flags = NST_KEY_VARY;
+
+    nst_key_hash(key);
+
+    return NST_OK;
+}
+
 void
 nst_key_hash(nst_key_t *key) {
     blk_SHA_CTX ctx;
@@ -111,6 +111,7 @@ nst_purger_advanced(hpx_stream_t *s, hpx_channel_t *req, hpx_proxy_t *px) {
     hpx_ist_t                name = { .len = 0 };
     hpx_ist_t                host = { .len = 0 };
     hpx_ist_t                path = { .len = 0 };
+    hpx_ist_t                tag  = { .len = 0 };
     char                    *regex_str, *error;
     int                      method, mode;
 
@@ -176,6 +177,14 @@ nst_purger_advanced(hpx_stream_t *s, hpx_channel_t *req, hpx_proxy_t *px) {
         }
 
         goto notfound;
+    } else if(http_find_header(htx, ist("tag"), &hdr, 0)) {
+        tag    = hdr.value;
+        method = NST_MANAGER_TAG;
+
+        /* tags are only read in cache mode */
+        if(mode == 0) {
+            mode = NST_MODE_CACHE;
+        }
     } else if(http_find_header(htx, ist("path"), &hdr, 0)) {
         path   = hdr.value;
         method = host.len ? NST_MANAGER_PATH_HOST : NST_MANAGER_PATH;
@@ -235,6 +244,9 @@ purge:
             appctx->ctx.nuster.manager.dict = &nuster.nosql->dict;
         }
 
+        /* keep buckets in place until the whole dict is checked */
+        nst_dict_rehash_pause(appctx->ctx.nuster.manager.dict);
+
         switch(method) {
             case NST_MANAGER_PROXY:
             case NST_MANAGER_RULE:
@@ -250,6 +262,9 @@ purge:
             case NST_MANAGER_PATH_HOST:
                 buf.size = path.len + host.len;
                 break;
+            case NST_MANAGER_TAG:
+                buf.size = tag.len;
+                break;
         }
 
         if(buf.size) {
@@ -285,10 +300,37 @@ purge:
                 appctx->ctx.nuster.manager.path = ist2(buf.area + buf.data, path.len);
                 chunk_istcat(&buf, path);
                 break;
+            case NST_MANAGER_TAG:
+                appctx->ctx.nuster.manager.name = ist2(buf.area + buf.data, tag.len);
+                chunk_istcat(&buf, tag);
+                break;
         }
 
         appctx->ctx.nuster.manager.buf = buf;
 
+        /* with secondary indexes, only the group of the matched entries is walked */
+        if(appctx->ctx.nuster.manager.dict->index_size) {
+
+            switch(method) {
+                case NST_MANAGER_PROXY:
+                    appctx->ctx.nuster.manager.index = NST_DICT_INDEX_PROXY;
+                    break;
+                case NST_MANAGER_RULE:
+                    appctx->ctx.nuster.manager.index = NST_DICT_INDEX_RULE;
+                    break;
+                case NST_MANAGER_HOST:
+                    appctx->ctx.nuster.manager.index = NST_DICT_INDEX_HOST;
+                    break;
+                case NST_MANAGER_PATH:
+                case NST_MANAGER_PATH_HOST:
+                    appctx->ctx.nuster.manager.index = NST_DICT_INDEX_PATH;
+                    break;
+                case NST_MANAGER_TAG:
+                    appctx->ctx.nuster.manager.index = NST_DICT_INDEX_TAG;
+                    break;
+            }
+        }
+
         req->analysers &= (AN_REQ_HTTP_BODY | AN_REQ_FLT_HTTP_HDRS | AN_REQ_FLT_END);
         req->analysers &= ~AN_REQ_FLT_XFER_DATA;
         req->analysers |= AN_REQ_HTTP_XFER_BODY;
@@ -327,7 +369,8 @@ badreq:
 
 int
 nst_purger_check(hpx_appctx_t *appctx, nst_dict_entry_t *entry) {
-    int  ret = 0;
+    hpx_ist_t  tag = { .ptr = NULL };
+    int        ret = 0;
 
     switch(appctx->st0) {
         case NST_MANAGER_PROXY:
@@ -359,48 +402,146 @@ nst_purger_check(hpx_appctx_t *appctx, nst_dict_entry_t *entry) {
             ret = isteq(entry->host, appctx->ctx.nuster.manager.host)
                 && regex_exec2(appctx->ctx.nuster.manager.regex, entry->path.ptr, entry->path.len);
 
+            break;
+        case NST_MANAGER_TAG:
+
+            while(!ret && nst_http_tags_next(entry->tags, &tag)) {
+                ret = isteq(tag, appctx->ctx.nuster.manager.name);
+            }
+
             break;
     }
 
     return ret;
 }
 
+static void
+nst_purger_purge(nst_dict_t *dict, nst_dict_entry_t *entry) {
+
+    if(entry->state == NST_DICT_ENTRY_STATE_VALID) {
+
+        entry->state  = NST_DICT_ENTRY_STATE_INVALID;
+        entry->expire = 0;
+
+        if(entry->store.memory.obj) {
+            entry->store.memory.obj->invalid = 1;
+            entry->store.memory.obj          = NULL;
+
+            nst_memory_incr_invalid(&dict->store->memory);
+        }
+
+        if(entry->store.disk.file) {
+            nst_disk_purge_by_path(&dict->store->disk, entry->store.disk.file,
+                    entry->store.disk.base);
+
+            nst_disk_journal(&dict->store->disk, entry, 1);
+        }
+    }
+}
+
+/*
+ * Walk the group of the purged name in each stripe, manager.idx is the
+ * stripe. Purged entries leave their groups, so a stripe interrupted after
+ * 10ms resumes with the entries left to check.
+ */
+static void
+nst_purger_index_handler(hpx_appctx_t *appctx) {
+    nst_dict_group_t        *group;
+    nst_dict_link_t         *link   = NULL;
+    nst_dict_entry_t        *entry;
+    hpx_stream_interface_t  *si     = appctx->owner;
+    hpx_stream_t            *s      = si_strm(si);
+    nst_dict_t              *dict   = appctx->ctx.nuster.manager.dict;
+    int                      type   = appctx->ctx.nuster.manager.index;
+    uint64_t                 start  = nst_time_now_ms();
+    uint64_t                 idx;
+    hpx_ist_t                name;
+
+    switch(type) {
+        case NST_DICT_INDEX_HOST:
+            name = appctx->ctx.nuster.manager.host;
+            break;
+        case NST_DICT_INDEX_PATH:
+            name = appctx->ctx.nuster.manager.path;
+            break;
+        default:
+            name = appctx->ctx.nuster.manager.name;
+            break;
+    }
+
+    while(appctx->ctx.nuster.manager.idx < NST_DICT_STRIPES) {
+        idx = appctx->ctx.nuster.manager.idx;
+
+        nst_dict_lock(dict, idx);
+
+        group = nst_dict_index_get(dict, idx, type, name);
+        link  = group ? group->link : NULL;
+
+        while(link) {
+            entry = link->entry;
+            link  = link->next;
+
+            if(nst_purger_check(appctx, entry) && entry->state == NST_DICT_ENTRY_STATE_VALID) {
+                nst_purger_purge(dict, entry);
+
+                /* frees the links of entry, and the group if it is left empty */
+                nst_dict_index_remove(dict, entry);
+            }
+
+            if(nst_time_now_ms() - start > 10) {
+                break;
+            }
+        }
+
+        if(link == NULL) {
+            appctx->ctx.nuster.manager.idx++;
+        }
+
+        nst_dict_unlock(dict, idx);
+
+        if(nst_time_now_ms() - start > 20) {
+            break;
+        }
+    }
+
+    task_wakeup(s->task, TASK_WOKEN_OTHER);
+
+    if(appctx->ctx.nuster.manager.idx == NST_DICT_STRIPES) {
+        nst_http_reply(s, NST_HTTP_200);
+    }
+}
+
 static void
 nst_purger_handler(hpx_appctx_t *appctx) {
+    nst_dict_entry_t       **bucket = NULL;
     nst_dict_entry_t        *entry  = NULL;
     hpx_stream_interface_t  *si     = appctx->owner;
     hpx_stream_t            *s      = si_strm(si);
     nst_dict_t              *dict   = appctx->ctx.nuster.manager.dict;
     uint64_t                 start  = nst_time_now_ms();
+    uint64_t                 idx;
     int                      max    = 1000;
 
-    while(1) {
+    if(appctx->ctx.nuster.manager.index) {
+        nst_purger_index_handler(appctx);
 
-        while(appctx->ctx.nuster.manager.idx < dict->size && max--) {
-            nst_shctx_lock(dict);
-
-            entry = dict->entry[appctx->ctx.nuster.manager.idx];
-
-            while(entry) {
+        return;
+    }
 
-                if(nst_purger_check(appctx, entry)) {
+    while(1) {
 
-                    if(entry->state == NST_DICT_ENTRY_STATE_VALID) {
+        while(appctx->ctx.nuster.manager.idx < nst_dict_buckets(dict) && max--) {
+            idx = appctx->ctx.nuster.manager.idx;
 
-                        entry->state  = NST_DICT_ENTRY_STATE_INVALID;
-                        entry->expire = 0;
+            nst_dict_lock(dict, idx);
 
-                        if(entry->store.memory.obj) {
-                            entry->store.memory.obj->invalid = 1;
-                            entry->store.memory.obj          = NULL;
+            bucket = nst_dict_bucket(dict, idx);
+            entry  = bucket ? *bucket : NULL;
 
-                            nst_memory_incr_invalid(&dict->store->memory);
-                        }
+            while(entry) {
 
-                        if(entry->store.disk.file) {
-                            nst_disk_purge_by_path(entry->store.disk.file);
-                        }
-                    }
+                if(nst_purger_check(appctx, entry)) {
+                    nst_purger_purge(dict, entry);
                 }
 
                 entry = entry->next;
@@ -414,7 +555,7 @@ nst_purger_handler(hpx_appctx_t *appctx) {
                 appctx->ctx.nuster.manager.idx++;
             }
 
-            nst_shctx_unlock(dict);
+            nst_dict_unlock(dict, idx);
         }
 
         if(nst_time_now_ms() - start > 20) {
@@ -426,13 +567,14 @@ nst_purger_handler(hpx_appctx_t *appctx) {
 
     task_wakeup(s->task, TASK_WOKEN_OTHER);
 
-    if(appctx->ctx.nuster.manager.idx == dict->size) {
+    if(appctx->ctx.nuster.manager.idx == nst_dict_buckets(dict)) {
         nst_http_reply(s, NST_HTTP_200);
     }
 }
 
 static void
 nst_purger_release_handler(hpx_appctx_t *appctx) {
+    nst_dict_rehash_resume(appctx->ctx.nuster.manager.dict);
 
     if(appctx->ctx.nuster.manager.regex) {
         regex_free(appctx->ctx.nuster.manager.regex);
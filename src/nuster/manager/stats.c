@@ -183,6 +183,64 @@ _getMaxPaddingLen() {
     return max;
 }
 
+static void
+_nst_stats_shmem_pages(int len, const char *name, nst_shmem_t *shmem) {
+    char  key[64];
+
+    snprintf(key, sizeof(key), "store.memory.%s.pages:", name);
+    chunk_appendf(&trash, "%-*s%s\n", len, key, nst_shmem_pages_str(shmem->pages));
+
+    snprintf(key, sizeof(key), "store.memory.%s.numa:", name);
+
+    if(shmem->numa == NST_SHMEM_NUMA_OFF) {
+        chunk_appendf(&trash, "%-*s%s\n", len, key, "off");
+    } else if(shmem->numa == NST_SHMEM_NUMA_INTERLEAVE) {
+        chunk_appendf(&trash, "%-*s%s\n", len, key, "interleave");
+    } else {
+        chunk_appendf(&trash, "%-*snode %d\n", len, key, shmem->numa);
+    }
+}
+
+/*
+ * frag is the share of the blocks of a chunk size which is not used
+ */
+static void
+_nst_stats_shmem_classes(int len, const char *name, nst_shmem_t *shmem) {
+    char      key[64];
+    uint64_t  blocks, chunks;
+    int       i;
+
+    for(i = 0; i < shmem->chunks; i++) {
+        blocks = shmem->classes[i].blocks;
+        chunks = shmem->classes[i].chunks;
+
+        if(!blocks) {
+            continue;
+        }
+
+        snprintf(key, sizeof(key), "store.memory.%s.class.%d:", name,
+                1 << (shmem->chunk_shift + i));
+
+        chunk_appendf(&trash, "%-*sblocks=%"PRIu64"  chunks=%"PRIu64"  frag=%d%%\n", len, key,
+                blocks, chunks,
+                (int)(100 - chunks * (1ULL << (shmem->chunk_shift + i)) * 100
+                    / (blocks * shmem->block_size)));
+    }
+}
+
+static void
+_nst_stats_shmem_threads(int len, const char *name, nst_shmem_t *shmem) {
+    char  key[64];
+    int   i;
+
+    for(i = 0; i < global.nbthread; i++) {
+        snprintf(key, sizeof(key), "store.memory.%s.thread%d:", name, i);
+
+        chunk_appendf(&trash, "%-*shit=%"PRIu64"  miss=%"PRIu64"\n", len, key,
+                shmem->stats[i].hit, shmem->stats[i].miss);
+    }
+}
+
 static int
 _nst_stats_payload(hpx_appctx_t *appctx, hpx_stream_interface_t *si, hpx_htx_t *htx) {
     hpx_channel_t  *res = si_ic(si);
@@ -218,7 +276,10 @@ _nst_stats_payload(hpx_appctx_t *appctx, hpx_stream_interface_t *si, hpx_htx_t *
                     global.nuster.cache.dict_size);
 
             chunk_appendf(&trash, "%-*s%"PRIu64"\n", len, "dict.cache.length:",
-                    nuster.cache->dict.size);
+                    nuster.cache->dict.table[0].size);
+
+            chunk_appendf(&trash, "%-*s%"PRId64"\n", len, "dict.cache.rehash_idx:",
+                    nuster.cache->dict.rehash_idx);
 
             chunk_appendf(&trash, "%-*s%"PRIu64"\n", len, "dict.cache.used:",
                     nuster.cache->dict.used);
@@ -235,7 +296,10 @@ _nst_stats_payload(hpx_appctx_t *appctx, hpx_stream_interface_t *si, hpx_htx_t *
                     global.nuster.nosql.dict_size);
 
             chunk_appendf(&trash, "%-*s%"PRIu64"\n", len, "dict.nosql.length:",
-                    nuster.nosql->dict.size);
+                    nuster.nosql->dict.table[0].size);
+
+            chunk_appendf(&trash, "%-*s%"PRId64"\n", len, "dict.nosql.rehash_idx:",
+                    nuster.nosql->dict.rehash_idx);
 
             chunk_appendf(&trash, "%-*s%"PRIu64"\n", len, "dict.nosql.used:",
                     nuster.nosql->dict.used);
@@ -267,6 +331,37 @@ _nst_stats_payload(hpx_appctx_t *appctx, hpx_stream_interface_t *si, hpx_htx_t *
 
         chunk_appendf(&trash, "%-*s%"PRIu64"\n", len, "store.memory.cache.count:",
                 nuster.cache->store.memory.count);
+
+        if(global.nuster.cache.eviction != NST_EVICTION_OFF) {
+            chunk_appendf(&trash, "%-*s%"PRIu64"\n", len, "store.memory.cache.evicted:",
+                    nuster.cache->store.memory.evicted);
+        }
+
+        if(global.nuster.cache.admission == NST_STATUS_ON) {
+            chunk_appendf(&trash, "%-*s%"PRIu64"\n", len, "store.memory.cache.rejected:",
+                    nuster.cache->store.memory.sketch.rejected);
+        }
+
+        if(global.nuster.cache.compaction == NST_STATUS_ON) {
+            chunk_appendf(&trash, "%-*s%"PRIu64"\n", len, "store.memory.cache.compacted:",
+                    nuster.cache->store.memory.compacted);
+
+            chunk_appendf(&trash, "%-*s%"PRIu64"\n", len, "store.memory.cache.drained:",
+                    global.nuster.cache.shmem->compact.drained);
+        }
+
+        if(nuster.cache->store.memory.encoding.objs) {
+            chunk_appendf(&trash,
+                    "%-*sobjs=%"PRIu64"  copies=%"PRIu64"  raw=%"PRIu64"  size=%"PRIu64"\n",
+                    len, "store.memory.cache.encoded:", nuster.cache->store.memory.encoding.objs,
+                    nuster.cache->store.memory.precompressed,
+                    nuster.cache->store.memory.encoding.raw,
+                    nuster.cache->store.memory.encoding.encoded);
+        }
+
+        _nst_stats_shmem_pages(len, "cache", global.nuster.cache.shmem);
+        _nst_stats_shmem_classes(len, "cache", global.nuster.cache.shmem);
+        _nst_stats_shmem_threads(len, "cache", global.nuster.cache.shmem);
     }
 
     if(global.nuster.nosql.status == NST_STATUS_ON) {
@@ -278,6 +373,18 @@ _nst_stats_payload(hpx_appctx_t *appctx, hpx_stream_interface_t *si, hpx_htx_t *
 
         chunk_appendf(&trash, "%-*s%"PRIu64"\n", len, "store.memory.nosql.count:",
                 nuster.nosql->store.memory.count);
+
+        if(global.nuster.nosql.compaction == NST_STATUS_ON) {
+            chunk_appendf(&trash, "%-*s%"PRIu64"\n", len, "store.memory.nosql.compacted:",
+                    nuster.nosql->store.memory.compacted);
+
+            chunk_appendf(&trash, "%-*s%"PRIu64"\n", len, "store.memory.nosql.drained:",
+                    global.nuster.nosql.shmem->compact.drained);
+        }
+
+        _nst_stats_shmem_pages(len, "nosql", global.nuster.nosql.shmem);
+        _nst_stats_shmem_classes(len, "nosql", global.nuster.nosql.shmem);
+        _nst_stats_shmem_threads(len, "nosql", global.nuster.nosql.shmem);
     }
 
     if(global.nuster.cache.status == NST_STATUS_ON || global.nuster.nosql.status == NST_STATUS_ON) {
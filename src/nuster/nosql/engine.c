@@ -21,7 +21,6 @@ nst_nosql_handler(hpx_appctx_t *appctx) {
     hpx_channel_t           *req  = si_oc(si);
     hpx_channel_t           *res  = si_ic(si);
     nst_memory_item_t       *item = NULL;
-    hpx_buffer_t            *buf;
     hpx_htx_t               *req_htx, *res_htx;
     hpx_htx_blk_type_t       type;
     hpx_htx_blk_t           *blk;
@@ -29,6 +28,7 @@ nst_nosql_handler(hpx_appctx_t *appctx) {
     uint64_t                 offset, payload_len;
     uint32_t                 blksz, sz, info;
     int                      ret, max, fd, header_len, total;
+    nst_disk_aio_t          *aio;
 
     res_htx = htxbuf(&res->buf);
     total   = res_htx->data;
@@ -46,6 +46,11 @@ nst_nosql_handler(hpx_appctx_t *appctx) {
 
     /* check that the output is not closed */
     if(res->flags & (CF_SHUTW|CF_SHUTW_NOW)) {
+
+        if(appctx->st0 == NST_NOSQL_APPCTX_STATE_HIT_DISK) {
+            nst_disk_aio_free(appctx->ctx.nuster.store.disk.aio);
+        }
+
         appctx->st0 = NST_CTX_STATE_DONE;
     }
 
@@ -66,13 +71,17 @@ nst_nosql_handler(hpx_appctx_t *appctx) {
 
                 while(item) {
 
-                    if(nst_http_memory_item_to_htx(item, res_htx) != NST_OK) {
+                    if(nst_http_memory_item_to_htx(item, &appctx->ctx.nuster.store.memory.offset,
+                                &appctx->ctx.nuster.store.memory.left, res_htx) != NST_OK) {
+
                         si_rx_room_blk(si);
 
                         goto out;
                     }
 
                     item = item->next;
+
+                    appctx->ctx.nuster.store.memory.offset = 0;
                 }
             }
 
@@ -114,13 +123,15 @@ out:
                 payload_len = appctx->ctx.nuster.store.disk.payload_len;
                 offset      = appctx->ctx.nuster.store.disk.offset;
                 fd          = appctx->ctx.nuster.store.disk.fd;
+                aio         = appctx->ctx.nuster.store.disk.aio;
 
                 switch(appctx->st1) {
                     case NST_DISK_APPLET_HEADER:
-                        buf = get_trash_chunk();
-                        p   = buf->area;
+                        ret = nst_disk_pread(aio, fd, &p, header_len, offset);
 
-                        ret = pread(fd, p, header_len, offset);
+                        if(ret == NST_DISK_AIO_AGAIN) {
+                            goto end;
+                        }
 
                         if(ret != header_len) {
                             appctx->st1 = NST_DISK_APPLET_ERROR;
@@ -162,8 +173,6 @@ out:
 
                         break;
                     case NST_DISK_APPLET_PAYLOAD:
-                        buf = get_trash_chunk();
-                        p   = buf->area;
                         max = htx_get_max_blksz(res_htx, channel_htx_recv_max(res, res_htx));
 
                         if(max <= 0) {
@@ -171,9 +180,13 @@ out:
                         }
 
                         if(max < payload_len) {
-                            ret = pread(fd, p, max, offset);
+                            ret = nst_disk_pread(aio, fd, &p, max, offset);
                         } else {
-                            ret = pread(fd, p, payload_len, offset);
+                            ret = nst_disk_pread(aio, fd, &p, payload_len, offset);
+                        }
+
+                        if(ret == NST_DISK_AIO_AGAIN) {
+                            goto end;
                         }
 
                         if(ret <= 0) {
@@ -291,6 +304,16 @@ end:
     return;
 }
 
+static void
+_nst_nosql_release_handler(hpx_appctx_t *appctx) {
+
+    if(appctx->st0 == NST_NOSQL_APPCTX_STATE_HIT_DISK) {
+        nst_disk_aio_free(appctx->ctx.nuster.store.disk.aio);
+
+        appctx->ctx.nuster.store.disk.aio = NULL;
+    }
+}
+
 void
 nst_nosql_housekeeping() {
     nst_dict_t   *dict  = &nuster.nosql->dict;
@@ -299,13 +322,26 @@ nst_nosql_housekeeping() {
     uint64_t      start;
 
     if(global.nuster.nosql.status == NST_STATUS_ON && master == 1) {
-        int  dict_cleaner = global.nuster.nosql.dict_cleaner;
-        int  data_cleaner = global.nuster.nosql.data_cleaner;
-        int  disk_cleaner = global.nuster.nosql.disk_cleaner;
-        int  disk_loader  = global.nuster.nosql.disk_loader;
-        int  disk_saver   = global.nuster.nosql.disk_saver;
-        int  ms           = 10;
-        int  ratio        = 1;
+        int  dict_cleaner  = global.nuster.nosql.dict_cleaner;
+        int  dict_rehasher = global.nuster.nosql.dict_rehasher;
+        int  data_cleaner  = global.nuster.nosql.data_cleaner;
+        int  disk_cleaner  = global.nuster.nosql.disk_cleaner;
+        int  disk_loader   = global.nuster.nosql.disk_loader;
+        int  disk_saver    = global.nuster.nosql.disk_saver;
+        int  compaction    = global.nuster.nosql.compaction;
+        int  ms            = 10;
+        int  ratio         = 1;
+
+        nst_dict_reclaim(dict);
+
+        start = nst_time_now_ms();
+
+        while(dict_rehasher-- && nst_dict_rehash(dict)) {
+
+            if(nst_time_now_ms() - start >= ms) {
+                break;
+            }
+        }
 
         start = nst_time_now_ms();
 
@@ -317,6 +353,17 @@ nst_nosql_housekeeping() {
             }
         }
 
+        if(compaction == NST_STATUS_ON) {
+            start = nst_time_now_ms();
+
+            while(nst_dict_compact(dict)) {
+
+                if(nst_time_now_ms() - start >= ms) {
+                    break;
+                }
+            }
+        }
+
         start = nst_time_now_ms();
 
         if(data_cleaner > store->memory.count) {
@@ -363,6 +410,10 @@ nst_nosql_housekeeping() {
             }
         }
 
+        if(store->disk.loaded) {
+            nst_disk_checkpoint(nuster.nosql);
+        }
+
         while(!store->disk.loaded && disk_loader--) {
             nst_disk_load(nuster.nosql);
 
@@ -387,11 +438,14 @@ nst_nosql_init() {
     size       = dict_size + data_size;
     clean_temp = global.nuster.nosql.clean_temp;
 
-    nuster.applet.nosql.fct = nst_nosql_handler;
+    nuster.applet.nosql.fct     = nst_nosql_handler;
+    nuster.applet.nosql.release = _nst_nosql_release_handler;
 
     if(global.nuster.nosql.status == NST_STATUS_ON) {
 
-        shmem = nst_shmem_create("nosql.shm", size, global.tune.bufsize, NST_DEFAULT_CHUNK_SIZE);
+        shmem = nst_shmem_create("nosql.shm", size, global.tune.bufsize, NST_DEFAULT_CHUNK_SIZE,
+                global.nuster.nosql.hugepages, global.nuster.nosql.hugepages_dir,
+                global.nuster.nosql.numa);
 
         if(!shmem) {
             ha_alert("Failed to create nuster nosql memory zone.\n");
@@ -422,11 +476,33 @@ nst_nosql_init() {
             exit(1);
         }
 
-        if(nst_dict_init(&nuster.nosql->dict, &nuster.nosql->store, shmem, dict_size) != NST_OK) {
+        if(global.nuster.nosql.disk_io != NST_DISK_IO_SYNC
+                && nst_disk_aio_init(&nuster.nosql->store.disk, global.nuster.nosql.disk_io,
+                    global.nuster.nosql.disk_io_threads) != NST_OK) {
+
+            ha_alert("Failed to init nuster nosql disk io.\n");
+            exit(1);
+        }
+
+        if(global.nuster.nosql.disk_layout == NST_DISK_LAYOUT_SEGMENT
+                && nst_disk_segment_init(&nuster.nosql->store.disk,
+                    global.nuster.nosql.segment_size) != NST_OK) {
+
+            ha_alert("Failed to init nuster nosql disk segments.\n");
+            exit(1);
+        }
+
+        if(nst_dict_init(&nuster.nosql->dict, &nuster.nosql->store, shmem, dict_size,
+                    global.nuster.nosql.dict_layout, global.nuster.nosql.dict_index) != NST_OK) {
             ha_alert("Failed to init nuster nosql dict.\n");
             exit(1);
         }
 
+        if(nst_disk_index_init(nuster.nosql, global.nuster.nosql.disk_checkpoint) != NST_OK) {
+            ha_alert("Failed to init nuster nosql disk index.\n");
+            exit(1);
+        }
+
     }
 }
 
@@ -473,10 +549,34 @@ nst_nosql_check_applet(hpx_stream_t *s, hpx_channel_t *req, hpx_proxy_t *px) {
     return 0;
 }
 
-nst_memory_item_t *
-_nst_nosql_create_header(hpx_stream_t *s, nst_http_txn_t *txn, nst_rule_prop_t *prop) {
-    nst_memory_t        *mem  = &nuster.nosql->store.memory;
-    nst_memory_item_t   *item_sl, *item_ct, *item_te, *item_eoh, *item_et, *item_lm, *tail;
+/*
+ * reserve a record of size bytes at the end of buf
+ * return the block of the record, NULL if buf is full
+ */
+static char *
+_nst_nosql_header_add(hpx_buffer_t *buf, nst_http_txn_t *txn, uint32_t info, uint32_t size) {
+    char  *data;
+
+    if(b_room(buf) < 4 + size) {
+        return NULL;
+    }
+
+    data = b_tail(buf);
+
+    memcpy(data, &info, 4);
+
+    buf->data           += 4 + size;
+    txn->res.header_len += 4 + size;
+
+    return data + 4;
+}
+
+/*
+ * build the header records of the response in buf, as stored in memory
+ * and on disk
+ */
+static int
+_nst_nosql_create_header(hpx_buffer_t *buf, nst_http_txn_t *txn, nst_rule_prop_t *prop) {
     hpx_htx_blk_type_t   type;
     hpx_htx_sl_t        *sl;
     hpx_ist_t            ctk  = ist("content-type");
@@ -490,24 +590,18 @@ _nst_nosql_create_header(hpx_stream_t *s, nst_http_txn_t *txn, nst_rule_prop_t *
     char                *data = NULL;
     uint32_t             size, info;
 
-    item_sl = item_ct = item_te = item_eoh = tail = NULL;
-
     /* status line */
     type  = HTX_BLK_RES_SL;
     info  = type << 28;
     size  = sizeof(*sl) + p1.len + p2.len + p3.len;
     info += size;
 
-    txn->res.header_len += 4 + size;
-
-    item_sl = nst_memory_alloc_item(mem, size);
+    data = _nst_nosql_header_add(buf, txn, info, size);
 
-    if(!item_sl) {
-        goto err;
+    if(!data) {
+        return NST_ERR;
     }
 
-    data = item_sl->data;
-
     sl = (hpx_htx_sl_t *)data;
     sl->hdrs_bytes = -1;
 
@@ -520,58 +614,36 @@ _nst_nosql_create_header(hpx_stream_t *s, nst_http_txn_t *txn, nst_rule_prop_t *
     memcpy(HTX_SL_P2_PTR(sl), p2.ptr, p2.len);
     memcpy(HTX_SL_P3_PTR(sl), p3.ptr, p3.len);
 
-    item_sl->info = info;
-
-    tail = item_sl;
-
     /* content-type */
     type  = HTX_BLK_HDR;
     info  = type << 28;
     size  = ctk.len + txn->req.content_type.len;
     info += (txn->req.content_type.len << 8) + ctk.len;
 
-    item_ct = nst_memory_alloc_item(mem, size);
+    data = _nst_nosql_header_add(buf, txn, info, size);
 
-    if(!item_ct) {
-        goto err;
+    if(!data) {
+        return NST_ERR;
     }
 
-    data = item_ct->data;
-
-    txn->res.header_len += 4 + size;
-
     ist2bin_lc(data, ctk);
     memcpy(data + ctk.len, txn->req.content_type.ptr, txn->req.content_type.len);
 
-    item_ct->info = info;
-
-    tail->next = item_ct;
-    tail       = item_ct;
-
     /* transfer-encoding */
     type  = HTX_BLK_HDR;
     info  = type << 28;
     size  = tek.len + tev.len;
     info += (tev.len << 8) + tek.len;
 
-    item_te = nst_memory_alloc_item(mem, size);
+    data = _nst_nosql_header_add(buf, txn, info, size);
 
-    if(!item_te) {
-        goto err;
+    if(!data) {
+        return NST_ERR;
     }
 
-    data = item_te->data;
-
-    txn->res.header_len += 4 + size;
-
     ist2bin_lc(data, tek);
     memcpy(data + tek.len, tev.ptr, tev.len);
 
-    item_te->info = info;
-
-    tail->next = item_te;
-    tail       = item_te;
-
     /* etag */
     if(prop->etag) {
         type  = HTX_BLK_HDR;
@@ -579,23 +651,14 @@ _nst_nosql_create_header(hpx_stream_t *s, nst_http_txn_t *txn, nst_rule_prop_t *
         size  = etk.len + txn->res.etag.len;
         info += (txn->res.etag.len << 8) + etk.len;
 
-        item_et = nst_memory_alloc_item(mem, size);
+        data = _nst_nosql_header_add(buf, txn, info, size);
 
-        if(!item_et) {
-            goto err;
+        if(!data) {
+            return NST_ERR;
         }
 
-        data = item_et->data;
-
-        txn->res.header_len += 4 + size;
-
         ist2bin_lc(data, etk);
         memcpy(data + etk.len, txn->res.etag.ptr, txn->res.etag.len);
-
-        item_et->info = info;
-
-        tail->next = item_et;
-        tail       = item_et;
     }
 
     /* last-modified */
@@ -605,23 +668,14 @@ _nst_nosql_create_header(hpx_stream_t *s, nst_http_txn_t *txn, nst_rule_prop_t *
         size  = lmk.len + txn->res.last_modified.len;
         info += (txn->res.last_modified.len << 8) + lmk.len;
 
-        item_lm = nst_memory_alloc_item(mem, size);
+        data = _nst_nosql_header_add(buf, txn, info, size);
 
-        if(!item_lm) {
-            goto err;
+        if(!data) {
+            return NST_ERR;
         }
 
-        data = item_lm->data;
-
-        txn->res.header_len += 4 + size;
-
         ist2bin_lc(data, lmk);
         memcpy(data + lmk.len, txn->res.last_modified.ptr, txn->res.last_modified.len);
-
-        item_lm->info = info;
-
-        tail->next = item_lm;
-        tail       = item_lm;
     }
 
     /* eoh */
@@ -630,53 +684,37 @@ _nst_nosql_create_header(hpx_stream_t *s, nst_http_txn_t *txn, nst_rule_prop_t *
     size  = 1;
     info += size;
 
-    item_eoh = nst_memory_alloc_item(mem, size);
+    data = _nst_nosql_header_add(buf, txn, info, size);
 
-    if(!item_eoh) {
-        goto err;
+    if(!data) {
+        return NST_ERR;
     }
 
-    data = item_eoh->data;
-
-    txn->res.header_len += 4 + size;
+    *data = 0;
 
-    item_eoh->info = info;
-
-    tail->next = item_eoh;
-    tail       = item_eoh;
-    tail->next = NULL;
-
-    return item_sl;
-
-err:
-    nst_shmem_free(nuster.nosql->shmem, item_sl);
-    nst_shmem_free(nuster.nosql->shmem, item_ct);
-    nst_shmem_free(nuster.nosql->shmem, item_te);
-    nst_shmem_free(nuster.nosql->shmem, item_eoh);
-
-    return NULL;
+    return NST_OK;
 }
 
 void
 nst_nosql_create(hpx_stream_t *s, hpx_http_msg_t *msg, nst_ctx_t *ctx) {
     nst_dict_entry_t   *entry  = NULL;
-    nst_memory_item_t  *item   = NULL;
-    nst_memory_item_t  *header = NULL;
+    hpx_buffer_t       *header = NULL;
     nst_dict_t         *dict   = &nuster.nosql->dict;
     nst_memory_t       *mem    = &nuster.nosql->store.memory;
     nst_disk_t         *disk   = &nuster.nosql->store.disk;
+    uint32_t            offset, info, blksz;
 
-    header = _nst_nosql_create_header(s, &ctx->txn, &ctx->rule->prop);
+    header = alloc_trash_chunk();
 
-    if(header == NULL) {
+    if(!header || _nst_nosql_create_header(header, &ctx->txn, &ctx->rule->prop) != NST_OK) {
         ctx->state = NST_CTX_STATE_FULL;
 
-        return;
+        goto err;
     }
 
     ctx->state = NST_CTX_STATE_CREATE;
 
-    nst_shctx_lock(dict);
+    nst_dict_lock(dict, ctx->key->hash);
 
     entry = nst_dict_get(dict, ctx->key);
 
@@ -704,7 +742,7 @@ nst_nosql_create(hpx_stream_t *s, hpx_http_msg_t *msg, nst_ctx_t *ctx) {
         }
     }
 
-    nst_shctx_unlock(dict);
+    nst_dict_unlock(dict, ctx->key->hash);
 
     /* init store data */
 
@@ -718,49 +756,38 @@ nst_nosql_create(hpx_stream_t *s, hpx_http_msg_t *msg, nst_ctx_t *ctx) {
         }
     }
 
-    /* create header */
+    /* add header */
 
     if(ctx->state == NST_CTX_STATE_CREATE || ctx->state == NST_CTX_STATE_UPDATE) {
 
         if(nst_store_memory_on(ctx->rule->prop.store) && ctx->store.memory.obj) {
-            ctx->store.memory.obj->item = header;
-
-            item = header;
+            offset = 0;
 
-            while(item) {
-                ctx->store.memory.item = item;
+            while(offset < header->data) {
+                memcpy(&info, header->area + offset, 4);
 
-                item = item->next;
-            }
-        }
+                blksz = nst_memory_blksz(info);
 
-        if(nst_store_disk_on(ctx->rule->prop.store) && ctx->store.disk.obj.file) {
-            item = header;
+                if(nst_memory_obj_append(mem, ctx->store.memory.obj, &ctx->store.memory.item,
+                            header->area + offset + 4, blksz, info) != NST_OK) {
 
-            while(item) {
-                int  sz = ((item->info & 0xff) + ((item->info >> 8) & 0xfffff));
+                    ctx->store.memory.obj = NULL;
 
-                nst_disk_obj_append(disk, &ctx->store.disk.obj, (char *)&item->info, 4);
-                nst_disk_obj_append(disk, &ctx->store.disk.obj, item->data, sz);
+                    break;
+                }
 
-                item = item->next;
+                offset += 4 + blksz;
             }
         }
 
-        if(nst_store_memory_off(ctx->rule->prop.store)) {
-            item = header;
-
-            while(item) {
-                nst_memory_item_t  *t = item;
-
-                item = item->next;
-
-                nst_shmem_free(nuster.nosql->shmem, t);
-            }
+        if(nst_store_disk_on(ctx->rule->prop.store) && ctx->store.disk.obj.file) {
+            nst_disk_obj_append(disk, &ctx->store.disk.obj, header->area, header->data);
         }
     }
 
 err:
+    free_trash_chunk(header);
+
     return;
 }
 
@@ -901,8 +928,9 @@ nst_nosql_finish(hpx_stream_t *s, hpx_http_msg_t *msg, nst_ctx_t *ctx) {
     }
 
     if(nst_store_memory_on(ctx->rule->prop.store) && ctx->store.memory.obj) {
+        nst_memory_obj_finish(mem, ctx->store.memory.obj, &ctx->store.memory.item);
 
-        nst_shctx_lock(dict);
+        nst_dict_lock(dict, ctx->key->hash);
 
         if(entry && entry->state != NST_DICT_ENTRY_STATE_INVALID && entry->store.memory.obj) {
             entry->store.memory.obj->invalid = 1;
@@ -913,7 +941,7 @@ nst_nosql_finish(hpx_stream_t *s, hpx_http_msg_t *msg, nst_ctx_t *ctx) {
         entry->state = NST_DICT_ENTRY_STATE_VALID;
         entry->store.memory.obj = ctx->store.memory.obj;
 
-        nst_shctx_unlock(dict);
+        nst_dict_unlock(dict, ctx->key->hash);
     }
 
     if(nst_store_disk_on(ctx->rule->prop.store) && ctx->store.disk.obj.file) {
@@ -928,9 +956,18 @@ nst_nosql_finish(hpx_stream_t *s, hpx_http_msg_t *msg, nst_ctx_t *ctx) {
         nst_disk_obj_t  *obj = &ctx->store.disk.obj;
 
         if(nst_disk_obj_finish(disk, obj, ctx->key, &ctx->txn, entry->expire) == NST_OK) {
+            nst_dict_lock(dict, ctx->key->hash);
+
+            nst_disk_obj_replace(disk, obj, entry->store.disk.file, entry->store.disk.base);
+
             entry->state = NST_DICT_ENTRY_STATE_VALID;
 
-            entry->store.disk.file = ctx->store.disk.obj.file;
+            entry->store.disk.file = obj->file;
+            entry->store.disk.base = obj->base;
+
+            nst_disk_journal(disk, entry, 0);
+
+            nst_dict_unlock(dict, ctx->key->hash);
         }
     }
 
@@ -942,6 +979,35 @@ nst_nosql_finish(hpx_stream_t *s, hpx_http_msg_t *msg, nst_ctx_t *ctx) {
 
 }
 
+/*
+ * Memory hit without taking the dict lock, the memory object is attached.
+ * return 1 if hit, 0 otherwise
+ */
+static int
+_nst_nosql_exists_lockless(nst_ctx_t *ctx) {
+    nst_dict_entry_t  *entry;
+    nst_dict_t        *dict = &nuster.nosql->dict;
+    unsigned int       epoch;
+
+    epoch = nst_dict_read_begin(dict);
+
+    entry = nst_dict_get_lockless(dict, ctx->key, &ctx->store.memory.obj);
+
+    if(entry) {
+        ctx->txn.res.header_len    = entry->header_len;
+        ctx->txn.res.payload_len   = entry->payload_len;
+        ctx->txn.res.etag          = entry->etag;
+        ctx->txn.res.last_modified = entry->last_modified;
+        ctx->prop                  = &entry->prop;
+
+        nst_dict_record_access(entry);
+    }
+
+    nst_dict_read_end(dict, epoch);
+
+    return entry != NULL;
+}
+
 int
 nst_nosql_exists(nst_ctx_t *ctx) {
     nst_dict_entry_t  *entry = NULL;
@@ -959,7 +1025,11 @@ nst_nosql_exists(nst_ctx_t *ctx) {
     if(!nst_key_memory_checked(ctx->key)) {
         nst_key_memory_set_checked(ctx->key);
 
-        nst_shctx_lock(dict);
+        if(_nst_nosql_exists_lockless(ctx)) {
+            return NST_CTX_STATE_HIT_MEMORY;
+        }
+
+        nst_dict_lock(dict, ctx->key->hash);
 
         entry = nst_dict_get(dict, ctx->key);
 
@@ -974,6 +1044,7 @@ nst_nosql_exists(nst_ctx_t *ctx) {
                     ret = NST_CTX_STATE_HIT_MEMORY;
                 } else if(entry->store.disk.file) {
                     ctx->store.disk.obj.file = entry->store.disk.file;
+                    ctx->store.disk.obj.base = entry->store.disk.base;
                     ret = NST_CTX_STATE_HIT_DISK;
                 }
 
@@ -991,7 +1062,7 @@ nst_nosql_exists(nst_ctx_t *ctx) {
             }
         }
 
-        nst_shctx_unlock(dict);
+        nst_dict_unlock(dict, ctx->key->hash);
     }
 
     if(ret == NST_CTX_STATE_INIT) {
@@ -1106,7 +1177,7 @@ nst_nosql_delete(nst_key_t *key) {
     nst_dict_entry_t  *entry = NULL;
     int                ret   = 0;
 
-    nst_shctx_lock(dict);
+    nst_dict_lock(dict, key->hash);
 
     entry = nst_dict_get(dict, key);
 
@@ -1126,7 +1197,11 @@ nst_nosql_delete(nst_key_t *key) {
             }
 
             if(entry->store.disk.file) {
-                nst_disk_file_remove(entry->store.disk.file);
+                nst_disk_purge_by_path(&nuster.nosql->store.disk, entry->store.disk.file,
+                        entry->store.disk.base);
+
+                nst_disk_journal(&nuster.nosql->store.disk, entry, 1);
+
                 nst_shmem_free(nuster.nosql->shmem, entry->store.disk.file);
                 entry->store.disk.file = NULL;
             }
@@ -1138,7 +1213,7 @@ nst_nosql_delete(nst_key_t *key) {
         ret = 0;
     }
 
-    nst_shctx_unlock(dict);
+    nst_dict_unlock(dict, key->hash);
 
     if(!nuster.nosql->store.disk.loaded && global.nuster.nosql.root.len){
         nst_disk_obj_t  disk;
@@ -254,8 +254,10 @@ _nst_nosql_filter_http_headers(hpx_stream_t *s, hpx_filter_t *filter, hpx_http_m
         /* 0: header unsent, 1: sent */
         appctx->st1 = 0;
 
-        appctx->ctx.nuster.store.memory.obj  = ctx->store.memory.obj;
-        appctx->ctx.nuster.store.memory.item = ctx->store.memory.obj->item;
+        appctx->ctx.nuster.store.memory.obj    = ctx->store.memory.obj;
+        appctx->ctx.nuster.store.memory.item   = ctx->store.memory.obj->item;
+        appctx->ctx.nuster.store.memory.offset = 0;
+        appctx->ctx.nuster.store.memory.left   = 0;
 
         req->analysers &= ~AN_REQ_FLT_HTTP_HDRS;
         req->analysers &= ~AN_REQ_FLT_XFER_DATA;
@@ -276,6 +278,8 @@ _nst_nosql_filter_http_headers(hpx_stream_t *s, hpx_filter_t *filter, hpx_http_m
         appctx->ctx.nuster.store.disk.offset      = nst_disk_pos_header(&ctx->store.disk.obj);
         appctx->ctx.nuster.store.disk.header_len  = nst_disk_meta_get_header_len(meta);
         appctx->ctx.nuster.store.disk.payload_len = nst_disk_meta_get_payload_len(meta);
+        appctx->ctx.nuster.store.disk.aio         = nst_disk_aio_new(&nuster.nosql->store.disk,
+                appctx->t);
 
         req->analysers &= ~AN_REQ_FLT_HTTP_HDRS;
         req->analysers &= ~AN_REQ_FLT_XFER_DATA;
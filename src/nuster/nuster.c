@@ -24,6 +24,10 @@ nuster_t  nuster = {
             .obj_type = OBJ_TYPE_APPLET,
             .name     = "<NUSTER.CACHE.ENGINE>",
         },
+        .refresh = {
+            .obj_type = OBJ_TYPE_APPLET,
+            .name     = "<NUSTER.CACHE.REFRESH>",
+        },
         .purger = {
             .obj_type = OBJ_TYPE_APPLET,
             .name     = "<NUSTER.MANAGER.PURGER>",
@@ -48,7 +52,8 @@ _nst_proxy_init() {
 
     /* new rule init */
     global.nuster.shmem = nst_shmem_create("nuster.shm", NST_DEFAULT_SIZE,
-            global.tune.bufsize, NST_DEFAULT_CHUNK_SIZE);
+            global.tune.bufsize, NST_DEFAULT_CHUNK_SIZE, NST_SHMEM_PAGES_NORMAL, NULL,
+            NST_SHMEM_NUMA_OFF);
 
     if(!global.nuster.shmem) {
         goto err;
@@ -144,7 +149,7 @@ _nst_proxy_init() {
 
                 while(key) {
 
-                    if(strcmp(key->name, rc->key.name) == 0) {
+                    if(strcmp(key->name, rc->key.name) == 0 && key->head == rc->key.head) {
                         break;
                     }
 
@@ -162,6 +167,7 @@ _nst_proxy_init() {
 
                     key->name = rc->key.name;
                     key->data = rc->key.data;
+                    key->head = rc->key.head;
                     key->idx  = px->key_cnt++;
                     key->next = NULL;
 
@@ -188,6 +194,11 @@ _nst_proxy_init() {
                 rule->prop.wait          = rc->wait;
                 rule->prop.stale         = rc->stale;
                 rule->prop.inactive      = rc->inactive;
+                rule->prop.compress      = rc->compress;
+                rule->prop.precompress   = rc->precompress;
+                rule->prop.refresh_ahead = rc->refresh_ahead;
+
+                rule->tag_header = ist2(rc->tag_header, rc->tag_header ? strlen(rc->tag_header) : 0);
 
                 rule->cond = rc->cond;
 
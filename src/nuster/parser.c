@@ -547,6 +547,256 @@ nuster_parse_global_cache(const char *file, int line, char **args) {
             continue;
         }
 
+        if(!strcmp(args[cur_arg], "dict-rehasher")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] dict-rehasher expects a number.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            global.nuster.cache.dict_rehasher = atoi(args[cur_arg]);
+
+            if(global.nuster.cache.dict_rehasher <= 0) {
+                global.nuster.cache.dict_rehasher = NST_DEFAULT_DICT_REHASHER;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "dict-layout")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] expects 'chain' or 'tag' as argument.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "chain")) {
+                global.nuster.cache.dict_layout = NST_DICT_LAYOUT_CHAIN;
+            } else if(!strcmp(args[cur_arg], "tag")) {
+                global.nuster.cache.dict_layout = NST_DICT_LAYOUT_TAG;
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] only supports 'chain' and 'tag'.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "dict-index")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] expects 'on' or 'off' as argument.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                global.nuster.cache.dict_index = NST_STATUS_OFF;
+            } else if(!strcmp(args[cur_arg], "on")) {
+                global.nuster.cache.dict_index = NST_STATUS_ON;
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] only supports 'on' and 'off'.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "eviction")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] expects 'lru', 'clock', 's3fifo' or 'off' as argument.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                global.nuster.cache.eviction = NST_EVICTION_OFF;
+            } else if(!strcmp(args[cur_arg], "lru")) {
+                global.nuster.cache.eviction = NST_EVICTION_LRU;
+            } else if(!strcmp(args[cur_arg], "clock")) {
+                global.nuster.cache.eviction = NST_EVICTION_CLOCK;
+            } else if(!strcmp(args[cur_arg], "s3fifo")) {
+                global.nuster.cache.eviction = NST_EVICTION_S3FIFO;
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] only supports 'lru', 'clock', 's3fifo' and 'off'.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "admission")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] expects 'on' or 'off' as argument.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                global.nuster.cache.admission = NST_STATUS_OFF;
+            } else if(!strcmp(args[cur_arg], "on")) {
+                global.nuster.cache.admission = NST_STATUS_ON;
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] only supports 'on' and 'off'.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "compaction")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] expects 'on' or 'off' as argument.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                global.nuster.cache.compaction = NST_STATUS_OFF;
+            } else if(!strcmp(args[cur_arg], "on")) {
+                global.nuster.cache.compaction = NST_STATUS_ON;
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] only supports 'on' and 'off'.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "hugepages")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] hugepages expects 'thp', '2m', '1g', a hugetlbfs dir or 'off' as argument.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                global.nuster.cache.hugepages = NST_SHMEM_PAGES_NORMAL;
+            } else if(!strcmp(args[cur_arg], "thp")) {
+                global.nuster.cache.hugepages = NST_SHMEM_PAGES_THP;
+            } else if(!strcmp(args[cur_arg], "2m")) {
+                global.nuster.cache.hugepages = NST_SHMEM_PAGES_2M;
+            } else if(!strcmp(args[cur_arg], "1g")) {
+                global.nuster.cache.hugepages = NST_SHMEM_PAGES_1G;
+            } else if(*args[cur_arg] == '/') {
+                global.nuster.cache.hugepages     = NST_SHMEM_PAGES_FILE;
+                global.nuster.cache.hugepages_dir = strdup(args[cur_arg]);
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] hugepages only supports 'thp', '2m', '1g', an absolute dir and 'off'.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "numa")) {
+            char  *end;
+
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] numa expects 'interleave', a node or 'off' as argument.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                global.nuster.cache.numa = NST_SHMEM_NUMA_OFF;
+            } else if(!strcmp(args[cur_arg], "interleave")) {
+                global.nuster.cache.numa = NST_SHMEM_NUMA_INTERLEAVE;
+            } else {
+                global.nuster.cache.numa = strtol(args[cur_arg], &end, 10);
+
+                if(*end != 0 || global.nuster.cache.numa < 0 || global.nuster.cache.numa > 63) {
+                    ha_alert("parsing [%s:%d]: [%s] numa only supports 'interleave', a node between 0 and 63 and 'off'.\n",
+                            file, line, args[0]);
+
+                    err_code |= ERR_ALERT | ERR_FATAL;
+
+                    goto out;
+                }
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
         if(!strcmp(args[cur_arg], "data-cleaner")) {
             cur_arg++;
 
@@ -639,25 +889,27 @@ nuster_parse_global_cache(const char *file, int line, char **args) {
             continue;
         }
 
-        if(!strcmp(args[cur_arg], "clean-temp")) {
+        if(!strcmp(args[cur_arg], "disk-io")) {
             cur_arg++;
 
             if(*args[cur_arg] == 0) {
-                ha_alert("parsing [%s:%d]: [%s] expects 'on' or 'off' as argument.\n", file, line,
-                        args[0]);
+                ha_alert("parsing [%s:%d]: [%s] disk-io expects 'sync', 'threads' or 'uring' as argument.\n",
+                        file, line, args[0]);
 
                 err_code |= ERR_ALERT | ERR_FATAL;
 
                 goto out;
             }
 
-            if(!strcmp(args[cur_arg], "off")) {
-                global.nuster.cache.clean_temp = NST_STATUS_OFF;
-            } else if(!strcmp(args[cur_arg], "on")) {
-                global.nuster.cache.clean_temp = NST_STATUS_ON;
+            if(!strcmp(args[cur_arg], "sync")) {
+                global.nuster.cache.disk_io = NST_DISK_IO_SYNC;
+            } else if(!strcmp(args[cur_arg], "threads")) {
+                global.nuster.cache.disk_io = NST_DISK_IO_THREADS;
+            } else if(!strcmp(args[cur_arg], "uring")) {
+                global.nuster.cache.disk_io = NST_DISK_IO_URING;
             } else {
-                ha_alert("parsing [%s:%d]: [%s] only supports 'on' and 'off'.\n", file, line,
-                        args[0]);
+                ha_alert("parsing [%s:%d]: [%s] disk-io only supports 'sync', 'threads' and 'uring'.\n",
+                        file, line, args[0]);
 
                 err_code |= ERR_ALERT | ERR_FATAL;
 
@@ -669,73 +921,486 @@ nuster_parse_global_cache(const char *file, int line, char **args) {
             continue;
         }
 
-        ha_alert("parsing [%s:%d]: [%s] Unrecognized '%s'.\n", file, line, args[0], args[cur_arg]);
+        if(!strcmp(args[cur_arg], "disk-io-threads")) {
+            cur_arg++;
 
-        err_code |= ERR_ALERT | ERR_FATAL;
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] disk-io-threads expects a number.\n",
+                        file, line, args[0]);
 
-        goto out;
-    }
+                err_code |= ERR_ALERT | ERR_FATAL;
 
-out:
-    return err_code;
-}
+                goto out;
+            }
 
-int
-nuster_parse_global_nosql(const char *file, int line, char **args) {
-    int  err_code = 0;
-    int  cur_arg  = 1;
+            global.nuster.cache.disk_io_threads = atoi(args[cur_arg]);
 
-    if(global.nuster.nosql.status != NST_STATUS_UNDEFINED) {
-        ha_warning("parsing [%s:%d]: [%s] already specified. Ignore.\n", file, line, args[0]);
+            if(global.nuster.cache.disk_io_threads <= 0) {
+                global.nuster.cache.disk_io_threads = NST_DEFAULT_DISK_IO_THREADS;
+            }
 
-        err_code |= ERR_ALERT;
+            cur_arg++;
 
-        goto out;
-    }
+            continue;
+        }
 
-    if(*(args[cur_arg]) == 0) {
-        ha_alert("parsing [%s:%d]: [%s] expects 'on' or 'off' as argument.\n", file, line, args[0]);
+        if(!strcmp(args[cur_arg], "disk-layout")) {
+            cur_arg++;
 
-        err_code |= ERR_ALERT | ERR_FATAL;
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] disk-layout expects 'file' or 'segment' as argument.\n",
+                        file, line, args[0]);
 
-        goto out;
-    }
+                err_code |= ERR_ALERT | ERR_FATAL;
 
-    if(!strcmp(args[cur_arg], "off")) {
-        global.nuster.nosql.status = NST_STATUS_OFF;
-    } else if(!strcmp(args[cur_arg], "on")) {
-        global.nuster.nosql.status = NST_STATUS_ON;
-    } else {
-        ha_alert("parsing [%s:%d]: [%s] only supports 'on' and 'off'.\n", file, line, args[0]);
+                goto out;
+            }
 
-        err_code |= ERR_ALERT | ERR_FATAL;
+            if(!strcmp(args[cur_arg], "file")) {
+                global.nuster.cache.disk_layout = NST_DISK_LAYOUT_FILE;
+            } else if(!strcmp(args[cur_arg], "segment")) {
+                global.nuster.cache.disk_layout = NST_DISK_LAYOUT_SEGMENT;
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] disk-layout only supports 'file' and 'segment'.\n",
+                        file, line, args[0]);
 
-        goto out;
-    }
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "segment-size")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] segment-size expects a size.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(nst_parse_size(args[cur_arg], &global.nuster.cache.segment_size)
+                    || global.nuster.cache.segment_size < 1024 * 1024
+                    || global.nuster.cache.segment_size > 1024 * 1024 * 1024) {
+
+                ha_alert("parsing [%s:%d]: [%s] segment-size expects a size between 1m and 1g.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "disk-checkpoint")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] disk-checkpoint expects a number of seconds.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            global.nuster.cache.disk_checkpoint = atoi(args[cur_arg]);
+
+            if(global.nuster.cache.disk_checkpoint < 0) {
+                global.nuster.cache.disk_checkpoint = 0;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "clean-temp")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] expects 'on' or 'off' as argument.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                global.nuster.cache.clean_temp = NST_STATUS_OFF;
+            } else if(!strcmp(args[cur_arg], "on")) {
+                global.nuster.cache.clean_temp = NST_STATUS_ON;
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] only supports 'on' and 'off'.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        ha_alert("parsing [%s:%d]: [%s] Unrecognized '%s'.\n", file, line, args[0], args[cur_arg]);
+
+        err_code |= ERR_ALERT | ERR_FATAL;
+
+        goto out;
+    }
+
+out:
+    return err_code;
+}
+
+int
+nuster_parse_global_nosql(const char *file, int line, char **args) {
+    int  err_code = 0;
+    int  cur_arg  = 1;
+
+    if(global.nuster.nosql.status != NST_STATUS_UNDEFINED) {
+        ha_warning("parsing [%s:%d]: [%s] already specified. Ignore.\n", file, line, args[0]);
+
+        err_code |= ERR_ALERT;
+
+        goto out;
+    }
+
+    if(*(args[cur_arg]) == 0) {
+        ha_alert("parsing [%s:%d]: [%s] expects 'on' or 'off' as argument.\n", file, line, args[0]);
+
+        err_code |= ERR_ALERT | ERR_FATAL;
+
+        goto out;
+    }
+
+    if(!strcmp(args[cur_arg], "off")) {
+        global.nuster.nosql.status = NST_STATUS_OFF;
+    } else if(!strcmp(args[cur_arg], "on")) {
+        global.nuster.nosql.status = NST_STATUS_ON;
+    } else {
+        ha_alert("parsing [%s:%d]: [%s] only supports 'on' and 'off'.\n", file, line, args[0]);
+
+        err_code |= ERR_ALERT | ERR_FATAL;
+
+        goto out;
+    }
+
+    cur_arg++;
+
+    while(*(args[cur_arg]) !=0) {
+
+        if(!strcmp(args[cur_arg], "dict-size")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] dict-size expects a size.\n", file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(nst_parse_size(args[cur_arg], &global.nuster.nosql.dict_size)) {
+
+                ha_alert("parsing [%s:%d]: [%s] invalid dict-size, expects [m|M|g|G].\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "data-size")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] data-size expects a size.\n", file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(nst_parse_size(args[cur_arg], &global.nuster.nosql.data_size)) {
+
+                ha_alert("parsing [%s:%d]: [%s] invalid data_size, expects [m|M|g|G].\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "dir")) {
+            cur_arg++;
+
+            if(*(args[cur_arg]) == 0) {
+                ha_alert("parsing [%s:%d]: [%s]: `dir` expects a dir as argument.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            global.nuster.nosql.root.ptr = strdup(args[cur_arg]);
+            global.nuster.nosql.root.len = strlen(args[cur_arg]);
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "dict-cleaner")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] dict-cleaner expects a number.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            global.nuster.nosql.dict_cleaner = atoi(args[cur_arg]);
+
+            if(global.nuster.nosql.dict_cleaner <= 0) {
+                global.nuster.nosql.dict_cleaner = NST_DEFAULT_DICT_CLEANER;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "dict-rehasher")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] dict-rehasher expects a number.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            global.nuster.nosql.dict_rehasher = atoi(args[cur_arg]);
+
+            if(global.nuster.nosql.dict_rehasher <= 0) {
+                global.nuster.nosql.dict_rehasher = NST_DEFAULT_DICT_REHASHER;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "dict-layout")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] expects 'chain' or 'tag' as argument.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "chain")) {
+                global.nuster.nosql.dict_layout = NST_DICT_LAYOUT_CHAIN;
+            } else if(!strcmp(args[cur_arg], "tag")) {
+                global.nuster.nosql.dict_layout = NST_DICT_LAYOUT_TAG;
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] only supports 'chain' and 'tag'.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "dict-index")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] expects 'on' or 'off' as argument.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                global.nuster.nosql.dict_index = NST_STATUS_OFF;
+            } else if(!strcmp(args[cur_arg], "on")) {
+                global.nuster.nosql.dict_index = NST_STATUS_ON;
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] only supports 'on' and 'off'.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "compaction")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] expects 'on' or 'off' as argument.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                global.nuster.nosql.compaction = NST_STATUS_OFF;
+            } else if(!strcmp(args[cur_arg], "on")) {
+                global.nuster.nosql.compaction = NST_STATUS_ON;
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] only supports 'on' and 'off'.\n", file, line,
+                        args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "hugepages")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] hugepages expects 'thp', '2m', '1g', a hugetlbfs dir or 'off' as argument.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                global.nuster.nosql.hugepages = NST_SHMEM_PAGES_NORMAL;
+            } else if(!strcmp(args[cur_arg], "thp")) {
+                global.nuster.nosql.hugepages = NST_SHMEM_PAGES_THP;
+            } else if(!strcmp(args[cur_arg], "2m")) {
+                global.nuster.nosql.hugepages = NST_SHMEM_PAGES_2M;
+            } else if(!strcmp(args[cur_arg], "1g")) {
+                global.nuster.nosql.hugepages = NST_SHMEM_PAGES_1G;
+            } else if(*args[cur_arg] == '/') {
+                global.nuster.nosql.hugepages     = NST_SHMEM_PAGES_FILE;
+                global.nuster.nosql.hugepages_dir = strdup(args[cur_arg]);
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] hugepages only supports 'thp', '2m', '1g', an absolute dir and 'off'.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "numa")) {
+            char  *end;
+
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] numa expects 'interleave', a node or 'off' as argument.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                global.nuster.nosql.numa = NST_SHMEM_NUMA_OFF;
+            } else if(!strcmp(args[cur_arg], "interleave")) {
+                global.nuster.nosql.numa = NST_SHMEM_NUMA_INTERLEAVE;
+            } else {
+                global.nuster.nosql.numa = strtol(args[cur_arg], &end, 10);
+
+                if(*end != 0 || global.nuster.nosql.numa < 0 || global.nuster.nosql.numa > 63) {
+                    ha_alert("parsing [%s:%d]: [%s] numa only supports 'interleave', a node between 0 and 63 and 'off'.\n",
+                            file, line, args[0]);
+
+                    err_code |= ERR_ALERT | ERR_FATAL;
 
-    cur_arg++;
+                    goto out;
+                }
+            }
 
-    while(*(args[cur_arg]) !=0) {
+            cur_arg++;
 
-        if(!strcmp(args[cur_arg], "dict-size")) {
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "data-cleaner")) {
             cur_arg++;
 
             if(*args[cur_arg] == 0) {
-                ha_alert("parsing [%s:%d]: [%s] dict-size expects a size.\n", file, line, args[0]);
+                ha_alert("parsing [%s:%d]: [%s] data-cleaner expects a number.\n",
+                        file, line, args[0]);
 
                 err_code |= ERR_ALERT | ERR_FATAL;
 
                 goto out;
             }
 
-            if(nst_parse_size(args[cur_arg], &global.nuster.nosql.dict_size)) {
-
-                ha_alert("parsing [%s:%d]: [%s] invalid dict-size, expects [m|M|g|G].\n",
-                        file, line, args[0]);
-
-                err_code |= ERR_ALERT | ERR_FATAL;
+            global.nuster.nosql.data_cleaner = atoi(args[cur_arg]);
 
-                goto out;
+            if(global.nuster.nosql.data_cleaner <= 0) {
+                global.nuster.nosql.data_cleaner = NST_DEFAULT_DATA_CLEANER;
             }
 
             cur_arg++;
@@ -743,20 +1408,34 @@ nuster_parse_global_nosql(const char *file, int line, char **args) {
             continue;
         }
 
-        if(!strcmp(args[cur_arg], "data-size")) {
+        if(!strcmp(args[cur_arg], "disk-cleaner")) {
             cur_arg++;
 
             if(*args[cur_arg] == 0) {
-                ha_alert("parsing [%s:%d]: [%s] data-size expects a size.\n", file, line, args[0]);
+                ha_alert("parsing [%s:%d]: [%s] disk-cleaner expects a number.\n",
+                        file, line, args[0]);
 
                 err_code |= ERR_ALERT | ERR_FATAL;
 
                 goto out;
             }
 
-            if(nst_parse_size(args[cur_arg], &global.nuster.nosql.data_size)) {
+            global.nuster.nosql.disk_cleaner = atoi(args[cur_arg]);
 
-                ha_alert("parsing [%s:%d]: [%s] invalid data_size, expects [m|M|g|G].\n",
+            if(global.nuster.nosql.disk_cleaner <= 0) {
+                global.nuster.nosql.disk_cleaner = NST_DEFAULT_DISK_CLEANER;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "disk-loader")) {
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] disk-loader expects a number.\n",
                         file, line, args[0]);
 
                 err_code |= ERR_ALERT | ERR_FATAL;
@@ -764,16 +1443,22 @@ nuster_parse_global_nosql(const char *file, int line, char **args) {
                 goto out;
             }
 
+            global.nuster.nosql.disk_loader = atoi(args[cur_arg]);
+
+            if(global.nuster.nosql.disk_loader <= 0) {
+                global.nuster.nosql.disk_loader = NST_DEFAULT_DISK_LOADER;
+            }
+
             cur_arg++;
 
             continue;
         }
 
-        if(!strcmp(args[cur_arg], "dir")) {
+        if(!strcmp(args[cur_arg], "disk-saver")) {
             cur_arg++;
 
-            if(*(args[cur_arg]) == 0) {
-                ha_alert("parsing [%s:%d]: [%s]: `dir` expects a dir as argument.\n",
+            if(*args[cur_arg] == 0) {
+                ha_alert("parsing [%s:%d]: [%s] disk-saver expects a number.\n",
                         file, line, args[0]);
 
                 err_code |= ERR_ALERT | ERR_FATAL;
@@ -781,19 +1466,22 @@ nuster_parse_global_nosql(const char *file, int line, char **args) {
                 goto out;
             }
 
-            global.nuster.nosql.root.ptr = strdup(args[cur_arg]);
-            global.nuster.nosql.root.len = strlen(args[cur_arg]);
+            global.nuster.nosql.disk_saver = atoi(args[cur_arg]);
+
+            if(global.nuster.nosql.disk_saver <= 0) {
+                global.nuster.nosql.disk_saver = NST_DEFAULT_DISK_SAVER;
+            }
 
             cur_arg++;
 
             continue;
         }
 
-        if(!strcmp(args[cur_arg], "dict-cleaner")) {
+        if(!strcmp(args[cur_arg], "disk-io")) {
             cur_arg++;
 
             if(*args[cur_arg] == 0) {
-                ha_alert("parsing [%s:%d]: [%s] dict-cleaner expects a number.\n",
+                ha_alert("parsing [%s:%d]: [%s] disk-io expects 'sync', 'threads' or 'uring' as argument.\n",
                         file, line, args[0]);
 
                 err_code |= ERR_ALERT | ERR_FATAL;
@@ -801,10 +1489,19 @@ nuster_parse_global_nosql(const char *file, int line, char **args) {
                 goto out;
             }
 
-            global.nuster.nosql.dict_cleaner = atoi(args[cur_arg]);
+            if(!strcmp(args[cur_arg], "sync")) {
+                global.nuster.nosql.disk_io = NST_DISK_IO_SYNC;
+            } else if(!strcmp(args[cur_arg], "threads")) {
+                global.nuster.nosql.disk_io = NST_DISK_IO_THREADS;
+            } else if(!strcmp(args[cur_arg], "uring")) {
+                global.nuster.nosql.disk_io = NST_DISK_IO_URING;
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] disk-io only supports 'sync', 'threads' and 'uring'.\n",
+                        file, line, args[0]);
 
-            if(global.nuster.nosql.dict_cleaner <= 0) {
-                global.nuster.nosql.dict_cleaner = NST_DEFAULT_DICT_CLEANER;
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
             }
 
             cur_arg++;
@@ -812,11 +1509,11 @@ nuster_parse_global_nosql(const char *file, int line, char **args) {
             continue;
         }
 
-        if(!strcmp(args[cur_arg], "data-cleaner")) {
+        if(!strcmp(args[cur_arg], "disk-io-threads")) {
             cur_arg++;
 
             if(*args[cur_arg] == 0) {
-                ha_alert("parsing [%s:%d]: [%s] data-cleaner expects a number.\n",
+                ha_alert("parsing [%s:%d]: [%s] disk-io-threads expects a number.\n",
                         file, line, args[0]);
 
                 err_code |= ERR_ALERT | ERR_FATAL;
@@ -824,10 +1521,10 @@ nuster_parse_global_nosql(const char *file, int line, char **args) {
                 goto out;
             }
 
-            global.nuster.nosql.data_cleaner = atoi(args[cur_arg]);
+            global.nuster.nosql.disk_io_threads = atoi(args[cur_arg]);
 
-            if(global.nuster.nosql.data_cleaner <= 0) {
-                global.nuster.nosql.data_cleaner = NST_DEFAULT_DATA_CLEANER;
+            if(global.nuster.nosql.disk_io_threads <= 0) {
+                global.nuster.nosql.disk_io_threads = NST_DEFAULT_DISK_IO_THREADS;
             }
 
             cur_arg++;
@@ -835,11 +1532,11 @@ nuster_parse_global_nosql(const char *file, int line, char **args) {
             continue;
         }
 
-        if(!strcmp(args[cur_arg], "disk-cleaner")) {
+        if(!strcmp(args[cur_arg], "disk-layout")) {
             cur_arg++;
 
             if(*args[cur_arg] == 0) {
-                ha_alert("parsing [%s:%d]: [%s] disk-cleaner expects a number.\n",
+                ha_alert("parsing [%s:%d]: [%s] disk-layout expects 'file' or 'segment' as argument.\n",
                         file, line, args[0]);
 
                 err_code |= ERR_ALERT | ERR_FATAL;
@@ -847,10 +1544,17 @@ nuster_parse_global_nosql(const char *file, int line, char **args) {
                 goto out;
             }
 
-            global.nuster.nosql.disk_cleaner = atoi(args[cur_arg]);
+            if(!strcmp(args[cur_arg], "file")) {
+                global.nuster.nosql.disk_layout = NST_DISK_LAYOUT_FILE;
+            } else if(!strcmp(args[cur_arg], "segment")) {
+                global.nuster.nosql.disk_layout = NST_DISK_LAYOUT_SEGMENT;
+            } else {
+                ha_alert("parsing [%s:%d]: [%s] disk-layout only supports 'file' and 'segment'.\n",
+                        file, line, args[0]);
 
-            if(global.nuster.nosql.disk_cleaner <= 0) {
-                global.nuster.nosql.disk_cleaner = NST_DEFAULT_DISK_CLEANER;
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
             }
 
             cur_arg++;
@@ -858,22 +1562,28 @@ nuster_parse_global_nosql(const char *file, int line, char **args) {
             continue;
         }
 
-        if(!strcmp(args[cur_arg], "disk-loader")) {
+        if(!strcmp(args[cur_arg], "segment-size")) {
             cur_arg++;
 
             if(*args[cur_arg] == 0) {
-                ha_alert("parsing [%s:%d]: [%s] disk-loader expects a number.\n",
-                        file, line, args[0]);
+                ha_alert("parsing [%s:%d]: [%s] segment-size expects a size.\n", file, line,
+                        args[0]);
 
                 err_code |= ERR_ALERT | ERR_FATAL;
 
                 goto out;
             }
 
-            global.nuster.nosql.disk_loader = atoi(args[cur_arg]);
+            if(nst_parse_size(args[cur_arg], &global.nuster.nosql.segment_size)
+                    || global.nuster.nosql.segment_size < 1024 * 1024
+                    || global.nuster.nosql.segment_size > 1024 * 1024 * 1024) {
 
-            if(global.nuster.nosql.disk_loader <= 0) {
-                global.nuster.nosql.disk_loader = NST_DEFAULT_DISK_LOADER;
+                ha_alert("parsing [%s:%d]: [%s] segment-size expects a size between 1m and 1g.\n",
+                        file, line, args[0]);
+
+                err_code |= ERR_ALERT | ERR_FATAL;
+
+                goto out;
             }
 
             cur_arg++;
@@ -881,11 +1591,11 @@ nuster_parse_global_nosql(const char *file, int line, char **args) {
             continue;
         }
 
-        if(!strcmp(args[cur_arg], "disk-saver")) {
+        if(!strcmp(args[cur_arg], "disk-checkpoint")) {
             cur_arg++;
 
             if(*args[cur_arg] == 0) {
-                ha_alert("parsing [%s:%d]: [%s] disk-saver expects a number.\n",
+                ha_alert("parsing [%s:%d]: [%s] disk-checkpoint expects a number of seconds.\n",
                         file, line, args[0]);
 
                 err_code |= ERR_ALERT | ERR_FATAL;
@@ -893,10 +1603,10 @@ nuster_parse_global_nosql(const char *file, int line, char **args) {
                 goto out;
             }
 
-            global.nuster.nosql.disk_saver = atoi(args[cur_arg]);
+            global.nuster.nosql.disk_checkpoint = atoi(args[cur_arg]);
 
-            if(global.nuster.nosql.disk_saver <= 0) {
-                global.nuster.nosql.disk_saver = NST_DEFAULT_DISK_SAVER;
+            if(global.nuster.nosql.disk_checkpoint < 0) {
+                global.nuster.nosql.disk_checkpoint = 0;
             }
 
             cur_arg++;
@@ -1072,13 +1782,16 @@ nst_parse_proxy_rule(char **args, int section, hpx_proxy_t *proxy, hpx_proxy_t *
     char               *name = NULL;
     char               *key  = NULL;
     char               *code = NULL;
+    char               *tag  = NULL;
 
-    int      memory, disk, ttl, etag, last_modified, wait, stale, inactive;
+    int      memory, disk, ttl, etag, last_modified, wait, stale, inactive, compress, precompress;
+    int      head, refresh_ahead;
     uint8_t  extend[4] = { -1 };
     int      cur_arg   = 2;
     int      ret;
 
-    memory = disk = etag = last_modified = wait = stale = inactive = -1;
+    memory = disk = etag = last_modified = wait = stale = inactive = compress = precompress = -1;
+    head = refresh_ahead = -1;
     ttl = -2;
 
     if(proxy == defpx || !(proxy->cap & PR_CAP_BE)) {
@@ -1506,6 +2219,199 @@ nst_parse_proxy_rule(char **args, int section, hpx_proxy_t *proxy, hpx_proxy_t *
             continue;
         }
 
+        if(!strcmp(args[cur_arg], "tag-header")) {
+
+            if(tag != NULL) {
+                memprintf(err, "[%s.%s]: tag-header already specified.", args[1], name);
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            if(*(args[cur_arg]) == 0) {
+                memprintf(err, "[%s.%s]: tag-header expects a header name.", args[1], name);
+
+                goto out;
+            }
+
+            tag = args[cur_arg];
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "compress")) {
+
+            if(compress != -1) {
+                memprintf(err, "[%s.%s]: compress already specified.", args[1], name);
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                memprintf(err, "[%s.%s]: compress expects [off|gzip], default off.", args[1], name);
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                compress = NST_MEMORY_ENCODING_IDENTITY;
+            } else if(!strcmp(args[cur_arg], "gzip")) {
+                compress = NST_MEMORY_ENCODING_GZIP;
+            } else {
+                memprintf(err, "[%s.%s]: compress expects [off|gzip], default off.", args[1], name);
+
+                goto out;
+            }
+
+#if !defined(USE_ZLIB)
+            if(compress != NST_MEMORY_ENCODING_IDENTITY) {
+                memprintf(err, "[%s.%s]: compress %s requires USE_ZLIB.", args[1], name,
+                        args[cur_arg]);
+
+                goto out;
+            }
+#endif
+
+            if(proxy->nuster.mode != NST_MODE_CACHE) {
+                memprintf(err, "[%s.%s]: compress is only supported in cache mode.", args[1], name);
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "precompress")) {
+
+            if(precompress != -1) {
+                memprintf(err, "[%s.%s]: precompress already specified.", args[1], name);
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                memprintf(err, "[%s.%s]: precompress expects [off|gzip], default off.", args[1],
+                        name);
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                precompress = NST_MEMORY_ENCODING_IDENTITY;
+            } else if(!strcmp(args[cur_arg], "gzip")) {
+                precompress = NST_MEMORY_ENCODING_GZIP;
+            } else {
+                memprintf(err, "[%s.%s]: precompress expects [off|gzip], default off.", args[1],
+                        name);
+
+                goto out;
+            }
+
+#if !defined(USE_ZLIB)
+            if(precompress != NST_MEMORY_ENCODING_IDENTITY) {
+                memprintf(err, "[%s.%s]: precompress %s requires USE_ZLIB.", args[1], name,
+                        args[cur_arg]);
+
+                goto out;
+            }
+#endif
+
+            if(proxy->nuster.mode != NST_MODE_CACHE) {
+                memprintf(err, "[%s.%s]: precompress is only supported in cache mode.", args[1],
+                        name);
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "head")) {
+
+            if(head != -1) {
+                memprintf(err, "[%s.%s]: head already specified.", args[1], name);
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            if(!strcmp(args[cur_arg], "on")) {
+                head = NST_STATUS_ON;
+            } else if(!strcmp(args[cur_arg], "off")) {
+                head = NST_STATUS_OFF;
+            } else {
+                memprintf(err, "[%s.%s]: head expects [on|off], default off.", args[1], name);
+
+                goto out;
+            }
+
+            if(proxy->nuster.mode != NST_MODE_CACHE) {
+                memprintf(err, "[%s.%s]: head is only supported in cache mode.", args[1], name);
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
+        if(!strcmp(args[cur_arg], "refresh-ahead")) {
+            char  *next;
+
+            if(refresh_ahead != -1) {
+                memprintf(err, "[%s.%s]: refresh-ahead already specified.", args[1], name);
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            if(*args[cur_arg] == 0) {
+                memprintf(err, "[%s.%s]: refresh-ahead expects [off|PCT], default off.", args[1],
+                        name);
+
+                goto out;
+            }
+
+            if(!strcmp(args[cur_arg], "off")) {
+                refresh_ahead = 0;
+            } else {
+                refresh_ahead = strtol(args[cur_arg], &next, 10);
+
+                if(next == args[cur_arg] || *next != '\0' || refresh_ahead < 1
+                        || refresh_ahead > 99) {
+
+                    memprintf(err, "[%s.%s]: refresh-ahead expects an integer between 1 and 99.",
+                            args[1], name);
+
+                    goto out;
+                }
+            }
+
+            if(proxy->nuster.mode != NST_MODE_CACHE) {
+                memprintf(err, "[%s.%s]: refresh-ahead is only supported in cache mode.", args[1],
+                        name);
+
+                goto out;
+            }
+
+            cur_arg++;
+
+            continue;
+        }
+
         memprintf(err, "[%s.%s]: Unrecognized '%s'.", args[1], name, args[cur_arg]);
 
         goto out;
@@ -1539,6 +2445,7 @@ nst_parse_proxy_rule(char **args, int section, hpx_proxy_t *proxy, hpx_proxy_t *
 
     rule->key.name = strdup(key == NULL ? NST_DEFAULT_KEY : key);
     rule->key.data = _nst_parse_rule_key(rule->key.name);
+    rule->key.head = head == -1 ? NST_STATUS_OFF : head;
 
     if(!rule->key.data) {
         memprintf(err, "[%s.%s]: invalid key.", args[1], name);
@@ -1566,6 +2473,33 @@ nst_parse_proxy_rule(char **args, int section, hpx_proxy_t *proxy, hpx_proxy_t *
         goto out;
     }
 
+    if(compress > 0 && disk == NST_STORE_DISK_SYNC) {
+        memprintf(err, "[%s.%s]: compress cannot be used with disk sync", args[1], name);
+
+        goto out;
+    }
+
+    if(compress > 0 && precompress > 0) {
+        memprintf(err, "[%s.%s]: compress and precompress cannot be used together", args[1], name);
+
+        goto out;
+    }
+
+    if(precompress > 0 && memory == NST_STORE_MEMORY_OFF) {
+        ha_warning("parsing [%s:%d]: [%s.%s]: precompress has no effect with memory off\n", file,
+                line, args[1], name);
+    }
+
+    if(compress > 0 && memory == NST_STORE_MEMORY_OFF) {
+        ha_warning("parsing [%s:%d]: [%s.%s]: compress has no effect with memory off\n", file,
+                line, args[1], name);
+    }
+
+    if(refresh_ahead > 0 && rule->ttl == 0) {
+        ha_warning("parsing [%s:%d]: [%s.%s]: refresh-ahead has no effect with ttl 0\n", file,
+                line, args[1], name);
+    }
+
     if(memory == NST_STORE_MEMORY_OFF && disk == NST_STORE_DISK_OFF) {
         ha_warning("parsing [%s:%d]: [%s.%s]: both memory and disk are off\n", file, line,
                 args[1], name);
@@ -1604,6 +2538,12 @@ nst_parse_proxy_rule(char **args, int section, hpx_proxy_t *proxy, hpx_proxy_t *
     rule->stale    = stale;
     rule->inactive = inactive == -1 ? 0 : inactive;
 
+    rule->tag_header = tag == NULL ? NULL : strdup(tag);
+    rule->compress    = compress    == -1 ? NST_MEMORY_ENCODING_IDENTITY : compress;
+    rule->precompress = precompress == -1 ? NST_MEMORY_ENCODING_IDENTITY : precompress;
+
+    rule->refresh_ahead = refresh_ahead == -1 ? 0 : refresh_ahead;
+
     rule->cond = cond;
 
     LIST_INIT(&rule->list);
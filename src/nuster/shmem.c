@@ -11,19 +11,256 @@
  */
 
 #include <sys/mman.h>
+#include <sys/vfs.h>
 
+#include <haproxy/errors.h>
+#include <haproxy/global.h>
+#include <haproxy/thread.h>
 #include <haproxy/tools.h>
 
 #include <nuster/shctx.h>
 #include <nuster/shmem.h>
 
+static THREAD_LOCAL nst_shmem_cache_t  nst_shmem_caches[NST_SHMEM_CACHE_MAX];
+static int                             nst_shmem_count = 0;
+
+static inline int
+_nst_shmem_chunk_idx(nst_shmem_t *shmem, int size) {
+    int  i, chunk_idx = 0;
+
+    for(i = (size - 1) >> (shmem->chunk_shift - 1); i >>= 1; chunk_idx++) {}
+
+    return chunk_idx;
+}
+
+/*
+ * Magazines are thread local and only used by workers once started, so
+ * that neither the master nor a forked child ever holds inherited chunks.
+ */
+static inline int
+_nst_shmem_local(nst_shmem_t *shmem) {
+    return !master && !(global.mode & MODE_STARTING) && shmem->id >= 0;
+}
+
+static inline nst_shmem_cache_t *
+_nst_shmem_cache(nst_shmem_t *shmem, int chunk_idx) {
+
+    if(!_nst_shmem_local(shmem)
+            || (1 << (shmem->chunk_shift + chunk_idx)) > NST_SHMEM_CACHE_MAX_SIZE) {
+
+        return NULL;
+    }
+
+    return &nst_shmem_caches[shmem->id];
+}
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB                   0x40000
+#endif
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT                26
+#endif
+
+#ifndef MPOL_BIND
+#define MPOL_BIND                     2
+#define MPOL_INTERLEAVE               3
+#endif
+
+#ifndef MPOL_F_MEMS_ALLOWED
+#define MPOL_F_MEMS_ALLOWED           (1 << 2)
+#endif
+
+const char *
+nst_shmem_pages_str(int pages) {
+
+    switch(pages) {
+        case NST_SHMEM_PAGES_THP:
+            return "thp";
+        case NST_SHMEM_PAGES_2M:
+            return "2m";
+        case NST_SHMEM_PAGES_1G:
+            return "1g";
+        case NST_SHMEM_PAGES_FILE:
+            return "hugetlbfs";
+        default:
+            return "normal";
+    }
+}
+
+/*
+ * Maps an unlinked file of a hugetlbfs mount, size is rounded up to
+ * the huge page size of the mount.
+ */
+static uint8_t *
+_nst_shmem_mmap_file(uint64_t *size, char *dir) {
+    struct statfs  fs;
+    uint8_t       *p;
+    char          *path;
+    uint64_t       n;
+    int            fd;
+
+    if(dir == NULL || statfs(dir, &fs) != 0 || fs.f_bsize <= 0) {
+        return MAP_FAILED;
+    }
+
+    path = malloc(strlen(dir) + sizeof("/nuster.XXXXXX"));
+
+    if(path == NULL) {
+        return MAP_FAILED;
+    }
+
+    sprintf(path, "%s/nuster.XXXXXX", dir);
+
+    fd = mkstemp(path);
+
+    if(fd == -1) {
+        free(path);
+
+        return MAP_FAILED;
+    }
+
+    unlink(path);
+    free(path);
+
+    n = (*size + fs.f_bsize - 1) / fs.f_bsize * fs.f_bsize;
+    p = MAP_FAILED;
+
+    if(ftruncate(fd, n) == 0) {
+        p = (uint8_t *) mmap(NULL, n, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    close(fd);
+
+    if(p != MAP_FAILED) {
+        *size = n;
+    }
+
+    return p;
+}
+
+static uint8_t *
+_nst_shmem_mmap_huge(uint64_t *size, int shift) {
+    uint8_t   *p;
+    uint64_t   n;
+
+    n = (*size + (1ULL << shift) - 1) & ~((1ULL << shift) - 1);
+    p = (uint8_t *) mmap(NULL, n, PROT_READ|PROT_WRITE,
+            MAP_ANON|MAP_SHARED|MAP_HUGETLB|(shift << MAP_HUGE_SHIFT), -1, 0);
+
+    if(p != MAP_FAILED) {
+        *size = n;
+    }
+
+    return p;
+}
+
+/*
+ * Maps the memory zone with the requested pages, falls back to
+ * transparent huge pages, then to normal pages. pages is set to the
+ * kind of pages in effect.
+ */
+static uint8_t *
+_nst_shmem_mmap(uint64_t *size, int *pages, char *dir) {
+    uint8_t  *p = MAP_FAILED;
+
+    if(*pages == NST_SHMEM_PAGES_FILE) {
+        p = _nst_shmem_mmap_file(size, dir);
+    } else if(*pages == NST_SHMEM_PAGES_2M) {
+        p = _nst_shmem_mmap_huge(size, 21);
+    } else if(*pages == NST_SHMEM_PAGES_1G) {
+        p = _nst_shmem_mmap_huge(size, 30);
+    }
+
+    if(p != MAP_FAILED) {
+        return p;
+    }
+
+    p = (uint8_t *) mmap(NULL, *size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+
+    if(p == MAP_FAILED) {
+        return p;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if(*pages != NST_SHMEM_PAGES_NORMAL && madvise(p, *size, MADV_HUGEPAGE) == 0) {
+        *pages = NST_SHMEM_PAGES_THP;
+
+        return p;
+    }
+#endif
+
+    *pages = NST_SHMEM_PAGES_NORMAL;
+
+    return p;
+}
+
+/*
+ * Interleaves the memory zone over the allowed nodes or binds it to one
+ * node, before any page is touched. Returns the policy in effect.
+ */
+static int
+_nst_shmem_bind(uint8_t *p, uint64_t size, int numa) {
+#if defined(SYS_mbind) && defined(SYS_get_mempolicy)
+    unsigned long  mask;
+
+    if(numa == NST_SHMEM_NUMA_OFF) {
+        return numa;
+    }
+
+    if(numa == NST_SHMEM_NUMA_INTERLEAVE) {
+
+        if(syscall(SYS_get_mempolicy, NULL, &mask, sizeof(mask) * 8 + 1,
+                    NULL, MPOL_F_MEMS_ALLOWED) != 0) {
+
+            return NST_SHMEM_NUMA_OFF;
+        }
+
+        if(syscall(SYS_mbind, p, size, MPOL_INTERLEAVE, &mask, sizeof(mask) * 8 + 1, 0) == 0) {
+            return numa;
+        }
+    } else {
+        mask = 1UL << numa;
+
+        if(syscall(SYS_mbind, p, size, MPOL_BIND, &mask, sizeof(mask) * 8 + 1, 0) == 0) {
+            return numa;
+        }
+    }
+#endif
+
+    return NST_SHMEM_NUMA_OFF;
+}
+
+static void
+_nst_shmem_report(nst_shmem_t *shmem, int pages, int numa) {
+
+    if(shmem->pages != pages) {
+        ha_warning("nuster %s: %s pages are not available, using %s pages.\n",
+                shmem->name, nst_shmem_pages_str(pages), nst_shmem_pages_str(shmem->pages));
+    } else if(pages != NST_SHMEM_PAGES_NORMAL) {
+        ha_notice("nuster %s: using %s pages.\n", shmem->name, nst_shmem_pages_str(pages));
+    }
+
+    if(shmem->numa != numa) {
+        ha_warning("nuster %s: failed to set numa policy, using the default one.\n",
+                shmem->name);
+    } else if(numa == NST_SHMEM_NUMA_INTERLEAVE) {
+        ha_notice("nuster %s: interleaved over numa nodes.\n", shmem->name);
+    } else if(numa != NST_SHMEM_NUMA_OFF) {
+        ha_notice("nuster %s: bound to numa node %d.\n", shmem->name, numa);
+    }
+}
+
 nst_shmem_t *
-nst_shmem_create(char *name, uint64_t size, uint32_t block_size, uint32_t chunk_size) {
+nst_shmem_create(char *name, uint64_t size, uint32_t block_size, uint32_t chunk_size,
+        int pages, char *dir, int numa) {
+
     uint8_t      *p;
     nst_shmem_t  *shmem;
     uint64_t      n;
     uint8_t      *begin, *end;
     uint32_t      bitmap_size;
+    int           used_pages, used_numa;
 
     if(block_size < NST_SHMEM_BLOCK_MIN_SIZE) {
         block_size = NST_SHMEM_BLOCK_MIN_SIZE;
@@ -68,7 +305,8 @@ nst_shmem_create(char *name, uint64_t size, uint32_t block_size, uint32_t chunk_
     size = (size + block_size - 1) / block_size * block_size;
 
     /* create shared memory */
-    p = (uint8_t *) mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+    used_pages = pages;
+    p          = _nst_shmem_mmap(&size, &used_pages, dir);
 
     if(p == MAP_FAILED) {
         fprintf(stderr, "Out of memory when initialization.\n");
@@ -76,7 +314,8 @@ nst_shmem_create(char *name, uint64_t size, uint32_t block_size, uint32_t chunk_
         return NULL;
     }
 
-    shmem = (nst_shmem_t *)p;
+    used_numa = _nst_shmem_bind(p, size, numa);
+    shmem     = (nst_shmem_t *)p;
 
     /* init header */
     if(name) {
@@ -89,6 +328,10 @@ nst_shmem_create(char *name, uint64_t size, uint32_t block_size, uint32_t chunk_
     shmem->chunk_size = chunk_size;
     shmem->size       = size;
     shmem->used       = 0;
+    shmem->pages      = used_pages;
+    shmem->numa       = used_numa;
+
+    _nst_shmem_report(shmem, pages, numa);
 
     p += sizeof(nst_shmem_t);
 
@@ -154,6 +397,8 @@ nst_shmem_create(char *name, uint64_t size, uint32_t block_size, uint32_t chunk_
         shmem->block[n].next   = NULL;
     }
 
+    shmem->id = nst_shmem_count < NST_SHMEM_CACHE_MAX ? nst_shmem_count++ : -1;
+
     return shmem;
 }
 
@@ -170,6 +415,8 @@ _nst_shmem_block_alloc(nst_shmem_t *shmem, nst_shmem_ctrl_t *block, int chunk_id
 
     shmem->used += chunk_size;
 
+    shmem->classes[chunk_idx].chunks++;
+
     /* use info, should not use anymore */
     if(chunk_size * NST_SHMEM_INFO_BITMAP_BITS >= shmem->block_size) {
         uint32_t  mask =  ~0U >> (NST_SHMEM_INFO_BITMAP_BITS - bits_need);
@@ -251,6 +498,8 @@ _nst_shmem_block_init(nst_shmem_t * shmem, nst_shmem_ctrl_t *block, int chunk_id
     _nst_shmem_block_set_type(block, chunk_idx);
     _nst_shmem_block_set_inited(block);
 
+    shmem->classes[chunk_idx].blocks++;
+
     memset(block->bitmap, 0, shmem->block_size / shmem->chunk_size / 8);
 
     block->prev = NULL;
@@ -268,13 +517,13 @@ _nst_shmem_block_init(nst_shmem_t * shmem, nst_shmem_ctrl_t *block, int chunk_id
 void *
 nst_shmem_alloc_locked(nst_shmem_t *shmem, int size) {
     nst_shmem_ctrl_t  *chunk, *block;
-    int                 i, chunk_idx = 0;
+    int                 chunk_idx;
 
     if(!size || size > shmem->block_size) {
         return NULL;
     }
 
-    for(i = (size - 1) >> (shmem->chunk_shift - 1); i >>= 1; chunk_idx++) {}
+    chunk_idx = _nst_shmem_chunk_idx(shmem, size);
 
     chunk = shmem->chunk[chunk_idx];
 
@@ -314,12 +563,59 @@ nst_shmem_alloc_locked(nst_shmem_t *shmem, int size) {
     return _nst_shmem_block_alloc(shmem, block, chunk_idx);
 }
 
+/*
+ * Small chunks are served from the calling thread's magazine, an empty
+ * magazine is refilled with NST_SHMEM_CACHE_BATCH chunks under one lock.
+ */
 void *
 nst_shmem_alloc(nst_shmem_t *shmem, int size) {
-    void  *p;
+    nst_shmem_cache_t  *cache;
+    void               *p, *q;
+    int                 chunk_idx;
+
+    if(!size || size > shmem->block_size) {
+        return NULL;
+    }
+
+    chunk_idx = _nst_shmem_chunk_idx(shmem, size);
+    cache     = _nst_shmem_cache(shmem, chunk_idx);
+
+    if(cache == NULL) {
+
+        if(_nst_shmem_local(shmem)) {
+            shmem->stats[tid].miss++;
+        }
+
+        nst_shctx_lock(shmem);
+        p = nst_shmem_alloc_locked(shmem, size);
+        nst_shctx_unlock(shmem);
+
+        return p;
+    }
+
+    if(cache->count[chunk_idx]) {
+        shmem->stats[tid].hit++;
+
+        return cache->chunk[chunk_idx][--cache->count[chunk_idx]];
+    }
+
+    shmem->stats[tid].miss++;
+    shmem->stats[tid].refill++;
 
     nst_shctx_lock(shmem);
+
     p = nst_shmem_alloc_locked(shmem, size);
+
+    while(p && cache->count[chunk_idx] < NST_SHMEM_CACHE_BATCH) {
+        q = nst_shmem_alloc_locked(shmem, size);
+
+        if(q == NULL) {
+            break;
+        }
+
+        cache->chunk[chunk_idx][cache->count[chunk_idx]++] = q;
+    }
+
     nst_shctx_unlock(shmem);
 
     return p;
@@ -347,6 +643,8 @@ nst_shmem_free_locked(nst_shmem_t *shmem, void *p) {
 
     shmem->used -= chunk_size;
 
+    shmem->classes[chunk_idx].chunks--;
+
     empty = 0;
     full  = _nst_shmem_block_is_full(block);
 
@@ -380,6 +678,39 @@ nst_shmem_free_locked(nst_shmem_t *shmem, void *p) {
         }
     }
 
+    /* a drained block is in no list until it is empty */
+    if(_nst_shmem_block_is_draining(block)) {
+
+        if(empty) {
+            _nst_shmem_block_clear_draining(block);
+
+            /* remove from draining list */
+            if(block->prev) {
+                block->prev->next = block->next;
+            } else {
+                shmem->compact.draining = block->next;
+            }
+
+            if(block->next) {
+                block->next->prev = block->prev;
+            }
+
+            /* add to empty list */
+            block->prev  = NULL;
+            block->next  = shmem->empty;
+            shmem->empty = block;
+
+            if(block->next) {
+                block->next->prev = block;
+            }
+
+            shmem->classes[chunk_idx].blocks--;
+            shmem->compact.drained++;
+        }
+
+        return;
+    }
+
     /*
      * 1. if the block previously was full
      *  a. if chunk_id is LAST, move the block from full list to empty list
@@ -416,6 +747,8 @@ nst_shmem_free_locked(nst_shmem_t *shmem, void *p) {
         block->next  = shmem->empty;
         shmem->empty = block;
 
+        shmem->classes[chunk_idx].blocks--;
+
         if(block->next) {
             block->next->prev = block;
         }
@@ -460,6 +793,8 @@ nst_shmem_free_locked(nst_shmem_t *shmem, void *p) {
             block->next  = shmem->empty;
             shmem->empty = block;
 
+            shmem->classes[chunk_idx].blocks--;
+
             if(block->next) {
                 block->next->prev = block;
             }
@@ -467,15 +802,175 @@ nst_shmem_free_locked(nst_shmem_t *shmem, void *p) {
     }
 }
 
+/*
+ * Small chunks go back to the calling thread's magazine, a full magazine
+ * returns NST_SHMEM_CACHE_BATCH chunks to the bitmap under one lock.
+ */
 void
 nst_shmem_free(nst_shmem_t *shmem, void *p) {
+    nst_shmem_cache_t  *cache;
+    int                 block_idx, chunk_idx;
 
     if(p == NULL) {
         return;
     }
 
+    if((uint8_t *)p < shmem->data.begin || (uint8_t *)p >= shmem->data.free) {
+        return;
+    }
+
+    /* the block type cannot change while p is allocated */
+    block_idx = ((uint8_t *)p - shmem->data.begin) / shmem->block_size;
+    chunk_idx = shmem->block[block_idx].info & 0xFF;
+    cache     = _nst_shmem_cache(shmem, chunk_idx);
+
+    if(cache == NULL) {
+
+        if(_nst_shmem_local(shmem)) {
+            shmem->stats[tid].miss++;
+        }
+
+        nst_shctx_lock(shmem);
+        nst_shmem_free_locked(shmem, p);
+        nst_shctx_unlock(shmem);
+
+        return;
+    }
+
+    if(cache->count[chunk_idx] < NST_SHMEM_CACHE_SIZE) {
+        shmem->stats[tid].hit++;
+        cache->chunk[chunk_idx][cache->count[chunk_idx]++] = p;
+
+        return;
+    }
+
+    shmem->stats[tid].miss++;
+    shmem->stats[tid].flush++;
+
     nst_shctx_lock(shmem);
+
     nst_shmem_free_locked(shmem, p);
+
+    while(cache->count[chunk_idx] > NST_SHMEM_CACHE_SIZE - NST_SHMEM_CACHE_BATCH) {
+        nst_shmem_free_locked(shmem, cache->chunk[chunk_idx][--cache->count[chunk_idx]]);
+    }
+
+    nst_shctx_unlock(shmem);
+}
+
+static int
+_nst_shmem_block_used(nst_shmem_t *shmem, nst_shmem_ctrl_t *block, int chunk_idx) {
+    int  chunk_size = 1<<(shmem->chunk_shift + chunk_idx);
+    int  bits       = shmem->block_size / chunk_size;
+    int  used       = 0;
+    int  i;
+
+    if(chunk_size * NST_SHMEM_INFO_BITMAP_BITS >= shmem->block_size) {
+        return __builtin_popcount(block->info >> 32);
+    }
+
+    for(i = 0; i < bits / 64; i++) {
+        used += __builtin_popcountll(*((uint64_t *)block->bitmap + i));
+    }
+
+    return used;
+}
+
+/*
+ * Once there is no free block left, take the sparsest blocks of each chunk
+ * size out of the chunk lists, so that nothing new is allocated from them
+ * while their objects are moved, see nst_dict_compact. They are returned
+ * to the empty list as soon as they are empty.
+ * return the number of blocks being drained
+ */
+int
+nst_shmem_compact_begin(nst_shmem_t *shmem) {
+    nst_shmem_ctrl_t  *block, *next;
+    int                chunk_idx, bits, scan, drain, total = 0;
+
+    if(shmem->empty || shmem->data.free <= shmem->data.end) {
+        return 0;
+    }
+
+    nst_shctx_lock(shmem);
+
+    /* the last class has one chunk per block */
+    for(chunk_idx = 0; chunk_idx < shmem->chunks - 1; chunk_idx++) {
+        bits  = shmem->block_size >> (shmem->chunk_shift + chunk_idx);
+        scan  = NST_SHMEM_COMPACT_SCAN;
+        drain = shmem->classes[chunk_idx].blocks / 2;
+        block = shmem->chunk[chunk_idx];
+
+        while(block && scan-- && drain && total < NST_SHMEM_COMPACT_BLOCKS) {
+            next = block->next;
+
+            if(_nst_shmem_block_used(shmem, block, chunk_idx) * 100
+                    <= bits * NST_SHMEM_COMPACT_SPARSE) {
+
+                /* remove from chunk list */
+                if(block->prev) {
+                    block->prev->next = block->next;
+                } else {
+                    shmem->chunk[chunk_idx] = block->next;
+                }
+
+                if(block->next) {
+                    block->next->prev = block->prev;
+                }
+
+                /* add to draining list */
+                block->prev = NULL;
+                block->next = shmem->compact.draining;
+
+                if(block->next) {
+                    block->next->prev = block;
+                }
+
+                shmem->compact.draining = block;
+
+                _nst_shmem_block_set_draining(block);
+
+                drain--;
+                total++;
+            }
+
+            block = next;
+        }
+    }
+
     nst_shctx_unlock(shmem);
+
+    return total;
 }
 
+/*
+ * return the blocks which could not be emptied to their chunk lists
+ */
+void
+nst_shmem_compact_end(nst_shmem_t *shmem) {
+    nst_shmem_ctrl_t  *block;
+    int                chunk_idx;
+
+    nst_shctx_lock(shmem);
+
+    while(shmem->compact.draining) {
+        block     = shmem->compact.draining;
+        chunk_idx = block->info & 0xFF;
+
+        shmem->compact.draining = block->next;
+
+        _nst_shmem_block_clear_draining(block);
+
+        /* add to chunk list */
+        block->prev = NULL;
+        block->next = shmem->chunk[chunk_idx];
+
+        if(block->next) {
+            block->next->prev = block;
+        }
+
+        shmem->chunk[chunk_idx] = block;
+    }
+
+    nst_shctx_unlock(shmem);
+}
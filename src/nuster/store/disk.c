@@ -10,8 +10,21 @@
  *
  */
 
+#include <signal.h>
+
+#ifdef USE_IO_URING
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
 #include <haproxy/tools.h>
+#include <haproxy/errors.h>
+#include <haproxy/fd.h>
 #include <haproxy/global.h>
+#include <haproxy/task.h>
+#include <haproxy/thread.h>
 
 #include <nuster/nuster.h>
 
@@ -63,7 +76,7 @@ int
 nst_disk_read_meta(nst_disk_obj_t *obj) {
     int  ret;
 
-    ret = pread(obj->fd, obj->meta, NST_DISK_META_SIZE, 0);
+    ret = pread(obj->fd, obj->meta, NST_DISK_META_SIZE, obj->base);
 
     if(ret != NST_DISK_META_SIZE) {
         return NST_ERR;
@@ -92,7 +105,7 @@ nst_disk_read_key(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key) {
         return NST_ERR;
     }
 
-    ret = pread(obj->fd, key->data, key->size, NST_DISK_POS_KEY);
+    ret = pread(obj->fd, key->data, key->size, obj->base + NST_DISK_POS_KEY);
 
     if(ret != key->size) {
         nst_shmem_free(disk->shmem, key->data);
@@ -109,7 +122,8 @@ nst_disk_read_key(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key) {
 
 int
 nst_disk_read_proxy(nst_disk_obj_t *obj, hpx_ist_t proxy) {
-    int  ret, offset;
+    uint64_t  offset;
+    int       ret;
 
     offset = nst_disk_pos_proxy(obj);
 
@@ -124,7 +138,8 @@ nst_disk_read_proxy(nst_disk_obj_t *obj, hpx_ist_t proxy) {
 
 int
 nst_disk_read_rule(nst_disk_obj_t *obj, hpx_ist_t rule) {
-    int  ret, offset;
+    uint64_t  offset;
+    int       ret;
 
     offset = nst_disk_pos_rule(obj);
 
@@ -139,7 +154,8 @@ nst_disk_read_rule(nst_disk_obj_t *obj, hpx_ist_t rule) {
 
 int
 nst_disk_read_host(nst_disk_obj_t *obj, hpx_ist_t host) {
-    int  ret, offset;
+    uint64_t  offset;
+    int       ret;
 
     offset = nst_disk_pos_host(obj);
 
@@ -154,7 +170,8 @@ nst_disk_read_host(nst_disk_obj_t *obj, hpx_ist_t host) {
 
 int
 nst_disk_read_path(nst_disk_obj_t *obj, hpx_ist_t path) {
-    int  ret, offset;
+    uint64_t  offset;
+    int       ret;
 
     offset = nst_disk_pos_path(obj);
 
@@ -169,7 +186,8 @@ nst_disk_read_path(nst_disk_obj_t *obj, hpx_ist_t path) {
 
 int
 nst_disk_read_etag(nst_disk_obj_t *obj, hpx_ist_t etag) {
-    int  ret, offset;
+    uint64_t  offset;
+    int       ret;
 
     offset = nst_disk_pos_etag(obj);
 
@@ -184,7 +202,8 @@ nst_disk_read_etag(nst_disk_obj_t *obj, hpx_ist_t etag) {
 
 int
 nst_disk_read_last_modified(nst_disk_obj_t *obj, hpx_ist_t last_modified) {
-    int  ret, offset;
+    uint64_t  offset;
+    int       ret;
 
     offset = nst_disk_pos_last_modified(obj);
 
@@ -197,6 +216,22 @@ nst_disk_read_last_modified(nst_disk_obj_t *obj, hpx_ist_t last_modified) {
     return NST_OK;
 }
 
+int
+nst_disk_read_tags(nst_disk_obj_t *obj, hpx_ist_t tags) {
+    uint64_t  offset;
+    int       ret;
+
+    offset = nst_disk_pos_tags(obj);
+
+    ret = pread(obj->fd, tags.ptr, tags.len, offset);
+
+    if(ret != tags.len) {
+        return NST_ERR;
+    }
+
+    return NST_OK;
+}
+
 int
 nst_disk_init(nst_disk_t *disk, hpx_ist_t root, nst_shmem_t *shmem, int clean_temp) {
 
@@ -252,228 +287,422 @@ nst_disk_init(nst_disk_t *disk, hpx_ist_t root, nst_shmem_t *shmem, int clean_te
     return NST_OK;
 }
 
-void
-nst_disk_load(nst_core_t *core) {
+static void
+_nst_disk_seg_path(nst_disk_t *disk, char *file, uint32_t id) {
+    sprintf(file, "%s/seg/%08x", disk->root.ptr, id);
+}
 
-    if(core->root.len && !core->store.disk.loaded) {
-        hpx_ist_t        root;
-        nst_disk_obj_t   obj;
-        nst_dirent_t     *de;
-        nst_key_t        key = { .data = NULL };
-        hpx_buffer_t     buf = { .area = NULL };
-        nst_http_txn_t   txn;
-        nst_rule_prop_t  prop;
-        uint64_t         start, ttl_extend, expire;
-        char            *file;
-        int              len, ret, stale_prop, stale, expired;
+/*
+ * Append the objects up to NST_DISK_STAGE_MAX to segments of size bytes. The
+ * segments left by a previous run are loaded, records go to a new one.
+ */
+int
+nst_disk_segment_init(nst_disk_t *disk, uint64_t size) {
+    nst_dirent_t  *de;
+    DIR           *dir;
+    char          *end;
+    uint32_t       id;
+    int            found = 0;
+
+    if(!disk->root.len) {
+        return NST_OK;
+    }
 
-        root = core->root;
-        file = core->store.disk.file;
+    disk->layout   = NST_DISK_LAYOUT_SEGMENT;
+    disk->seg.max  = size;
+    disk->seg.fd   = -1;
+    disk->seg.file = nst_shmem_alloc(disk->shmem, nst_disk_path_file_len(disk->root));
 
-        start  = nst_time_now_ms();
+    if(!disk->seg.file) {
+        return NST_ERR;
+    }
 
-        if(core->store.disk.dir) {
+    sprintf(disk->seg.file, "%s/seg", disk->root.ptr);
 
-            while((de = readdir(core->store.disk.dir)) != NULL) {
+    if(nst_disk_mkdir(disk->seg.file) == NST_ERR) {
+        fprintf(stderr, "Create `%s` failed\n", disk->seg.file);
 
-                if(strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
-                    continue;
-                }
+        return NST_ERR;
+    }
 
-                len = strlen(de->d_name);
+    dir = opendir(disk->seg.file);
 
-                if(len != NST_DISK_FILE_LEN) {
-                    chunk_reset(&trash);
-                    chunk_memcat(&trash, file, nst_disk_path_base_len(root));
-                    chunk_memcat(&trash, "/", 1);
-                    chunk_memcat(&trash, de->d_name, len);
-                    trash.area[trash.data++] = '\0';
+    if(!dir) {
+        fprintf(stderr, "Open `%s` failed\n", disk->seg.file);
 
-                    remove(trash.area);
+        return NST_ERR;
+    }
 
-                    continue;
-                }
+    while((de = readdir(dir)) != NULL) {
 
-                memcpy(file + nst_disk_path_base_len(root), "/", 1);
-                memcpy(file + nst_disk_path_base_len(root) + 1, de->d_name, NST_DISK_FILE_LEN);
+        if(strlen(de->d_name) != NST_DISK_SEGMENT_NAME_LEN) {
+            continue;
+        }
 
-                obj.fd = nst_disk_file_open(file);
+        id = strtoul(de->d_name, &end, 16);
 
-                if(obj.fd == -1) {
-                    continue;
-                }
+        if(*end != '\0') {
+            continue;
+        }
 
-                if(nst_disk_read_meta(&obj) != NST_OK) {
-                    goto err;
-                }
+        if(!found || id < disk->seg.first) {
+            disk->seg.first = id;
+        }
 
-                stale_prop = nst_disk_meta_get_stale(obj.meta);
-                stale      = nst_disk_meta_check_stale(obj.meta) != NST_OK;
-                expired    = nst_disk_meta_check_expire(obj.meta) != NST_OK;
+        if(!found || id >= disk->seg.active) {
+            disk->seg.active = id + 1;
+        }
 
-                if(expired && (stale_prop == 0 || (stale_prop > 0 && stale))) {
-                    goto err;
-                }
+        found = 1;
+    }
 
-                if(nst_disk_read_key(&core->store.disk, &obj, &key) != NST_OK) {
-                    goto err;
-                }
+    closedir(dir);
 
-                prop.pid.len              = nst_disk_meta_get_proxy_len(obj.meta);
-                prop.rid.len              = nst_disk_meta_get_rule_len(obj.meta);
-                txn.req.host.len          = nst_disk_meta_get_host_len(obj.meta);
-                txn.req.path.len          = nst_disk_meta_get_path_len(obj.meta);
-                txn.res.etag.len          = nst_disk_meta_get_etag_len(obj.meta);
-                txn.res.last_modified.len = nst_disk_meta_get_last_modified_len(obj.meta);
+    disk->seg.id = disk->seg.first;
 
-                buf.size = prop.pid.len + prop.rid.len + txn.req.host.len + txn.req.path.len
-                    + txn.res.etag.len + txn.res.last_modified.len;
+    return nst_shctx_init(disk);
+}
 
-                buf.data = 0;
-                buf.area = nst_shmem_alloc(core->shmem, buf.size);
+/* the segment appended to by this thread, of each disk store */
+static THREAD_LOCAL struct {
+    nst_disk_t  *disk;
+    uint32_t     id;
+    int          fd;
+} _nst_disk_seg[2];
 
-                if(!buf.area) {
-                    goto err;
-                }
+static int
+_nst_disk_seg_open(nst_disk_t *disk, uint32_t id) {
+    char  *file;
+    int    i;
 
-                prop.pid.ptr = buf.area + buf.data;
+    /* the cache and the nosql stores */
+    i = _nst_disk_seg[0].disk && _nst_disk_seg[0].disk != disk;
 
-                if(nst_disk_read_proxy(&obj, prop.pid) != NST_OK) {
-                    goto err;
-                }
+    if(_nst_disk_seg[i].disk == disk) {
 
-                buf.data += prop.pid.len;
+        if(_nst_disk_seg[i].id == id && _nst_disk_seg[i].fd != -1) {
+            return _nst_disk_seg[i].fd;
+        }
 
-                prop.rid.ptr = buf.area + buf.data;
+        if(_nst_disk_seg[i].fd != -1) {
+            close(_nst_disk_seg[i].fd);
+        }
+    }
 
-                if(nst_disk_read_rule(&obj, prop.rid) != NST_OK) {
-                    goto err;
-                }
+    file = get_trash_chunk()->area;
 
-                ttl_extend         = nst_disk_meta_get_ttl_extend(obj.meta);
-                prop.ttl           = ttl_extend >> 32;
-                prop.extend[0]     = *( uint8_t *)(&ttl_extend);
-                prop.extend[1]     = *((uint8_t *)(&ttl_extend) + 1);
-                prop.extend[2]     = *((uint8_t *)(&ttl_extend) + 2);
-                prop.extend[3]     = *((uint8_t *)(&ttl_extend) + 3);
-                prop.etag          = nst_disk_meta_get_etag_prop(obj.meta);
-                prop.last_modified = nst_disk_meta_get_last_modified_prop(obj.meta);
-                prop.stale         = nst_disk_meta_get_stale(obj.meta);
-                prop.inactive      = nst_disk_meta_get_inactive(obj.meta);
+    _nst_disk_seg_path(disk, file, id);
 
-                buf.data += prop.rid.len;
+    _nst_disk_seg[i].disk = disk;
+    _nst_disk_seg[i].id   = id;
+    _nst_disk_seg[i].fd   = open(file, O_CREAT | O_WRONLY, 0600);
 
-                txn.req.host.ptr = buf.area + buf.data;
+    return _nst_disk_seg[i].fd;
+}
 
-                if(nst_disk_read_host(&obj, txn.req.host) != NST_OK) {
-                    goto err;
-                }
+/*
+ * Append the record of len bytes in buf to the active segment, which is sealed
+ * once full. The room is taken under the lock and written out of it, the
+ * record of a failed write is left deleted.
+ */
+static int
+_nst_disk_seg_append(nst_disk_t *disk, char *buf, uint64_t len, uint32_t *id, uint64_t *base) {
+    char  meta[NST_DISK_META_SIZE];
+    int   fd;
 
-                buf.data += txn.req.host.len;
+    nst_shctx_lock(disk);
 
-                txn.req.path.ptr = buf.area + buf.data;
+    if(disk->seg.size && disk->seg.size + len > disk->seg.max) {
+        disk->seg.active++;
+        disk->seg.size = 0;
+    }
 
-                if(nst_disk_read_path(&obj, txn.req.path) != NST_OK) {
-                    goto err;
-                }
+    *id   = disk->seg.active;
+    *base = disk->seg.size;
 
-                buf.data += txn.req.path.len;
+    disk->seg.size += len;
 
-                txn.res.etag.ptr = buf.area + buf.data;
+    nst_shctx_unlock(disk);
 
-                if(nst_disk_read_etag(&obj, txn.res.etag) != NST_OK) {
-                    goto err;
-                }
+    fd = _nst_disk_seg_open(disk, *id);
 
-                buf.data += txn.res.etag.len;
+    if(fd == -1) {
+        return NST_ERR;
+    }
 
-                txn.res.last_modified.ptr = buf.area + buf.data;
+    if(pwrite(fd, buf, len, *base) != (ssize_t)len) {
+        memcpy(meta, buf, NST_DISK_META_SIZE);
+        nst_disk_meta_set_flags(meta, NST_DISK_META_DELETED);
+        pwrite(fd, meta, NST_DISK_META_SIZE, *base);
 
-                if(nst_disk_read_last_modified(&obj, txn.res.last_modified) != NST_OK) {
-                    goto err;
-                }
+        return NST_ERR;
+    }
 
-                buf.data += txn.res.last_modified.len;
+    return NST_OK;
+}
 
-                txn.res.header_len  = nst_disk_meta_get_header_len(obj.meta);
-                txn.res.payload_len = nst_disk_meta_get_payload_len(obj.meta);
+/*
+ * Read the meta of the record at obj->base of a segment
+ * return the length of the record, 0 at the end of the segment
+ */
+static uint64_t
+_nst_disk_seg_read_meta(nst_disk_obj_t *obj) {
+    uint64_t  length;
 
-                expire = nst_disk_meta_get_expire(obj.meta);
+    if(nst_disk_read_meta(obj) != NST_OK) {
+        return 0;
+    }
 
-                nst_shctx_lock(&core->dict);
+    length = nst_disk_meta_get_length(obj->meta);
 
-                ret = nst_dict_set_from_disk(&core->dict, &buf, &key, &txn, &prop, file, expire);
+    if(length < NST_DISK_META_SIZE + nst_disk_meta_get_key_len(obj->meta)
+            || length > NST_DISK_STAGE_MAX) {
 
-                nst_shctx_unlock(&core->dict);
+        return 0;
+    }
 
-                if(ret != NST_OK) {
-                    goto err;
-                }
+    return length;
+}
 
-                close(obj.fd);
+/*
+ * An expired object which cannot be served stale
+ */
+static int
+_nst_disk_meta_dropped(char *meta) {
+    int  stale_prop, stale, expired;
 
-                if(nst_time_now_ms() - start >= 300) {
-                    break;
-                }
-            }
+    stale_prop = nst_disk_meta_get_stale(meta);
+    stale      = nst_disk_meta_check_stale(meta) != NST_OK;
+    expired    = nst_disk_meta_check_expire(meta) != NST_OK;
 
-            if(de == NULL) {
-                core->store.disk.idx++;
-                closedir(core->store.disk.dir);
-                core->store.disk.dir = NULL;
-            }
-        } else {
-            core->store.disk.dir = nst_disk_opendir_by_idx(core->root, file, core->store.disk.idx);
+    return expired && (stale_prop == 0 || (stale_prop > 0 && stale));
+}
 
-            if(!core->store.disk.dir) {
-                core->store.disk.idx++;
+/*
+ * Set the properties of prop kept in meta
+ */
+static void
+_nst_disk_meta_prop(char *meta, nst_rule_prop_t *prop) {
+    uint64_t  ttl_extend = nst_disk_meta_get_ttl_extend(meta);
+
+    prop->ttl           = ttl_extend >> 32;
+    prop->extend[0]     = *( uint8_t *)(&ttl_extend);
+    prop->extend[1]     = *((uint8_t *)(&ttl_extend) + 1);
+    prop->extend[2]     = *((uint8_t *)(&ttl_extend) + 2);
+    prop->extend[3]     = *((uint8_t *)(&ttl_extend) + 3);
+    prop->etag          = nst_disk_meta_get_etag_prop(meta);
+    prop->last_modified = nst_disk_meta_get_last_modified_prop(meta);
+    prop->stale         = nst_disk_meta_get_stale(meta);
+    prop->inactive      = nst_disk_meta_get_inactive(meta);
+}
+
+/*
+ * Add the object whose meta is read in obj to the dict
+ */
+static int
+_nst_disk_load_obj(nst_core_t *core, nst_disk_obj_t *obj, char *file) {
+    nst_key_t        key = { .data = NULL };
+    hpx_buffer_t     buf = { .area = NULL };
+    nst_http_txn_t   txn;
+    nst_rule_prop_t  prop;
+    uint64_t         expire;
+    int              ret;
+
+    if(_nst_disk_meta_dropped(obj->meta)) {
+        return NST_ERR;
+    }
+
+    if(nst_disk_read_key(&core->store.disk, obj, &key) != NST_OK) {
+        return NST_ERR;
+    }
+
+    prop.pid.len              = nst_disk_meta_get_proxy_len(obj->meta);
+    prop.rid.len              = nst_disk_meta_get_rule_len(obj->meta);
+    txn.req.host.len          = nst_disk_meta_get_host_len(obj->meta);
+    txn.req.path.len          = nst_disk_meta_get_path_len(obj->meta);
+    txn.res.etag.len          = nst_disk_meta_get_etag_len(obj->meta);
+    txn.res.last_modified.len = nst_disk_meta_get_last_modified_len(obj->meta);
+    txn.res.tags.len          = nst_disk_meta_get_tags_len(obj->meta);
+
+    buf.size = prop.pid.len + prop.rid.len + txn.req.host.len + txn.req.path.len
+        + txn.res.etag.len + txn.res.last_modified.len + txn.res.tags.len;
+
+    buf.data = 0;
+    buf.area = nst_shmem_alloc(core->shmem, buf.size);
+
+    if(!buf.area) {
+        goto err;
+    }
+
+    prop.pid.ptr = buf.area + buf.data;
+
+    if(nst_disk_read_proxy(obj, prop.pid) != NST_OK) {
+        goto err;
+    }
+
+    buf.data += prop.pid.len;
+
+    prop.rid.ptr = buf.area + buf.data;
+
+    if(nst_disk_read_rule(obj, prop.rid) != NST_OK) {
+        goto err;
+    }
+
+    _nst_disk_meta_prop(obj->meta, &prop);
+
+    buf.data += prop.rid.len;
+
+    txn.req.host.ptr = buf.area + buf.data;
+
+    if(nst_disk_read_host(obj, txn.req.host) != NST_OK) {
+        goto err;
+    }
+
+    buf.data += txn.req.host.len;
+
+    txn.req.path.ptr = buf.area + buf.data;
+
+    if(nst_disk_read_path(obj, txn.req.path) != NST_OK) {
+        goto err;
+    }
+
+    buf.data += txn.req.path.len;
+
+    txn.res.etag.ptr = buf.area + buf.data;
+
+    if(nst_disk_read_etag(obj, txn.res.etag) != NST_OK) {
+        goto err;
+    }
+
+    buf.data += txn.res.etag.len;
+
+    txn.res.last_modified.ptr = buf.area + buf.data;
+
+    if(nst_disk_read_last_modified(obj, txn.res.last_modified) != NST_OK) {
+        goto err;
+    }
+
+    buf.data += txn.res.last_modified.len;
+
+    txn.res.tags.ptr = buf.area + buf.data;
+
+    if(nst_disk_read_tags(obj, txn.res.tags) != NST_OK) {
+        goto err;
+    }
+
+    buf.data += txn.res.tags.len;
+
+    txn.res.header_len  = nst_disk_meta_get_header_len(obj->meta);
+    txn.res.payload_len = nst_disk_meta_get_payload_len(obj->meta);
+
+    expire = nst_disk_meta_get_expire(obj->meta);
+
+    nst_dict_lock(&core->dict, key.hash);
+
+    ret = nst_dict_set_from_disk(&core->dict, &buf, &key, &txn, &prop, file, obj->base, expire);
+
+    nst_dict_unlock(&core->dict, key.hash);
+
+    if(ret != NST_OK) {
+        goto err;
+    }
+
+    return NST_OK;
+
+err:
+    nst_shmem_free(core->shmem, key.data);
+    nst_shmem_free(core->shmem, buf.area);
+
+    return NST_ERR;
+}
+
+/*
+ * Load the records of the segments up to the active one, a segment ends at the
+ * first record which is not complete.
+ */
+static void
+_nst_disk_load_segments(nst_core_t *core) {
+    nst_disk_t      *disk = &core->store.disk;
+    nst_disk_obj_t   obj;
+    uint64_t         start, length;
+
+    start = nst_time_now_ms();
+
+    while(disk->seg.id < disk->seg.active) {
+
+        if(disk->seg.fd == -1) {
+            _nst_disk_seg_path(disk, disk->seg.file, disk->seg.id);
+
+            disk->seg.fd  = nst_disk_file_open(disk->seg.file);
+            disk->seg.pos = 0;
+
+            if(disk->seg.fd == -1) {
+                disk->seg.id++;
+
+                continue;
             }
         }
 
-        if(core->store.disk.idx == 16 * 16) {
-            core->store.disk.loaded = 1;
-            core->store.disk.idx    = 0;
-        }
+        obj.fd   = disk->seg.fd;
+        obj.base = disk->seg.pos;
 
-        return;
+        length = _nst_disk_seg_read_meta(&obj);
 
-err:
+        if(!length) {
+            close(disk->seg.fd);
 
-        if(file) {
-            remove(file);
+            disk->seg.fd = -1;
+            disk->seg.id++;
+
+            continue;
         }
 
-        if(obj.fd) {
-            close(obj.fd);
+        if(!(nst_disk_meta_get_flags(obj.meta) & NST_DISK_META_DELETED)) {
+            _nst_disk_load_obj(core, &obj, disk->seg.file);
         }
 
-        nst_shmem_free(core->shmem, key.data);
-        nst_shmem_free(core->shmem, buf.area);
+        disk->seg.pos += length;
 
+        if(nst_time_now_ms() - start >= 300) {
+            return;
+        }
     }
+
+    disk->loaded = 1;
+    disk->idx    = 0;
+    disk->seg.id = disk->seg.first;
 }
 
+/*
+ * Load the object files of /x/xx dirs, then the segments
+ */
 void
-nst_disk_cleanup(nst_core_t *core) {
-    nst_disk_obj_t  obj;
-    nst_dirent_t   *de;
-    hpx_ist_t       root;
-    uint64_t        start;
-    char           *file;
-    int             len;
+nst_disk_load(nst_core_t *core) {
 
-    root = core->root;
-    file = core->store.disk.file;
+    if(core->root.len && !core->store.disk.loaded) {
+        hpx_ist_t        root;
+        nst_disk_obj_t   obj;
+        nst_dirent_t     *de;
+        uint64_t         start;
+        char            *file;
+        int              len;
 
-    start  = nst_time_now_ms();
+        if(core->store.disk.idx == 16 * 16) {
+            _nst_disk_load_segments(core);
 
-    if(core->root.len && core->store.disk.loaded) {
+            return;
+        }
+
+        root = core->root;
+        file = core->store.disk.file;
+
+        start  = nst_time_now_ms();
 
         if(core->store.disk.dir) {
 
             while((de = readdir(core->store.disk.dir)) != NULL) {
 
-                if(de->d_name[0] == '.') {
+                if(strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
                     continue;
                 }
 
@@ -494,38 +723,31 @@ nst_disk_cleanup(nst_core_t *core) {
                 memcpy(file + nst_disk_path_base_len(root), "/", 1);
                 memcpy(file + nst_disk_path_base_len(root) + 1, de->d_name, NST_DISK_FILE_LEN);
 
-                obj.fd = nst_disk_file_open(file);
+                obj.base = 0;
+                obj.fd   = nst_disk_file_open(file);
 
                 if(obj.fd == -1) {
                     continue;
                 }
 
-                if(nst_disk_read_meta(&obj) != NST_OK) {
-                    remove(file);
-                    close(obj.fd);
-
-                    continue;
-                }
-
-                if(nst_disk_meta_get_stale(obj.meta) < 0
-                        && nst_disk_meta_check_expire(obj.meta) != NST_OK) {
+                if(nst_disk_read_meta(&obj) != NST_OK
+                        || _nst_disk_load_obj(core, &obj, file) != NST_OK) {
 
                     remove(file);
-                    close(obj.fd);
-
-                    continue;
                 }
 
                 close(obj.fd);
 
-                if(nst_time_now_ms() - start >= 10) {
+                if(nst_time_now_ms() - start >= 300) {
                     break;
                 }
             }
 
-            core->store.disk.idx++;
-            closedir(core->store.disk.dir);
-            core->store.disk.dir = NULL;
+            if(de == NULL) {
+                core->store.disk.idx++;
+                closedir(core->store.disk.dir);
+                core->store.disk.dir = NULL;
+            }
         } else {
             core->store.disk.dir = nst_disk_opendir_by_idx(core->root, file, core->store.disk.idx);
 
@@ -534,15 +756,269 @@ nst_disk_cleanup(nst_core_t *core) {
             }
         }
 
-        if(core->store.disk.idx == 16 * 16) {
-            core->store.disk.idx = 0;
+        if(core->store.disk.idx == 16 * 16 && core->store.disk.layout == NST_DISK_LAYOUT_FILE) {
+            core->store.disk.loaded = 1;
+            core->store.disk.idx    = 0;
         }
-
     }
 }
 
 /*
- * -1: error
+ * Whether the record read in buf is the object of its entry, which is moved to
+ * the record at to_base of to if set.
+ */
+static int
+_nst_disk_seg_refer(nst_core_t *core, char *buf, char *file, uint64_t base, char *to,
+        uint64_t to_base) {
+
+    nst_key_t  key;
+    int        ret;
+
+    if(nst_disk_meta_get_flags(buf) & NST_DISK_META_DELETED) {
+        return 0;
+    }
+
+    if(_nst_disk_meta_dropped(buf)) {
+        return 0;
+    }
+
+    key.size = nst_disk_meta_get_key_len(buf);
+    key.data = buf + NST_DISK_POS_KEY;
+    key.hash = nst_disk_meta_get_hash(buf);
+
+    memcpy(key.uuid, nst_disk_meta_get_uuid(buf), NST_KEY_UUID_LEN);
+
+    nst_dict_lock(&core->dict, key.hash);
+
+    ret = nst_dict_move_disk(&core->dict, &key, file, base, to, to_base);
+
+    nst_dict_unlock(&core->dict, key.hash);
+
+    return ret == NST_OK;
+}
+
+/*
+ * Compact the sealed segments in turn. The live and dead bytes of a segment
+ * are counted first, a segment with no live record is removed, and one which
+ * is at least half dead has its live records appended to the active segment
+ * before being removed. The last sealed one is left, it may still be written.
+ */
+static void
+_nst_disk_compact(nst_core_t *core) {
+    static char     *buf;
+    nst_disk_t      *disk = &core->store.disk;
+    nst_disk_obj_t   obj;
+    uint64_t         start, length, base;
+    uint32_t         id;
+    char            *to;
+
+    if(!buf) {
+        buf = malloc(NST_DISK_STAGE_MAX);
+
+        if(!buf) {
+            return;
+        }
+    }
+
+    start = nst_time_now_ms();
+
+    while(nst_time_now_ms() - start < 10) {
+
+        if(disk->seg.fd == -1) {
+
+            if(disk->seg.id < disk->seg.first || disk->seg.id + 1 >= disk->seg.active) {
+                disk->seg.id = disk->seg.first;
+
+                return;
+            }
+
+            _nst_disk_seg_path(disk, disk->seg.file, disk->seg.id);
+
+            disk->seg.fd      = nst_disk_file_open(disk->seg.file);
+            disk->seg.pos     = 0;
+            disk->seg.compact = 0;
+            disk->seg.live    = 0;
+            disk->seg.dead    = 0;
+
+            if(disk->seg.fd == -1) {
+
+                if(disk->seg.id == disk->seg.first) {
+                    disk->seg.first++;
+                }
+
+                disk->seg.id++;
+
+                continue;
+            }
+        }
+
+        obj.fd   = disk->seg.fd;
+        obj.base = disk->seg.pos;
+
+        length = _nst_disk_seg_read_meta(&obj);
+
+        if(length && pread(obj.fd, buf, length, obj.base) != (ssize_t)length) {
+            length = 0;
+        }
+
+        if(length == 0) {
+
+            if(!disk->seg.compact && disk->seg.live) {
+
+                if(disk->seg.dead >= disk->seg.live) {
+                    disk->seg.pos     = 0;
+                    disk->seg.compact = 1;
+
+                    continue;
+                }
+
+                close(disk->seg.fd);
+
+                disk->seg.fd = -1;
+                disk->seg.id++;
+
+                continue;
+            }
+
+            close(disk->seg.fd);
+            remove(disk->seg.file);
+
+            if(disk->seg.id == disk->seg.first) {
+                disk->seg.first++;
+            }
+
+            disk->seg.fd = -1;
+            disk->seg.id++;
+
+            continue;
+        }
+
+        if(!disk->seg.compact) {
+
+            if(_nst_disk_seg_refer(core, buf, disk->seg.file, obj.base, NULL, 0)) {
+                disk->seg.live += length;
+            } else {
+                disk->seg.dead += length;
+            }
+        } else if(_nst_disk_seg_refer(core, buf, disk->seg.file, obj.base, NULL, 0)) {
+
+            /* the segment is kept if a live record cannot be moved */
+            if(_nst_disk_seg_append(disk, buf, length, &id, &base) != NST_OK) {
+                close(disk->seg.fd);
+
+                disk->seg.fd = -1;
+                disk->seg.id++;
+
+                continue;
+            }
+
+            to = get_trash_chunk()->area;
+
+            _nst_disk_seg_path(disk, to, id);
+
+            /* the entry may have changed meanwhile */
+            if(!_nst_disk_seg_refer(core, buf, disk->seg.file, obj.base, to, base)) {
+                nst_disk_purge_by_path(disk, to, base);
+            }
+        }
+
+        disk->seg.pos += length;
+    }
+}
+
+void
+nst_disk_cleanup(nst_core_t *core) {
+    nst_disk_obj_t  obj;
+    nst_dirent_t   *de;
+    hpx_ist_t       root;
+    uint64_t        start;
+    char           *file;
+    int             len;
+
+    root = core->root;
+    file = core->store.disk.file;
+
+    start  = nst_time_now_ms();
+
+    if(core->root.len && core->store.disk.loaded) {
+
+        if(core->store.disk.dir) {
+
+            while((de = readdir(core->store.disk.dir)) != NULL) {
+
+                if(de->d_name[0] == '.') {
+                    continue;
+                }
+
+                len = strlen(de->d_name);
+
+                if(len != NST_DISK_FILE_LEN) {
+                    chunk_reset(&trash);
+                    chunk_memcat(&trash, file, nst_disk_path_base_len(root));
+                    chunk_memcat(&trash, "/", 1);
+                    chunk_memcat(&trash, de->d_name, len);
+                    trash.area[trash.data++] = '\0';
+
+                    remove(trash.area);
+
+                    continue;
+                }
+
+                memcpy(file + nst_disk_path_base_len(root), "/", 1);
+                memcpy(file + nst_disk_path_base_len(root) + 1, de->d_name, NST_DISK_FILE_LEN);
+
+                obj.fd = nst_disk_file_open(file);
+
+                if(obj.fd == -1) {
+                    continue;
+                }
+
+                if(nst_disk_read_meta(&obj) != NST_OK) {
+                    remove(file);
+                    close(obj.fd);
+
+                    continue;
+                }
+
+                if(nst_disk_meta_get_stale(obj.meta) < 0
+                        && nst_disk_meta_check_expire(obj.meta) != NST_OK) {
+
+                    remove(file);
+                    close(obj.fd);
+
+                    continue;
+                }
+
+                close(obj.fd);
+
+                if(nst_time_now_ms() - start >= 10) {
+                    break;
+                }
+            }
+
+            core->store.disk.idx++;
+            closedir(core->store.disk.dir);
+            core->store.disk.dir = NULL;
+        } else {
+            core->store.disk.dir = nst_disk_opendir_by_idx(core->root, file, core->store.disk.idx);
+
+            if(!core->store.disk.dir) {
+                core->store.disk.idx++;
+            }
+        }
+
+        if(core->store.disk.idx == 16 * 16) {
+            core->store.disk.idx = 0;
+        }
+
+        if(core->store.disk.layout == NST_DISK_LAYOUT_SEGMENT) {
+            _nst_disk_compact(core);
+        }
+    }
+}
+
+/*
+ * -1: error
  *  0: not found
  *  1: ok
  */
@@ -587,13 +1063,31 @@ nst_disk_purge_by_key(nst_disk_obj_t *obj, nst_key_t *key, hpx_ist_t root) {
 }
 
 /*
+ * The record at base of a segment is marked deleted, a file is removed
  * -1: error
  *  0: not found
  *  1: ok
  */
 int
-nst_disk_purge_by_path(char *path) {
-    int  ret = remove(path);
+nst_disk_purge_by_path(nst_disk_t *disk, char *path, uint64_t base) {
+    char  flags = NST_DISK_META_DELETED;
+    int   fd, ret;
+
+    if(nst_disk_file_segment(disk, path)) {
+        fd = open(path, O_WRONLY);
+
+        if(fd == -1) {
+            return errno == ENOENT ? 0 : -1;
+        }
+
+        ret = pwrite(fd, &flags, 1, base + NST_DISK_META_POS_FLAGS);
+
+        close(fd);
+
+        return ret == 1 ? 1 : -1;
+    }
+
+    ret = remove(path);
 
     if(ret == 0) {
         return 1;
@@ -607,7 +1101,7 @@ nst_disk_purge_by_path(char *path) {
 }
 
 void
-nst_disk_update_expire(char *file, uint64_t expire) {
+nst_disk_update_expire(char *file, uint64_t base, uint64_t expire) {
     int  fd;
 
     fd = open(file, O_WRONLY);
@@ -616,7 +1110,7 @@ nst_disk_update_expire(char *file, uint64_t expire) {
         return;
     }
 
-    pwrite(fd, &expire, 8, NST_DISK_META_POS_EXPIRE);
+    pwrite(fd, &expire, 8, base + NST_DISK_META_POS_EXPIRE);
 
     close(fd);
 }
@@ -638,6 +1132,8 @@ nst_disk_meta_init(char *p, uint64_t hash, uint64_t expire, uint64_t header_len,
     p[6] = 0;
     p[7] = (char)NST_DISK_VERSION;
 
+    nst_disk_meta_set_length(p, 0);
+
     nst_disk_meta_set_hash(p, hash);
     nst_disk_meta_set_key_len(p, key_len);
     nst_disk_meta_set_expire(p, expire);
@@ -654,14 +1150,19 @@ nst_disk_meta_init(char *p, uint64_t hash, uint64_t expire, uint64_t header_len,
     nst_disk_meta_set_ttl_extend(p, ttl_extend);
     nst_disk_meta_set_stale(p, prop->stale);
     nst_disk_meta_set_inactive(p, prop->inactive);
+    nst_disk_meta_set_tags_len(p, txn->res.tags.len);
 }
 
 int
 nst_disk_obj_create(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key, nst_http_txn_t *txn,
         nst_rule_prop_t *prop) {
 
-    obj->file = NULL;
-    obj->fd   = -1;
+    obj->file       = NULL;
+    obj->fd         = -1;
+    obj->base       = 0;
+    obj->length     = 0;
+    obj->stage      = NULL;
+    obj->stage_size = 0;
 
     obj->file = nst_shmem_alloc(disk->shmem, nst_disk_path_file_len(disk->root));
 
@@ -672,10 +1173,20 @@ nst_disk_obj_create(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key, nst_h
     sprintf(obj->file, "%s/.tmp/%020"PRIx64"%020"PRIu64, disk->root.ptr, ha_random64(),
             nst_time_now_ns());
 
-    obj->fd = nst_disk_file_create(obj->file);
+    /* the temp file is only created if the staged object gets too large */
+    if(disk->layout == NST_DISK_LAYOUT_SEGMENT) {
+        obj->stage_size = 4096;
+        obj->stage      = malloc(obj->stage_size);
 
-    if(obj->fd == -1) {
-        goto err;
+        if(!obj->stage) {
+            goto err;
+        }
+    } else {
+        obj->fd = nst_disk_file_create(obj->file);
+
+        if(obj->fd == -1) {
+            goto err;
+        }
     }
 
     nst_disk_meta_init(obj->meta, key->hash, 0, 0, 0, key->size, txn, prop);
@@ -708,9 +1219,15 @@ nst_disk_obj_create(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key, nst_h
         goto err;
     }
 
+    if(nst_disk_write_tags(obj, txn->res.tags) != NST_OK) {
+        goto err;
+    }
+
     return NST_OK;
 
 err:
+    free(obj->stage);
+    obj->stage = NULL;
 
     if(obj->fd != -1) {
         close(obj->fd);
@@ -726,6 +1243,96 @@ err:
     return NST_ERR;
 }
 
+/*
+ * Write len bytes at obj->offset of the record staged in memory, which is
+ * spilled to the temp file once larger than NST_DISK_STAGE_MAX.
+ */
+int
+nst_disk_stage(nst_disk_obj_t *obj, char *buf, int len) {
+    uint64_t  end = obj->offset + len;
+    uint64_t  size;
+    char     *stage;
+
+    if(end > NST_DISK_STAGE_MAX) {
+        obj->fd = nst_disk_file_create(obj->file);
+
+        if(obj->fd == -1) {
+            return NST_ERR;
+        }
+
+        if(pwrite(obj->fd, obj->stage, obj->length, 0) != (ssize_t)obj->length) {
+            return NST_ERR;
+        }
+
+        free(obj->stage);
+        obj->stage = NULL;
+
+        return nst_disk_write(obj, buf, len);
+    }
+
+    if(end > obj->stage_size) {
+        size = obj->stage_size;
+
+        while(size < end) {
+            size *= 2;
+        }
+
+        if(size > NST_DISK_STAGE_MAX) {
+            size = NST_DISK_STAGE_MAX;
+        }
+
+        stage = realloc(obj->stage, size);
+
+        if(!stage) {
+            return NST_ERR;
+        }
+
+        obj->stage      = stage;
+        obj->stage_size = size;
+    }
+
+    memcpy(obj->stage + obj->offset, buf, len);
+
+    obj->offset = end;
+
+    if(obj->offset > obj->length) {
+        obj->length = obj->offset;
+    }
+
+    return NST_OK;
+}
+
+/*
+ * Append the staged record to the active segment, obj->file is set to the
+ * segment and obj->base to the record.
+ */
+static int
+_nst_disk_obj_finish_segment(nst_disk_t *disk, nst_disk_obj_t *obj) {
+    uint64_t  base;
+    uint32_t  id;
+    int       ret;
+
+    memcpy(obj->stage, obj->meta, NST_DISK_META_SIZE);
+
+    ret = _nst_disk_seg_append(disk, obj->stage, obj->length, &id, &base);
+
+    free(obj->stage);
+    obj->stage = NULL;
+
+    if(ret != NST_OK) {
+        nst_shmem_free(disk->shmem, obj->file);
+        obj->file = NULL;
+
+        return NST_ERR;
+    }
+
+    _nst_disk_seg_path(disk, obj->file, id);
+
+    obj->base = base;
+
+    return NST_OK;
+}
+
 int
 nst_disk_obj_finish(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key, nst_http_txn_t *txn,
         uint64_t expire) {
@@ -736,6 +1343,11 @@ nst_disk_obj_finish(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key, nst_h
     nst_disk_meta_set_expire(obj->meta, expire);
     nst_disk_meta_set_header_len(obj->meta, txn->res.header_len);
     nst_disk_meta_set_payload_len(obj->meta, txn->res.payload_len);
+    nst_disk_meta_set_length(obj->meta, obj->length);
+
+    if(obj->stage) {
+        return _nst_disk_obj_finish_segment(disk, obj);
+    }
 
     if(nst_disk_write_meta(obj) != NST_OK) {
         goto err;
@@ -784,40 +1396,73 @@ err:
     return NST_ERR;
 }
 
-int
-nst_disk_obj_valid(nst_disk_obj_t *obj, nst_key_t *key) {
-    hpx_buffer_t  *buf;
-    int            ret;
-
-    buf = get_trash_chunk();
+/*
+ * Drop the record at base of file, which obj replaces. A file replaced by a
+ * file is already gone with the rename.
+ */
+void
+nst_disk_obj_replace(nst_disk_t *disk, nst_disk_obj_t *obj, char *file, uint64_t base) {
 
-    obj->fd = nst_disk_file_open(obj->file);
+    if(!file || !obj->file) {
+        return;
+    }
 
-    if(obj->fd == -1) {
-        goto err;
+    if(strcmp(file, obj->file) == 0 && base == obj->base) {
+        return;
     }
 
-    ret = pread(obj->fd, obj->meta, NST_DISK_META_SIZE, 0);
+    nst_disk_purge_by_path(disk, file, base);
+}
 
-    if(ret != NST_DISK_META_SIZE) {
-        goto err;
+/*
+ * Check that meta, read from a disk file, belongs to key
+ */
+static int
+_nst_disk_meta_valid(char *meta, nst_key_t *key) {
+
+    if(memcmp(meta, "NUSTER", 6) !=0) {
+        return NST_ERR;
     }
 
-    if(memcmp(obj->meta, "NUSTER", 6) !=0) {
-        goto err;
+    if(meta[7] != NST_DISK_VERSION) {
+        return NST_ERR;
     }
 
-    if(obj->meta[7] != NST_DISK_VERSION) {
+    if(nst_disk_meta_get_flags(meta) & NST_DISK_META_DELETED) {
+        return NST_ERR;
+    }
+
+    if(nst_disk_meta_get_hash(meta) != key->hash || nst_disk_meta_get_key_len(meta) != key->size) {
+        return NST_ERR;
+    }
+
+    return NST_OK;
+}
+
+int
+nst_disk_obj_valid(nst_disk_obj_t *obj, nst_key_t *key) {
+    hpx_buffer_t  *buf;
+    int            ret;
+
+    buf = get_trash_chunk();
+
+    obj->fd = nst_disk_file_open(obj->file);
+
+    if(obj->fd == -1) {
         goto err;
     }
 
-    if(nst_disk_meta_get_hash(obj->meta) != key->hash
-            || nst_disk_meta_get_key_len(obj->meta) != key->size) {
+    ret = pread(obj->fd, obj->meta, NST_DISK_META_SIZE, obj->base);
+
+    if(ret != NST_DISK_META_SIZE) {
+        goto err;
+    }
 
+    if(_nst_disk_meta_valid(obj->meta, key) != NST_OK) {
         goto err;
     }
 
-    ret = pread(obj->fd, buf->area, key->size, NST_DISK_POS_KEY);
+    ret = pread(obj->fd, buf->area, key->size, obj->base + NST_DISK_POS_KEY);
 
     if(ret != key->size) {
         goto err;
@@ -835,8 +1480,11 @@ err:
     return NST_ERR;
 }
 
-int
-nst_disk_obj_exists(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key) {
+/*
+ * Set obj->file to the path of the file of key
+ */
+static void
+_nst_disk_obj_path(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key) {
     hpx_buffer_t  *buf1, *buf2;
     char          *p;
 
@@ -845,12 +1493,19 @@ nst_disk_obj_exists(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key) {
     p    = buf1->area;
 
     obj->file = buf2->area;
+    obj->base = 0;
 
     nst_key_uuid_stringify(key, p);
 
     p[NST_DISK_FILE_LEN] = '\0';
 
     sprintf(obj->file, "%s/%c/%c%c/%s", disk->root.ptr, p[0], p[0], p[1], p);
+}
+
+int
+nst_disk_obj_exists(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key) {
+
+    _nst_disk_obj_path(disk, obj, key);
 
     if(nst_disk_obj_valid(obj, key) == NST_OK) {
         return NST_OK;
@@ -859,3 +1514,1556 @@ nst_disk_obj_exists(nst_disk_t *disk, nst_disk_obj_t *obj, nst_key_t *key) {
     return NST_ERR;
 }
 
+
+/*
+ * Write the record of entry to p, deleted if it drops the entry of its key.
+ * return the length of the record, 0 if it is larger than size
+ */
+static uint64_t
+_nst_disk_index_record(char *p, uint64_t size, nst_dict_entry_t *entry, int deleted) {
+    nst_http_txn_t  txn;
+    char           *file = entry->store.disk.file;
+    uint64_t        len, pos;
+
+    len = NST_DISK_META_SIZE + entry->key.size + entry->prop.pid.len + entry->prop.rid.len
+        + entry->host.len + entry->path.len + entry->etag.len + entry->last_modified.len
+        + entry->tags.len + 8 + strlen(file) + 1;
+
+    len = (len + 7) & ~7ULL;
+
+    if(len > size) {
+        return 0;
+    }
+
+    txn.req.host          = entry->host;
+    txn.req.path          = entry->path;
+    txn.res.etag          = entry->etag;
+    txn.res.last_modified = entry->last_modified;
+    txn.res.tags          = entry->tags;
+
+    nst_disk_meta_init(p, entry->key.hash, entry->expire, entry->header_len, entry->payload_len,
+            entry->key.size, &txn, &entry->prop);
+
+    nst_disk_meta_set_uuid(p, entry->key.uuid);
+    nst_disk_meta_set_length(p, len);
+
+    if(deleted) {
+        nst_disk_meta_set_flags(p, NST_DISK_META_DELETED);
+    }
+
+    pos = NST_DISK_POS_KEY;
+
+    memcpy(p + pos, entry->key.data, entry->key.size);
+    pos += entry->key.size;
+    memcpy(p + pos, entry->prop.pid.ptr, entry->prop.pid.len);
+    pos += entry->prop.pid.len;
+    memcpy(p + pos, entry->prop.rid.ptr, entry->prop.rid.len);
+    pos += entry->prop.rid.len;
+    memcpy(p + pos, entry->host.ptr, entry->host.len);
+    pos += entry->host.len;
+    memcpy(p + pos, entry->path.ptr, entry->path.len);
+    pos += entry->path.len;
+    memcpy(p + pos, entry->etag.ptr, entry->etag.len);
+    pos += entry->etag.len;
+    memcpy(p + pos, entry->last_modified.ptr, entry->last_modified.len);
+    pos += entry->last_modified.len;
+    memcpy(p + pos, entry->tags.ptr, entry->tags.len);
+    pos += entry->tags.len;
+    memcpy(p + pos, &entry->store.disk.base, 8);
+    pos += 8;
+
+    memset(p + pos, 0, len - pos);
+    memcpy(p + pos, file, strlen(file));
+
+    return len;
+}
+
+/*
+ * return the length of the record at p, 0 if it is not complete
+ */
+static uint64_t
+_nst_disk_index_record_valid(char *p, uint64_t size) {
+    uint64_t  len, min;
+
+    if(size < NST_DISK_META_SIZE || memcmp(p, "NUSTER", 6) != 0 || p[7] != NST_DISK_VERSION) {
+        return 0;
+    }
+
+    len = nst_disk_meta_get_length(p);
+
+    if(len > size || len % 8) {
+        return 0;
+    }
+
+    min = NST_DISK_META_SIZE + (uint64_t)nst_disk_meta_get_key_len(p)
+        + nst_disk_meta_get_proxy_len(p) + nst_disk_meta_get_rule_len(p)
+        + nst_disk_meta_get_host_len(p) + nst_disk_meta_get_path_len(p)
+        + nst_disk_meta_get_etag_len(p) + nst_disk_meta_get_last_modified_len(p)
+        + nst_disk_meta_get_tags_len(p) + 8 + 1;
+
+    if(min > len || p[len - 1] != '\0') {
+        return 0;
+    }
+
+    return len;
+}
+
+/*
+ * Restore the entry of a record of the index or of a journal, which replaces
+ * the current one of the key, if any.
+ */
+static void
+_nst_disk_index_restore(nst_core_t *core, char *p) {
+    nst_key_t        key;
+    hpx_buffer_t     buf;
+    nst_http_txn_t   txn;
+    nst_rule_prop_t  prop;
+    uint64_t         pos, base;
+    char            *file;
+
+    key.size = nst_disk_meta_get_key_len(p);
+    key.hash = nst_disk_meta_get_hash(p);
+    key.data = p + NST_DISK_POS_KEY;
+
+    memcpy(key.uuid, nst_disk_meta_get_uuid(p), NST_KEY_UUID_LEN);
+
+    prop.pid.len              = nst_disk_meta_get_proxy_len(p);
+    prop.rid.len              = nst_disk_meta_get_rule_len(p);
+    txn.req.host.len          = nst_disk_meta_get_host_len(p);
+    txn.req.path.len          = nst_disk_meta_get_path_len(p);
+    txn.res.etag.len          = nst_disk_meta_get_etag_len(p);
+    txn.res.last_modified.len = nst_disk_meta_get_last_modified_len(p);
+    txn.res.tags.len          = nst_disk_meta_get_tags_len(p);
+    txn.res.header_len        = nst_disk_meta_get_header_len(p);
+    txn.res.payload_len       = nst_disk_meta_get_payload_len(p);
+
+    buf.size = prop.pid.len + prop.rid.len + txn.req.host.len + txn.req.path.len
+        + txn.res.etag.len + txn.res.last_modified.len + txn.res.tags.len;
+
+    pos  = NST_DISK_POS_KEY + key.size;
+    file = p + pos + buf.size + 8;
+
+    memcpy(&base, p + pos + buf.size, 8);
+
+    nst_dict_lock(&core->dict, key.hash);
+
+    if(nst_disk_meta_get_flags(p) & NST_DISK_META_DELETED) {
+        nst_dict_unset_from_disk(&core->dict, &key, file, base);
+
+        goto out;
+    }
+
+    nst_dict_unset_from_disk(&core->dict, &key, NULL, 0);
+
+    if(_nst_disk_meta_dropped(p)) {
+        goto out;
+    }
+
+    key.data = nst_shmem_alloc(core->shmem, key.size);
+    buf.area = nst_shmem_alloc(core->shmem, buf.size);
+
+    if(!key.data || !buf.area) {
+        goto err;
+    }
+
+    memcpy(key.data, p + NST_DISK_POS_KEY, key.size);
+    memcpy(buf.area, p + pos, buf.size);
+
+    buf.data = buf.size;
+
+    prop.pid.ptr              = buf.area;
+    prop.rid.ptr              = prop.pid.ptr + prop.pid.len;
+    txn.req.host.ptr          = prop.rid.ptr + prop.rid.len;
+    txn.req.path.ptr          = txn.req.host.ptr + txn.req.host.len;
+    txn.res.etag.ptr          = txn.req.path.ptr + txn.req.path.len;
+    txn.res.last_modified.ptr = txn.res.etag.ptr + txn.res.etag.len;
+    txn.res.tags.ptr          = txn.res.last_modified.ptr + txn.res.last_modified.len;
+
+    _nst_disk_meta_prop(p, &prop);
+
+    if(nst_dict_set_from_disk(&core->dict, &buf, &key, &txn, &prop, file, base,
+                nst_disk_meta_get_expire(p)) != NST_OK) {
+
+        goto err;
+    }
+
+    goto out;
+
+err:
+    nst_shmem_free(core->shmem, key.data);
+    nst_shmem_free(core->shmem, buf.area);
+
+out:
+    nst_dict_unlock(&core->dict, key.hash);
+}
+
+/*
+ * Restore the entries of the records of file, up to the first one which is not
+ * complete. The file is an index if gen is set, which is set to its generation.
+ */
+static int
+_nst_disk_index_replay(nst_core_t *core, char *file, uint32_t *gen) {
+    struct stat  st;
+    uint64_t     pos, len;
+    char        *p;
+    int          fd;
+
+    fd = open(file, O_RDONLY);
+
+    if(fd == -1) {
+        return NST_ERR;
+    }
+
+    if(fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+
+        return NST_ERR;
+    }
+
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if(p == MAP_FAILED) {
+        return NST_ERR;
+    }
+
+    pos = 0;
+
+    if(gen) {
+
+        if(st.st_size < NST_DISK_INDEX_HEADER_SIZE
+                || memcmp(p, NST_DISK_INDEX_MAGIC, 8) != 0
+                || *(uint32_t *)(p + 8) != NST_DISK_VERSION) {
+
+            munmap(p, st.st_size);
+
+            return NST_ERR;
+        }
+
+        *gen = *(uint32_t *)(p + 12);
+        pos  = NST_DISK_INDEX_HEADER_SIZE;
+    }
+
+    while((len = _nst_disk_index_record_valid(p + pos, st.st_size - pos)) != 0) {
+        _nst_disk_index_restore(core, p + pos);
+
+        pos += len;
+    }
+
+    munmap(p, st.st_size);
+
+    return NST_OK;
+}
+
+static void
+_nst_disk_journal_path(nst_disk_t *disk, char *file, uint32_t gen) {
+    sprintf(file, "%s/journal/%08x", disk->root.ptr, gen);
+}
+
+static int
+_nst_disk_gen_cmp(const void *a, const void *b) {
+    uint32_t  x = *(const uint32_t *)a;
+    uint32_t  y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * With checkpoints on, rebuild the dict from the index then the journals of
+ * its generation and after, and the disk store is loaded. Otherwise, or
+ * without an index, the files and segments are loaded as usual, and what is
+ * left of the index is removed.
+ */
+int
+nst_disk_index_init(nst_core_t *core, int interval) {
+    nst_disk_t    *disk = &core->store.disk;
+    nst_dirent_t  *de;
+    DIR           *dir;
+    uint32_t      *gens = NULL, *tmp;
+    uint32_t       gen  = 0;
+    char          *file, *end;
+    int            n    = 0, i, found;
+
+    if(!disk->root.len) {
+        return NST_OK;
+    }
+
+    /* <root>/journal/xxxxxxxx */
+    file = malloc(disk->root.len + 18);
+
+    if(!file) {
+        return NST_ERR;
+    }
+
+    sprintf(file, "%s/journal", disk->root.ptr);
+
+    if(interval && nst_disk_mkdir(file) == NST_ERR) {
+        fprintf(stderr, "Create `%s` failed\n", file);
+
+        goto err;
+    }
+
+    dir = opendir(file);
+
+    while(dir && (de = readdir(dir)) != NULL) {
+
+        if(strlen(de->d_name) != NST_DISK_SEGMENT_NAME_LEN) {
+            continue;
+        }
+
+        tmp = realloc(gens, (n + 1) * sizeof(*gens));
+
+        if(!tmp) {
+            break;
+        }
+
+        gens = tmp;
+
+        gens[n] = strtoul(de->d_name, &end, 16);
+
+        if(*end == '\0') {
+            n++;
+        }
+    }
+
+    if(dir) {
+        closedir(dir);
+    }
+
+    if(n) {
+        qsort(gens, n, sizeof(*gens), _nst_disk_gen_cmp);
+    }
+
+    sprintf(file, "%s/index", disk->root.ptr);
+
+    found = interval && _nst_disk_index_replay(core, file, &gen) == NST_OK;
+
+    if(!found) {
+        remove(file);
+    }
+
+    disk->index.first = gen;
+
+    for(i = 0; i < n; i++) {
+        _nst_disk_journal_path(disk, file, gens[i]);
+
+        if(found && gens[i] >= disk->index.first) {
+            _nst_disk_index_replay(core, file, NULL);
+        } else {
+            remove(file);
+        }
+
+        if(gens[i] >= gen) {
+            gen = gens[i];
+        }
+    }
+
+    free(gens);
+    free(file);
+
+    if(!interval) {
+        return NST_OK;
+    }
+
+    disk->index.interval = interval;
+    disk->index.gen      = gen + 1;
+    disk->index.fd       = -1;
+    disk->index.file     = nst_shmem_alloc(disk->shmem, disk->root.len + 18);
+
+    if(!disk->index.file) {
+        return NST_ERR;
+    }
+
+    if(found) {
+        disk->loaded = 1;
+    } else {
+        disk->index.first = disk->index.gen;
+    }
+
+    return NST_OK;
+
+err:
+    free(file);
+
+    return NST_ERR;
+}
+
+/* the journal appended to by this thread, of each disk store */
+static THREAD_LOCAL struct {
+    nst_disk_t  *disk;
+    uint32_t     gen;
+    int          fd;
+    char        *buf;
+} _nst_disk_journal[2];
+
+/*
+ * Append the record of entry to the journal, under the lock of its key. A
+ * change is either in the journal of the generation of a checkpoint, which
+ * goes to the bucket of the entry once the lock is released, or in the next.
+ */
+void
+nst_disk_journal(nst_disk_t *disk, nst_dict_entry_t *entry, int deleted) {
+    uint32_t  gen;
+    uint64_t  len;
+    int       i;
+
+    if(!disk->index.interval || !entry->store.disk.file) {
+        return;
+    }
+
+    gen = *(volatile uint32_t *)&disk->index.gen;
+
+    /* the cache and the nosql stores */
+    i = _nst_disk_journal[0].disk && _nst_disk_journal[0].disk != disk;
+
+    if(!_nst_disk_journal[i].buf) {
+        _nst_disk_journal[i].buf = malloc(global.tune.bufsize);
+
+        if(!_nst_disk_journal[i].buf) {
+            return;
+        }
+    }
+
+    if(_nst_disk_journal[i].disk != disk || _nst_disk_journal[i].gen != gen) {
+
+        if(_nst_disk_journal[i].disk == disk && _nst_disk_journal[i].fd != -1) {
+            close(_nst_disk_journal[i].fd);
+        }
+
+        _nst_disk_journal_path(disk, _nst_disk_journal[i].buf, gen);
+
+        _nst_disk_journal[i].disk = disk;
+        _nst_disk_journal[i].gen  = gen;
+        _nst_disk_journal[i].fd   = open(_nst_disk_journal[i].buf,
+                O_CREAT | O_WRONLY | O_APPEND, 0600);
+    }
+
+    if(_nst_disk_journal[i].fd == -1) {
+        return;
+    }
+
+    len = _nst_disk_index_record(_nst_disk_journal[i].buf, global.tune.bufsize, entry, deleted);
+
+    if(len) {
+        write(_nst_disk_journal[i].fd, _nst_disk_journal[i].buf, len);
+    }
+}
+
+static int
+_nst_disk_checkpoint_flush(nst_disk_t *disk) {
+
+    if(write(disk->index.fd, disk->index.buf, disk->index.used) != (ssize_t)disk->index.used) {
+        return NST_ERR;
+    }
+
+    disk->index.used = 0;
+
+    return NST_OK;
+}
+
+/*
+ * Every interval seconds, write the entries on disk to index.tmp, 10ms at a
+ * time, then rename it to index. The changes made meanwhile are in the journal
+ * of the generation started with the checkpoint, the older ones are removed.
+ */
+void
+nst_disk_checkpoint(nst_core_t *core) {
+    nst_disk_t         *disk = &core->store.disk;
+    nst_dict_t         *dict = &core->dict;
+    nst_dict_entry_t  **bucket;
+    nst_dict_entry_t   *entry;
+    uint64_t            start, len;
+    char               *file;
+    int                 ret  = NST_OK;
+
+    if(!disk->root.len || !disk->index.interval) {
+        return;
+    }
+
+    if(disk->index.fd == -1) {
+
+        if(nst_time_now_ms() < disk->index.next) {
+            return;
+        }
+
+        disk->index.next = nst_time_now_ms() + disk->index.interval * 1000ULL;
+
+        if(!disk->index.buf) {
+            disk->index.buf = malloc(NST_DISK_INDEX_BUF_SIZE);
+
+            if(!disk->index.buf) {
+                return;
+            }
+        }
+
+        sprintf(disk->index.file, "%s/index.tmp", disk->root.ptr);
+
+        disk->index.fd = open(disk->index.file, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+
+        if(disk->index.fd == -1) {
+            return;
+        }
+
+        /* the header is written once done */
+        memset(disk->index.buf, 0, NST_DISK_INDEX_HEADER_SIZE);
+
+        disk->index.used  = NST_DISK_INDEX_HEADER_SIZE;
+        disk->index.idx   = 0;
+        disk->index.count = 0;
+
+        __sync_add_and_fetch(&disk->index.gen, 1);
+
+        /* keep buckets in place until the whole dict is written */
+        nst_dict_rehash_pause(dict);
+    }
+
+    start = nst_time_now_ms();
+
+    while(disk->index.idx < nst_dict_buckets(dict)) {
+
+        nst_dict_lock(dict, disk->index.idx);
+
+        bucket = nst_dict_bucket(dict, disk->index.idx);
+        entry  = bucket ? *bucket : NULL;
+
+        while(entry && ret == NST_OK) {
+
+            if(entry->store.disk.file && !nst_dict_entry_invalid(entry)
+                    && (entry->state == NST_DICT_ENTRY_STATE_VALID
+                        || entry->state == NST_DICT_ENTRY_STATE_UPDATE
+                        || entry->state == NST_DICT_ENTRY_STATE_STALE)) {
+
+                len = _nst_disk_index_record(disk->index.buf + disk->index.used,
+                        NST_DISK_INDEX_BUF_SIZE - disk->index.used, entry, 0);
+
+                if(!len && (ret = _nst_disk_checkpoint_flush(disk)) == NST_OK) {
+                    len = _nst_disk_index_record(disk->index.buf, NST_DISK_INDEX_BUF_SIZE,
+                            entry, 0);
+                }
+
+                if(len) {
+                    disk->index.used += len;
+                    disk->index.count++;
+                }
+            }
+
+            entry = entry->next;
+        }
+
+        nst_dict_unlock(dict, disk->index.idx);
+
+        if(ret != NST_OK) {
+            goto err;
+        }
+
+        disk->index.idx++;
+
+        if(nst_time_now_ms() - start >= 10) {
+            return;
+        }
+    }
+
+    if(disk->index.used && _nst_disk_checkpoint_flush(disk) != NST_OK) {
+        goto err;
+    }
+
+    memcpy(disk->index.buf, NST_DISK_INDEX_MAGIC, 8);
+
+    *(uint32_t *)(disk->index.buf + 8)  = NST_DISK_VERSION;
+    *(uint32_t *)(disk->index.buf + 12) = disk->index.gen;
+    *(uint64_t *)(disk->index.buf + 16) = disk->index.count;
+
+    if(pwrite(disk->index.fd, disk->index.buf, NST_DISK_INDEX_HEADER_SIZE, 0)
+            != NST_DISK_INDEX_HEADER_SIZE || fsync(disk->index.fd) == -1) {
+
+        goto err;
+    }
+
+    close(disk->index.fd);
+
+    disk->index.fd = -1;
+
+    file = get_trash_chunk()->area;
+
+    sprintf(file, "%s/index", disk->root.ptr);
+
+    if(rename(disk->index.file, file) == -1) {
+        goto err;
+    }
+
+    while(disk->index.first < disk->index.gen) {
+        _nst_disk_journal_path(disk, disk->index.file, disk->index.first++);
+
+        remove(disk->index.file);
+    }
+
+    nst_dict_rehash_resume(dict);
+
+    return;
+
+err:
+    if(disk->index.fd != -1) {
+        close(disk->index.fd);
+
+        disk->index.fd = -1;
+    }
+
+    sprintf(disk->index.file, "%s/index.tmp", disk->root.ptr);
+
+    remove(disk->index.file);
+
+    nst_dict_rehash_resume(dict);
+}
+
+
+/*
+ * The async disk io serves the reads of the disk store off the event loop, so
+ * that a slow disk does not stall it. With threads, a request is queued to a
+ * pool of threads, then handed back to the done list of its owner thread,
+ * whose tasklet wakes up the owner task. With uring, the owner thread submits
+ * it to its own io_uring, and reaps the completions when the eventfd of the
+ * ring is readable.
+ */
+#if defined(USE_THREAD) || defined(USE_IO_URING)
+
+static void
+_nst_disk_aio_destroy(nst_disk_aio_t *aio) {
+
+    /* the file opened for an owner which is gone */
+    if(aio->op == NST_DISK_AIO_OP_OPEN && aio->fd != -1) {
+        close(aio->fd);
+    }
+
+    free(aio->buf);
+    free(aio);
+}
+
+/*
+ * Read the meta and the key of the file opened by an open request, the key is
+ * left in buf for the owner to check, as the key may have gone meanwhile.
+ */
+static void
+_nst_disk_aio_read_key(nst_disk_aio_t *aio) {
+    int  len;
+
+    aio->ret = -1;
+
+    if(pread(aio->fd, aio->meta, NST_DISK_META_SIZE, aio->offset) != NST_DISK_META_SIZE) {
+        return;
+    }
+
+    len = nst_disk_meta_get_key_len(aio->meta);
+
+    if(len <= aio->len) {
+        aio->ret = pread(aio->fd, aio->buf, len, aio->offset + NST_DISK_POS_KEY);
+    }
+}
+
+/*
+ * Serve the request with blocking calls
+ */
+static void
+_nst_disk_aio_serve(nst_disk_aio_t *aio) {
+
+    if(aio->op == NST_DISK_AIO_OP_READ) {
+        aio->ret = pread(aio->fd, aio->buf, aio->len, aio->offset);
+
+        return;
+    }
+
+    aio->ret = -1;
+    aio->fd  = nst_disk_file_open(aio->buf);
+
+    if(aio->fd != -1) {
+        _nst_disk_aio_read_key(aio);
+    }
+}
+
+/*
+ * Runs in the owner thread once the request is served
+ */
+static void
+_nst_disk_aio_complete(nst_disk_aio_t *aio) {
+
+    if(aio->orphan) {
+        _nst_disk_aio_destroy(aio);
+
+        return;
+    }
+
+    aio->state = NST_DISK_AIO_DONE;
+
+    task_wakeup(aio->task, TASK_WOKEN_MSG);
+}
+
+#ifdef USE_THREAD
+
+static struct {
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    hpx_list_t          queue;
+    hpx_list_t          done[MAX_THREADS];
+    struct tasklet     *tasklet[MAX_THREADS];
+    int                 threads;
+} _nst_disk_aio = {
+    .lock  = PTHREAD_MUTEX_INITIALIZER,
+    .cond  = PTHREAD_COND_INITIALIZER,
+    .queue = LIST_HEAD_INIT(_nst_disk_aio.queue),
+};
+
+static void *
+_nst_disk_aio_worker(void *arg) {
+    nst_disk_aio_t  *aio;
+    struct tasklet  *tl;
+    int              orphan;
+
+    while(1) {
+        pthread_mutex_lock(&_nst_disk_aio.lock);
+
+        while(LIST_ISEMPTY(&_nst_disk_aio.queue)) {
+            pthread_cond_wait(&_nst_disk_aio.cond, &_nst_disk_aio.lock);
+        }
+
+        aio = LIST_NEXT(&_nst_disk_aio.queue, nst_disk_aio_t *, list);
+        LIST_DEL_INIT(&aio->list);
+
+        orphan = aio->orphan;
+
+        pthread_mutex_unlock(&_nst_disk_aio.lock);
+
+        if(!orphan) {
+            _nst_disk_aio_serve(aio);
+        }
+
+        pthread_mutex_lock(&_nst_disk_aio.lock);
+
+        LIST_ADDQ(&_nst_disk_aio.done[aio->tid], &aio->list);
+        tl = _nst_disk_aio.tasklet[aio->tid];
+
+        pthread_mutex_unlock(&_nst_disk_aio.lock);
+
+        /* a tasklet bound to a thread can be woken up from anywhere */
+        tasklet_wakeup(tl);
+    }
+
+    return NULL;
+}
+
+/*
+ * Runs in the owner thread, hands the results back to their tasks
+ */
+static struct task *
+_nst_disk_aio_done(struct task *t, void *context, unsigned short state) {
+    nst_disk_aio_t  *aio, *back;
+    hpx_list_t       done;
+
+    LIST_INIT(&done);
+
+    pthread_mutex_lock(&_nst_disk_aio.lock);
+
+    LIST_SPLICE(&done, &_nst_disk_aio.done[tid]);
+    LIST_INIT(&_nst_disk_aio.done[tid]);
+
+    pthread_mutex_unlock(&_nst_disk_aio.lock);
+
+    list_for_each_entry_safe(aio, back, &done, list) {
+        LIST_DEL_INIT(&aio->list);
+
+        _nst_disk_aio_complete(aio);
+    }
+
+    return t;
+}
+
+static int
+_nst_disk_aio_init_per_thread() {
+    pthread_t  thread;
+    sigset_t   set, old;
+    int        i;
+
+    if(master || !_nst_disk_aio.threads) {
+        return 1;
+    }
+
+    LIST_INIT(&_nst_disk_aio.done[tid]);
+
+    _nst_disk_aio.tasklet[tid] = tasklet_new();
+
+    if(!_nst_disk_aio.tasklet[tid]) {
+        return 0;
+    }
+
+    _nst_disk_aio.tasklet[tid]->process = _nst_disk_aio_done;
+    _nst_disk_aio.tasklet[tid]->tid     = tid;
+
+    if(tid != 0) {
+        return 1;
+    }
+
+    /* the signals are left to the haproxy threads */
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &old);
+
+    for(i = 0; i < _nst_disk_aio.threads; i++) {
+
+        if(pthread_create(&thread, NULL, _nst_disk_aio_worker, NULL) != 0) {
+            break;
+        }
+
+        pthread_detach(thread);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return i == _nst_disk_aio.threads;
+}
+
+REGISTER_PER_THREAD_INIT(_nst_disk_aio_init_per_thread);
+
+static void
+_nst_disk_aio_queue(nst_disk_aio_t *aio) {
+    pthread_mutex_lock(&_nst_disk_aio.lock);
+
+    LIST_ADDQ(&_nst_disk_aio.queue, &aio->list);
+    pthread_cond_signal(&_nst_disk_aio.cond);
+
+    pthread_mutex_unlock(&_nst_disk_aio.lock);
+}
+
+#endif /* USE_THREAD */
+
+#ifdef USE_IO_URING
+
+/*
+ * The rings are set up with the raw syscalls, an open request is an openat
+ * followed by a read of the first buffer of the file, which holds the meta
+ * and, most of the time, the key.
+ */
+static struct nst_disk_uring {
+    int                     fd;             /* of the ring */
+    int                     efd;            /* eventfd signaled on completions */
+    void                   *sq_ptr;
+    size_t                  sq_len;
+    void                   *cq_ptr;
+    size_t                  cq_len;
+    unsigned int           *sq_head;
+    unsigned int           *sq_tail;
+    unsigned int           *sq_array;
+    unsigned int            sq_mask;
+    unsigned int            sq_entries;
+    unsigned int           *cq_head;
+    unsigned int           *cq_tail;
+    unsigned int            cq_mask;
+    unsigned int            cq_entries;
+    struct io_uring_sqe    *sqes;
+    struct io_uring_cqe    *cqes;
+    unsigned int            pending;        /* queued, not submitted yet */
+    unsigned int            inflight;       /* submitted, not reaped yet */
+    struct tasklet         *flush;          /* submits the pending ones at once */
+} _nst_disk_uring[MAX_THREADS];
+
+static int  _nst_disk_uring_used;
+
+static int
+_nst_disk_uring_setup(unsigned int entries, struct io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+_nst_disk_uring_enter(int fd, unsigned int to_submit) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, 0, 0, NULL, 0);
+}
+
+static int
+_nst_disk_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+}
+
+/*
+ * Check the kernel supports io_uring, and openat and read in it
+ */
+static int
+_nst_disk_uring_probe() {
+    struct io_uring_params   params;
+    struct io_uring_probe   *probe;
+    int                      fd, ret;
+
+    memset(&params, 0, sizeof(params));
+
+    fd = _nst_disk_uring_setup(1, &params);
+
+    if(fd == -1) {
+        return NST_ERR;
+    }
+
+    ret   = NST_ERR;
+    probe = calloc(1, sizeof(*probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+
+    if(probe && _nst_disk_uring_register(fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0
+            && probe->last_op >= IORING_OP_READ
+            && (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED)
+            && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)) {
+
+        ret = NST_OK;
+    }
+
+    free(probe);
+    close(fd);
+
+    return ret;
+}
+
+/*
+ * Queue a sqe of aio, it is submitted with the others queued in the same loop
+ * by the flush tasklet. The completions are not dropped as long as there are
+ * no more in flight than the entries of the completion queue.
+ * return NST_ERR if the ring is full
+ */
+static int
+_nst_disk_uring_prep(nst_disk_aio_t *aio, int opcode, int fd, uint64_t offset) {
+    struct nst_disk_uring  *ring = &_nst_disk_uring[tid];
+    struct io_uring_sqe    *sqe;
+    unsigned int            tail, index;
+
+    tail = *ring->sq_tail;
+
+    if(ring->inflight >= ring->cq_entries
+            || tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+
+        return NST_ERR;
+    }
+
+    index = tail & ring->sq_mask;
+    sqe   = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+
+    sqe->opcode    = opcode;
+    sqe->fd        = fd;
+    sqe->addr      = (uintptr_t)aio->buf;
+    sqe->off       = offset;
+    sqe->user_data = (uintptr_t)aio;
+
+    if(opcode == IORING_OP_OPENAT) {
+        sqe->open_flags = O_RDONLY;
+    } else {
+        sqe->len = aio->len;
+    }
+
+    ring->sq_array[index] = index;
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    ring->pending++;
+    ring->inflight++;
+
+    tasklet_wakeup(ring->flush);
+
+    return NST_OK;
+}
+
+static struct task *
+_nst_disk_uring_flush(struct task *t, void *context, unsigned short state) {
+    struct nst_disk_uring  *ring = &_nst_disk_uring[tid];
+    int                     ret;
+
+    if(!ring->pending) {
+        return t;
+    }
+
+    ret = _nst_disk_uring_enter(ring->fd, ring->pending);
+
+    if(ret > 0) {
+        ring->pending -= ret;
+    }
+
+    if(ring->pending && (ret > 0 || errno == EAGAIN || errno == EBUSY || errno == EINTR)) {
+        tasklet_wakeup(ring->flush);
+    }
+
+    return t;
+}
+
+/*
+ * The request is served with blocking calls if the ring is full
+ */
+static void
+_nst_disk_uring_submit(nst_disk_aio_t *aio) {
+    int  ret;
+
+    if(aio->op == NST_DISK_AIO_OP_READ) {
+        ret = _nst_disk_uring_prep(aio, IORING_OP_READ, aio->fd, aio->offset);
+    } else {
+        aio->step = 0;
+
+        ret = _nst_disk_uring_prep(aio, IORING_OP_OPENAT, AT_FDCWD, 0);
+    }
+
+    if(ret != NST_OK) {
+        _nst_disk_aio_serve(aio);
+        _nst_disk_aio_complete(aio);
+    }
+}
+
+/*
+ * Take the meta and the key from the first n bytes of the file read in buf,
+ * a key which does not fit is read again.
+ */
+static void
+_nst_disk_uring_read_key(nst_disk_aio_t *aio, int n) {
+    int  len;
+
+    aio->ret = -1;
+
+    if(n < NST_DISK_META_SIZE) {
+        return;
+    }
+
+    memcpy(aio->meta, aio->buf, NST_DISK_META_SIZE);
+
+    len = nst_disk_meta_get_key_len(aio->meta);
+
+    if(len > aio->len) {
+        return;
+    }
+
+    if(NST_DISK_POS_KEY + len <= n) {
+        memmove(aio->buf, aio->buf + NST_DISK_POS_KEY, len);
+
+        aio->ret = len;
+    } else {
+        aio->ret = pread(aio->fd, aio->buf, len, aio->offset + NST_DISK_POS_KEY);
+    }
+}
+
+static void
+_nst_disk_uring_done(nst_disk_aio_t *aio, int res) {
+
+    if(aio->op == NST_DISK_AIO_OP_READ) {
+        aio->ret = res < 0 ? -1 : res;
+    } else if(aio->step == 0) {
+        aio->fd  = res < 0 ? -1 : res;
+        aio->ret = -1;
+
+        if(aio->fd != -1 && !aio->orphan) {
+            aio->step = 1;
+
+            if(_nst_disk_uring_prep(aio, IORING_OP_READ, aio->fd, aio->offset) == NST_OK) {
+                return;
+            }
+
+            _nst_disk_aio_read_key(aio);
+        }
+    } else {
+        _nst_disk_uring_read_key(aio, res);
+    }
+
+    _nst_disk_aio_complete(aio);
+}
+
+/*
+ * The iocb of the eventfd, reaps all the completions of the ring
+ */
+static void
+_nst_disk_uring_reap(int fd) {
+    struct nst_disk_uring  *ring = &_nst_disk_uring[tid];
+    struct io_uring_cqe    *cqe;
+    nst_disk_aio_t         *aio;
+    unsigned int            head;
+    uint64_t                n;
+    int                     res;
+
+    while(read(fd, &n, sizeof(n)) > 0);
+
+    fd_cant_recv(fd);
+
+    head = *ring->cq_head;
+
+    while(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &ring->cqes[head & ring->cq_mask];
+        aio = (nst_disk_aio_t *)(uintptr_t)cqe->user_data;
+        res = cqe->res;
+
+        __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+
+        ring->inflight--;
+
+        _nst_disk_uring_done(aio, res);
+    }
+}
+
+static void
+_nst_disk_uring_release(struct nst_disk_uring *ring) {
+
+    if(ring->flush) {
+        tasklet_free(ring->flush);
+        ring->flush = NULL;
+    }
+
+    if(ring->efd != -1) {
+        fd_delete(ring->efd);
+        ring->efd = -1;
+    }
+
+    if(ring->sqes) {
+        munmap(ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe));
+        ring->sqes = NULL;
+    }
+
+    if(ring->cq_ptr && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+
+    if(ring->sq_ptr) {
+        munmap(ring->sq_ptr, ring->sq_len);
+    }
+
+    ring->sq_ptr = ring->cq_ptr = NULL;
+
+    if(ring->fd != -1) {
+        close(ring->fd);
+        ring->fd = -1;
+    }
+}
+
+/*
+ * A thread whose ring cannot be set up, by lack of locked memory for example,
+ * reads the disk with blocking calls.
+ */
+static int
+_nst_disk_uring_init_per_thread() {
+    struct nst_disk_uring   *ring = &_nst_disk_uring[tid];
+    struct io_uring_params   params;
+    void                    *p;
+    int                      efd;
+
+    ring->fd  = -1;
+    ring->efd = -1;
+
+    if(master || !_nst_disk_uring_used) {
+        return 1;
+    }
+
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = _nst_disk_uring_setup(NST_DISK_URING_ENTRIES, &params);
+
+    if(ring->fd == -1) {
+        goto err;
+    }
+
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_len = ring->cq_len = MAX(ring->sq_len, ring->cq_len);
+    }
+
+    p = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+            IORING_OFF_SQ_RING);
+
+    if(p == MAP_FAILED) {
+        goto err;
+    }
+
+    ring->sq_ptr = ring->cq_ptr = p;
+
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        p = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring->fd, IORING_OFF_CQ_RING);
+
+        if(p == MAP_FAILED) {
+            goto err;
+        }
+
+        ring->cq_ptr = p;
+    }
+
+    p = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if(p == MAP_FAILED) {
+        goto err;
+    }
+
+    ring->sqes       = p;
+    ring->sq_head    = (unsigned int *)((char *)ring->sq_ptr + params.sq_off.head);
+    ring->sq_tail    = (unsigned int *)((char *)ring->sq_ptr + params.sq_off.tail);
+    ring->sq_array   = (unsigned int *)((char *)ring->sq_ptr + params.sq_off.array);
+    ring->sq_mask    = *(unsigned int *)((char *)ring->sq_ptr + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->cq_head    = (unsigned int *)((char *)ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail    = (unsigned int *)((char *)ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask    = *(unsigned int *)((char *)ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cq_entries = params.cq_entries;
+    ring->cqes       = (struct io_uring_cqe *)((char *)ring->cq_ptr + params.cq_off.cqes);
+    ring->pending    = 0;
+    ring->inflight   = 0;
+
+    efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if(efd == -1) {
+        goto err;
+    }
+
+    if(efd >= global.maxsock) {
+        close(efd);
+
+        goto err;
+    }
+
+    fd_insert(efd, ring, _nst_disk_uring_reap, tid_bit);
+
+    ring->efd = efd;
+
+    if(_nst_disk_uring_register(ring->fd, IORING_REGISTER_EVENTFD, &efd, 1) != 0) {
+        goto err;
+    }
+
+    ring->flush = tasklet_new();
+
+    if(!ring->flush) {
+        goto err;
+    }
+
+    ring->flush->process = _nst_disk_uring_flush;
+    ring->flush->tid     = tid;
+
+    fd_want_recv(efd);
+
+    return 1;
+
+err:
+    ha_warning("[nuster] failed to set up the io_uring of thread %d, use sync: %s.\n",
+            tid + 1, strerror(errno));
+
+    _nst_disk_uring_release(ring);
+
+    return 1;
+}
+
+static void
+_nst_disk_uring_deinit_per_thread() {
+
+    if(!master && _nst_disk_uring_used) {
+        _nst_disk_uring_release(&_nst_disk_uring[tid]);
+    }
+}
+
+REGISTER_PER_THREAD_INIT(_nst_disk_uring_init_per_thread);
+REGISTER_PER_THREAD_DEINIT(_nst_disk_uring_deinit_per_thread);
+
+#endif /* USE_IO_URING */
+
+static void
+_nst_disk_aio_submit(nst_disk_aio_t *aio, int op) {
+    aio->op    = op;
+    aio->state = NST_DISK_AIO_BUSY;
+
+#ifdef USE_IO_URING
+    if(aio->io == NST_DISK_IO_URING) {
+        _nst_disk_uring_submit(aio);
+
+        return;
+    }
+#endif
+
+#ifdef USE_THREAD
+    _nst_disk_aio_queue(aio);
+#endif
+}
+
+/*
+ * Take the result of the last request if it is op, the file left open by
+ * another request is closed.
+ * return 1 if the result of op is ready, 0 otherwise
+ */
+static int
+_nst_disk_aio_result(nst_disk_aio_t *aio, int op) {
+
+    if(aio->state != NST_DISK_AIO_DONE) {
+        return 0;
+    }
+
+    aio->state = NST_DISK_AIO_IDLE;
+
+    if(aio->op == op) {
+        return 1;
+    }
+
+    if(aio->op == NST_DISK_AIO_OP_OPEN && aio->fd != -1) {
+        close(aio->fd);
+
+        aio->fd = -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Serve the reads of disk with io, uring falls back to the pool of threads if
+ * the kernel does not support it. The pool is shared by all disk stores and
+ * sized by the largest.
+ */
+int
+nst_disk_aio_init(nst_disk_t *disk, int io, int threads) {
+
+    if(!disk->root.len) {
+        return NST_OK;
+    }
+
+    if(io == NST_DISK_IO_URING) {
+#ifdef USE_IO_URING
+        if(_nst_disk_uring_probe() == NST_OK) {
+            disk->io             = NST_DISK_IO_URING;
+            _nst_disk_uring_used = 1;
+
+            return NST_OK;
+        }
+
+        ha_warning("[nuster] io_uring is not supported by the kernel, use disk-io threads.\n");
+#else
+        ha_warning("[nuster] disk-io uring requires USE_IO_URING, use disk-io threads.\n");
+#endif
+    }
+
+#ifdef USE_THREAD
+    disk->io = NST_DISK_IO_THREADS;
+
+    if(threads > _nst_disk_aio.threads) {
+        _nst_disk_aio.threads = threads;
+    }
+#else
+    ha_warning("[nuster] disk-io threads requires USE_THREAD, use sync.\n");
+#endif
+
+    return NST_OK;
+}
+
+/*
+ * return a request owned by task, or NULL if the reads of disk are sync
+ */
+nst_disk_aio_t *
+nst_disk_aio_new(nst_disk_t *disk, hpx_task_t *task) {
+    nst_disk_aio_t  *aio;
+
+    if(disk->io == NST_DISK_IO_SYNC) {
+        return NULL;
+    }
+
+#ifdef USE_IO_URING
+    if(disk->io == NST_DISK_IO_URING && !_nst_disk_uring[tid].flush) {
+        return NULL;
+    }
+#endif
+
+    aio = calloc(1, sizeof(*aio));
+
+    if(!aio) {
+        return NULL;
+    }
+
+    aio->buf = malloc(global.tune.bufsize);
+
+    if(!aio->buf) {
+        free(aio);
+
+        return NULL;
+    }
+
+    LIST_INIT(&aio->list);
+
+    aio->task = task;
+    aio->tid  = tid;
+    aio->io   = disk->io;
+    aio->fd   = -1;
+
+    return aio;
+}
+
+/*
+ * A busy request is freed by the owner thread once served
+ */
+void
+nst_disk_aio_free(nst_disk_aio_t *aio) {
+
+    if(!aio) {
+        return;
+    }
+
+    if(aio->state == NST_DISK_AIO_BUSY) {
+#ifdef USE_THREAD
+        pthread_mutex_lock(&_nst_disk_aio.lock);
+        aio->orphan = 1;
+        pthread_mutex_unlock(&_nst_disk_aio.lock);
+#else
+        aio->orphan = 1;
+#endif
+
+        return;
+    }
+
+    _nst_disk_aio_destroy(aio);
+}
+
+/*
+ * Read up to len bytes at offset of fd, *p is set to the data in aio->buf.
+ * A worker reads a whole buffer, the following reads are served from it.
+ * return the number of bytes read, -1 on error, or NST_DISK_AIO_AGAIN
+ */
+int
+nst_disk_aio_read(nst_disk_aio_t *aio, int fd, char **p, int len, uint64_t offset) {
+    int  ret;
+
+    if(aio->state == NST_DISK_AIO_BUSY) {
+        return NST_DISK_AIO_AGAIN;
+    }
+
+    if(aio->state == NST_DISK_AIO_DONE && aio->op == NST_DISK_AIO_OP_READ && aio->fd == fd) {
+
+        if(offset == aio->offset && aio->ret <= 0) {
+            return aio->ret;
+        }
+
+        if(offset >= aio->offset && offset < aio->offset + aio->ret) {
+            ret = aio->offset + aio->ret - offset;
+            *p  = aio->buf + (offset - aio->offset);
+
+            return ret < len ? ret : len;
+        }
+    }
+
+    _nst_disk_aio_result(aio, NST_DISK_AIO_OP_READ);
+
+    aio->fd     = fd;
+    aio->len    = global.tune.bufsize;
+    aio->offset = offset;
+
+    _nst_disk_aio_submit(aio, NST_DISK_AIO_OP_READ);
+
+    return NST_DISK_AIO_AGAIN;
+}
+
+/*
+ * The async nst_disk_obj_valid
+ * return NST_OK, NST_ERR, or NST_DISK_AIO_AGAIN
+ */
+int
+nst_disk_aio_obj_valid(nst_disk_aio_t *aio, nst_disk_obj_t *obj, nst_key_t *key) {
+    int  len;
+
+    if(aio->state == NST_DISK_AIO_BUSY) {
+        return NST_DISK_AIO_AGAIN;
+    }
+
+    if(_nst_disk_aio_result(aio, NST_DISK_AIO_OP_OPEN)) {
+        obj->fd = aio->fd;
+        aio->fd = -1;
+
+        if(aio->ret == key->size && _nst_disk_meta_valid(aio->meta, key) == NST_OK
+                && memcmp(aio->buf, key->data, key->size) == 0) {
+
+            memcpy(obj->meta, aio->meta, NST_DISK_META_SIZE);
+
+            return NST_OK;
+        }
+
+        if(obj->fd != -1) {
+            close(obj->fd);
+        }
+
+        return NST_ERR;
+    }
+
+    len = strlen(obj->file) + 1;
+
+    if(len > global.tune.bufsize) {
+        return NST_ERR;
+    }
+
+    memcpy(aio->buf, obj->file, len);
+
+    aio->fd     = -1;
+    aio->len    = global.tune.bufsize;
+    aio->offset = obj->base;
+
+    _nst_disk_aio_submit(aio, NST_DISK_AIO_OP_OPEN);
+
+    return NST_DISK_AIO_AGAIN;
+}
+
+/*
+ * The async nst_disk_obj_exists
+ * return NST_OK, NST_ERR, or NST_DISK_AIO_AGAIN
+ */
+int
+nst_disk_aio_obj_exists(nst_disk_t *disk, nst_disk_aio_t *aio, nst_disk_obj_t *obj,
+        nst_key_t *key) {
+
+    _nst_disk_obj_path(disk, obj, key);
+
+    return nst_disk_aio_obj_valid(aio, obj, key);
+}
+
+#else
+
+int
+nst_disk_aio_init(nst_disk_t *disk, int io, int threads) {
+
+    if(disk->root.len) {
+        ha_warning("[nuster] disk-io %s requires USE_THREAD or USE_IO_URING, use sync.\n",
+                io == NST_DISK_IO_URING ? "uring" : "threads");
+    }
+
+    return NST_OK;
+}
+
+nst_disk_aio_t *
+nst_disk_aio_new(nst_disk_t *disk, hpx_task_t *task) {
+    return NULL;
+}
+
+void
+nst_disk_aio_free(nst_disk_aio_t *aio) {
+}
+
+int
+nst_disk_aio_read(nst_disk_aio_t *aio, int fd, char **p, int len, uint64_t offset) {
+    *p = aio->buf;
+
+    return pread(fd, aio->buf, len, offset);
+}
+
+int
+nst_disk_aio_obj_valid(nst_disk_aio_t *aio, nst_disk_obj_t *obj, nst_key_t *key) {
+    return nst_disk_obj_valid(obj, key);
+}
+
+int
+nst_disk_aio_obj_exists(nst_disk_t *disk, nst_disk_aio_t *aio, nst_disk_obj_t *obj,
+        nst_key_t *key) {
+
+    return nst_disk_obj_exists(disk, obj, key);
+}
+
+#endif
+
+/*
+ * Read up to len bytes at offset of fd for the disk applets, asynchronously
+ * if aio is set, *p is set to the data read.
+ * return the number of bytes read, -1 on error, or NST_DISK_AIO_AGAIN
+ */
+int
+nst_disk_pread(nst_disk_aio_t *aio, int fd, char **p, int len, uint64_t offset) {
+    hpx_buffer_t  *buf;
+
+    if(aio) {
+        return nst_disk_aio_read(aio, fd, p, len, offset);
+    }
+
+    buf = get_trash_chunk();
+    *p  = buf->area;
+
+    return pread(fd, *p, len, offset);
+}
@@ -20,20 +20,135 @@ nst_memory_init(nst_memory_t *mem, nst_shmem_t *shmem) {
     mem->shmem   = shmem;
     mem->head    = NULL;
     mem->tail    = NULL;
-    mem->count   = 0;
-    mem->invalid = 0;
+    mem->retired = NULL;
+    mem->count    = 0;
+    mem->invalid  = 0;
+    mem->pressure = 0;
+    mem->evicting = 0;
+    mem->evicted  = 0;
+
+    memset(&mem->sketch, 0, sizeof(mem->sketch));
+    memset(&mem->encoding, 0, sizeof(mem->encoding));
+
+    mem->wanted        = NULL;
+    mem->precompressed = 0;
 
     return nst_shctx_init(mem);
 }
 
+int
+nst_memory_sketch_init(nst_memory_t *mem) {
+    int  i;
+
+    mem->sketch.width     = mem->shmem->block_size;
+    mem->sketch.additions = 0;
+    mem->sketch.rejected  = 0;
+
+    for(i = 0; i < NST_MEMORY_SKETCH_DEPTH; i++) {
+        mem->sketch.row[i] = nst_shmem_alloc(mem->shmem, mem->sketch.width);
+
+        if(!mem->sketch.row[i]) {
+            return NST_ERR;
+        }
+
+        memset(mem->sketch.row[i], 0, mem->sketch.width);
+    }
+
+    return NST_OK;
+}
+
 /*
- * free invalid nst_memory_object
+ * Count one more request of hash and tell whether its response is worth
+ * storing in memory. Everything is admitted while memory is not short, then
+ * only keys requested at least NST_MEMORY_ADMIT_FREQ times recently, so that
+ * one-hit wonders do not push out popular caches. Counters are updated
+ * without lock, a lost increment does not matter.
+ * return 1 if admitted, 0 otherwise
+ */
+int
+nst_memory_admit(nst_memory_t *mem, uint64_t hash) {
+    uint64_t  mask = mem->sketch.width - 1;
+    uint64_t  step = (hash >> 32) | 1;
+    uint8_t  *counter[NST_MEMORY_SKETCH_DEPTH];
+    uint8_t   freq = NST_MEMORY_SKETCH_MAX;
+    int       i;
+
+    if(!mem->sketch.row[0]) {
+        return 1;
+    }
+
+    for(i = 0; i < NST_MEMORY_SKETCH_DEPTH; i++) {
+        counter[i] = &mem->sketch.row[i][(hash + i * step) & mask];
+
+        if(*counter[i] < freq) {
+            freq = *counter[i];
+        }
+    }
+
+    /* conservative update, only the smallest counters are incremented */
+    if(freq < NST_MEMORY_SKETCH_MAX) {
+
+        for(i = 0; i < NST_MEMORY_SKETCH_DEPTH; i++) {
+
+            if(*counter[i] == freq) {
+                *counter[i] = freq + 1;
+            }
+        }
+
+        freq++;
+    }
+
+    mem->sketch.additions++;
+
+    if(!mem->pressure
+            && mem->shmem->used < mem->shmem->size / 100 * NST_MEMORY_EVICT_LOW) {
+
+        return 1;
+    }
+
+    if(freq >= NST_MEMORY_ADMIT_FREQ) {
+        return 1;
+    }
+
+    __sync_add_and_fetch(&mem->sketch.rejected, 1);
+
+    return 0;
+}
+
+/*
+ * halve all counters once enough keys were counted, so that keys which were
+ * popular long ago are forgotten
+ */
+void
+nst_memory_sketch_age(nst_memory_t *mem) {
+    uint64_t  n;
+    int       i;
+
+    if(!mem->sketch.row[0]) {
+        return;
+    }
+
+    if(mem->sketch.additions < mem->sketch.width * NST_MEMORY_SKETCH_SAMPLE) {
+        return;
+    }
+
+    for(i = 0; i < NST_MEMORY_SKETCH_DEPTH; i++) {
+
+        for(n = 0; n < mem->sketch.width; n++) {
+            mem->sketch.row[i][n] >>= 1;
+        }
+    }
+
+    mem->sketch.additions /= 2;
+}
+
+/*
+ * remove invalid nst_memory_object from the list, it is freed later by
+ * nst_dict_reclaim since lock free readers may still see it
  */
 void
 nst_memory_cleanup(nst_memory_t *mem) {
-    nst_memory_obj_t   *obj  = NULL;
-    nst_memory_item_t  *item = NULL;
-    nst_memory_item_t  *tmp;
+    nst_memory_obj_t  *obj = NULL;
 
     nst_shctx_lock(mem);
 
@@ -63,16 +178,8 @@ nst_memory_cleanup(nst_memory_t *mem) {
     }
 
     if(obj) {
-        item = obj->item;
-
-        while(item) {
-            tmp  = item;
-            item = item->next;
-
-            nst_shmem_free(mem->shmem, tmp);
-        }
-
-        nst_shmem_free(mem->shmem, obj);
+        obj->next    = mem->retired;
+        mem->retired = obj;
 
         mem->count--;
         mem->invalid--;
@@ -81,6 +188,69 @@ nst_memory_cleanup(nst_memory_t *mem) {
     nst_shctx_unlock(mem);
 }
 
+/*
+ * take all retired nst_memory_object
+ */
+nst_memory_obj_t *
+nst_memory_retired(nst_memory_t *mem) {
+    nst_memory_obj_t  *obj;
+
+    nst_shctx_lock(mem);
+
+    obj          = mem->retired;
+    mem->retired = NULL;
+
+    nst_shctx_unlock(mem);
+
+    return obj;
+}
+
+/*
+ * free a retired nst_memory_object, or retire it again if it is still used
+ */
+void
+nst_memory_obj_free(nst_memory_t *mem, nst_memory_obj_t *obj) {
+    nst_memory_item_t  *item = NULL;
+    nst_memory_item_t  *tmp;
+
+    if(obj->clients) {
+        nst_shctx_lock(mem);
+
+        obj->next    = mem->retired;
+        mem->retired = obj;
+
+        nst_shctx_unlock(mem);
+
+        return;
+    }
+
+    /* nobody can reach the precompressed copy anymore */
+    if(obj->encoded) {
+        obj->encoded->invalid = 1;
+
+        nst_memory_incr_invalid(mem);
+    }
+
+    item = obj->item;
+
+    while(item) {
+        tmp  = item;
+        item = item->next;
+
+        nst_shmem_free(mem->shmem, tmp);
+    }
+
+    if(obj->evicted) {
+        nst_shctx_lock(mem);
+
+        mem->evicting = mem->evicting > obj->evicted ? mem->evicting - obj->evicted : 0;
+
+        nst_shctx_unlock(mem);
+    }
+
+    nst_shmem_free(mem->shmem, obj);
+}
+
 /*
  * create a new nst_memory_object and insert it to nst_memory list
  */
@@ -113,35 +283,51 @@ nst_memory_obj_create(nst_memory_t *mem) {
         mem->count++;
 
         nst_shctx_unlock(mem);
+    } else {
+        mem->pressure = 1;
     }
 
     return obj;
 }
 
-int
-nst_memory_obj_append(nst_memory_t *mem, nst_memory_obj_t *obj, nst_memory_item_t **tail,
-        const char *buf, uint32_t len, uint32_t info) {
+/*
+ * append a new extent to obj, twice as large as the previous one
+ */
+static nst_memory_item_t *
+_nst_memory_obj_extend(nst_memory_t *mem, nst_memory_obj_t *obj, nst_memory_item_t **tail,
+        uint32_t need) {
 
     nst_memory_item_t  *item;
+    uint32_t            size = NST_MEMORY_EXTENT_MIN;
 
-    if(obj->invalid) {
-        return NST_ERR;
+    if(*tail) {
+        size = 2 * (sizeof(*item) + (*tail)->size);
     }
 
-    item = nst_memory_alloc_item(mem, len);
+    while(size < sizeof(*item) + need) {
+        size *= 2;
+    }
 
-    if(!item) {
-        obj->invalid = 1;
+    if(size > mem->shmem->block_size) {
+        size = mem->shmem->block_size;
+    }
 
-        nst_memory_incr_invalid(mem);
+    if(size < sizeof(*item) + need) {
+        return NULL;
+    }
 
-        return NST_ERR;
+    item = nst_shmem_alloc(mem->shmem, size);
+
+    if(!item) {
+        return NULL;
     }
 
-    memcpy(item->data, buf, len);
+    item->next    = NULL;
+    item->size    = size - sizeof(*item);
+    item->used    = 0;
+    item->payload = 0;
 
-    item->info = info;
-    item->next = NULL;
+    __sync_synchronize();
 
     if(*tail) {
         (*tail)->next = item;
@@ -151,18 +337,446 @@ nst_memory_obj_append(nst_memory_t *mem, nst_memory_obj_t *obj, nst_memory_item_
 
     *tail = item;
 
+    return item;
+}
+
+int
+nst_memory_obj_append(nst_memory_t *mem, nst_memory_obj_t *obj, nst_memory_item_t **tail,
+        const char *buf, uint32_t len, uint32_t info) {
+
+    nst_memory_item_t  *item = *tail;
+    uint32_t            n, blk;
+
+    if(obj->invalid) {
+        return NST_ERR;
+    }
+
+    if((info >> 28) != HTX_BLK_DATA) {
+
+        if(!item || item->size - item->used < 4 + len) {
+            item = _nst_memory_obj_extend(mem, obj, tail, 4 + len);
+
+            if(!item) {
+                goto err;
+            }
+        }
+
+        memcpy(item->data + item->used, &info, 4);
+        memcpy(item->data + item->used + 4, buf, len);
+
+        __sync_synchronize();
+
+        item->used += 4 + len;
+
+        return NST_OK;
+    }
+
+    while(len) {
+
+        if(!item || item->size - item->used < 5) {
+            item = _nst_memory_obj_extend(mem, obj, tail, 5);
+
+            if(!item) {
+                goto err;
+            }
+        }
+
+        n   = item->size - item->used - 4;
+        n   = n < len ? n : len;
+        blk = (HTX_BLK_DATA << 28) + n;
+
+        memcpy(item->data + item->used, &blk, 4);
+        memcpy(item->data + item->used + 4, buf, n);
+
+        item->payload += n;
+
+        __sync_synchronize();
+
+        item->used += 4 + n;
+        buf        += n;
+        len        -= n;
+    }
+
     return NST_OK;
+
+err:
+    mem->pressure = 1;
+    obj->invalid  = 1;
+
+    nst_memory_incr_invalid(mem);
+
+    return NST_ERR;
+}
+
+/*
+ * obj is complete, move its last extent to a smaller chunk if it is mostly
+ * unused
+ */
+void
+nst_memory_obj_finish(nst_memory_t *mem, nst_memory_obj_t *obj, nst_memory_item_t **tail) {
+    nst_memory_item_t  *item = *tail;
+    nst_memory_item_t  *prev;
+    nst_memory_item_t  *copy;
+
+    if(!item || 2 * (sizeof(*item) + item->used) > sizeof(*item) + item->size) {
+        return;
+    }
+
+    copy = nst_shmem_alloc(mem->shmem, sizeof(*item) + item->used);
+
+    if(!copy) {
+        return;
+    }
+
+    memcpy(copy, item, sizeof(*item) + item->used);
+
+    copy->size = item->used;
+
+    if(obj->item == item) {
+        obj->item = copy;
+    } else {
+        prev = obj->item;
+
+        while(prev->next != item) {
+            prev = prev->next;
+        }
+
+        prev->next = copy;
+    }
+
+    nst_shmem_free(mem->shmem, item);
+
+    *tail = copy;
+}
+
+/*
+ * copy a complete obj to a new one, with extents as large as their data
+ */
+nst_memory_obj_t *
+nst_memory_obj_copy(nst_memory_t *mem, nst_memory_obj_t *obj) {
+    nst_memory_obj_t   *copy;
+    nst_memory_item_t  *item, *dst;
+    nst_memory_item_t  *tail = NULL;
+
+    copy = nst_memory_obj_create(mem);
+
+    if(!copy) {
+        return NULL;
+    }
+
+    copy->encoding    = obj->encoding;
+    copy->length      = obj->length;
+    copy->precompress = obj->precompress;
+
+    for(item = obj->item; item; item = item->next) {
+        dst = nst_shmem_alloc(mem->shmem, sizeof(*dst) + item->used);
+
+        if(!dst) {
+            nst_memory_obj_abort(mem, copy);
+
+            return NULL;
+        }
+
+        memcpy(dst, item, sizeof(*dst) + item->used);
+
+        dst->next = NULL;
+        dst->size = item->used;
+
+        if(tail) {
+            tail->next = dst;
+        } else {
+            copy->item = dst;
+        }
+
+        tail = dst;
+    }
+
+    return copy;
+}
+
+/*
+ * Create a zlib stream to encode or decode a body with encoding
+ * return NULL on failure or if zlib is not built in
+ */
+nst_memory_zstream_t *
+nst_memory_zstream_create(int encoding, int inflate) {
+    nst_memory_zstream_t  *z = NULL;
+
+#if defined(USE_ZLIB)
+    int                    ret;
+
+    if(encoding != NST_MEMORY_ENCODING_GZIP) {
+        return NULL;
+    }
+
+    z = calloc(1, sizeof(*z));
+
+    if(!z) {
+        return NULL;
+    }
+
+    z->inflate = inflate;
+
+    /* 16 + window bits for a gzip header and trailer */
+    if(inflate) {
+        ret = inflateInit2(&z->zs, MAX_WBITS + 16);
+    } else {
+        ret = deflateInit2(&z->zs, Z_BEST_SPEED, Z_DEFLATED, MAX_WBITS + 16, 8,
+                Z_DEFAULT_STRATEGY);
+    }
+
+    if(ret != Z_OK) {
+        free(z);
+
+        return NULL;
+    }
+#endif
+
+    return z;
+}
+
+void
+nst_memory_zstream_free(nst_memory_zstream_t *z) {
+
+    if(!z) {
+        return;
+    }
+
+#if defined(USE_ZLIB)
+    if(z->inflate) {
+        inflateEnd(&z->zs);
+    } else {
+        deflateEnd(&z->zs);
+    }
+#endif
+
+    free(z);
+}
+
+/*
+ * Encode len bytes of buf through z and append the output to obj as data
+ * records, finish flushes the end of the encoded body.
+ * return NST_OK on success, NST_ERR if obj is invalidated
+ */
+int
+nst_memory_obj_deflate(nst_memory_t *mem, nst_memory_obj_t *obj, nst_memory_item_t **tail,
+        nst_memory_zstream_t *z, const char *buf, uint32_t len, int finish) {
+
+#if defined(USE_ZLIB)
+    hpx_buffer_t  *out = get_trash_chunk();
+    uint32_t       n;
+    int            ret;
+
+    z->zs.next_in  = (Bytef *)buf;
+    z->zs.avail_in = len;
+
+    do {
+        z->zs.next_out  = (Bytef *)out->area;
+        z->zs.avail_out = out->size;
+
+        ret = deflate(&z->zs, finish ? Z_FINISH : Z_NO_FLUSH);
+
+        if(ret == Z_STREAM_ERROR) {
+            break;
+        }
+
+        n = out->size - z->zs.avail_out;
+
+        if(n) {
+
+            if(nst_memory_obj_append(mem, obj, tail, out->area, n, (HTX_BLK_DATA << 28) + n)
+                    != NST_OK) {
+
+                return NST_ERR;
+            }
+
+            obj->length += n;
+        }
+
+    } while(z->zs.avail_out == 0);
+
+    if(ret != Z_STREAM_ERROR && (!finish || ret == Z_STREAM_END)) {
+        return NST_OK;
+    }
+#endif
+
+    obj->invalid = 1;
+
+    nst_memory_incr_invalid(mem);
+
+    return NST_ERR;
+}
+
+/*
+ * Append a vary: accept-encoding header record, the encoded body varies
+ * with it
+ */
+int
+nst_memory_obj_append_vary(nst_memory_t *mem, nst_memory_obj_t *obj, nst_memory_item_t **tail) {
+    hpx_ist_t  name  = ist("vary");
+    hpx_ist_t  value = ist("accept-encoding");
+    char       buf[19];
+
+    memcpy(buf, name.ptr, name.len);
+    memcpy(buf + name.len, value.ptr, value.len);
+
+    return nst_memory_obj_append(mem, obj, tail, buf, name.len + value.len,
+            (HTX_BLK_HDR << 28) + (value.len << 8) + name.len);
+}
+
+/*
+ * Build a copy of obj with its body encoded, like the objects stored with
+ * rule compress. raw is set to the length of the body.
+ * return the copy, or NULL on failure
+ */
+static nst_memory_obj_t *
+_nst_memory_obj_encode(nst_memory_t *mem, nst_memory_obj_t *obj, int encoding, uint64_t *raw) {
+    nst_memory_zstream_t  *z;
+    nst_memory_obj_t      *copy;
+    nst_memory_item_t     *item;
+    nst_memory_item_t     *tail = NULL;
+    hpx_htx_blk_type_t     type;
+    uint32_t               offset, info, blksz;
+    char                  *ptr;
+    int                    vary = 0;
+    int                    ret  = NST_OK;
+
+    copy = nst_memory_obj_create(mem);
+
+    if(!copy) {
+        return NULL;
+    }
+
+    z = nst_memory_zstream_create(encoding, 0);
+
+    if(!z) {
+        nst_memory_obj_abort(mem, copy);
+
+        return NULL;
+    }
+
+    *raw = 0;
+
+    for(item = obj->item; item && ret == NST_OK; item = item->next) {
+        offset = 0;
+
+        while(offset < item->used && ret == NST_OK) {
+            memcpy(&info, item->data + offset, 4);
+
+            type  = (info >> 28);
+            blksz = nst_memory_blksz(info);
+            ptr   = item->data + offset + 4;
+
+            offset += 4 + blksz;
+
+            if(type == HTX_BLK_DATA) {
+                *raw += blksz;
+
+                ret = nst_memory_obj_deflate(mem, copy, &tail, z, ptr, blksz, 0);
+
+                continue;
+            }
+
+            if(type == HTX_BLK_HDR && isteqi(ist2(ptr, info & 0xff), ist("vary"))) {
+                vary = 1;
+            }
+
+            if(type == HTX_BLK_EOH && !vary) {
+                ret = nst_memory_obj_append_vary(mem, copy, &tail);
+            }
+
+            /* the encoded body ends before the trailers */
+            if((type == HTX_BLK_TLR || type == HTX_BLK_EOT) && z && ret == NST_OK) {
+                ret = nst_memory_obj_deflate(mem, copy, &tail, z, NULL, 0, 1);
+
+                nst_memory_zstream_free(z);
+
+                z = NULL;
+            }
+
+            if(ret == NST_OK) {
+                ret = nst_memory_obj_append(mem, copy, &tail, ptr, blksz, info);
+            }
+        }
+    }
+
+    if(z && ret == NST_OK) {
+        ret = nst_memory_obj_deflate(mem, copy, &tail, z, NULL, 0, 1);
+    }
+
+    nst_memory_zstream_free(z);
+
+    if(ret != NST_OK) {
+        return NULL;
+    }
+
+    copy->encoding = encoding;
+
+    nst_memory_obj_finish(mem, copy, &tail);
+
+    return copy;
+}
+
+/*
+ * Build the precompressed copy of one object queued by nst_memory_obj_want.
+ * The copy is published once complete, readers reach it through the object
+ * they attached, see nst_memory_obj_free.
+ * return 1 if an object was dequeued, 0 otherwise
+ */
+int
+nst_memory_precompress(nst_memory_t *mem) {
+    nst_memory_obj_t  *obj, *copy;
+    uint64_t           raw;
+
+    nst_shctx_lock(mem);
+
+    obj = mem->wanted;
+
+    if(obj) {
+        mem->wanted = obj->wanted_next;
+    }
+
+    nst_shctx_unlock(mem);
+
+    if(!obj) {
+        return 0;
+    }
+
+    if(!obj->invalid && !obj->encoded) {
+        copy = _nst_memory_obj_encode(mem, obj, obj->precompress, &raw);
+
+        if(!copy) {
+            /* retried on a later hit */
+            obj->wanted = 0;
+        } else if(copy->length >= raw) {
+            /* incompressible, never retried */
+            nst_memory_obj_abort(mem, copy);
+        } else {
+            __sync_synchronize();
+
+            obj->encoded = copy;
+
+            mem->precompressed++;
+
+            nst_memory_incr_encoded(mem, raw, copy->length);
+        }
+    }
+
+    nst_memory_obj_detach(mem, obj);
+
+    return 1;
 }
 
 void
 nst_store_memory_sync_disk(nst_core_t *core) {
+    nst_dict_entry_t  **bucket;
     nst_dict_entry_t   *entry;
     nst_disk_obj_t      data = { .file = NULL };
     nst_memory_item_t  *item;
     nst_http_txn_t      txn;
     hpx_htx_blk_type_t  type;
-    uint64_t            start;
-    uint32_t            blksz, info;
+    uint64_t            start, idx;
+    uint32_t            blksz, info, offset;
     int                 ret;
 
 
@@ -175,21 +789,29 @@ nst_store_memory_sync_disk(nst_core_t *core) {
     }
 
     start = nst_time_now_ms();
+    idx   = core->dict.sync_idx;
+
+    if(idx >= nst_dict_buckets(&core->dict)) {
+        idx = 0;
+    }
 
-    nst_shctx_lock(&core->dict);
+    nst_dict_lock(&core->dict, idx);
 
-    entry = core->dict.entry[core->dict.sync_idx];
+    bucket = nst_dict_bucket(&core->dict, idx);
+    entry  = bucket ? *bucket : NULL;
 
     while(entry) {
 
         if(nst_dict_entry_valid(entry)
                 && nst_store_disk_sync(entry->prop.store)
+                && entry->store.memory.obj
                 && entry->store.disk.file == NULL) {
 
             txn.req.host          = entry->host;
             txn.req.path          = entry->path;
             txn.res.etag          = entry->etag;
             txn.res.last_modified = entry->last_modified;
+            txn.res.tags          = entry->tags;
             txn.res.header_len    = 0;
             txn.res.payload_len   = 0;
 
@@ -204,39 +826,48 @@ nst_store_memory_sync_disk(nst_core_t *core) {
             item = entry->store.memory.obj->item;
 
             while(item) {
-                info  = item->info;
-                type  = (info >> 28);
-                blksz = ((type == HTX_BLK_HDR || type == HTX_BLK_TLR)
-                        ? (info & 0xff) + ((info >> 8) & 0xfffff)
-                        : info & 0xfffffff);
-
-                if(type == HTX_BLK_RES_SL || type == HTX_BLK_HDR || type == HTX_BLK_EOH) {
-                    txn.res.header_len += 4 + blksz;
-                }
+                offset = 0;
 
-                if(type == HTX_BLK_DATA) {
-                    txn.res.payload_len += blksz;
-                }
+                while(offset < item->used) {
+                    memcpy(&info, item->data + offset, 4);
 
-                if(type != HTX_BLK_DATA) {
-                    ret = nst_disk_obj_append(&core->store.disk, &data, (char *)&info, 4);
+                    type  = (info >> 28);
+                    blksz = nst_memory_blksz(info);
 
-                    if(ret != NST_OK) {
-                        goto next;
+                    if(type == HTX_BLK_RES_SL || type == HTX_BLK_HDR || type == HTX_BLK_EOH) {
+                        txn.res.header_len += 4 + blksz;
                     }
 
-                }
+                    if(type == HTX_BLK_DATA) {
+                        txn.res.payload_len += blksz;
+                    } else {
+                        ret = nst_disk_obj_append(&core->store.disk, &data, (char *)&info, 4);
 
-                ret = nst_disk_obj_append(&core->store.disk, &data, item->data, blksz);
+                        if(ret != NST_OK) {
+                            goto next;
+                        }
+                    }
+
+                    ret = nst_disk_obj_append(&core->store.disk, &data, item->data + offset + 4,
+                            blksz);
+
+                    if(ret != NST_OK) {
+                        goto next;
+                    }
 
-                if(ret != NST_OK) {
-                    goto next;
+                    offset += 4 + blksz;
                 }
 
                 item = item->next;
             }
 
-            nst_disk_obj_finish(&core->store.disk, &data, &entry->key, &txn, entry->expire);
+            if(nst_disk_obj_finish(&core->store.disk, &data, &entry->key, &txn, entry->expire)
+                    == NST_OK) {
+
+                entry->store.disk.base = data.base;
+
+                nst_disk_journal(&core->store.disk, entry, 0);
+            }
         }
 next:
 
@@ -247,15 +878,17 @@ next:
         }
     }
 
+    nst_dict_unlock(&core->dict, idx);
+
     if(entry == NULL) {
-        core->dict.sync_idx++;
+        idx++;
     }
 
     /* if we have checked the whole dict */
-    if(core->dict.sync_idx == core->dict.size) {
-        core->dict.sync_idx = 0;
+    if(idx >= nst_dict_buckets(&core->dict)) {
+        idx = 0;
     }
 
-    nst_shctx_unlock(&core->dict);
+    core->dict.sync_idx = idx;
 }
 